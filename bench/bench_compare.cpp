@@ -0,0 +1,590 @@
+// Runs the same corpora through wutils, glibc iconv, the standard codecvt
+// facets and, when built with WUTILS_BENCH_ICU, ICU converters, and prints
+// throughput, allocations per call and whether each output matches wutils.
+//
+// Usage: bench_compare [--counters] [file...]
+// Each file is added as a corpus and should hold UTF-8 text. --counters
+// also reads hardware performance counters around every call, where Linux
+// allows it.
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <clocale>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <locale>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if __has_include(<iconv.h>)
+#include <iconv.h>
+#define WUTILS_BENCH_ICONV
+#endif
+
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define WUTILS_BENCH_PERF
+#endif
+
+#ifdef WUTILS_BENCH_ICU
+#include <unicode/ucnv.h>
+#endif
+
+#include "wutils.hpp"
+
+// Every operator new is counted, so allocations per call cover the output
+// strings and any scratch buffers of the C++ libraries. iconv and ICU
+// allocate with malloc internally, which is not seen.
+static std::size_t allocations = 0;
+
+void *operator new(std::size_t size) {
+  ++allocations;
+  if (void *p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+constexpr bool little_endian = std::endian::native == std::endian::little;
+
+struct Corpus {
+  std::string name;
+  std::u8string utf8;
+  std::u16string utf16;
+  std::wstring wide;
+};
+
+enum Event { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, EVENTS };
+
+using EventCounts = std::array<double, EVENTS>;
+
+// Cycles, instructions, branch misses and L1D read misses of this thread in
+// user space, read as one group so all four cover the same instructions.
+// Events the machine lacks read as NaN; without cycles nothing is counted
+class PerfCounters {
+public:
+  PerfCounters() {
+    fds.fill(-1);
+#ifdef WUTILS_BENCH_PERF
+    const std::uint64_t l1d_read_miss =
+        PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+        PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    const std::pair<std::uint32_t, std::uint64_t> configs[EVENTS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, l1d_read_miss}};
+    for (int event = 0; event < EVENTS; ++event) {
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = configs[event].first;
+      attr.config = configs[event].second;
+      attr.disabled = event == CYCLES;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+      fds[event] = static_cast<int>(
+          syscall(SYS_perf_event_open, &attr, 0, -1, fds[CYCLES], 0));
+      if (fds[event] >= 0) {
+        order.push_back(static_cast<Event>(event));
+      } else if (event == CYCLES) {
+        error = std::strerror(errno);
+        if (errno == EACCES || errno == EPERM) {
+          error += " (see /proc/sys/kernel/perf_event_paranoid)";
+        } else if (errno == ENOENT || errno == EOPNOTSUPP) {
+          error += " (no hardware counters, as in most VMs)";
+        }
+        return;
+      }
+    }
+#else
+    error = "not supported on this platform";
+#endif
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  ~PerfCounters() {
+#ifdef WUTILS_BENCH_PERF
+    for (const int fd : fds) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+#endif
+  }
+
+  // Empty when counting works, else the reason it does not
+  const std::string &unavailable() const { return error; }
+  bool counts(Event event) const { return fds[event] >= 0; }
+
+  void start() {
+#ifdef WUTILS_BENCH_PERF
+    ioctl(fds[CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  }
+
+  // Adds the events counted since start() to `totals`
+  void stop(EventCounts &totals) {
+#ifdef WUTILS_BENCH_PERF
+    ioctl(fds[CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    std::uint64_t values[1 + EVENTS];
+    if (read(fds[CYCLES], values, sizeof(values)) < 0) {
+      return;
+    }
+    for (std::size_t i = 0; i < values[0] && i < order.size(); ++i) {
+      totals[order[i]] += static_cast<double>(values[1 + i]);
+    }
+#else
+    (void)totals;
+#endif
+  }
+
+private:
+  std::array<int, EVENTS> fds;
+  std::vector<Event> order; // Events in the order the group reads them
+  std::string error;
+};
+
+struct Measurement {
+  double seconds = 0;     // Fastest call
+  double allocations = 0; // Per call
+  EventCounts events;     // Per call, NaN when not counted
+};
+
+struct Row {
+  std::string corpus;
+  std::string operation;
+  std::string library;
+  std::size_t input_bytes;
+  Measurement measurement;
+  std::string output;
+};
+
+Corpus make_corpus(std::string name, std::u8string_view text) {
+  return {std::move(name), std::u8string(text), *wutils::u16s(text),
+          *wutils::ws(text)};
+}
+
+// About a megabyte of `sample` repeated
+Corpus repeated(std::string name, std::u8string_view sample) {
+  std::u8string text;
+  while (text.size() < (1u << 20)) {
+    text += sample;
+  }
+  return make_corpus(std::move(name), text);
+}
+
+std::vector<Corpus> builtin_corpora() {
+  std::vector<Corpus> corpora;
+  corpora.push_back(repeated(
+      "ascii", u8"The quick brown fox jumps over the lazy dog, again. "));
+  corpora.push_back(repeated(
+      "latin", u8"Größere Äpfel kosten mehr, déjà vu à la française. "));
+  corpora.push_back(
+      repeated("cyrillic", u8"Съешь же ещё этих мягких французских булок. "));
+  corpora.push_back(repeated("cjk", u8"日本語のテキストと中文文本和한국어텍스트。"));
+  corpora.push_back(repeated("emoji", u8"😀😂🥲👍🏽🎉🚀🌍❤️‍🔥👨‍👩‍👧"));
+  corpora.push_back(repeated(
+      "mixed", u8"id=42 name=\"Zoë\" city=東京 mood=😀 note=Привет; "));
+  return corpora;
+}
+
+// Times `call` until about a fifth of a second has passed, at least five
+// times, keeping the fastest. Counter events are averaged over all calls
+template <typename Call>
+Measurement measure(Call &&call, PerfCounters *counters) {
+  using clock = std::chrono::steady_clock;
+  call(); // Warm up caches and lazily initialized state
+  Measurement result{1e30, 0, {}};
+  const clock::time_point deadline =
+      clock::now() + std::chrono::milliseconds(200);
+  int calls = 0;
+  for (; calls < 5 || clock::now() < deadline; ++calls) {
+    const std::size_t allocations_before = allocations;
+    if (counters) {
+      counters->start();
+    }
+    const clock::time_point start = clock::now();
+    call();
+    const std::chrono::duration<double> elapsed = clock::now() - start;
+    if (counters) {
+      counters->stop(result.events);
+    }
+    result.seconds = std::min(result.seconds, elapsed.count());
+    result.allocations = static_cast<double>(allocations - allocations_before);
+  }
+  for (int event = 0; event < EVENTS; ++event) {
+    double &count = result.events[event];
+    count = counters && counters->counts(static_cast<Event>(event))
+                ? count / calls
+                : std::nan("");
+  }
+  return result;
+}
+
+// One operation run by several libraries. The first implementation added is
+// the reference the others' outputs are compared to
+template <typename Output> class Operation {
+public:
+  using Implementation = std::function<std::optional<Output>()>;
+
+  Operation(std::string name, std::size_t input_bytes)
+      : name(std::move(name)), input_bytes(input_bytes) {}
+
+  void add(std::string library, Implementation implementation) {
+    implementations.emplace_back(std::move(library),
+                                 std::move(implementation));
+  }
+
+  void run(const std::string &corpus, PerfCounters *counters,
+           std::vector<Row> &rows) const {
+    std::optional<Output> reference;
+    for (const auto &[library, implementation] : implementations) {
+      std::optional<Output> output = implementation();
+      if (!output) {
+        rows.push_back({corpus, name, library, input_bytes, {}, "unavailable"});
+        continue;
+      }
+      std::string verdict = "reference";
+      if (reference) {
+        verdict = *output == *reference ? "equal" : "differs";
+      } else {
+        reference = std::move(output);
+      }
+      Output sink;
+      const Measurement measurement =
+          measure([&] { sink = *implementation(); }, counters);
+      rows.push_back(
+          {corpus, name, library, input_bytes, measurement, verdict});
+    }
+  }
+
+private:
+  std::string name;
+  std::size_t input_bytes;
+  std::vector<std::pair<std::string, Implementation>> implementations;
+};
+
+#ifdef WUTILS_BENCH_ICONV
+// Converts with a descriptor opened once; `bound` is the worst-case number of
+// output units per input unit
+template <typename Output, typename Input>
+std::function<std::optional<Output>()>
+iconv_converter(const char *to, const char *from, const Input &input,
+                std::size_t bound) {
+  iconv_t cd = iconv_open(to, from);
+  if (cd == reinterpret_cast<iconv_t>(-1)) {
+    return [] { return std::optional<Output>(); };
+  }
+  return [cd, &input, bound]() -> std::optional<Output> {
+    Output output(input.size() * bound, 0);
+    char *in = const_cast<char *>(reinterpret_cast<const char *>(input.data()));
+    std::size_t in_left = input.size() * sizeof(input[0]);
+    char *out = reinterpret_cast<char *>(output.data());
+    std::size_t out_left = output.size() * sizeof(output[0]);
+    iconv(cd, nullptr, nullptr, nullptr, nullptr);
+    if (iconv(cd, &in, &in_left, &out, &out_left) == static_cast<size_t>(-1)) {
+      return std::nullopt;
+    }
+    output.resize(output.size() - out_left / sizeof(output[0]));
+    return output;
+  };
+}
+#endif
+
+// Converts with the `in` side of a codecvt facet, decoding bytes
+template <typename Output, typename Facet, typename Input>
+std::optional<Output> codecvt_in(const Facet &facet, const Input &input) {
+  using Extern = typename Facet::extern_type;
+  Output output(input.size(), 0);
+  std::mbstate_t state{};
+  const Extern *from = reinterpret_cast<const Extern *>(input.data());
+  const Extern *from_next;
+  typename Output::value_type *to_next;
+  if (facet.in(state, from, from + input.size(), from_next, output.data(),
+               output.data() + output.size(),
+               to_next) != std::codecvt_base::ok) {
+    return std::nullopt;
+  }
+  output.resize(to_next - output.data());
+  return output;
+}
+
+// Converts with the `out` side of a codecvt facet, encoding to bytes
+template <typename Output, typename Facet, typename Input>
+std::optional<Output> codecvt_out(const Facet &facet, const Input &input) {
+  using Extern = typename Facet::extern_type;
+  Output output(input.size() * 4, 0);
+  std::mbstate_t state{};
+  const typename Input::value_type *from_next;
+  Extern *to = reinterpret_cast<Extern *>(output.data());
+  Extern *to_next;
+  if (facet.out(state, input.data(), input.data() + input.size(), from_next,
+                to, to + output.size(), to_next) != std::codecvt_base::ok) {
+    return std::nullopt;
+  }
+  output.resize(to_next - to);
+  return output;
+}
+
+std::vector<Row> run_corpus(const Corpus &corpus, PerfCounters *counters) {
+  std::vector<Row> rows;
+  const std::u8string &u8 = corpus.utf8;
+  const std::u16string &u16 = corpus.utf16;
+  const std::wstring &wide = corpus.wide;
+  const std::string narrow(u8.begin(), u8.end());
+  // Views, as the conversions take their argument by value
+  const std::u8string_view u8_view = u8;
+  const std::u16string_view u16_view = u16;
+  const std::wstring_view wide_view = wide;
+
+  const auto &utf16_facet =
+      std::use_facet<std::codecvt<char16_t, char8_t, std::mbstate_t>>(
+          std::locale::classic());
+  const auto &utf32_facet =
+      std::use_facet<std::codecvt<char32_t, char8_t, std::mbstate_t>>(
+          std::locale::classic());
+  std::optional<std::locale> utf8_locale;
+  try {
+    utf8_locale.emplace("C.UTF-8");
+  } catch (const std::runtime_error &) {
+  }
+  using WideFacet = std::codecvt<wchar_t, char, std::mbstate_t>;
+
+  Operation<std::u16string> to_utf16("UTF-8 -> UTF-16", u8.size());
+  to_utf16.add("wutils",
+               [&] { return std::optional(wutils::u16s(u8_view).value); });
+  to_utf16.add("codecvt", [&] {
+    return codecvt_in<std::u16string>(utf16_facet, u8);
+  });
+
+  Operation<std::u32string> to_utf32("UTF-8 -> UTF-32", u8.size());
+  to_utf32.add("wutils",
+               [&] { return std::optional(wutils::u32s(u8_view).value); });
+  to_utf32.add("codecvt", [&] {
+    return codecvt_in<std::u32string>(utf32_facet, u8);
+  });
+
+  Operation<std::wstring> to_wide("UTF-8 -> wchar_t", u8.size());
+  to_wide.add("wutils",
+              [&] { return std::optional(wutils::ws(u8_view).value); });
+  to_wide.add("codecvt", [&]() -> std::optional<std::wstring> {
+    if (!utf8_locale) {
+      return std::nullopt;
+    }
+    return codecvt_in<std::wstring>(std::use_facet<WideFacet>(*utf8_locale),
+                                    narrow);
+  });
+
+  Operation<std::u8string> from_utf16("UTF-16 -> UTF-8", u16.size() * 2);
+  from_utf16.add("wutils",
+                 [&] { return std::optional(wutils::u8s(u16_view).value); });
+  from_utf16.add("codecvt", [&] {
+    return codecvt_out<std::u8string>(utf16_facet, u16);
+  });
+
+  Operation<std::string> from_wide("wchar_t -> char",
+                                   wide.size() * sizeof(wchar_t));
+  from_wide.add("wutils",
+                [&] { return std::optional(wutils::s(wide_view).value); });
+  from_wide.add("codecvt", [&]() -> std::optional<std::string> {
+    if (!utf8_locale) {
+      return std::nullopt;
+    }
+    return codecvt_out<std::string>(std::use_facet<WideFacet>(*utf8_locale),
+                                    wide);
+  });
+
+  Operation<int> width("width", wide.size() * sizeof(wchar_t));
+  width.add("wutils",
+            [&] { return std::optional(wutils::wswidth(wide_view)); });
+  width.add("wcswidth", [&] {
+    return std::optional(::wcswidth(wide.data(), wide.size()));
+  });
+
+#ifdef WUTILS_BENCH_ICONV
+  const char *utf16_name = little_endian ? "UTF-16LE" : "UTF-16BE";
+  const char *utf32_name = little_endian ? "UTF-32LE" : "UTF-32BE";
+  to_utf16.add("iconv",
+               iconv_converter<std::u16string>(utf16_name, "UTF-8", u8, 1));
+  to_utf32.add("iconv",
+               iconv_converter<std::u32string>(utf32_name, "UTF-8", u8, 1));
+  to_wide.add("iconv",
+              iconv_converter<std::wstring>("WCHAR_T", "UTF-8", u8, 1));
+  from_utf16.add("iconv",
+                 iconv_converter<std::u8string>("UTF-8", utf16_name, u16, 3));
+  from_wide.add("iconv",
+                iconv_converter<std::string>("UTF-8", "WCHAR_T", wide, 4));
+#endif
+
+#ifdef WUTILS_BENCH_ICU
+  UErrorCode status = U_ZERO_ERROR;
+  UConverter *icu_utf8 = ucnv_open("UTF-8", &status);
+  UConverter *icu_utf32 =
+      ucnv_open(little_endian ? "UTF-32LE" : "UTF-32BE", &status);
+  if (U_SUCCESS(status)) {
+    to_utf16.add("icu", [&]() -> std::optional<std::u16string> {
+      UErrorCode error = U_ZERO_ERROR;
+      std::u16string output(u8.size() + 1, 0);
+      const int32_t length = ucnv_toUChars(
+          icu_utf8, output.data(), static_cast<int32_t>(output.size()),
+          reinterpret_cast<const char *>(u8.data()),
+          static_cast<int32_t>(u8.size()), &error);
+      if (U_FAILURE(error)) {
+        return std::nullopt;
+      }
+      output.resize(length);
+      return output;
+    });
+    to_utf32.add("icu", [&]() -> std::optional<std::u32string> {
+      UErrorCode error = U_ZERO_ERROR;
+      std::u32string output(u8.size(), 0);
+      char *target = reinterpret_cast<char *>(output.data());
+      const char *source = reinterpret_cast<const char *>(u8.data());
+      ucnv_convertEx(icu_utf32, icu_utf8, &target,
+                     target + output.size() * sizeof(char32_t), &source,
+                     source + u8.size(), nullptr, nullptr, nullptr, nullptr,
+                     true, true, &error);
+      if (U_FAILURE(error)) {
+        return std::nullopt;
+      }
+      output.resize((target - reinterpret_cast<char *>(output.data())) /
+                    sizeof(char32_t));
+      return output;
+    });
+    from_utf16.add("icu", [&]() -> std::optional<std::u8string> {
+      UErrorCode error = U_ZERO_ERROR;
+      std::u8string output(u16.size() * 3 + 1, 0);
+      const int32_t length = ucnv_fromUChars(
+          icu_utf8, reinterpret_cast<char *>(output.data()),
+          static_cast<int32_t>(output.size()), u16.data(),
+          static_cast<int32_t>(u16.size()), &error);
+      if (U_FAILURE(error)) {
+        return std::nullopt;
+      }
+      output.resize(length);
+      return output;
+    });
+  }
+#endif
+
+  to_utf16.run(corpus.name, counters, rows);
+  to_utf32.run(corpus.name, counters, rows);
+  to_wide.run(corpus.name, counters, rows);
+  from_utf16.run(corpus.name, counters, rows);
+  from_wide.run(corpus.name, counters, rows);
+  width.run(corpus.name, counters, rows);
+
+#ifdef WUTILS_BENCH_ICU
+  ucnv_close(icu_utf8);
+  ucnv_close(icu_utf32);
+#endif
+  return rows;
+}
+
+// `value` with `precision` decimals, or a dash when it is unknown
+std::string number(double value, int precision) {
+  if (!std::isfinite(value)) {
+    return "-";
+  }
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.*f", precision, value);
+  return text;
+}
+
+void print_header(bool counters) {
+  std::printf("%-12s %-17s %-9s %10s %8s", "corpus", "operation", "library",
+              "MB/s", "allocs");
+  if (counters) {
+    std::printf(" %7s %6s %9s %10s", "cyc/B", "IPC", "brmis/KB", "L1Dmis/KB");
+  }
+  std::printf("  %s\n", "output");
+}
+
+void print_row(const Row &row, bool counters) {
+  const Measurement &m = row.measurement;
+  const bool measured = row.output != "unavailable";
+  const double bytes = static_cast<double>(row.input_bytes);
+  const double nan = std::nan("");
+  std::printf("%-12s %-17s %-9s %10s %8s", row.corpus.c_str(),
+              row.operation.c_str(), row.library.c_str(),
+              number(measured ? bytes / m.seconds / 1e6 : nan, 1).c_str(),
+              number(measured ? m.allocations : nan, 0).c_str());
+  if (counters) {
+    const EventCounts &events = m.events;
+    std::printf(" %7s %6s %9s %10s",
+                number(events[CYCLES] / bytes, 2).c_str(),
+                number(events[INSTRUCTIONS] / events[CYCLES], 2).c_str(),
+                number(events[BRANCH_MISSES] / bytes * 1024, 1).c_str(),
+                number(events[L1D_MISSES] / bytes * 1024, 1).c_str());
+  }
+  std::printf("  %s\n", row.output.c_str());
+}
+
+std::optional<Corpus> read_corpus(const char *path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return std::nullopt;
+  }
+  const std::string text((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+  return make_corpus(path, wutils::detail::as_unicode(text));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  // wcswidth() and the wchar_t facet need a UTF-8 locale
+  std::setlocale(LC_ALL, "C.UTF-8");
+
+  std::vector<Corpus> corpora = builtin_corpora();
+  std::optional<PerfCounters> counters;
+  for (int i = 1; i < argc; ++i) {
+    if (std::string_view(argv[i]) == "--counters") {
+      counters.emplace();
+    } else if (std::optional<Corpus> corpus = read_corpus(argv[i])) {
+      corpora.push_back(std::move(*corpus));
+    } else {
+      std::fprintf(stderr, "cannot read %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (counters && !counters->unavailable().empty()) {
+    std::fprintf(stderr, "hardware counters unavailable: %s\n",
+                 counters->unavailable().c_str());
+    counters.reset();
+  }
+
+  print_header(counters.has_value());
+  for (const Corpus &corpus : corpora) {
+    for (const Row &row :
+         run_corpus(corpus, counters ? &*counters : nullptr)) {
+      print_row(row, counters.has_value());
+    }
+  }
+  return 0;
+}
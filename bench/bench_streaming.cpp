@@ -0,0 +1,189 @@
+// Measures how a large conversion disturbs a concurrent workload whose
+// working set fits in the cache, with the output written through regular
+// stores and through streaming stores.
+//
+// Usage: bench_streaming [output MiB] [working set KiB]
+//
+// The workload follows a random cycle through its working set, one
+// dependent load per cache line, so every line evicted by the conversion
+// costs it a miss. For each store mode the table shows the conversion's
+// throughput, the workload's rate while the conversion runs on another
+// thread, and the time of one walk over the working set right after a
+// conversion on the same thread, which shows how much of it was evicted
+// even where the two threads share a single core.
+//
+// Conversions go into one buffer allocated up front, so the kernel zeroing
+// fresh pages, which goes through the cache whatever the store mode, does
+// not hide the difference.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wutils.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct alignas(64) Line {
+  std::uint32_t next;
+};
+
+// A single random cycle through all lines, so the hardware prefetchers
+// cannot predict the walk
+std::vector<Line> make_working_set(const std::size_t bytes) {
+  std::vector<Line> lines(std::max<std::size_t>(bytes / sizeof(Line), 2));
+  std::vector<std::uint32_t> order(lines.size());
+  std::iota(order.begin(), order.end(), 0u);
+  std::mt19937 rng(42);
+  std::shuffle(order.begin() + 1, order.end(), rng);
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    lines[order[i]].next = order[(i + 1) % order.size()];
+  }
+  return lines;
+}
+
+// Nanoseconds per step of one full walk
+double walk(const std::vector<Line> &lines) {
+  const auto start = Clock::now();
+  std::uint32_t at = 0;
+  for (std::size_t i = 0; i < lines.size(); ++i) {
+    at = lines[at].next;
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  if (at == lines.size()) {
+    std::puts(""); // Keeps the walk from being optimized away
+  }
+  return seconds * 1e9 / static_cast<double>(lines.size());
+}
+
+// Steps per microsecond of a walker running until `stop` is set
+class Walker {
+public:
+  explicit Walker(const std::vector<Line> &lines)
+      : thread([this, &lines] {
+          std::uint32_t at = 0;
+          std::uint64_t steps = 0;
+          while (!stop.load(std::memory_order_relaxed)) {
+            for (int i = 0; i < 256; ++i) {
+              at = lines[at].next;
+            }
+            steps += 256;
+            if (measuring.load(std::memory_order_relaxed)) {
+              counted.store(counted.load(std::memory_order_relaxed) + 256,
+                            std::memory_order_relaxed);
+            }
+          }
+          sink = at + steps;
+        }) {}
+
+  ~Walker() {
+    stop = true;
+    thread.join();
+  }
+
+  void begin() {
+    counted = 0;
+    measuring = true;
+  }
+
+  std::uint64_t end() {
+    measuring = false;
+    return counted.load(std::memory_order_relaxed);
+  }
+
+  std::uint64_t sink = 0;
+
+private:
+  std::atomic<bool> stop{false};
+  std::atomic<bool> measuring{false};
+  std::atomic<std::uint64_t> counted{0};
+  std::thread thread;
+};
+
+const char *mode_name(const wutils::StoreMode mode) {
+  switch (mode) {
+  case wutils::StoreMode::Auto:
+    return "auto";
+  case wutils::StoreMode::Cached:
+    return "cached";
+  default:
+    return "streaming";
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const std::size_t output_mib = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                                          : 256;
+  const std::size_t working_set_kib =
+      argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1024;
+
+  // UTF-8 to UTF-16 of mostly Latin text, half the output size in input
+  std::u8string text;
+  const std::u8string sample = u8"Grüße aus Köln, naïve café, 世界! ";
+  while (text.size() < output_mib * 512 * 1024) {
+    text += sample;
+  }
+  std::u16string output(text.size(), u'\0');
+  const auto convert = [&](const wutils::StoreMode mode) {
+    return wutils::detail::transcode(
+               std::u8string_view(text), output.data(),
+               wutils::ErrorPolicy::UseReplacementCharacter,
+               wutils::ContentClass::Unknown, mode)
+        .written;
+  };
+  const std::vector<Line> lines = make_working_set(working_set_kib * 1024);
+  walk(lines);
+  const double warm = walk(lines);
+
+  std::printf("%zu MiB UTF-8 -> UTF-16, working set %zu KiB, warm walk "
+              "%.2f ns/line\n\n",
+              text.size() >> 20, working_set_kib, warm);
+  std::printf("%-10s %12s %18s %18s %16s\n", "stores", "MB/s alone",
+              "MB/s with walker", "walker steps/us", "walk after ns");
+
+  for (const wutils::StoreMode mode :
+       {wutils::StoreMode::Cached, wutils::StoreMode::Streaming,
+        wutils::StoreMode::Auto}) {
+    double alone = 0, shared = 0, walker_rate = 0, after = 0;
+    for (int rep = 0; rep < 3; ++rep) {
+      // Alone, then the walk over the working set it left behind
+      walk(lines);
+      auto start = Clock::now();
+      std::size_t size = convert(mode);
+      double seconds =
+          std::chrono::duration<double>(Clock::now() - start).count();
+      after = rep == 0 ? walk(lines) : std::min(after, walk(lines));
+      alone = std::max(alone, text.size() / seconds / 1e6);
+
+      Walker walker(lines);
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      walker.begin();
+      start = Clock::now();
+      size += convert(mode);
+      seconds = std::chrono::duration<double>(Clock::now() - start).count();
+      const std::uint64_t steps = walker.end();
+      shared = std::max(shared, text.size() / seconds / 1e6);
+      walker_rate = std::max(walker_rate, steps / seconds / 1e6);
+      if (size == 0) {
+        std::puts("");
+      }
+    }
+    std::printf("%-10s %12.0f %18.0f %18.1f %16.2f\n", mode_name(mode), alone,
+                shared, walker_rate, after);
+  }
+  return 0;
+}
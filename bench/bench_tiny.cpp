@@ -0,0 +1,105 @@
+// Measures the latency of converting short strings, where the call into the
+// library and the setup of the conversion weigh as much as the loop itself.
+// Build the library once as usual and once with WUTILS_INLINE_KERNELS to
+// compare the out-of-line entry points with the inlined kernels.
+//
+// Usage: bench_tiny [calls per length]
+//
+// Every call converts one string of a set of a few hundred, so the lengths
+// and contents the branch predictor sees vary a little as they do in real
+// use, and prints nanoseconds per call for each direction.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "wutils.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t STRINGS = 256;
+
+// Strings of `length` code points cut from `sample` at varying offsets
+std::vector<std::u8string> make_strings(const std::u8string_view sample,
+                                        const std::size_t length) {
+  const std::u32string code_points = wutils::u32s(sample).value;
+  std::vector<std::u8string> strings;
+  for (std::size_t i = 0; i < STRINGS; ++i) {
+    std::u32string piece;
+    for (std::size_t k = 0; k < length; ++k) {
+      piece += code_points[(i * 7 + k) % code_points.size()];
+    }
+    strings.push_back(wutils::u8s(piece).value);
+  }
+  return strings;
+}
+
+// Nanoseconds per call of the best of three runs of `calls` calls
+template <typename Convert>
+double time_calls(const std::size_t calls, Convert convert) {
+  double best = 0;
+  for (int rep = 0; rep < 3; ++rep) {
+    std::size_t units = 0;
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < calls; ++i) {
+      units += convert(i % STRINGS);
+    }
+    const double seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    if (units == 0) {
+      std::puts(""); // Keeps the conversions from being optimized away
+    }
+    const double ns = seconds * 1e9 / static_cast<double>(calls);
+    best = rep == 0 ? ns : std::min(best, ns);
+  }
+  return best;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const std::size_t calls =
+      argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+
+#ifdef WUTILS_INLINE_KERNELS
+  std::puts("kernels: inline\n");
+#else
+  std::puts("kernels: library\n");
+#endif
+  std::printf("%-8s %-6s %12s %12s %12s\n", "text", "chars", "u8 -> u16",
+              "u16 -> u8", "u8 -> u32");
+
+  const struct {
+    const char *name;
+    std::u8string_view sample;
+  } samples[] = {{"ascii", u8"identifier_name = value; "},
+                 {"latin", u8"Grüße aus Köln, naïve café "},
+                 {"cjk", u8"東京都渋谷区神南一丁目"}};
+  for (const auto &[name, sample] : samples) {
+    for (const std::size_t length : {1, 4, 8, 16, 32}) {
+      const std::vector<std::u8string> utf8 = make_strings(sample, length);
+      std::vector<std::u16string> utf16;
+      for (const std::u8string &s : utf8) {
+        utf16.push_back(wutils::u16s(s).value);
+      }
+      const double to_u16 = time_calls(calls, [&](std::size_t i) {
+        return wutils::u16s(utf8[i]).value.size();
+      });
+      const double to_u8 = time_calls(calls, [&](std::size_t i) {
+        return wutils::u8s(utf16[i]).value.size();
+      });
+      const double to_u32 = time_calls(calls, [&](std::size_t i) {
+        return wutils::u32s(utf8[i]).value.size();
+      });
+      std::printf("%-8s %-6zu %9.1f ns %9.1f ns %9.1f ns\n", name, length,
+                  to_u16, to_u8, to_u32);
+    }
+  }
+  return 0;
+}
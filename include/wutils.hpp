@@ -3,6 +3,8 @@
 #include <uchar.h>
 #include <wchar.h>
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <string_view>
 #if __cpp_lib_ranges_to_container >= 202202L ||                                \
@@ -10,9 +12,7 @@
 #include <ranges>
 #endif
 #include <type_traits>
-#ifndef _WIN32
-#include <iostream>
-#endif
+#include <utility>
 
 namespace wutils {
 
@@ -49,22 +49,6 @@ static_assert(sizeof(wchar_t) == sizeof(ustring::value_type) &&
                   sizeof(wchar_t) == sizeof(ustring_view::value_type),
               "Invalid wchar_t deduction");
 
-// Windows sucks and can't properly print std::wcout to terminal so we use a
-// wrapper
-#ifdef _WIN32
-void wcout(const std::wstring_view ws);
-void wcerr(const std::wstring_view ws);
-#else
-inline void wcout(const std::wstring_view ws) { std::wcout << ws; }
-inline void wcerr(const std::wstring_view ws) { std::wcerr << ws << std::endl; }
-#endif
-
-inline void wprint(const std::wstring_view ws) { wcout(ws); }
-inline void wprintln(const std::wstring_view ws) {
-  wcout(ws);
-  wcout(L"\n");
-}
-
 // Determines course of action when encountered with an invalid sequence
 enum class ErrorPolicy {
   UseReplacementCharacter, // Insert replacement character '�' on error
@@ -84,6 +68,32 @@ template <typename T> struct ConversionResult {
   explicit operator bool() const { return is_valid; }
 };
 
+// Dominant UTF-8 sequence length of a text, used to pick the conversion loop
+// best suited to it
+enum class ContentClass {
+  Unknown,   // Let each conversion sample its own input
+  Ascii,     // Mostly 1 byte sequences
+  TwoByte,   // Mostly Latin, Greek, Cyrillic, Hebrew, Arabic...
+  ThreeByte, // Mostly CJK and the rest of the BMP
+  FourByte   // Mostly emoji and other supplementary characters
+};
+
+struct ContentProfile {
+  ContentClass dominant;
+  std::size_t counts[4]; // Sampled characters by UTF-8 sequence length
+};
+
+// How a conversion writes its output
+enum class StoreMode {
+  Auto,     // Streaming once the output may reach STREAMING_STORE_BYTES
+  Cached,   // Regular stores, leaving the output in the cache
+  Streaming // Non-temporal stores that bypass the cache, so a large output
+            // does not evict the rest of the working set
+};
+
+// Outputs at least this large cannot stay in the cache anyway
+inline constexpr std::size_t STREAMING_STORE_BYTES = std::size_t{32} << 20;
+
 namespace detail {
 
 static constexpr inline const char8_t *REPLACEMENT_CHAR_8 = u8"�";
@@ -174,6 +184,340 @@ u32(const std::u32string_view u32s,
   return {std::u32string(u32s), true};
 }
 
+// ===== Buffer Kernels =====
+// Outcome of a conversion into a caller-provided buffer
+struct TranscodeResult {
+  std::size_t read;    // Number of input units consumed
+  std::size_t written; // Number of output units produced
+  bool is_valid;       // Was the consumed input valid?
+};
+
+// Worst-case number of output units for `n` input units, replacement
+// characters included
+template <typename FromChar, typename ToChar>
+constexpr std::size_t max_transcoded_size(const std::size_t n) {
+  if constexpr (sizeof(ToChar) == 1 && sizeof(FromChar) <= 2) {
+    return n * 3; // One unit can become a 3 byte sequence
+  } else if constexpr (sizeof(ToChar) == 1 && sizeof(FromChar) == 4) {
+    return n * 4;
+  } else if constexpr (sizeof(ToChar) == 2 && sizeof(FromChar) == 4) {
+    return n * 2; // Supplementary planes need a surrogate pair
+  } else {
+    return n;
+  }
+}
+
+// Convert `from` into `out`, which must hold at least
+// max_transcoded_size(from.size()) units
+TranscodeResult transcode(const std::u16string_view from, char8_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+TranscodeResult transcode(const std::u32string_view from, char8_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+TranscodeResult transcode(const std::u8string_view from, char16_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+TranscodeResult transcode(const std::u32string_view from, char16_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+TranscodeResult transcode(const std::u8string_view from, char32_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+TranscodeResult transcode(const std::u16string_view from, char32_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+
+// Copy `from` into `out` within one encoding, applying `errorPolicy` to the
+// invalid sequences. `out` must hold max_transcoded_size(from.size()) units
+TranscodeResult transcode(const std::u8string_view from, char8_t *out,
+                          const ErrorPolicy errorPolicy);
+TranscodeResult transcode(const std::u16string_view from, char16_t *out,
+                          const ErrorPolicy errorPolicy);
+TranscodeResult transcode(const std::u32string_view from, char32_t *out,
+                          const ErrorPolicy errorPolicy);
+
+// Receives each block of output of transcode_blocks
+template <typename CharT> struct UnitSink {
+  void (*emit)(void *context, const CharT *units, std::size_t count);
+  void *context;
+};
+
+// Convert `from` block by block through a buffer that stays in the cache,
+// handing each block of output to `sink`
+TranscodeResult transcode_blocks(const std::u16string_view from,
+                                 const UnitSink<char8_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+TranscodeResult transcode_blocks(const std::u32string_view from,
+                                 const UnitSink<char8_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+TranscodeResult transcode_blocks(const std::u8string_view from,
+                                 const UnitSink<char16_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+TranscodeResult transcode_blocks(const std::u32string_view from,
+                                 const UnitSink<char16_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+TranscodeResult transcode_blocks(const std::u8string_view from,
+                                 const UnitSink<char32_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+TranscodeResult transcode_blocks(const std::u16string_view from,
+                                 const UnitSink<char32_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+
+// Length of the longest prefix of `units` that is valid
+std::size_t valid_prefix(const std::u8string_view u8s);
+std::size_t valid_prefix(const std::u16string_view u16s);
+std::size_t valid_prefix(const std::u32string_view u32s);
+
+// Exact output length with ErrorPolicy::UseReplacementCharacter, and an
+// upper bound for the other policies
+std::size_t u8_length(const std::u16string_view u16s);
+std::size_t u8_length(const std::u32string_view u32s);
+std::size_t u16_length(const std::u8string_view u8s);
+std::size_t u16_length(const std::u32string_view u32s);
+std::size_t u32_length(const std::u8string_view u8s);
+std::size_t u32_length(const std::u16string_view u16s);
+
+// Output length counted from the lead units without decoding. Exact for
+// valid input, so it sizes outputs before the input has been checked
+std::size_t u8_estimate(const std::u16string_view u16s);
+std::size_t u8_estimate(const std::u32string_view u32s);
+std::size_t u16_estimate(const std::u8string_view u8s);
+std::size_t u16_estimate(const std::u32string_view u32s);
+std::size_t u32_estimate(const std::u8string_view u8s);
+std::size_t u32_estimate(const std::u16string_view u16s);
+
+// Classify the first few cache lines of the input
+ContentProfile sample_profile(const std::u8string_view u8s);
+ContentProfile sample_profile(const std::u16string_view u16s);
+ContentProfile sample_profile(const std::u32string_view u32s);
+
+// Length of the longest prefix of `units` that does not end in the middle of
+// a multi-unit sequence, for splitting streamed input on a safe boundary
+std::size_t complete_prefix(const std::u8string_view u8s);
+std::size_t complete_prefix(const std::u16string_view u16s);
+inline std::size_t complete_prefix(const std::u32string_view u32s) {
+  return u32s.size();
+}
+
+// ===== JSON Strings =====
+ConversionResult<std::u8string> json_escape(const std::u8string_view u8s,
+                                            const bool ascii_only,
+                                            const ErrorPolicy errorPolicy);
+ConversionResult<std::u8string> json_escape(const std::u16string_view u16s,
+                                            const bool ascii_only,
+                                            const ErrorPolicy errorPolicy);
+ConversionResult<std::u8string> json_escape(const std::u32string_view u32s,
+                                            const bool ascii_only,
+                                            const ErrorPolicy errorPolicy);
+
+ConversionResult<std::u8string>
+json_unescape_u8(const std::u8string_view json, const ErrorPolicy errorPolicy);
+ConversionResult<std::u16string>
+json_unescape_u16(const std::u8string_view json, const ErrorPolicy errorPolicy);
+
+// ===== WTF-8 =====
+// WTF-8 is UTF-8 generalized to also encode surrogate code points, which
+// makes conversions of ill-formed UTF-16 lossless
+ConversionResult<std::u8string>
+wtf8(const std::u16string_view u16s,
+     const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+ConversionResult<std::u8string>
+wtf8(const std::u32string_view u32s,
+     const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+// Checks WTF-8 input, rewriting encoded surrogate pairs as the 4 byte
+// sequence of the character they stand for
+ConversionResult<std::u8string>
+wtf8(const std::u8string_view wtf8s,
+     const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+ConversionResult<std::u16string>
+wtf16(const std::u8string_view wtf8s,
+      const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+ConversionResult<std::u32string>
+wtf32(const std::u8string_view wtf8s,
+      const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+
+// ===== CESU-8 and Modified UTF-8 =====
+// `modified` selects Java's Modified UTF-8, which also writes NUL as C0 80
+ConversionResult<std::u8string> cesu8(const std::u8string_view u8s,
+                                      const bool modified,
+                                      const ErrorPolicy errorPolicy);
+ConversionResult<std::u8string> cesu8(const std::u16string_view u16s,
+                                      const bool modified,
+                                      const ErrorPolicy errorPolicy);
+ConversionResult<std::u8string> cesu8(const std::u32string_view u32s,
+                                      const bool modified,
+                                      const ErrorPolicy errorPolicy);
+ConversionResult<std::u8string> u8_from_cesu8(const std::u8string_view cesu8s,
+                                              const bool modified,
+                                              const ErrorPolicy errorPolicy);
+ConversionResult<std::u16string>
+u16_from_cesu8(const std::u8string_view cesu8s, const bool modified,
+               const ErrorPolicy errorPolicy);
+
+template <typename ToChar, typename FromChar>
+std::size_t transcoded_length(const std::basic_string_view<FromChar> from) {
+  if constexpr (std::is_same_v<FromChar, ToChar>) {
+    return from.size();
+  } else if constexpr (std::is_same_v<ToChar, char8_t>) {
+    return u8_length(from);
+  } else if constexpr (std::is_same_v<ToChar, char16_t>) {
+    return u16_length(from);
+  } else {
+    return u32_length(from);
+  }
+}
+
+template <typename ToChar, typename FromChar>
+std::size_t estimated_length(const std::basic_string_view<FromChar> from) {
+  if constexpr (std::is_same_v<ToChar, char8_t>) {
+    return u8_estimate(from);
+  } else if constexpr (std::is_same_v<ToChar, char16_t>) {
+    return u16_estimate(from);
+  } else {
+    return u32_estimate(from);
+  }
+}
+
+// char and wchar_t share their representation with char8_t and uchar_t, so
+// their views can be handed to the kernels without a copy
+inline std::u8string_view as_unicode(const std::string_view s) {
+  return {reinterpret_cast<const char8_t *>(s.data()), s.size()};
+}
+inline ustring_view as_unicode(const std::wstring_view ws) {
+  return {reinterpret_cast<const uchar_t *>(ws.data()), ws.size()};
+}
+inline std::u8string_view as_unicode(const std::u8string_view u8s) {
+  return u8s;
+}
+inline std::u16string_view as_unicode(const std::u16string_view u16s) {
+  return u16s;
+}
+inline std::u32string_view as_unicode(const std::u32string_view u32s) {
+  return u32s;
+}
+
+// The Unicode code unit type backing a character type
+template <typename CharT>
+using unit_of = typename decltype(as_unicode(
+    std::basic_string_view<CharT>()))::value_type;
+
+// Grow `out` by up to `bound` units, let `write` fill them from a pointer to
+// the old end, and keep as many units as it reports having written. Past
+// the capacity `out` grows geometrically, so appends stay amortized O(1)
+template <BasicString String, typename Write>
+void append_bounded(String &out, const std::size_t bound, Write write) {
+  const std::size_t old_size = out.size();
+  if (out.capacity() < old_size + bound) {
+    const std::size_t doubled = out.capacity() * 2;
+    out.reserve(doubled > old_size + bound ? doubled : old_size + bound);
+  }
+#if __cpp_lib_string_resize_and_overwrite >= 202110L
+  out.resize_and_overwrite(old_size + bound, [&](auto *data, std::size_t) {
+    return old_size + write(data + old_size);
+  });
+#else
+  out.resize(old_size + bound);
+  out.resize(old_size + write(out.data() + old_size));
+#endif
+}
+
+// Transcode `from` directly onto the end of `out`, allocating little more
+// than the result needs. Output whose worst case fits in the spare capacity,
+// or comes within an eighth of the estimated length, is written in place.
+// Otherwise `out` grows by the estimated length, exact for valid input, and
+// is filled block by block from a buffer in the cache; output large enough
+// to be streamed is measured exactly instead. A char or wchar_t string is
+// written through the Unicode units it shares its representation with
+template <BasicString String, typename FromChar>
+  requires is_unicode_char<FromChar>
+bool append_transcoded(String &out, const std::basic_string_view<FromChar> from,
+                       const ErrorPolicy errorPolicy,
+                       const ContentClass content = ContentClass::Unknown,
+                       const StoreMode store = StoreMode::Auto) {
+  using Char = typename String::value_type;
+  using ToChar = unit_of<Char>;
+  bool is_valid = true;
+  auto write_in_place = [&](const std::basic_string_view<FromChar> units,
+                            const std::size_t bound) {
+    append_bounded(out, bound, [&](Char *data) {
+      ToChar *const units_out = reinterpret_cast<ToChar *>(data);
+      TranscodeResult result;
+      if constexpr (std::is_same_v<FromChar, ToChar>) {
+        result = transcode(units, units_out, errorPolicy);
+      } else {
+        result = transcode(units, units_out, errorPolicy, content, store);
+      }
+      is_valid = result.is_valid;
+      return result.written;
+    });
+  };
+  const std::size_t worst = max_transcoded_size<FromChar, ToChar>(from.size());
+  if constexpr (std::is_same_v<FromChar, ToChar>) {
+    // Valid input, the common case, is appended as it is
+    const std::size_t valid = valid_prefix(from);
+    out.append(reinterpret_cast<const Char *>(from.data()), valid);
+    if (valid < from.size()) {
+      const std::basic_string_view<FromChar> rest = from.substr(valid);
+      write_in_place(rest,
+                     max_transcoded_size<FromChar, ToChar>(rest.size()));
+    }
+  } else if (worst <= out.capacity() - out.size()) {
+    write_in_place(from, worst);
+  } else if (store == StoreMode::Streaming ||
+             (store == StoreMode::Auto &&
+              worst * sizeof(ToChar) >= STREAMING_STORE_BYTES)) {
+    write_in_place(from, transcoded_length<ToChar>(from));
+  } else if (const std::size_t estimate = estimated_length<ToChar>(from);
+             worst - estimate <= worst / 8) {
+    write_in_place(from, worst); // Close enough to skip the staging copy
+  } else {
+    const std::size_t needed = out.size() + estimate;
+    if (out.capacity() < needed) {
+      const std::size_t doubled = out.capacity() * 2;
+      out.reserve(doubled > needed ? doubled : needed);
+    }
+    const UnitSink<ToChar> sink{
+        [](void *context, const ToChar *units, const std::size_t count) {
+          static_cast<String *>(context)->append(
+              reinterpret_cast<const Char *>(units), count);
+        },
+        &out};
+    is_valid = transcode_blocks(from, sink, errorPolicy, content).is_valid;
+  }
+  return is_valid;
+}
+
+template <BasicString To, typename From>
+ConversionResult<To> convert_tuned(const From &from,
+                                   const ContentClass content,
+                                   const ErrorPolicy errorPolicy,
+                                   const StoreMode store = StoreMode::Auto) {
+  const auto units = as_unicode(from);
+  using FromChar = typename decltype(units)::value_type;
+  using ToChar = typename To::value_type;
+  if constexpr (std::is_same_v<FromChar, ToChar>) {
+    return {To(units), true};
+  } else {
+    To out;
+    const bool is_valid =
+        append_transcoded(out, units, errorPolicy, content, store);
+    return {std::move(out), is_valid};
+  }
+}
+
 template <detail::BasicStringView From, detail::BasicString To>
   requires is_implicitly_convertible<typename From::value_type,
                                      typename To::value_type>
@@ -245,15 +589,11 @@ template <BasicStringView From, BasicString To>
 inline ConversionResult<To>
 convert(From from,
         ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
-  if constexpr (std::is_same_v<typename From::value_type, char>) {
-    // Source is char-based. Pivot through u8string.
-    return convert<std::u8string, To>(
-        detail::convert_implicitly<From, std::u8string>(from), errorPolicy);
-  } else if constexpr (std::is_same_v<typename From::value_type, wchar_t>) {
-    // Source is wchar_t-based. Pivot through ustring.
-    return convert<ustring, To>(detail::convert_implicitly<From, ustring>(from),
-                                errorPolicy);
-  }
+  // char and wchar_t text is read in place as the Unicode units they share
+  // their representation with
+  using Units =
+      std::basic_string_view<detail::unit_of<typename From::value_type>>;
+  return convert<Units, To>(detail::as_unicode(from), errorPolicy);
 }
 
 // OVERLOAD 4: Exit point. Source is Unicode, destination is not.
@@ -265,19 +605,12 @@ template <BasicStringView From, BasicString To>
 inline ConversionResult<To>
 convert(From from,
         ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
-  if constexpr (std::is_same_v<typename To::value_type, char>) {
-    // Destination is char-based. Pivot through u8string.
-    ConversionResult<std::u8string> intermediate =
-        convert<From, std::u8string>(from, errorPolicy);
-    return {detail::convert_implicitly<std::u8string, To>(intermediate.value),
-            intermediate.is_valid};
-  } else if constexpr (std::is_same_v<typename To::value_type, wchar_t>) {
-    // Destination is wchar_t-based. Pivot through ustring.
-    ConversionResult<ustring> intermediate =
-        convert<From, ustring>(from, errorPolicy);
-    return {detail::convert_implicitly<ustring, To>(intermediate.value),
-            intermediate.is_valid};
-  }
+  // char and wchar_t strings are written through the Unicode units they
+  // share their representation with, without an intermediate string
+  To out;
+  const bool is_valid = detail::append_transcoded(
+      out, detail::as_unicode(std::basic_string_view(from)), errorPolicy);
+  return {std::move(out), is_valid};
 }
 
 // Simple conversions to avoid ConversionResult
@@ -336,13 +669,524 @@ s(From from, ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
   return convert<From, std::string>(from, errorPolicy);
 }
 
+// Number of code units the converted string occupies, computed without
+// converting. Exact for ErrorPolicy::UseReplacementCharacter
+template <BasicStringView From> inline std::size_t u8length(const From &from) {
+  return detail::transcoded_length<char8_t>(detail::as_unicode(from));
+}
+
+template <BasicStringView From>
+inline std::size_t u16length(const From &from) {
+  return detail::transcoded_length<char16_t>(detail::as_unicode(from));
+}
+
+template <BasicStringView From>
+inline std::size_t u32length(const From &from) {
+  return detail::transcoded_length<char32_t>(detail::as_unicode(from));
+}
+
+// Accumulates text of any encoding into a single Unicode string, transcoding
+// each piece straight into the tail of the buffer. Pass a
+// std::pmr::polymorphic_allocator to back it with an arena
+template <typename CharT, typename Allocator = std::allocator<CharT>>
+  requires detail::is_unicode_char<CharT>
+class BasicUtfBuilder {
+public:
+  using value_type = CharT;
+  using string_type =
+      std::basic_string<CharT, std::char_traits<CharT>, Allocator>;
+  using view_type = std::basic_string_view<CharT>;
+
+  BasicUtfBuilder() = default;
+  explicit BasicUtfBuilder(const Allocator &alloc) : buffer(alloc) {}
+  explicit BasicUtfBuilder(const ErrorPolicy errorPolicy,
+                           const Allocator &alloc = Allocator())
+      : buffer(alloc), errorPolicy(errorPolicy) {}
+
+  BasicUtfBuilder &append(const std::string_view s) {
+    return append_view(detail::as_unicode(s));
+  }
+  BasicUtfBuilder &append(const std::wstring_view ws) {
+    return append_view(detail::as_unicode(ws));
+  }
+  BasicUtfBuilder &append(const std::u8string_view u8s) {
+    return append_view(u8s);
+  }
+  BasicUtfBuilder &append(const std::u16string_view u16s) {
+    return append_view(u16s);
+  }
+  BasicUtfBuilder &append(const std::u32string_view u32s) {
+    return append_view(u32s);
+  }
+
+  template <typename T>
+    requires requires(BasicUtfBuilder &b, const T &from) { b.append(from); }
+  BasicUtfBuilder &operator+=(const T &from) {
+    return append(from);
+  }
+
+  // Reserve the exact room needed to append all of `froms`
+  template <typename... Froms> void reserve_for(const Froms &...froms) {
+    buffer.reserve(buffer.size() +
+                   (std::size_t{0} + ... +
+                    detail::transcoded_length<CharT>(
+                        detail::as_unicode(froms))));
+  }
+  void reserve(const std::size_t n) { buffer.reserve(n); }
+
+  // Hand the buffer over without copying, leaving the builder empty
+  string_type release() {
+    string_type out = std::move(buffer);
+    buffer.clear();
+    valid = true;
+    return out;
+  }
+
+  void clear() {
+    buffer.clear();
+    valid = true;
+  }
+
+  view_type view() const { return buffer; }
+  std::size_t size() const { return buffer.size(); }
+  bool empty() const { return buffer.empty(); }
+  // False once any appended piece contained an invalid sequence
+  bool is_valid() const { return valid; }
+
+private:
+  template <typename FromChar>
+  BasicUtfBuilder &append_view(const std::basic_string_view<FromChar> from) {
+    valid &= detail::append_transcoded(buffer, from, errorPolicy);
+    return *this;
+  }
+
+  string_type buffer;
+  ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter;
+  bool valid = true;
+};
+
+using Utf8Builder = BasicUtfBuilder<char8_t>;
+using Utf16Builder = BasicUtfBuilder<char16_t>;
+using Utf32Builder = BasicUtfBuilder<char32_t>;
+
+// Escape `from` as the body of a JSON string literal, without the enclosing
+// quotes. With `ascii_only` everything above U+007F is written as \uXXXX,
+// using a surrogate pair outside the BMP
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+json_escape(const From &from, const bool ascii_only = false,
+            ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::json_escape(detail::as_unicode(from), ascii_only,
+                             errorPolicy);
+}
+
+// Decode the body of a JSON string literal. Escaped surrogate pairs are
+// joined; unpaired ones, malformed escapes and quotes or control characters
+// left unescaped are invalid values
+inline ConversionResult<std::u8string>
+json_unescape(const std::u8string_view json,
+              ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::json_unescape_u8(json, errorPolicy);
+}
+
+inline ConversionResult<std::u8string>
+json_unescape(const std::string_view json,
+              ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::json_unescape_u8(detail::as_unicode(json), errorPolicy);
+}
+
+inline ConversionResult<std::u16string> json_unescape_u16(
+    const std::u8string_view json,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::json_unescape_u16(json, errorPolicy);
+}
+
+inline ConversionResult<std::u16string> json_unescape_u16(
+    const std::string_view json,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::json_unescape_u16(detail::as_unicode(json), errorPolicy);
+}
+
+// Encode as WTF-8. Lone surrogates survive, so wtf16s(*wtf8s(x)) == x for any
+// UTF-16 or wide string x. UTF-8 and WTF-8 input is checked
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+wtf8s(const From &from,
+      ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::wtf8(detail::as_unicode(from), errorPolicy);
+}
+
+// Decode WTF-8 (or plain UTF-8), restoring any encoded lone surrogates
+template <BasicStringView From>
+inline ConversionResult<std::u16string>
+wtf16s(const From &wtf8,
+       ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::wtf16(detail::as_unicode(wtf8), errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u32string>
+wtf32s(const From &wtf8,
+       ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::wtf32(detail::as_unicode(wtf8), errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::wstring>
+wtfws(const From &wtf8,
+      ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  ConversionResult<ustring> intermediate;
+  if constexpr (std::is_same_v<uchar_t, char16_t>) {
+    intermediate = detail::wtf16(detail::as_unicode(wtf8), errorPolicy);
+  } else {
+    intermediate = detail::wtf32(detail::as_unicode(wtf8), errorPolicy);
+  }
+  return {us_to_ws(intermediate.value), intermediate.is_valid};
+}
+
+// Encode as CESU-8, where supplementary characters become two 3 byte
+// surrogate sequences. Text without them is copied unchanged
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+cesu8s(const From &from,
+       ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::cesu8(detail::as_unicode(from), false, errorPolicy);
+}
+
+// Encode as Java's Modified UTF-8 (JNI, class files): CESU-8 with NUL
+// written as C0 80
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+mutf8s(const From &from,
+       ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::cesu8(detail::as_unicode(from), true, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+u8s_from_cesu8(const From &cesu8,
+               ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::u8_from_cesu8(detail::as_unicode(cesu8), false, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u16string> u16s_from_cesu8(
+    const From &cesu8,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::u16_from_cesu8(detail::as_unicode(cesu8), false,
+                                errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+u8s_from_mutf8(const From &mutf8,
+               ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::u8_from_cesu8(detail::as_unicode(mutf8), true, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u16string> u16s_from_mutf8(
+    const From &mutf8,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::u16_from_cesu8(detail::as_unicode(mutf8), true, errorPolicy);
+}
+
+// Sample the start of `from` to classify its content. Batch callers can
+// classify one representative string and pass the result to the overloads
+// below for similar strings, skipping the per-call sampling
+template <BasicStringView From>
+inline ContentProfile content_profile(const From &from) {
+  return detail::sample_profile(detail::as_unicode(from));
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+u8s(const From &from, const ContentClass content,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u8string>(from, content, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u16string>
+u16s(const From &from, const ContentClass content,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u16string>(from, content, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u32string>
+u32s(const From &from, const ContentClass content,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u32string>(from, content, errorPolicy);
+}
+
+// Conversions writing their output as `store` says. Without one, outputs
+// that may reach STREAMING_STORE_BYTES are streamed
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+u8s(const From &from, const StoreMode store,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u8string>(from, ContentClass::Unknown,
+                                              errorPolicy, store);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u16string>
+u16s(const From &from, const StoreMode store,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u16string>(from, ContentClass::Unknown,
+                                               errorPolicy, store);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u32string>
+u32s(const From &from, const StoreMode store,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u32string>(from, ContentClass::Unknown,
+                                               errorPolicy, store);
+}
+
+// ===== Bounded Conversions =====
+// Where a conversion cut short by its output budget stops
+enum class Truncation {
+  CodePoint, // After the last code point that fits
+  Grapheme   // After the last extended grapheme cluster that fits
+};
+
+template <typename T> struct BoundedResult {
+  T value;
+  std::size_t consumed; // Input units converted, where a next call resumes
+  bool is_valid;        // Was the consumed input valid?
+
+  T &operator*() { return value; }
+  T *operator->() { return &value; }
+  const T *operator->() const { return &value; }
+  explicit operator bool() const { return is_valid; }
+};
+
+namespace detail {
+
+// Convert the longest prefix of `from` whose output fits in `max_units`,
+// ending on a code point or cluster boundary. The input beyond what fits is
+// not converted. Between equal encodings the units are copied unchecked, as
+// the unbounded conversions do
+TranscodeResult transcode_bounded(const std::u8string_view from, char8_t *out,
+                                  const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u16string_view from, char8_t *out,
+                                  const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u32string_view from, char8_t *out,
+                                  const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u8string_view from, char16_t *out,
+                                  const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u16string_view from,
+                                  char16_t *out, const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u32string_view from,
+                                  char16_t *out, const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u8string_view from, char32_t *out,
+                                  const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u16string_view from,
+                                  char32_t *out, const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u32string_view from,
+                                  char32_t *out, const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+
+template <BasicString To, typename From>
+BoundedResult<To> convert_bounded(const From &from, const std::size_t max_units,
+                                  const Truncation truncation,
+                                  const ErrorPolicy errorPolicy) {
+  const auto units = as_unicode(from);
+  using FromChar = typename decltype(units)::value_type;
+  using ToChar = typename To::value_type;
+  To out;
+  // Input whose worst case fits in `max_units` is converted whole, and sized
+  // like any other conversion
+  std::size_t bound = max_transcoded_size<FromChar, ToChar>(units.size());
+  if constexpr (std::is_same_v<FromChar, ToChar>) {
+    if (valid_prefix(units) == units.size()) {
+      bound = units.size(); // Copied as it is
+    }
+  } else if (bound <= max_units) {
+    bound = transcoded_length<ToChar>(units); // Small enough to measure
+  }
+  TranscodeResult result{0, 0, true};
+  append_bounded(out, bound < max_units ? bound : max_units,
+                 [&](ToChar *data) {
+                   result = transcode_bounded(units, data, max_units,
+                                              errorPolicy, truncation);
+                   return result.written;
+                 });
+  return {std::move(out), result.read, result.is_valid};
+}
+
+} // namespace detail
+
+// Conversions producing at most `max_units` code units, for fixed-size
+// fields. Only as much input as fits is converted
+template <BasicStringView From>
+inline BoundedResult<std::u8string>
+u8s_bounded(const From &from, const std::size_t max_units,
+            const Truncation truncation = Truncation::CodePoint,
+            ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_bounded<std::u8string>(from, max_units, truncation,
+                                                errorPolicy);
+}
+
+template <BasicStringView From>
+inline BoundedResult<std::u16string>
+u16s_bounded(const From &from, const std::size_t max_units,
+             const Truncation truncation = Truncation::CodePoint,
+             ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_bounded<std::u16string>(from, max_units, truncation,
+                                                 errorPolicy);
+}
+
+template <BasicStringView From>
+inline BoundedResult<std::u32string>
+u32s_bounded(const From &from, const std::size_t max_units,
+             const Truncation truncation = Truncation::CodePoint,
+             ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_bounded<std::u32string>(from, max_units, truncation,
+                                                 errorPolicy);
+}
+
+// ===== Inline Conversions =====
+// Up to N code units stored in the object itself, so conversions of short
+// strings on hot paths never touch the allocator
+template <typename CharT, std::size_t N>
+  requires detail::is_unicode_char<CharT> && (N > 0)
+class InlineString {
+public:
+  using value_type = CharT;
+  using view_type = std::basic_string_view<CharT>;
+
+  InlineString() = default;
+  InlineString(const InlineString &other) : length(other.length) {
+    std::char_traits<CharT>::copy(units, other.units, length);
+  }
+  InlineString &operator=(const InlineString &other) {
+    length = other.length;
+    std::char_traits<CharT>::copy(units, other.units, length);
+    return *this;
+  }
+
+  // Let `write` fill up to `n` units, capped at N, and keep as many as it
+  // returns, like std::basic_string::resize_and_overwrite
+  template <typename Write>
+  void resize_and_overwrite(const std::size_t n, Write write) {
+    length = write(units, n < N ? n : N);
+  }
+
+  static constexpr std::size_t capacity() { return N; }
+  std::size_t size() const { return length; }
+  bool empty() const { return length == 0; }
+  const CharT *data() const { return units; }
+  const CharT *begin() const { return units; }
+  const CharT *end() const { return units + length; }
+  const CharT &operator[](const std::size_t i) const { return units[i]; }
+
+  view_type view() const { return {units, length}; }
+  operator view_type() const { return view(); }
+
+  friend bool operator==(const InlineString &a, const view_type b) {
+    return a.view() == b;
+  }
+
+private:
+  std::size_t length = 0;
+  CharT units[N]; // Only the first `length` are ever read
+};
+
+namespace detail {
+
+template <typename ToChar, std::size_t N, typename From>
+BoundedResult<InlineString<ToChar, N>>
+convert_inline(const From &from, const ErrorPolicy errorPolicy) {
+  const auto units = as_unicode(from);
+  using FromChar = typename decltype(units)::value_type;
+  InlineString<ToChar, N> out;
+  TranscodeResult result{0, 0, true};
+  out.resize_and_overwrite(N, [&](ToChar *data, const std::size_t) {
+    // Input that surely fits takes the plain conversion loop
+    if constexpr (!std::is_same_v<FromChar, ToChar>) {
+      if (max_transcoded_size<FromChar, ToChar>(units.size()) <= N) {
+        result = transcode(units, data, errorPolicy);
+        return result.written;
+      }
+    }
+    result = transcode_bounded(units, data, N, errorPolicy,
+                               Truncation::CodePoint);
+    return result.written;
+  });
+  return {out, result.read, result.is_valid};
+}
+
+} // namespace detail
+
+// Conversions into an InlineString of N units. Input that does not fit is
+// converted up to the last code point that does, and `consumed` is then
+// less than the input size
+template <std::size_t N, BasicStringView From>
+inline BoundedResult<InlineString<char8_t, N>>
+u8s_inline(const From &from,
+           ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_inline<char8_t, N>(from, errorPolicy);
+}
+
+template <std::size_t N, BasicStringView From>
+inline BoundedResult<InlineString<char16_t, N>>
+u16s_inline(const From &from,
+            ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_inline<char16_t, N>(from, errorPolicy);
+}
+
+template <std::size_t N, BasicStringView From>
+inline BoundedResult<InlineString<char32_t, N>>
+u32s_inline(const From &from,
+            ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_inline<char32_t, N>(from, errorPolicy);
+}
+
 int uswidth(const std::u8string_view u8s);
 int uswidth(const std::u16string_view u16s);
 int uswidth(const std::u32string_view u32s);
 
+// Column width, code points and extended grapheme clusters (UAX #29) of a
+// text, measured in one pass. Code points are read as uswidth() reads them,
+// so width is what uswidth() returns
+struct TextCounts {
+  int width;
+  std::size_t code_points;
+  std::size_t graphemes;
+};
+
+TextCounts text_counts(const std::u8string_view u8s);
+TextCounts text_counts(const std::u16string_view u16s);
+TextCounts text_counts(const std::u32string_view u32s);
+
 inline int wswidth(const std::wstring_view ws) {
   ustring u = wutils::ws_to_us(ws);
   return wutils::uswidth(u);
 }
 
 } // namespace wutils
+
+#ifdef WUTILS_INLINE_KERNELS
+#include "wutils_kernels.hpp"
+#endif
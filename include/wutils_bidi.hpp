@@ -0,0 +1,153 @@
+#pragma once
+
+// Bidirectional text (UAX #9): detecting right-to-left text, resolving the
+// visual runs of a line and caching them across redraws.
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "wutils.hpp"
+
+namespace wutils {
+
+// Bidirectional text (UAX #9)
+
+enum class BidiClass : std::uint8_t {
+  L,   // Left-to-right
+  R,   // Right-to-left
+  AL,  // Arabic letter
+  EN,  // European number
+  ES,  // European separator
+  ET,  // European terminator
+  AN,  // Arabic number
+  CS,  // Common separator
+  NSM, // Nonspacing mark
+  BN,  // Boundary neutral
+  B,   // Paragraph separator
+  S,   // Segment separator
+  WS,  // Whitespace
+  ON,  // Other neutral
+  LRE,
+  LRO,
+  RLE,
+  RLO,
+  PDF,
+  LRI,
+  RLI,
+  FSI,
+  PDI
+};
+
+BidiClass bidi_class(char32_t cp);
+
+// Bidi_Mirroring_Glyph of `cp`, or `cp` itself if it has none. Terminals do
+// not mirror glyphs, so characters of right-to-left runs go through this
+char32_t bidi_mirror(char32_t cp);
+
+// Base direction of a paragraph. Auto takes it from the first strong
+// character, left-to-right if there is none
+enum class BidiDirection : std::uint8_t { Auto, LeftToRight, RightToLeft };
+
+// Code units of a line at one embedding level. The code units of a run are
+// in logical order, to be displayed reversed when the level is odd
+struct BidiRun {
+  std::size_t offset;
+  std::size_t length;
+  std::uint8_t level;
+
+  bool right_to_left() const { return level & 1; }
+
+  bool operator==(const BidiRun &) const = default;
+};
+
+namespace detail {
+
+bool has_rtl(std::u8string_view text);
+bool has_rtl(std::u16string_view text);
+bool has_rtl(std::u32string_view text);
+
+void append_bidi_runs(std::vector<BidiRun> &runs, std::u8string_view line,
+                      BidiDirection direction);
+void append_bidi_runs(std::vector<BidiRun> &runs, std::u16string_view line,
+                      BidiDirection direction);
+void append_bidi_runs(std::vector<BidiRun> &runs, std::u32string_view line,
+                      BidiDirection direction);
+
+} // namespace detail
+
+// Whether `text` holds a right-to-left letter, an Arabic digit or an
+// explicit right-to-left control. Text without one displays in logical
+// order unless its paragraph is right-to-left. UTF-8 is scanned a word at a
+// time and only the lead bytes of the few blocks holding such characters are
+// decoded
+template <BasicStringView From> inline bool has_rtl(const From &text) {
+  return detail::has_rtl(detail::as_unicode(text));
+}
+
+// Runs of `line` in visual order, left to right, as resolved by rules P2 to
+// L2. Paragraph separators inside the line end a paragraph, the next one
+// taking its own direction. A line without right-to-left characters in a
+// paragraph that is not right-to-left is returned as one run at level 0
+// without resolving anything
+template <BasicStringView From>
+inline std::vector<BidiRun>
+bidi_runs(const From &line, BidiDirection direction = BidiDirection::Auto) {
+  std::vector<BidiRun> runs;
+  detail::append_bidi_runs(runs, detail::as_unicode(line), direction);
+  return runs;
+}
+
+// Runs of the lines of a display, kept across redraws. `line` keys the
+// cache, typically the row on screen, and any row may be used without
+// allocating for the ones before it. Each entry keeps a copy of the code
+// units of its line, which is resolved again only when they or its
+// direction changed
+class BidiCache {
+public:
+  template <BasicStringView From>
+  std::span<const BidiRun>
+  runs(std::size_t line, const From &text,
+       BidiDirection direction = BidiDirection::Auto) {
+    const auto units = detail::as_unicode(text);
+    using Unit = typename decltype(units)::value_type;
+    const std::string_view bytes(reinterpret_cast<const char *>(units.data()),
+                                 units.size() * sizeof(Unit));
+    Entry &entry = lines[line];
+    if (entry.unit_size != sizeof(Unit) || entry.units != bytes ||
+        entry.direction != direction) {
+      entry.runs.clear();
+      detail::append_bidi_runs(entry.runs, units, direction);
+      entry.units.assign(bytes);
+      entry.unit_size = sizeof(Unit);
+      entry.direction = direction;
+      ++misses;
+    }
+    return entry.runs;
+  }
+
+  // Forgets a line, e.g. one scrolled out of view
+  void erase(std::size_t line) { lines.erase(line); }
+
+  void clear() { lines.clear(); }
+
+  // Lines resolved so far, as opposed to served from the cache
+  std::size_t resolved() const { return misses; }
+
+private:
+  struct Entry {
+    std::vector<BidiRun> runs;
+    std::string units; // The bytes of the code units the runs belong to
+    std::size_t unit_size = 0; // None before the line is resolved
+    BidiDirection direction = BidiDirection::Auto;
+  };
+
+  std::unordered_map<std::size_t, Entry> lines;
+  std::size_t misses = 0;
+};
+
+} // namespace wutils
@@ -0,0 +1,87 @@
+#pragma once
+
+// Collation (UTS #10): binary sort keys, one at a time or packed into an
+// arena.
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "wutils.hpp"
+
+namespace wutils {
+
+// Collation (UTS #10) with the Default Unicode Collation Element Table
+
+// Levels of difference a sort key distinguishes
+enum class CollationStrength {
+  Primary,   // Base characters only: "role" == "Rôle"
+  Secondary, // Also accents: "role" == "Role" < "rôle"
+  Tertiary   // Also case and variants: "role" < "Role" < "rôle"
+};
+
+namespace detail {
+
+void append_sort_key(std::string &key, std::u8string_view text,
+                     CollationStrength strength);
+void append_sort_key(std::string &key, std::u16string_view text,
+                     CollationStrength strength);
+void append_sort_key(std::string &key, std::u32string_view text,
+                     CollationStrength strength);
+
+} // namespace detail
+
+// Binary sort key of `from`: comparing two keys bytewise (std::string's
+// operator<, memcmp) orders the strings as the collation algorithm does.
+// Variable characters such as spaces and punctuation are not ignorable, and
+// input is expected in NFC or NFD; contractions are matched contiguously
+template <BasicStringView From>
+inline std::string
+sort_key(const From &from,
+         CollationStrength strength = CollationStrength::Tertiary) {
+  std::string key;
+  detail::append_sort_key(key, detail::as_unicode(from), strength);
+  return key;
+}
+
+// Sort keys of many strings stored back to back in one buffer, so sorting a
+// large result set costs two allocations that are reused after clear()
+class SortKeyArena {
+public:
+  explicit SortKeyArena(
+      CollationStrength strength = CollationStrength::Tertiary)
+      : strength(strength) {}
+
+  // Appends the key of `from`, returning its index
+  template <BasicStringView From> std::size_t add(const From &from) {
+    detail::append_sort_key(bytes, detail::as_unicode(from), strength);
+    ends.push_back(bytes.size());
+    return ends.size() - 1;
+  }
+
+  // Valid until the next add()
+  std::string_view operator[](std::size_t index) const {
+    const std::size_t start = index == 0 ? 0 : ends[index - 1];
+    return std::string_view(bytes).substr(start, ends[index] - start);
+  }
+
+  std::size_t size() const { return ends.size(); }
+
+  void reserve(std::size_t keys, std::size_t key_bytes) {
+    ends.reserve(keys);
+    bytes.reserve(key_bytes);
+  }
+
+  void clear() {
+    bytes.clear();
+    ends.clear();
+  }
+
+private:
+  std::string bytes;
+  std::vector<std::size_t> ends;
+  CollationStrength strength;
+};
+
+} // namespace wutils
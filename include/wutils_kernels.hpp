@@ -0,0 +1,1308 @@
+#pragma once
+
+// The UTF conversion kernels: validating decoders and encoders, the tuned
+// transcoding loops, and the conversion entry points declared in wutils.hpp.
+//
+// src/wutils.cpp includes this header to compile the entry points into the
+// library. With WUTILS_INLINE_KERNELS defined, wutils.hpp includes it as
+// well and the entry points become inline, so converting a short string
+// compiles down to the loop itself, with the policy and the input size
+// visible to the optimizer. The macro must then be defined for the library
+// too, and so must WUTILS_TELEMETRY if either side counts conversions.
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#ifdef WUTILS_TELEMETRY
+#include <atomic>
+#include <chrono>
+#endif
+
+// Streaming stores and prefetches take SSE2, which every x86-64 target has
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define WUTILS_SSE2
+#endif
+
+#ifndef WUTILS_MODULE
+#include "wutils.hpp"
+#include "wutils_telemetry.hpp"
+#endif
+
+#ifdef WUTILS_INLINE_KERNELS
+#define WUTILS_KERNEL inline
+#else
+#define WUTILS_KERNEL
+#endif
+
+namespace wutils::detail::kernels {
+using std::size_t;
+using std::uint64_t;
+using std::uintptr_t;
+
+// A struct to hold the result of a single decoding operation
+struct DecodeResult {
+  char32_t codepoint;    // The decoded Unicode codepoint
+  size_t consumed_units; // Number of input units (e.g., char8_t) consumed
+  bool is_valid;         // Was the sequence valid?
+};
+
+// UTF-8 validation as a shift-based DFA. Each state is a bit offset, and
+// the entry of a byte holds at that offset the state the byte leads to, so a
+// step is one load and one shift. ERROR is absorbing.
+enum Utf8State : unsigned {
+  UTF8_ACCEPT = 0,
+  UTF8_ERROR = 6,
+  UTF8_TAIL1 = 12, // One continuation byte left
+  UTF8_TAIL2 = 18,
+  UTF8_TAIL3 = 24,
+  UTF8_E0 = 30, // Continues with A0..BF, not overlong
+  UTF8_ED = 36, // Continues with 80..9F, not a surrogate
+  UTF8_F0 = 42, // Continues with 90..BF, not overlong
+  UTF8_F4 = 48, // Continues with 80..8F, at most U+10FFFF
+};
+inline constexpr uint64_t UTF8_STATE_MASK = 63;
+
+constexpr uint64_t utf8_transitions(unsigned char c) {
+  const auto to = [](Utf8State from, Utf8State next) {
+    return static_cast<uint64_t>(next) << from;
+  };
+  uint64_t row = to(UTF8_ERROR, UTF8_ERROR);
+  if (c < 0x80) {
+    row |= to(UTF8_ACCEPT, UTF8_ACCEPT);
+  } else if (c < 0xC0) {
+    row |= to(UTF8_ACCEPT, UTF8_ERROR) | to(UTF8_TAIL1, UTF8_ACCEPT) |
+           to(UTF8_TAIL2, UTF8_TAIL1) | to(UTF8_TAIL3, UTF8_TAIL2) |
+           to(UTF8_E0, c >= 0xA0 ? UTF8_TAIL1 : UTF8_ERROR) |
+           to(UTF8_ED, c < 0xA0 ? UTF8_TAIL1 : UTF8_ERROR) |
+           to(UTF8_F0, c >= 0x90 ? UTF8_TAIL2 : UTF8_ERROR) |
+           to(UTF8_F4, c < 0x90 ? UTF8_TAIL2 : UTF8_ERROR);
+    return row;
+  } else {
+    row |= to(UTF8_ACCEPT, c < 0xC2   ? UTF8_ERROR
+                           : c < 0xE0 ? UTF8_TAIL1
+                           : c == 0xE0 ? UTF8_E0
+                           : c == 0xED ? UTF8_ED
+                           : c < 0xF0  ? UTF8_TAIL2
+                           : c == 0xF0 ? UTF8_F0
+                           : c < 0xF4  ? UTF8_TAIL3
+                           : c == 0xF4 ? UTF8_F4
+                                       : UTF8_ERROR);
+  }
+  // Anything but a continuation byte ends a sequence in error
+  for (const Utf8State from :
+       {UTF8_TAIL1, UTF8_TAIL2, UTF8_TAIL3, UTF8_E0, UTF8_ED, UTF8_F0,
+        UTF8_F4}) {
+    row |= to(from, UTF8_ERROR);
+  }
+  return row;
+}
+
+inline constexpr auto UTF8_TRANSITIONS = [] {
+  std::array<uint64_t, 256> table{};
+  for (unsigned c = 0; c < 256; ++c) {
+    table[c] = utf8_transitions(static_cast<unsigned char>(c));
+  }
+  return table;
+}();
+
+// Decodes one character from a UTF-8 stream, with validation. With four
+// bytes available all of them run through the DFA, and the state after the
+// last byte of the sequence decides. The only branch left is on validity,
+// which well-formed text always predicts, whatever mix of sequence lengths
+// it holds. Invalid and truncated sequences consume one byte.
+inline DecodeResult decode_one_utf8(std::u8string_view input) {
+  if (input.size() >= 4) {
+    const unsigned char b0 = input[0], b1 = input[1], b2 = input[2],
+                        b3 = input[3];
+    // Index of the last byte of the sequence by the high nibble of its lead,
+    // and the payload bits of the lead by that index. Bytes that cannot lead
+    // fail in the DFA, whatever is picked for them
+    const unsigned last = (0xE5000000u >> (b0 >> 4) * 2) & 3;
+    const unsigned payload = (0x070F1F7Fu >> last * 8) & 0xFF;
+    const uint64_t s0 = UTF8_TRANSITIONS[b0] & UTF8_STATE_MASK;
+    const uint64_t s1 = (UTF8_TRANSITIONS[b1] >> s0) & UTF8_STATE_MASK;
+    const uint64_t s2 = (UTF8_TRANSITIONS[b2] >> s1) & UTF8_STATE_MASK;
+    const uint64_t s3 = (UTF8_TRANSITIONS[b3] >> s2) & UTF8_STATE_MASK;
+    const uint64_t states = s0 | s1 << 8 | s2 << 16 | s3 << 24;
+    if (((states >> last * 8) & UTF8_STATE_MASK) != UTF8_ACCEPT) {
+      return {0, 1, false};
+    }
+    const char32_t cp = (static_cast<char32_t>(b0 & payload) << 18 |
+                         (b1 & 0x3F) << 12 | (b2 & 0x3F) << 6 | (b3 & 0x3F)) >>
+                        (6 * (3 - last));
+    return {cp, last + 1, true};
+  }
+  if (input.empty()) {
+    return {0, 0, false};
+  }
+  const unsigned char lead = input[0];
+  if (lead < 0x80) {
+    return {lead, 1, true};
+  }
+  const size_t length = std::countl_one(lead);
+  if (length > input.size()) {
+    return {0, 1, false};
+  }
+  uint64_t state = UTF8_TRANSITIONS[lead] & UTF8_STATE_MASK;
+  char32_t cp = lead & (0x7F >> length);
+  for (size_t k = 1; k < length; ++k) {
+    const unsigned char c = input[k];
+    state = (UTF8_TRANSITIONS[c] >> state) & UTF8_STATE_MASK;
+    cp = (cp << 6) | (c & 0x3F);
+  }
+  if (state != UTF8_ACCEPT) {
+    return {0, 1, false};
+  }
+  return {cp, length, true};
+}
+
+// Decodes one character from a UTF-16 stream, with validation.
+inline DecodeResult decode_one_utf16(std::u16string_view input) {
+  if (input.empty()) {
+    return {0, 0, false};
+  }
+  char16_t c1 = input[0];
+  if (c1 < 0xD800 || c1 > 0xDFFF) {
+    return {c1, 1, true}; // Not a surrogate
+  }
+  if (c1 > 0xDBFF || input.size() < 2) {
+    return {0, 1, false}; // Lone low surrogate or truncated sequence
+  }
+  char16_t c2 = input[1];
+  if (c2 < 0xDC00 || c2 > 0xDFFF) {
+    return {0, 1, false}; // High surrogate not followed by low surrogate
+  }
+  char32_t codepoint = 0x10000 + (((c1 - 0xD800) << 10) | (c2 - 0xDC00));
+  return {codepoint, 2, true};
+}
+
+// Decodes one character from a UTF-32 stream, with validation.
+inline DecodeResult decode_one_utf32(std::u32string_view input) {
+  if (input.empty()) {
+    return {0, 0, false};
+  }
+  char32_t c = input[0];
+  if (c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+    return {0, 1, false}; // Out of range or surrogate
+  }
+  return {c, 1, true};
+}
+
+// Decodes one character of WTF-8, which additionally allows the 3 byte
+// encoding of surrogates. An encoded lead surrogate followed by an encoded
+// trail surrogate is joined into the character the pair stands for.
+inline DecodeResult decode_one_wtf8(std::u8string_view input) {
+  DecodeResult decoded = decode_one_utf8(input);
+  auto encoded_surrogate = [&](size_t i, char8_t first, char8_t last) {
+    return input.size() >= i + 3 && input[i] == 0xED &&
+           input[i + 1] >= first && input[i + 1] <= last &&
+           (input[i + 2] & 0xC0) == 0x80;
+  };
+  if (!decoded.is_valid && encoded_surrogate(0, 0xA0, 0xBF)) {
+    const char32_t surrogate =
+        0xD000 | ((input[1] & 0x3F) << 6) | (input[2] & 0x3F);
+    if (surrogate <= 0xDBFF && encoded_surrogate(3, 0xB0, 0xBF)) {
+      const char32_t trail = ((input[4] & 0x0F) << 6) | (input[5] & 0x3F);
+      return {0x10000 + (((surrogate - 0xD800) << 10) | trail), 6, true};
+    }
+    return {surrogate, 3, true};
+  }
+  return decoded;
+}
+
+// Decodes one character of potentially ill-formed UTF-16, passing lone
+// surrogates through as themselves.
+inline DecodeResult decode_one_wtf16(std::u16string_view input) {
+  DecodeResult decoded = decode_one_utf16(input);
+  if (!decoded.is_valid && !input.empty()) {
+    return {input[0], 1, true};
+  }
+  return decoded;
+}
+
+// Decodes one UTF-32 value, allowing surrogate code points. A lead surrogate
+// followed by a trail surrogate is joined, as it would be in UTF-16.
+inline DecodeResult decode_one_wtf32(std::u32string_view input) {
+  if (input.empty()) {
+    return {0, 0, false};
+  }
+  if (input.size() >= 2 && input[0] >= 0xD800 && input[0] <= 0xDBFF &&
+      input[1] >= 0xDC00 && input[1] <= 0xDFFF) {
+    return {0x10000 + (((input[0] - 0xD800) << 10) | (input[1] - 0xDC00)), 2,
+            true};
+  }
+  return {input[0], 1, input[0] <= 0x10FFFF};
+}
+
+// With `Wtf`, surrogate code points are decoded instead of rejected
+template <bool Wtf = false> DecodeResult decode_one(std::u8string_view input) {
+  return Wtf ? decode_one_wtf8(input) : decode_one_utf8(input);
+}
+template <bool Wtf = false>
+DecodeResult decode_one(std::u16string_view input) {
+  return Wtf ? decode_one_wtf16(input) : decode_one_utf16(input);
+}
+template <bool Wtf = false>
+DecodeResult decode_one(std::u32string_view input) {
+  return Wtf ? decode_one_wtf32(input) : decode_one_utf32(input);
+}
+
+// Encodes a codepoint into a UTF-8 buffer, returns the units written.
+inline size_t encode_utf8(char32_t codepoint, char8_t *output) {
+  if (codepoint <= 0x7F) {
+    output[0] = static_cast<char8_t>(codepoint);
+    return 1;
+  } else if (codepoint <= 0x7FF) {
+    output[0] = static_cast<char8_t>(0xC0 | (codepoint >> 6));
+    output[1] = static_cast<char8_t>(0x80 | (codepoint & 0x3F));
+    return 2;
+  } else if (codepoint <= 0xFFFF) {
+    output[0] = static_cast<char8_t>(0xE0 | (codepoint >> 12));
+    output[1] = static_cast<char8_t>(0x80 | ((codepoint >> 6) & 0x3F));
+    output[2] = static_cast<char8_t>(0x80 | (codepoint & 0x3F));
+    return 3;
+  } else {
+    output[0] = static_cast<char8_t>(0xF0 | (codepoint >> 18));
+    output[1] = static_cast<char8_t>(0x80 | ((codepoint >> 12) & 0x3F));
+    output[2] = static_cast<char8_t>(0x80 | ((codepoint >> 6) & 0x3F));
+    output[3] = static_cast<char8_t>(0x80 | (codepoint & 0x3F));
+    return 4;
+  }
+}
+
+// Encodes a codepoint into a UTF-16 buffer, returns the units written.
+inline size_t encode_utf16(char32_t codepoint, char16_t *output) {
+  if (codepoint <= 0xFFFF) {
+    output[0] = static_cast<char16_t>(codepoint);
+    return 1;
+  }
+  output[0] = static_cast<char16_t>(0xD800) +
+              static_cast<char16_t>((codepoint - 0x10000) >> 10);
+  output[1] = static_cast<char16_t>(0xDC00) +
+              static_cast<char16_t>((codepoint - 0x10000) & 0x3FF);
+  return 2;
+}
+
+inline size_t encode(char32_t codepoint, char8_t *output) {
+  return encode_utf8(codepoint, output);
+}
+inline size_t encode(char32_t codepoint, char16_t *output) {
+  return encode_utf16(codepoint, output);
+}
+inline size_t encode(char32_t codepoint, char32_t *output) {
+  output[0] = codepoint;
+  return 1;
+}
+
+// Number of units `codepoint` occupies once encoded as ToChar.
+template <typename ToChar> size_t encoded_units(char32_t codepoint) {
+  if constexpr (sizeof(ToChar) == 1) {
+    return codepoint <= 0x7F     ? 1
+           : codepoint <= 0x7FF  ? 2
+           : codepoint <= 0xFFFF ? 3
+                                 : 4;
+  } else if constexpr (sizeof(ToChar) == 2) {
+    return codepoint <= 0xFFFF ? 1 : 2;
+  } else {
+    return 1;
+  }
+}
+
+// SWAR helpers examining eight bytes per step, portable to every target
+inline constexpr uint64_t SWAR_LOW7 = 0x7F7F7F7F7F7F7F7FULL;
+inline constexpr uint64_t SWAR_HIGH = 0x8080808080808080ULL;
+inline constexpr uint64_t SWAR_ONES = 0x0101010101010101ULL;
+
+inline uint64_t load_word(const char8_t *p) {
+  uint64_t word;
+  std::memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+// High bit set in exactly the bytes of `word` that are zero
+inline uint64_t zero_bytes(uint64_t word) {
+  return ~(((word & SWAR_LOW7) + SWAR_LOW7) | word) & SWAR_HIGH;
+}
+
+// High bit set in exactly the bytes of `word` equal to `byte`
+inline uint64_t equal_bytes(uint64_t word, unsigned char byte) {
+  return zero_bytes(word ^ (SWAR_ONES * byte));
+}
+
+// Index of the first flagged byte in a non-zero mask, in memory order
+inline size_t first_flagged(uint64_t mask) {
+  if constexpr (std::endian::native == std::endian::little) {
+    return static_cast<size_t>(std::countr_zero(mask)) / 8;
+  } else {
+    return static_cast<size_t>(std::countl_zero(mask)) / 8;
+  }
+}
+
+// Length of the leading run of ASCII in `text`, optionally ending at NUL.
+inline size_t ascii_prefix(std::u8string_view text, bool stop_at_nul = false) {
+  size_t i = 0;
+  for (; i + 8 <= text.size(); i += 8) {
+    const uint64_t word = load_word(text.data() + i);
+    const uint64_t mask =
+        (word & SWAR_HIGH) | (stop_at_nul ? zero_bytes(word) : 0);
+    if (mask != 0) {
+      return i + first_flagged(mask);
+    }
+  }
+  while (i < text.size() && text[i] < 0x80 && !(stop_at_nul && text[i] == 0)) {
+    ++i;
+  }
+  return i;
+}
+
+// Length of the leading run of ASCII units in UTF-16 `text`.
+inline size_t ascii_prefix(std::u16string_view text) {
+  constexpr uint64_t NON_ASCII = 0xFF80FF80FF80FF80ULL;
+  size_t i = 0;
+  for (; i + 4 <= text.size(); i += 4) {
+    uint64_t word;
+    std::memcpy(&word, text.data() + i, sizeof(word));
+    if (word & NON_ASCII) {
+      break;
+    }
+  }
+  while (i < text.size() && text[i] < 0x80) {
+    ++i;
+  }
+  return i;
+}
+
+using wutils::ContentClass;
+
+// Below this many units sampling costs more than a tuned loop saves
+inline constexpr size_t PROFILE_MIN_UNITS = 64;
+// Bytes examined when sampling, four cache lines
+inline constexpr size_t PROFILE_SAMPLE_BYTES = 256;
+
+template <typename FromChar>
+wutils::ContentProfile sample_units(std::basic_string_view<FromChar> input) {
+  wutils::ContentProfile profile{ContentClass::Ascii, {0, 0, 0, 0}};
+  const size_t n = input.size() < PROFILE_SAMPLE_BYTES / sizeof(FromChar)
+                       ? input.size()
+                       : PROFILE_SAMPLE_BYTES / sizeof(FromChar);
+  for (size_t i = 0; i < n; ++i) {
+    const char32_t c = input[i];
+    if constexpr (sizeof(FromChar) == 1) {
+      // Classify lead bytes by the length of their sequence
+      if (c < 0x80) {
+        ++profile.counts[0];
+      } else if (c >= 0xF0) {
+        ++profile.counts[3];
+      } else if (c >= 0xE0) {
+        ++profile.counts[2];
+      } else if (c >= 0xC0) {
+        ++profile.counts[1];
+      }
+    } else if constexpr (sizeof(FromChar) == 2) {
+      if (c >= 0xDC00 && c <= 0xDFFF) {
+        continue; // Counted with its high surrogate
+      }
+      ++profile.counts[c < 0x80     ? 0
+                       : c < 0x800  ? 1
+                       : c < 0xD800 ? 2
+                       : c < 0xDC00 ? 3
+                                    : 2];
+    } else {
+      ++profile.counts[c < 0x80      ? 0
+                       : c < 0x800   ? 1
+                       : c < 0x10000 ? 2
+                                     : 3];
+    }
+  }
+
+  size_t best = 0;
+  for (size_t k = 1; k < 4; ++k) {
+    if (profile.counts[k] > profile.counts[best]) {
+      best = k;
+    }
+  }
+  profile.dominant = static_cast<ContentClass>(
+      static_cast<int>(ContentClass::Ascii) + static_cast<int>(best));
+  return profile;
+}
+
+// Index of the conversion pair between two encodings in TelemetrySnapshot
+template <typename FromChar, typename ToChar>
+constexpr size_t conversion_pair() {
+  using wutils::ConversionPair;
+  constexpr ConversionPair pairs[3][3] = {
+      {ConversionPair::Utf8ToUtf16, ConversionPair::Utf8ToUtf16,
+       ConversionPair::Utf8ToUtf32},
+      {ConversionPair::Utf16ToUtf8, ConversionPair::Utf16ToUtf8,
+       ConversionPair::Utf16ToUtf32},
+      {ConversionPair::Utf32ToUtf8, ConversionPair::Utf32ToUtf16,
+       ConversionPair::Utf32ToUtf16}};
+  constexpr size_t from = sizeof(FromChar) == 1 ? 0 : sizeof(FromChar) / 2;
+  constexpr size_t to = sizeof(ToChar) == 1 ? 0 : sizeof(ToChar) / 2;
+  return static_cast<size_t>(pairs[from][to]);
+}
+
+#ifdef WUTILS_TELEMETRY
+inline constexpr size_t TELEMETRY_PAIRS = 6;
+
+struct PairCounters {
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> input_units{0};
+  std::atomic<uint64_t> output_units{0};
+  std::atomic<uint64_t> invalid_sequences{0};
+  std::atomic<uint64_t> loop_calls[5] = {};
+  std::atomic<uint64_t> size_histogram[wutils::TELEMETRY_BUCKETS] = {};
+  std::atomic<uint64_t> latency_histogram[wutils::TELEMETRY_BUCKETS] = {};
+};
+
+// Counters of one thread. Only the owning thread writes them, with a
+// relaxed load and store instead of a locked increment; snapshots read them
+// from any thread. Blocks live on a lock-free list for the whole process,
+// and a block released by an exiting thread is adopted by the next new one
+struct ThreadTelemetry {
+  PairCounters pairs[TELEMETRY_PAIRS];
+  std::atomic<bool> in_use{true};
+  ThreadTelemetry *next = nullptr;
+};
+
+inline std::atomic<ThreadTelemetry *> telemetry_threads{nullptr};
+
+inline ThreadTelemetry *acquire_telemetry() {
+  for (ThreadTelemetry *block =
+           telemetry_threads.load(std::memory_order_acquire);
+       block != nullptr; block = block->next) {
+    bool released = false;
+    if (block->in_use.compare_exchange_strong(released, true,
+                                              std::memory_order_acquire)) {
+      return block;
+    }
+  }
+  ThreadTelemetry *block = new ThreadTelemetry;
+  block->next = telemetry_threads.load(std::memory_order_relaxed);
+  while (!telemetry_threads.compare_exchange_weak(
+      block->next, block, std::memory_order_release,
+      std::memory_order_relaxed)) {
+  }
+  return block;
+}
+
+inline PairCounters &thread_counters(size_t pair) {
+  struct Owner {
+    ThreadTelemetry *block = acquire_telemetry();
+    ~Owner() { block->in_use.store(false, std::memory_order_release); }
+  };
+  thread_local Owner owner;
+  return owner.block->pairs[pair];
+}
+
+inline void bump(std::atomic<uint64_t> &counter, uint64_t amount = 1) {
+  counter.store(counter.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+}
+
+inline size_t telemetry_bucket(uint64_t value) {
+  return std::min<size_t>(std::bit_width(value),
+                          wutils::TELEMETRY_BUCKETS - 1);
+}
+#endif
+
+template <typename FromChar, typename ToChar>
+inline void count_invalid_sequence() {
+#ifdef WUTILS_TELEMETRY
+  bump(thread_counters(conversion_pair<FromChar, ToChar>()).invalid_sequences);
+#endif
+}
+
+// Decode-validate-encode loop shared by every pair of Unicode encodings.
+// `Hint` selects the fast paths tried before the general decoder: bulk
+// ASCII runs, or inline decoding of the dominant sequence length.
+template <ContentClass Hint, bool Wtf, typename FromChar, typename ToChar>
+wutils::detail::TranscodeResult
+transcode_tuned(std::basic_string_view<FromChar> input, ToChar *output,
+                const wutils::ErrorPolicy errorPolicy) {
+  using wutils::ErrorPolicy;
+  constexpr bool ascii_runs =
+      Hint == ContentClass::Ascii || Hint == ContentClass::TwoByte;
+  bool is_valid = true;
+  ToChar *const begin = output;
+
+  size_t i = 0;
+  while (i < input.size()) {
+    const char32_t c = input[i];
+    if constexpr (sizeof(FromChar) == 1 && Hint == ContentClass::FourByte) {
+      // Eight ASCII bytes at a time. Anything else goes to the decoder,
+      // which takes a lone ASCII byte without a branch
+      if (i + 8 <= input.size() &&
+          (load_word(input.data() + i) & SWAR_HIGH) == 0) {
+        for (size_t k = 0; k < 8; ++k) {
+          output[k] = static_cast<ToChar>(input[i + k]);
+        }
+        output += 8;
+        i += 8;
+        continue;
+      }
+    } else if constexpr (sizeof(FromChar) <= 2) {
+      if (c < 0x80) {
+        if constexpr (ascii_runs) {
+          const size_t run = ascii_prefix(input.substr(i));
+          for (size_t k = 0; k < run; ++k) {
+            output[k] = static_cast<ToChar>(input[i + k]);
+          }
+          output += run;
+          i += run;
+        } else {
+          *output++ = static_cast<ToChar>(c);
+          ++i;
+        }
+        continue;
+      }
+    }
+    if constexpr (sizeof(FromChar) == 1 && Hint == ContentClass::TwoByte) {
+      if (c >= 0xC2 && c < 0xE0 && i + 1 < input.size() &&
+          (input[i + 1] & 0xC0) == 0x80) {
+        output += encode(((c & 0x1F) << 6) | (input[i + 1] & 0x3F), output);
+        i += 2;
+        continue;
+      }
+    }
+    if constexpr (sizeof(FromChar) == 1 && Hint == ContentClass::ThreeByte) {
+      if ((c & 0xF0) == 0xE0 && i + 2 < input.size() &&
+          (input[i + 1] & 0xC0) == 0x80 && (input[i + 2] & 0xC0) == 0x80) {
+        const char32_t cp = ((c & 0x0F) << 12) | ((input[i + 1] & 0x3F) << 6) |
+                            (input[i + 2] & 0x3F);
+        if (cp >= 0x800 && (cp < 0xD800 || cp > 0xDFFF)) {
+          output += encode(cp, output);
+          i += 3;
+          continue;
+        }
+      }
+    }
+    if constexpr (sizeof(FromChar) == 2 && (Hint == ContentClass::TwoByte ||
+                                            Hint == ContentClass::ThreeByte)) {
+      if (c < 0xD800 || c > 0xDFFF) {
+        output += encode(c, output);
+        ++i;
+        continue;
+      }
+    }
+
+    DecodeResult decoded = decode_one<Wtf>(input.substr(i));
+    if (decoded.is_valid) {
+      output += encode(decoded.codepoint, output);
+    } else {
+      is_valid = false;
+      count_invalid_sequence<FromChar, ToChar>();
+      switch (errorPolicy) {
+      case ErrorPolicy::SkipInvalidValues:
+        break;
+      case ErrorPolicy::StopOnFirstError:
+        return {i, static_cast<size_t>(output - begin), false};
+      case ErrorPolicy::UseReplacementCharacter:
+        output += encode(wutils::detail::REPLACEMENT_CHAR_32, output);
+        break;
+      }
+    }
+    i += decoded.consumed_units;
+  }
+  return {i, static_cast<size_t>(output - begin), is_valid};
+}
+
+template <bool Wtf, typename FromChar, typename ToChar>
+wutils::detail::TranscodeResult
+transcode_content(std::basic_string_view<FromChar> input, ToChar *output,
+                  const wutils::ErrorPolicy errorPolicy,
+                  const ContentClass content) {
+  switch (content) {
+  case ContentClass::Ascii:
+    return transcode_tuned<ContentClass::Ascii, Wtf>(input, output,
+                                                     errorPolicy);
+  case ContentClass::TwoByte:
+    return transcode_tuned<ContentClass::TwoByte, Wtf>(input, output,
+                                                       errorPolicy);
+  case ContentClass::ThreeByte:
+    return transcode_tuned<ContentClass::ThreeByte, Wtf>(input, output,
+                                                         errorPolicy);
+  default:
+    return transcode_tuned<ContentClass::FourByte, Wtf>(input, output,
+                                                        errorPolicy);
+  }
+}
+
+// Output bytes staged in the cache between streaming stores, and the input
+// prefetched ahead of them; both stay well within L1
+inline constexpr size_t STREAMING_STAGING_BYTES = 8 * 1024;
+inline constexpr size_t CACHE_LINE_BYTES = 64;
+
+inline void prefetch_streamed(const void *p) {
+#if defined(__GNUC__)
+  __builtin_prefetch(p, 0, 0);
+#elif defined(WUTILS_SSE2)
+  _mm_prefetch(static_cast<const char *>(p), _MM_HINT_NTA);
+#endif
+}
+
+// Writes the longest prefix of `units` that ends on a 16 byte boundary of
+// `output` with non-temporal stores, returning its length. The units before
+// the first boundary are stored normally, so `output` is aligned on every
+// later call. Without SSE2 everything is copied with regular stores
+template <typename ToChar>
+size_t stream_units(ToChar *output, const ToChar *units, const size_t count) {
+#ifdef WUTILS_SSE2
+  const size_t misalignment = reinterpret_cast<uintptr_t>(output) % 16;
+  const size_t head =
+      std::min(count, misalignment ? (16 - misalignment) / sizeof(ToChar) : 0);
+  std::memcpy(output, units, head * sizeof(ToChar));
+  const size_t blocks = (count - head) * sizeof(ToChar) / 16;
+  char *out = reinterpret_cast<char *>(output + head);
+  const char *in = reinterpret_cast<const char *>(units + head);
+  for (size_t k = 0; k < blocks; ++k) {
+    _mm_stream_si128(reinterpret_cast<__m128i *>(out + 16 * k),
+                     _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                         in + 16 * k)));
+  }
+  return head + blocks * 16 / sizeof(ToChar);
+#else
+  std::memcpy(output, units, count * sizeof(ToChar));
+  return count;
+#endif
+}
+
+// Transcodes block by block into a buffer that stays in the cache, and
+// streams each block out from there. The next block of input is prefetched
+// with a non-temporal hint while the current one is converted
+template <bool Wtf, typename FromChar, typename ToChar>
+wutils::detail::TranscodeResult
+transcode_streaming(std::basic_string_view<FromChar> input, ToChar *output,
+                    const wutils::ErrorPolicy errorPolicy,
+                    const ContentClass content) {
+  using wutils::detail::max_transcoded_size;
+  constexpr size_t staging_units = STREAMING_STAGING_BYTES / sizeof(ToChar);
+  constexpr size_t block_units =
+      staging_units / max_transcoded_size<FromChar, ToChar>(1);
+  // Room for the units below 16 bytes carried over from the last block
+  alignas(16) ToChar staging[staging_units + 16 / sizeof(ToChar)];
+  size_t staged = 0, read = 0, written = 0;
+  bool is_valid = true;
+  while (read < input.size()) {
+    std::basic_string_view<FromChar> block =
+        input.substr(read, std::min(block_units, input.size() - read));
+    if (read + block.size() < input.size()) {
+      block = block.substr(0, wutils::detail::complete_prefix(block));
+    }
+    const FromChar *next = block.data() + block.size();
+    const size_t ahead = std::min(block_units, input.size() - read -
+                                                   block.size()) *
+                         sizeof(FromChar);
+    for (size_t offset = 0; offset < ahead; offset += CACHE_LINE_BYTES) {
+      prefetch_streamed(reinterpret_cast<const char *>(next) + offset);
+    }
+    const wutils::detail::TranscodeResult result =
+        transcode_content<Wtf>(block, staging + staged, errorPolicy, content);
+    read += result.read;
+    staged += result.written;
+    is_valid &= result.is_valid;
+    const size_t streamed = stream_units(output + written, staging, staged);
+    written += streamed;
+    staged -= streamed;
+    std::memmove(staging, staging + streamed, staged * sizeof(ToChar));
+    if (result.read < block.size()) {
+      break; // Stopped on an error
+    }
+  }
+  std::memcpy(output + written, staging, staged * sizeof(ToChar));
+#ifdef WUTILS_SSE2
+  _mm_sfence(); // Order the streaming stores before anything that follows
+#endif
+  return {read, written + staged, is_valid};
+}
+
+// Whether to stream an output of up to `units` units
+template <typename ToChar>
+bool streams_output(const size_t units, const wutils::StoreMode store) {
+  return store == wutils::StoreMode::Streaming ||
+         (store == wutils::StoreMode::Auto &&
+          units * sizeof(ToChar) >= wutils::STREAMING_STORE_BYTES);
+}
+
+// Transcodes block by block into a buffer that stays in the cache and hands
+// each block of output to `emit`, for outputs whose length is not known
+// before the input has been checked
+template <typename FromChar, typename ToChar, typename Emit>
+wutils::detail::TranscodeResult
+transcode_staged(std::basic_string_view<FromChar> input,
+                 const wutils::ErrorPolicy errorPolicy,
+                 const ContentClass content, Emit emit) {
+  constexpr size_t staging_units = STREAMING_STAGING_BYTES / sizeof(ToChar);
+  constexpr size_t block_units =
+      staging_units /
+      wutils::detail::max_transcoded_size<FromChar, ToChar>(1);
+  ToChar staging[staging_units];
+  size_t read = 0, written = 0;
+  bool is_valid = true;
+  while (read < input.size()) {
+    std::basic_string_view<FromChar> block =
+        input.substr(read, std::min(block_units, input.size() - read));
+    if (read + block.size() < input.size()) {
+      block = block.substr(0, wutils::detail::complete_prefix(block));
+    }
+    const wutils::detail::TranscodeResult result =
+        transcode_content<false>(block, staging, errorPolicy, content);
+    emit(staging, result.written);
+    read += result.read;
+    written += result.written;
+    is_valid &= result.is_valid;
+    if (result.read < block.size()) {
+      break; // Stopped on an error
+    }
+  }
+  return {read, written, is_valid};
+}
+
+template <typename FromChar>
+ContentClass resolve_content(std::basic_string_view<FromChar> input,
+                             const ContentClass content) {
+  if (content != ContentClass::Unknown) {
+    return content;
+  }
+  return input.size() >= PROFILE_MIN_UNITS ? sample_units(input).dominant
+                                           : ContentClass::FourByte;
+}
+
+// Runs one conversion, counting it for telemetry
+template <typename FromChar, typename ToChar, typename Transcode>
+wutils::detail::TranscodeResult
+counted_transcode(std::basic_string_view<FromChar> input,
+                  [[maybe_unused]] const ContentClass content,
+                  Transcode transcode) {
+#ifdef WUTILS_TELEMETRY
+  const auto start = std::chrono::steady_clock::now();
+  const wutils::detail::TranscodeResult result = transcode();
+  const uint64_t nanoseconds =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+  PairCounters &counters = thread_counters(conversion_pair<FromChar, ToChar>());
+  bump(counters.calls);
+  bump(counters.input_units, result.read);
+  bump(counters.output_units, result.written);
+  bump(counters.loop_calls[static_cast<size_t>(content)]);
+  bump(counters.size_histogram[telemetry_bucket(input.size())]);
+  bump(counters.latency_histogram[telemetry_bucket(nanoseconds)]);
+  return result;
+#else
+  return transcode();
+#endif
+}
+
+// Picks the loop for `content`, sampling the input when it is not known.
+template <bool Wtf = false, typename FromChar, typename ToChar>
+wutils::detail::TranscodeResult
+transcode_units(std::basic_string_view<FromChar> input, ToChar *output,
+                const wutils::ErrorPolicy errorPolicy,
+                ContentClass content = ContentClass::Unknown,
+                const wutils::StoreMode store = wutils::StoreMode::Cached) {
+  content = resolve_content(input, content);
+  return counted_transcode<FromChar, ToChar>(input, content, [&] {
+    return streams_output<ToChar>(
+               wutils::detail::max_transcoded_size<FromChar, ToChar>(
+                   input.size()),
+               store)
+               ? transcode_streaming<Wtf>(input, output, errorPolicy, content)
+               : transcode_content<Wtf>(input, output, errorPolicy, content);
+  });
+}
+
+template <typename FromChar, typename ToChar>
+wutils::detail::TranscodeResult
+transcode_blocks(std::basic_string_view<FromChar> input,
+                 const wutils::detail::UnitSink<ToChar> sink,
+                 const wutils::ErrorPolicy errorPolicy, ContentClass content) {
+  content = resolve_content(input, content);
+  return counted_transcode<FromChar, ToChar>(input, content, [&] {
+    return transcode_staged<FromChar, ToChar>(
+        input, errorPolicy, content,
+        [&](const ToChar *units, size_t count) {
+          sink.emit(sink.context, units, count);
+        });
+  });
+}
+
+// Output length of transcode_units with UseReplacementCharacter. ASCII runs,
+// one unit each in every encoding, are counted without decoding them.
+template <typename ToChar, typename FromChar>
+size_t transcoded_units(std::basic_string_view<FromChar> input) {
+  size_t length = 0;
+  for (size_t i = 0; i < input.size();) {
+    if constexpr (sizeof(FromChar) <= 2) {
+      if (input[i] < 0x80) {
+        const size_t run = ascii_prefix(input.substr(i));
+        length += run;
+        i += run;
+        continue;
+      }
+    }
+    DecodeResult decoded = decode_one(input.substr(i));
+    length += encoded_units<ToChar>(
+        decoded.is_valid ? decoded.codepoint
+                         : wutils::detail::REPLACEMENT_CHAR_32);
+    i += decoded.consumed_units;
+  }
+  return length;
+}
+
+// Output length counted from the lead units alone, without decoding. Exact
+// for valid input, where every lead unit starts one character.
+template <typename ToChar, typename FromChar>
+size_t estimated_units(std::basic_string_view<FromChar> input) {
+  size_t length = 0;
+  size_t i = 0;
+  if constexpr (sizeof(FromChar) == 1) {
+    // Everything but continuation bytes starts a character, and in UTF-16 the
+    // 4 byte ones take a surrogate pair. Both are counted in byte lanes,
+    // summed every 255 words before a lane can overflow
+    auto lane_sum = [](uint64_t lanes) {
+      constexpr uint64_t even = 0x00FF00FF00FF00FFULL;
+      lanes = (lanes & even) + ((lanes >> 8) & even);
+      return static_cast<size_t>((lanes * 0x0001000100010001ULL) >> 48);
+    };
+    size_t continuations = 0, four_byte = 0;
+    while (i + 8 <= input.size()) {
+      const size_t end = i + 8 * std::min<size_t>(255, (input.size() - i) / 8);
+      uint64_t continuation_lanes = 0, four_byte_lanes = 0;
+      for (; i < end; i += 8) {
+        const uint64_t word = load_word(input.data() + i);
+        continuation_lanes += (word & ~(word << 1) & SWAR_HIGH) >> 7;
+        if constexpr (sizeof(ToChar) == 2) {
+          four_byte_lanes +=
+              (word & (word << 1) & (word << 2) & (word << 3) & SWAR_HIGH) >> 7;
+        }
+      }
+      continuations += lane_sum(continuation_lanes);
+      four_byte += lane_sum(four_byte_lanes);
+    }
+    length = i - continuations + four_byte;
+  } else if constexpr (sizeof(FromChar) == 2) {
+    // The same in four 16 bit lanes: UTF-8 takes an extra byte from 0x80 and
+    // another from 0x800 but for surrogates, and UTF-32 drops low surrogates.
+    // Lanes gain at most 2 a word and are summed every 4096 words
+    constexpr uint64_t ones = 0x0001000100010001ULL;
+    constexpr uint64_t high = ones * 0x8000, low15 = ones * 0x7FFF;
+    auto nonzero = [](uint64_t lanes) {
+      return (((lanes & low15) + low15) | lanes) & high;
+    };
+    size_t extra = 0;
+    while (i + 4 <= input.size()) {
+      const size_t end = i + 4 * std::min<size_t>(4096, (input.size() - i) / 4);
+      uint64_t lanes = 0;
+      for (; i < end; i += 4) {
+        const uint64_t word =
+            load_word(reinterpret_cast<const char8_t *>(input.data() + i));
+        if constexpr (sizeof(ToChar) == 1) {
+          const uint64_t wide = word & (ones * 0xFF80);
+          if (wide == 0) {
+            continue;
+          }
+          const uint64_t top = word & (ones * 0xF800);
+          lanes += nonzero(wide) >> 15;
+          lanes += (nonzero(top) & nonzero(top ^ (ones * 0xD800))) >> 15;
+        } else {
+          const uint64_t top = word & (ones * 0xFC00);
+          lanes += (~nonzero(top ^ (ones * 0xDC00)) & high) >> 15;
+        }
+      }
+      extra += static_cast<size_t>((lanes * ones) >> 48);
+    }
+    length = sizeof(ToChar) == 1 ? i + extra : i - extra;
+  }
+  for (; i < input.size(); ++i) {
+    const char32_t c = input[i];
+    if constexpr (sizeof(FromChar) == 1) {
+      length += ((c & 0xC0) != 0x80) + (sizeof(ToChar) == 2 && c >= 0xF0);
+    } else if constexpr (sizeof(FromChar) == 2 && sizeof(ToChar) == 1) {
+      // Each half of a surrogate pair takes two of its four bytes
+      length += 1 + (c >= 0x80) + (c >= 0x800 && (c < 0xD800 || c > 0xDFFF));
+    } else if constexpr (sizeof(FromChar) == 2) {
+      length += c < 0xDC00 || c > 0xDFFF;
+    } else if constexpr (sizeof(ToChar) == 1) {
+      length += 1 + (c >= 0x80) + (c >= 0x800) + (c >= 0x10000);
+    } else {
+      length += 1 + (sizeof(ToChar) == 2 && c >= 0x10000);
+    }
+  }
+  return length;
+}
+
+// Length of the valid UTF-8 prefix. Only the bounds of each sequence are
+// checked, one branch per length, which text mostly of one script predicts;
+// runs of at least eight ASCII bytes are skipped in bulk
+inline size_t valid_utf8_units(std::u8string_view input) {
+  const char8_t *const p = input.data();
+  const size_t n = input.size();
+  auto continues = [&](size_t k) { return (p[k] & 0xC0) == 0x80; };
+  size_t i = 0;
+  while (i < n) {
+    const unsigned char c = p[i];
+    if (c < 0x80) {
+      if (i + 8 <= n && (load_word(p + i) & SWAR_HIGH) == 0) {
+        i += ascii_prefix(input.substr(i));
+      } else {
+        ++i;
+      }
+    } else if (c >= 0xC2 && c <= 0xDF) {
+      if (i + 1 >= n || !continues(i + 1)) {
+        break;
+      }
+      i += 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      // No overlong forms after E0, no surrogates after ED
+      const unsigned char low = c == 0xE0 ? 0xA0 : 0x80;
+      const unsigned char high = c == 0xED ? 0x9F : 0xBF;
+      if (i + 2 >= n || p[i + 1] < low || p[i + 1] > high ||
+          !continues(i + 2)) {
+        break;
+      }
+      i += 3;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      // No overlong forms after F0, nothing past U+10FFFF after F4
+      const unsigned char low = c == 0xF0 ? 0x90 : 0x80;
+      const unsigned char high = c == 0xF4 ? 0x8F : 0xBF;
+      if (i + 3 >= n || p[i + 1] < low || p[i + 1] > high ||
+          !continues(i + 2) || !continues(i + 3)) {
+        break;
+      }
+      i += 4;
+    } else {
+      break;
+    }
+  }
+  return i;
+}
+
+// Length of the valid prefix, skipping ASCII runs without decoding them
+template <typename CharT>
+size_t valid_units(std::basic_string_view<CharT> input) {
+  if constexpr (sizeof(CharT) == 1) {
+    return valid_utf8_units(input);
+  }
+  size_t i = 0;
+  while (i < input.size()) {
+    if constexpr (sizeof(CharT) <= 2) {
+      i += ascii_prefix(input.substr(i));
+      if (i == input.size()) {
+        break;
+      }
+    }
+    const DecodeResult decoded = decode_one(input.substr(i));
+    if (!decoded.is_valid) {
+      break;
+    }
+    i += decoded.consumed_units;
+  }
+  return i;
+}
+
+// Copy within one encoding. Valid runs are copied as they are, and only the
+// invalid sequences between them go through the error policy
+template <typename CharT>
+wutils::detail::TranscodeResult
+copy_units(std::basic_string_view<CharT> input, CharT *output,
+           const wutils::ErrorPolicy errorPolicy) {
+  using wutils::ErrorPolicy;
+  CharT *const begin = output;
+  bool is_valid = true;
+  size_t i = 0;
+  while (i < input.size()) {
+    const size_t run = valid_units(input.substr(i));
+    std::copy_n(input.data() + i, run, output);
+    output += run;
+    i += run;
+    if (i == input.size()) {
+      break;
+    }
+    is_valid = false;
+    switch (errorPolicy) {
+    case ErrorPolicy::SkipInvalidValues:
+      break;
+    case ErrorPolicy::StopOnFirstError:
+      return {i, static_cast<size_t>(output - begin), false};
+    case ErrorPolicy::UseReplacementCharacter:
+      output += encode(wutils::detail::REPLACEMENT_CHAR_32, output);
+      break;
+    }
+    i += decode_one(input.substr(i)).consumed_units;
+  }
+  return {i, static_cast<size_t>(output - begin), is_valid};
+}
+} // namespace wutils::detail::kernels
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode(const std::u16string_view from, char8_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content, const StoreMode store) {
+  return kernels::transcode_units(from, out, errorPolicy, content, store);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode(const std::u32string_view from, char8_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content, const StoreMode store) {
+  return kernels::transcode_units(from, out, errorPolicy, content, store);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode(const std::u8string_view from, char16_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content, const StoreMode store) {
+  return kernels::transcode_units(from, out, errorPolicy, content, store);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode(const std::u32string_view from, char16_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content, const StoreMode store) {
+  return kernels::transcode_units(from, out, errorPolicy, content, store);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode(const std::u8string_view from, char32_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content, const StoreMode store) {
+  return kernels::transcode_units(from, out, errorPolicy, content, store);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode(const std::u16string_view from, char32_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content, const StoreMode store) {
+  return kernels::transcode_units(from, out, errorPolicy, content, store);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode_blocks(const std::u16string_view from,
+                                 const UnitSink<char8_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content) {
+  return kernels::transcode_blocks(from, sink, errorPolicy, content);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode_blocks(const std::u32string_view from,
+                                 const UnitSink<char8_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content) {
+  return kernels::transcode_blocks(from, sink, errorPolicy, content);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode_blocks(const std::u8string_view from,
+                                 const UnitSink<char16_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content) {
+  return kernels::transcode_blocks(from, sink, errorPolicy, content);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode_blocks(const std::u32string_view from,
+                                 const UnitSink<char16_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content) {
+  return kernels::transcode_blocks(from, sink, errorPolicy, content);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode_blocks(const std::u8string_view from,
+                                 const UnitSink<char32_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content) {
+  return kernels::transcode_blocks(from, sink, errorPolicy, content);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode_blocks(const std::u16string_view from,
+                                 const UnitSink<char32_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content) {
+  return kernels::transcode_blocks(from, sink, errorPolicy, content);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode(const std::u8string_view from, char8_t *out,
+                          const ErrorPolicy errorPolicy) {
+  return kernels::copy_units(from, out, errorPolicy);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode(const std::u16string_view from, char16_t *out,
+                          const ErrorPolicy errorPolicy) {
+  return kernels::copy_units(from, out, errorPolicy);
+}
+
+WUTILS_KERNEL wutils::detail::TranscodeResult
+wutils::detail::transcode(const std::u32string_view from, char32_t *out,
+                          const ErrorPolicy errorPolicy) {
+  return kernels::copy_units(from, out, errorPolicy);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::valid_prefix(const std::u8string_view u8s) {
+  return kernels::valid_units(u8s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::valid_prefix(const std::u16string_view u16s) {
+  return kernels::valid_units(u16s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::valid_prefix(const std::u32string_view u32s) {
+  return kernels::valid_units(u32s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u8_estimate(const std::u16string_view u16s) {
+  return kernels::estimated_units<char8_t>(u16s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u8_estimate(const std::u32string_view u32s) {
+  return kernels::estimated_units<char8_t>(u32s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u16_estimate(const std::u8string_view u8s) {
+  return kernels::estimated_units<char16_t>(u8s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u16_estimate(const std::u32string_view u32s) {
+  return kernels::estimated_units<char16_t>(u32s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u32_estimate(const std::u8string_view u8s) {
+  return kernels::estimated_units<char32_t>(u8s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u32_estimate(const std::u16string_view u16s) {
+  return kernels::estimated_units<char32_t>(u16s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u8_length(const std::u16string_view u16s) {
+  return kernels::transcoded_units<char8_t>(u16s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u8_length(const std::u32string_view u32s) {
+  return kernels::transcoded_units<char8_t>(u32s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u16_length(const std::u8string_view u8s) {
+  return kernels::transcoded_units<char16_t>(u8s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u16_length(const std::u32string_view u32s) {
+  return kernels::transcoded_units<char16_t>(u32s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u32_length(const std::u8string_view u8s) {
+  return kernels::transcoded_units<char32_t>(u8s);
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::u32_length(const std::u16string_view u16s) {
+  return kernels::transcoded_units<char32_t>(u16s);
+}
+
+// UTF-16 to UTF-8 conversion
+WUTILS_KERNEL wutils::ConversionResult<std::u8string>
+wutils::detail::u8(const std::u16string_view u16s,
+                   const ErrorPolicy errorPolicy) {
+  std::u8string result;
+  const bool is_valid = append_transcoded(result, u16s, errorPolicy);
+  return {std::move(result), is_valid};
+}
+
+// UTF-32 to UTF-8 conversion
+WUTILS_KERNEL wutils::ConversionResult<std::u8string>
+wutils::detail::u8(const std::u32string_view u32s,
+                   const ErrorPolicy errorPolicy) {
+  std::u8string result;
+  const bool is_valid = append_transcoded(result, u32s, errorPolicy);
+  return {std::move(result), is_valid};
+}
+
+// UTF-8 to UTF-16 conversion
+WUTILS_KERNEL wutils::ConversionResult<std::u16string>
+wutils::detail::u16(const std::u8string_view u8s,
+                    const ErrorPolicy errorPolicy) {
+  std::u16string result;
+  const bool is_valid = append_transcoded(result, u8s, errorPolicy);
+  return {std::move(result), is_valid};
+}
+
+// UTF-32 to UTF-16 conversion
+WUTILS_KERNEL wutils::ConversionResult<std::u16string>
+wutils::detail::u16(const std::u32string_view u32s,
+                    const ErrorPolicy errorPolicy) {
+  std::u16string result;
+  const bool is_valid = append_transcoded(result, u32s, errorPolicy);
+  return {std::move(result), is_valid};
+}
+
+// UTF-8 to UTF-32 conversion
+WUTILS_KERNEL wutils::ConversionResult<std::u32string>
+wutils::detail::u32(const std::u8string_view u8s,
+                    const ErrorPolicy errorPolicy) {
+  std::u32string result;
+  const bool is_valid = append_transcoded(result, u8s, errorPolicy);
+  return {std::move(result), is_valid};
+}
+
+// UTF-16 to UTF-32 conversion
+WUTILS_KERNEL wutils::ConversionResult<std::u32string>
+wutils::detail::u32(const std::u16string_view u16s,
+                    const ErrorPolicy errorPolicy) {
+  std::u32string result;
+  const bool is_valid = append_transcoded(result, u16s, errorPolicy);
+  return {std::move(result), is_valid};
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::complete_prefix(const std::u8string_view u8s) {
+  // Walk back over at most three continuation bytes to the lead byte
+  size_t i = u8s.size();
+  size_t continuation = 0;
+  while (i > 0 && continuation < 3 && (u8s[i - 1] & 0xC0) == 0x80) {
+    --i;
+    ++continuation;
+  }
+  if (i == 0) {
+    return u8s.size();
+  }
+  const unsigned char lead = u8s[i - 1];
+  const size_t expected = lead >= 0xF0   ? 4
+                          : lead >= 0xE0 ? 3
+                          : lead >= 0xC0 ? 2
+                                         : 1;
+  return continuation + 1 < expected ? i - 1 : u8s.size();
+}
+
+WUTILS_KERNEL std::size_t
+wutils::detail::complete_prefix(const std::u16string_view u16s) {
+  if (!u16s.empty() && u16s.back() >= 0xD800 && u16s.back() <= 0xDBFF) {
+    return u16s.size() - 1; // Keep the high surrogate for the next block
+  }
+  return u16s.size();
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+// Conversions, lengths and widths computed chunk by chunk on an
+// application's thread pool. Kept out of wutils.hpp along with the
+// <functional> its tasks are passed in.
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "wutils.hpp"
+
+namespace wutils {
+
+// ===== Parallel Conversions =====
+// Anything with a submit() member taking a task, typically an adapter over
+// an application's thread pool. Tasks may run on any thread, in any order,
+// or late; wutils never starts threads of its own
+template <typename E>
+concept Executor = requires(E &executor, std::function<void()> task) {
+  executor.submit(std::move(task));
+};
+
+// Inputs are split into chunks of about this many bytes at code point
+// boundaries. Inputs shorter than two chunks are converted on the calling
+// thread without involving the executor
+constexpr std::size_t PARALLEL_CHUNK_BYTES = 256 * 1024;
+
+namespace detail {
+
+// Type-erased reference to an Executor
+class TaskSubmitter {
+public:
+  template <Executor E>
+  TaskSubmitter(E &executor)
+      : executor(&executor),
+        submit_task([](void *executor, std::function<void()> task) {
+          static_cast<E *>(executor)->submit(std::move(task));
+        }) {}
+
+  void submit(std::function<void()> task) const {
+    submit_task(executor, std::move(task));
+  }
+
+private:
+  void *executor;
+  void (*submit_task)(void *, std::function<void()>);
+};
+
+ConversionResult<std::u8string> u8(const std::u16string_view u16s,
+                                   const ErrorPolicy errorPolicy,
+                                   const TaskSubmitter executor);
+ConversionResult<std::u8string> u8(const std::u32string_view u32s,
+                                   const ErrorPolicy errorPolicy,
+                                   const TaskSubmitter executor);
+ConversionResult<std::u16string> u16(const std::u8string_view u8s,
+                                     const ErrorPolicy errorPolicy,
+                                     const TaskSubmitter executor);
+ConversionResult<std::u16string> u16(const std::u32string_view u32s,
+                                     const ErrorPolicy errorPolicy,
+                                     const TaskSubmitter executor);
+ConversionResult<std::u32string> u32(const std::u8string_view u8s,
+                                     const ErrorPolicy errorPolicy,
+                                     const TaskSubmitter executor);
+ConversionResult<std::u32string> u32(const std::u16string_view u16s,
+                                     const ErrorPolicy errorPolicy,
+                                     const TaskSubmitter executor);
+
+std::size_t u8_length(const std::u16string_view u16s,
+                      const TaskSubmitter executor);
+std::size_t u8_length(const std::u32string_view u32s,
+                      const TaskSubmitter executor);
+std::size_t u16_length(const std::u8string_view u8s,
+                       const TaskSubmitter executor);
+std::size_t u16_length(const std::u32string_view u32s,
+                       const TaskSubmitter executor);
+std::size_t u32_length(const std::u8string_view u8s,
+                       const TaskSubmitter executor);
+std::size_t u32_length(const std::u16string_view u16s,
+                       const TaskSubmitter executor);
+
+template <BasicString To, typename From>
+ConversionResult<To> convert_parallel(const From &from,
+                                      const TaskSubmitter executor,
+                                      const ErrorPolicy errorPolicy) {
+  const auto units = as_unicode(from);
+  using FromChar = typename decltype(units)::value_type;
+  using ToChar = typename To::value_type;
+  if constexpr (std::is_same_v<FromChar, ToChar>) {
+    return {To(units), true};
+  } else if constexpr (std::is_same_v<ToChar, char8_t>) {
+    return u8(units, errorPolicy, executor);
+  } else if constexpr (std::is_same_v<ToChar, char16_t>) {
+    return u16(units, errorPolicy, executor);
+  } else {
+    return u32(units, errorPolicy, executor);
+  }
+}
+
+template <typename ToChar, typename FromChar>
+std::size_t transcoded_length(const std::basic_string_view<FromChar> from,
+                              const TaskSubmitter executor) {
+  if constexpr (std::is_same_v<FromChar, ToChar>) {
+    return from.size();
+  } else if constexpr (std::is_same_v<ToChar, char8_t>) {
+    return u8_length(from, executor);
+  } else if constexpr (std::is_same_v<ToChar, char16_t>) {
+    return u16_length(from, executor);
+  } else {
+    return u32_length(from, executor);
+  }
+}
+
+} // namespace detail
+
+// Conversions and lengths computed chunk by chunk on `executor`. The calling
+// thread works on chunks too and returns once all are done, so it never
+// waits on tasks the executor has not started
+template <BasicStringView From, Executor E>
+inline ConversionResult<std::u8string>
+u8s(const From &from, E &executor,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_parallel<std::u8string>(from, executor, errorPolicy);
+}
+
+template <BasicStringView From, Executor E>
+inline ConversionResult<std::u16string>
+u16s(const From &from, E &executor,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_parallel<std::u16string>(from, executor, errorPolicy);
+}
+
+template <BasicStringView From, Executor E>
+inline ConversionResult<std::u32string>
+u32s(const From &from, E &executor,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_parallel<std::u32string>(from, executor, errorPolicy);
+}
+
+template <BasicStringView From, Executor E>
+inline std::size_t u8length(const From &from, E &executor) {
+  return detail::transcoded_length<char8_t>(detail::as_unicode(from), executor);
+}
+
+template <BasicStringView From, Executor E>
+inline std::size_t u16length(const From &from, E &executor) {
+  return detail::transcoded_length<char16_t>(detail::as_unicode(from),
+                                             executor);
+}
+
+template <BasicStringView From, Executor E>
+inline std::size_t u32length(const From &from, E &executor) {
+  return detail::transcoded_length<char32_t>(detail::as_unicode(from),
+                                             executor);
+}
+
+namespace detail {
+TextCounts text_counts(const std::u8string_view u8s,
+                       const TaskSubmitter executor);
+TextCounts text_counts(const std::u16string_view u16s,
+                       const TaskSubmitter executor);
+TextCounts text_counts(const std::u32string_view u32s,
+                       const TaskSubmitter executor);
+} // namespace detail
+
+// text_counts() and uswidth() measured chunk by chunk on `executor`.
+// Sequences straddling two chunks are settled when the chunks are joined, so
+// the results equal the sequential ones
+template <BasicStringView From, Executor E>
+inline TextCounts text_counts(const From &from, E &executor) {
+  return detail::text_counts(detail::as_unicode(from), executor);
+}
+
+template <BasicStringView From, Executor E>
+inline int uswidth(const From &from, E &executor) {
+  return text_counts(from, executor).width;
+}
+
+} // namespace wutils
@@ -0,0 +1,31 @@
+#pragma once
+
+// Console output of wide strings. Kept out of wutils.hpp so that code which
+// only converts does not pay for <iostream> and its static initializer.
+
+#include <string_view>
+#ifndef _WIN32
+#include <iostream>
+#endif
+
+#include "wutils.hpp"
+
+namespace wutils {
+
+// Windows sucks and can't properly print std::wcout to terminal so we use a
+// wrapper
+#ifdef _WIN32
+void wcout(const std::wstring_view ws);
+void wcerr(const std::wstring_view ws);
+#else
+inline void wcout(const std::wstring_view ws) { std::wcout << ws; }
+inline void wcerr(const std::wstring_view ws) { std::wcerr << ws << std::endl; }
+#endif
+
+inline void wprint(const std::wstring_view ws) { wcout(ws); }
+inline void wprintln(const std::wstring_view ws) {
+  wcout(ws);
+  wcout(L"\n");
+}
+
+} // namespace wutils
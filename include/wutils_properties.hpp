@@ -0,0 +1,132 @@
+#pragma once
+
+// Unicode character properties, from the tables behind the column width
+// functions. Needs nothing else from the library.
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace wutils {
+
+// Unicode character properties, looked up in the same tables as uswidth()
+
+enum class GeneralCategory : std::uint8_t {
+  Unassigned,           // Cn
+  UppercaseLetter,      // Lu
+  LowercaseLetter,      // Ll
+  TitlecaseLetter,      // Lt
+  ModifierLetter,       // Lm
+  OtherLetter,          // Lo
+  NonspacingMark,       // Mn
+  SpacingMark,          // Mc
+  EnclosingMark,        // Me
+  DecimalNumber,        // Nd
+  LetterNumber,         // Nl
+  OtherNumber,          // No
+  ConnectorPunctuation, // Pc
+  DashPunctuation,      // Pd
+  OpenPunctuation,      // Ps
+  ClosePunctuation,     // Pe
+  InitialPunctuation,   // Pi
+  FinalPunctuation,     // Pf
+  OtherPunctuation,     // Po
+  MathSymbol,           // Sm
+  CurrencySymbol,       // Sc
+  ModifierSymbol,       // Sk
+  OtherSymbol,          // So
+  SpaceSeparator,       // Zs
+  LineSeparator,        // Zl
+  ParagraphSeparator,   // Zp
+  Control,              // Cc
+  Format,               // Cf
+  Surrogate,            // Cs
+  PrivateUse            // Co
+};
+
+// Script property values (UAX #24), Unknown for unassigned code points
+enum class Script : std::uint8_t {
+  Unknown, Common, Inherited, Adlam, Ahom, AnatolianHieroglyphs, Arabic,
+  Armenian, Avestan, Balinese, Bamum, BassaVah, Batak, Bengali, Bhaiksuki,
+  Bopomofo, Brahmi, Braille, Buginese, Buhid, CanadianAboriginal, Carian,
+  CaucasianAlbanian, Chakma, Cham, Cherokee, Chorasmian, Coptic, Cuneiform,
+  Cypriot, CyproMinoan, Cyrillic, Deseret, Devanagari, DivesAkuru, Dogra,
+  Duployan, EgyptianHieroglyphs, Elbasan, Elymaic, Ethiopic, Georgian,
+  Glagolitic, Gothic, Grantha, Greek, Gujarati, GunjalaGondi, Gurmukhi, Han,
+  Hangul, HanifiRohingya, Hanunoo, Hatran, Hebrew, Hiragana, ImperialAramaic,
+  InscriptionalPahlavi, InscriptionalParthian, Javanese, Kaithi, Kannada,
+  Katakana, KayahLi, Kharoshthi, KhitanSmallScript, Khmer, Khojki, Khudawadi,
+  Lao, Latin, Lepcha, Limbu, LinearA, LinearB, Lisu, Lycian, Lydian, Mahajani,
+  Makasar, Malayalam, Mandaic, Manichaean, Marchen, MasaramGondi, Medefaidrin,
+  MeeteiMayek, MendeKikakui, MeroiticCursive, MeroiticHieroglyphs, Miao, Modi,
+  Mongolian, Mro, Multani, Myanmar, Nabataean, Nandinagari, NewTaiLue, Newa,
+  Nko, Nushu, NyiakengPuachueHmong, Ogham, OlChiki, OldHungarian, OldItalic,
+  OldNorthArabian, OldPermic, OldPersian, OldSogdian, OldSouthArabian,
+  OldTurkic, OldUyghur, Oriya, Osage, Osmanya, PahawhHmong, Palmyrene,
+  PauCinHau, PhagsPa, Phoenician, PsalterPahlavi, Rejang, Runic, Samaritan,
+  Saurashtra, Sharada, Shavian, Siddham, SignWriting, Sinhala, Sogdian,
+  SoraSompeng, Soyombo, Sundanese, SylotiNagri, Syriac, Tagalog, Tagbanwa,
+  TaiLe, TaiTham, TaiViet, Takri, Tamil, Tangsa, Tangut, Telugu, Thaana, Thai,
+  Tibetan, Tifinagh, Tirhuta, Toto, Ugaritic, Vai, Vithkuqi, Wancho,
+  WarangCiti, Yezidi, Yi, ZanabazarSquare
+};
+
+// East_Asian_Width property values (UAX #11)
+enum class EastAsianWidth : std::uint8_t {
+  Neutral,
+  Ambiguous,
+  Halfwidth,
+  Wide,
+  Fullwidth,
+  Narrow
+};
+
+// Grapheme_Cluster_Break property values (UAX #29)
+enum class GraphemeBreak : std::uint8_t {
+  Other,
+  CR,
+  LF,
+  Control,
+  Extend,
+  ZWJ,
+  RegionalIndicator,
+  Prepend,
+  SpacingMark,
+  L,
+  V,
+  T,
+  LV,
+  LVT
+};
+
+struct CodePointProperties {
+  GeneralCategory category;
+  Script script;
+  EastAsianWidth east_asian_width;
+  GraphemeBreak grapheme_break;
+  bool emoji : 1;
+  bool emoji_presentation : 1;
+  bool emoji_modifier : 1;
+  bool emoji_modifier_base : 1;
+  bool emoji_component : 1;
+  bool extended_pictographic : 1;
+  std::int8_t width; // Column width of the code point on its own, -1 for
+                     // control characters
+};
+
+// Code points above U+10FFFF are reported as unassigned with a width of 1
+CodePointProperties properties(char32_t cp);
+GeneralCategory general_category(char32_t cp);
+Script script(char32_t cp);
+EastAsianWidth east_asian_width(char32_t cp);
+GraphemeBreak grapheme_break(char32_t cp);
+
+// Fills out[i] with the properties of code_points[i], up to the shorter of the
+// two spans
+void classify(std::span<const char32_t> code_points,
+              std::span<CodePointProperties> out);
+
+// Long property value alias, e.g. "Latin" or "Old_Italic"
+std::string_view script_name(Script script);
+
+} // namespace wutils
@@ -0,0 +1,79 @@
+#pragma once
+
+// Editable UTF-8 text for editors, with the metrics of every span cached
+// in a balanced tree.
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "wutils.hpp"
+
+namespace wutils {
+
+// ===== Rope =====
+// Sizes of a span of text
+struct TextMetrics {
+  std::size_t bytes = 0; // UTF-8 code units
+  std::size_t utf16_units = 0;
+  std::size_t code_points = 0;
+  std::size_t newlines = 0; // Line feeds, i.e. the line index of the end
+  // Columns as uswidth() counts them, except that control characters take
+  // none instead of making the whole width -1
+  std::size_t width = 0;
+};
+
+enum class TextMetric { Bytes, Utf16Units, CodePoints, Newlines, Width };
+
+namespace detail {
+struct RopeNode;
+} // namespace detail
+
+// Editable UTF-8 text stored as a balanced tree of chunks of about a
+// kilobyte. Every node caches the metrics of its subtree, so edits and
+// position conversions take O(log n) instead of a pass over the document.
+// Offsets inside a code point are moved back to its start and offsets past
+// the end to the end; invalid input is stored with U+FFFD replacements
+class Rope {
+public:
+  Rope() noexcept;
+  explicit Rope(std::u8string_view text);
+  explicit Rope(const std::string_view text)
+      : Rope(detail::as_unicode(text)) {}
+  Rope(const Rope &other);
+  Rope(Rope &&other) noexcept;
+  Rope &operator=(const Rope &other);
+  Rope &operator=(Rope &&other) noexcept;
+  ~Rope();
+
+  void insert(std::size_t offset, std::u8string_view text);
+  void insert(const std::size_t offset, const std::string_view text) {
+    insert(offset, detail::as_unicode(text));
+  }
+  void append(const std::u8string_view text) { insert(size(), text); }
+  void append(const std::string_view text) { insert(size(), text); }
+  void erase(std::size_t offset, std::size_t count);
+  void clear() noexcept;
+
+  std::size_t size() const noexcept;
+  bool empty() const noexcept { return size() == 0; }
+
+  // Metrics of the whole text and of the text before `offset`
+  TextMetrics metrics() const noexcept;
+  TextMetrics prefix(std::size_t offset) const;
+
+  // Byte offset of the last code point boundary where the prefix measures
+  // at most `value` in `metric`. For TextMetric::Newlines it is the start of
+  // line `value` instead, or size() past the last line
+  std::size_t offset_of(TextMetric metric, std::size_t value) const;
+
+  std::u8string substr(std::size_t offset,
+                       std::size_t count = std::u8string::npos) const;
+  std::u8string str() const { return substr(0); }
+
+private:
+  std::unique_ptr<detail::RopeNode> root;
+};
+
+} // namespace wutils
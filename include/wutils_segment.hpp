@@ -0,0 +1,159 @@
+#pragma once
+
+// Word and sentence boundaries (UAX #29), and cursor movement over
+// grapheme clusters and words for editors.
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "wutils.hpp"
+
+namespace wutils {
+
+// Text segmentation (UAX #29)
+
+namespace detail {
+
+// Context carried from one boundary to the next. Classes are the internal
+// Word_Break and Sentence_Break values, 0xFF standing for the start of text.
+struct WordBreakState {
+  std::uint8_t raw = 0xFF;         // Last code point
+  std::uint8_t last = 0xFF;        // Last code point not Extend, Format or ZWJ
+  std::uint8_t before_last = 0xFF; // The one before it
+  bool odd_regional = false;       // Odd run of regional indicators so far
+};
+
+struct SentenceBreakState {
+  std::uint8_t raw = 0xFF;         // Last code point
+  std::uint8_t last = 0xFF;        // Last code point not Extend or Format
+  std::uint8_t term = 0xFF;        // Terminator of an open "Term Close* Sp*"
+  std::uint8_t before_term = 0xFF; // Last code point before the terminator
+  std::uint8_t trailer = 0;        // 0 after the terminator, 1 in Close*, 2
+                                   // in Sp*
+};
+
+// Offset of the first boundary after `pos`, which must be a boundary
+std::size_t next_word_break(std::u8string_view text, std::size_t pos,
+                            WordBreakState &state, bool &word);
+std::size_t next_word_break(std::u16string_view text, std::size_t pos,
+                            WordBreakState &state, bool &word);
+std::size_t next_sentence_break(std::u8string_view text, std::size_t pos,
+                                SentenceBreakState &state);
+std::size_t next_sentence_break(std::u16string_view text, std::size_t pos,
+                                SentenceBreakState &state);
+
+} // namespace detail
+
+// Walks the word boundaries of UTF-8 or UTF-16 text without allocating.
+// next() yields the end offset, in code units, of one segment per call; the
+// first segment starts at 0 and each following one where the last ended.
+template <typename CharT> class BasicWordBoundaries {
+public:
+  explicit BasicWordBoundaries(std::basic_string_view<CharT> text)
+      : text(text) {}
+
+  bool next(std::size_t &boundary) {
+    if (pos >= text.size()) {
+      return false;
+    }
+    pos = detail::next_word_break(text, pos, state, word);
+    boundary = pos;
+    return true;
+  }
+
+  // Whether the last segment holds a letter or a number, as opposed to
+  // spaces, punctuation or symbols
+  bool is_word() const { return word; }
+
+private:
+  std::basic_string_view<CharT> text;
+  std::size_t pos = 0;
+  detail::WordBreakState state;
+  bool word = false;
+};
+
+using Utf8WordBoundaries = BasicWordBoundaries<char8_t>;
+using Utf16WordBoundaries = BasicWordBoundaries<char16_t>;
+
+// Walks the sentence boundaries of UTF-8 or UTF-16 text, as above
+template <typename CharT> class BasicSentenceBoundaries {
+public:
+  explicit BasicSentenceBoundaries(std::basic_string_view<CharT> text)
+      : text(text) {}
+
+  bool next(std::size_t &boundary) {
+    if (pos >= text.size()) {
+      return false;
+    }
+    pos = detail::next_sentence_break(text, pos, state);
+    boundary = pos;
+    return true;
+  }
+
+private:
+  std::basic_string_view<CharT> text;
+  std::size_t pos = 0;
+  detail::SentenceBreakState state;
+};
+
+using Utf8SentenceBoundaries = BasicSentenceBoundaries<char8_t>;
+using Utf16SentenceBoundaries = BasicSentenceBoundaries<char16_t>;
+
+// Cursor movement for editors, over the text in place without allocating.
+// Offsets are in code units, and invalid sequences read as U+FFFD.
+
+// Where a cursor lands, and the columns of the text it stepped over: the
+// width uswidth() would give it, control characters taking none
+struct CursorStep {
+  std::size_t offset;
+  std::size_t columns;
+  bool word = false; // next_word_boundary(): the segment holds a letter or
+                     // a number
+};
+
+namespace detail {
+
+CursorStep next_grapheme_boundary(std::u8string_view text, std::size_t offset);
+CursorStep next_grapheme_boundary(std::u16string_view text,
+                                  std::size_t offset);
+CursorStep next_grapheme_boundary(std::u32string_view text,
+                                  std::size_t offset);
+CursorStep prev_grapheme_boundary(std::u8string_view text, std::size_t offset);
+CursorStep prev_grapheme_boundary(std::u16string_view text,
+                                  std::size_t offset);
+CursorStep prev_grapheme_boundary(std::u32string_view text,
+                                  std::size_t offset);
+CursorStep next_word_boundary(std::u8string_view text, std::size_t offset);
+CursorStep next_word_boundary(std::u16string_view text, std::size_t offset);
+CursorStep next_word_boundary(std::u32string_view text, std::size_t offset);
+
+} // namespace detail
+
+// End of the grapheme cluster starting at `offset`, which should be a
+// cluster boundary. At the end of the text, the cursor stays there
+template <BasicStringView From>
+inline CursorStep next_grapheme_boundary(const From &text,
+                                         std::size_t offset) {
+  return detail::next_grapheme_boundary(detail::as_unicode(text), offset);
+}
+
+// Start of the grapheme cluster ending at `offset`. Only the code points back
+// to the first boundary that needs no further context are read, usually the
+// cluster itself and the one before it
+template <BasicStringView From>
+inline CursorStep prev_grapheme_boundary(const From &text,
+                                         std::size_t offset) {
+  return detail::prev_grapheme_boundary(detail::as_unicode(text), offset);
+}
+
+// First word boundary after `offset`, which may be inside a word; the few
+// code points before it that the rules look back at are read as context.
+// Stepping over spaces and punctuation until `word` is set moves the cursor
+// past the next word
+template <BasicStringView From>
+inline CursorStep next_word_boundary(const From &text, std::size_t offset) {
+  return detail::next_word_boundary(detail::as_unicode(text), offset);
+}
+
+} // namespace wutils
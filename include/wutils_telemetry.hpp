@@ -0,0 +1,57 @@
+#pragma once
+
+// Counters of the conversions the library ran. Needs nothing else from the
+// library, so the kernels in wutils_kernels.hpp include it to count into.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wutils {
+
+// ===== Telemetry =====
+// Conversions are only counted when the library is built with
+// WUTILS_TELEMETRY defined. Otherwise they carry no bookkeeping at all and
+// snapshots stay empty
+enum class ConversionPair {
+  Utf8ToUtf16,
+  Utf8ToUtf32,
+  Utf16ToUtf8,
+  Utf16ToUtf32,
+  Utf32ToUtf8,
+  Utf32ToUtf16
+};
+
+// Histogram bucket k counts values needing k bits: bucket 0 holds zero,
+// bucket 1 one, bucket 2 two and three, and the last one everything larger
+inline constexpr std::size_t TELEMETRY_BUCKETS = 40;
+
+struct ConversionTelemetry {
+  std::uint64_t calls = 0;
+  std::uint64_t input_units = 0;
+  std::uint64_t output_units = 0;
+  std::uint64_t invalid_sequences = 0;
+  // Calls per conversion loop, indexed by the ContentClass it was tuned for
+  std::uint64_t loop_calls[5] = {};
+  std::uint64_t size_histogram[TELEMETRY_BUCKETS] = {};    // Input units
+  std::uint64_t latency_histogram[TELEMETRY_BUCKETS] = {}; // Nanoseconds
+};
+
+struct TelemetrySnapshot {
+  ConversionTelemetry pairs[6];
+
+  const ConversionTelemetry &operator[](const ConversionPair pair) const {
+    return pairs[static_cast<int>(pair)];
+  }
+
+  // What was counted between `earlier` and this snapshot
+  TelemetrySnapshot since(const TelemetrySnapshot &earlier) const;
+};
+
+bool telemetry_enabled();
+
+// Sums the counters of every thread, including threads that have exited.
+// Counting threads are not paused, so conversions running concurrently may
+// be partly included
+TelemetrySnapshot telemetry_snapshot();
+
+} // namespace wutils
@@ -70,54 +70,92 @@
 module;
 #endif
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 
 #include <stdint.h>
 #include <uchar.h>
 #include <wchar.h>
 
+#include <atomic>
 #include <string>
 #include <string_view>
+#include <thread>
+
+#ifdef WUTILS_TELEMETRY
+#include <chrono>
+#endif
+
+// Taken by the streaming stores in wutils_kernels.hpp, and included here so
+// that it stays in the global module fragment
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define WUTILS_SSE2
+#endif
 
 #ifndef WUTILS_MODULE
 #include "wutils.hpp"
+#include "wutils_bidi.hpp"
+#include "wutils_collation.hpp"
+#include "wutils_parallel.hpp"
+#include "wutils_properties.hpp"
+#include "wutils_rope.hpp"
+#include "wutils_segment.hpp"
+#include "wutils_stream.hpp"
+#include "wutils_telemetry.hpp"
+#ifdef _WIN32
+#include "wutils_print.hpp"
+#endif
 #endif
 
 #ifdef _WIN32
+#include <io.h>
 #include <windows.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
 #endif
 
 #ifdef WUTILS_MODULE
 module wutils;
 #endif
 
+// A module interface built with inline kernels already holds them
+#if !defined(WUTILS_MODULE) || !defined(WUTILS_INLINE_KERNELS)
+#include "wutils_kernels.hpp"
+#endif
+
 using std::size_t;
 
 namespace internal {
 
-struct interval {
-  char32_t first;
-  char32_t last;
-};
-
-/* auxiliary function for binary search in interval table */
-static bool bisearch(char32_t ucs, const struct interval *table, char32_t max) {
-  char32_t min = 0;
-  char32_t mid;
+#include "wutils_properties.inc"
 
-  if (ucs < table[0].first || ucs > table[max].last)
-    return false;
-  while (max >= min) {
-    mid = (min + max) / 2;
-    if (ucs > table[mid].last)
-      min = mid + 1;
-    else if (ucs < table[mid].first)
-      max = mid - 1;
-    else
-      return true;
-  }
+/* Index of the property records of a code point, see
+ * tools/gen_properties.pl */
+static size_t property_index(char32_t ucs) {
+  if (ucs > 0x10FFFF)
+    return PROPERTY_BEYOND_UNICODE;
+  const size_t mid = property_stage1[ucs >> (PROPERTY_LEAF_SHIFT +
+                                             PROPERTY_MID_SHIFT)];
+  const size_t leaf =
+      property_stage2[(mid << PROPERTY_MID_SHIFT) +
+                      ((ucs >> PROPERTY_LEAF_SHIFT) &
+                       ((1u << PROPERTY_MID_SHIFT) - 1))];
+  return property_stage3[(leaf << PROPERTY_LEAF_SHIFT) +
+                         (ucs & ((1u << PROPERTY_LEAF_SHIFT) - 1))];
+}
 
-  return false;
+/* Packed property record of a code point */
+static std::uint32_t property_record(char32_t ucs) {
+  return property_records[property_index(ucs)];
 }
 
 /* The following two functions define the column width of an ISO 10646
@@ -153,185 +191,23 @@ static bool bisearch(char32_t ucs, const struct interval *table, char32_t max) {
  */
 
 int mk_wcwidth(char32_t ucs) {
-  /* sorted list of non-overlapping intervals of non-spacing characters */
-  /* generated by "uniset +cat=Me +cat=Mn +cat=Cf -00AD +1160-11FF +200B c" */
-  static const struct interval combining[] = {
-      {0x0300, 0x036F},
-      {0x0483, 0x0486},
-      {0x0488, 0x0489},
-      {0x0591, 0x05BD},
-      {0x05BF, 0x05BF},
-      {0x05C1, 0x05C2},
-      {0x05C4, 0x05C5},
-      {0x05C7, 0x05C7},
-      {0x0600, 0x0603},
-      {0x0610, 0x0615},
-      {0x064B, 0x065E},
-      {0x0670, 0x0670},
-      {0x06D6, 0x06E4},
-      {0x06E7, 0x06E8},
-      {0x06EA, 0x06ED},
-      {0x070F, 0x070F},
-      {0x0711, 0x0711},
-      {0x0730, 0x074A},
-      {0x07A6, 0x07B0},
-      {0x07EB, 0x07F3},
-      {0x0901, 0x0902},
-      {0x093C, 0x093C},
-      {0x0941, 0x0948},
-      {0x094D, 0x094D},
-      {0x0951, 0x0954},
-      {0x0962, 0x0963},
-      {0x0981, 0x0981},
-      {0x09BC, 0x09BC},
-      {0x09C1, 0x09C4},
-      {0x09CD, 0x09CD},
-      {0x09E2, 0x09E3},
-      {0x0A01, 0x0A02},
-      {0x0A3C, 0x0A3C},
-      {0x0A41, 0x0A42},
-      {0x0A47, 0x0A48},
-      {0x0A4B, 0x0A4D},
-      {0x0A70, 0x0A71},
-      {0x0A81, 0x0A82},
-      {0x0ABC, 0x0ABC},
-      {0x0AC1, 0x0AC5},
-      {0x0AC7, 0x0AC8},
-      {0x0ACD, 0x0ACD},
-      {0x0AE2, 0x0AE3},
-      {0x0B01, 0x0B01},
-      {0x0B3C, 0x0B3C},
-      {0x0B3F, 0x0B3F},
-      {0x0B41, 0x0B43},
-      {0x0B4D, 0x0B4D},
-      {0x0B56, 0x0B56},
-      {0x0B82, 0x0B82},
-      {0x0BC0, 0x0BC0},
-      {0x0BCD, 0x0BCD},
-      {0x0C3E, 0x0C40},
-      {0x0C46, 0x0C48},
-      {0x0C4A, 0x0C4D},
-      {0x0C55, 0x0C56},
-      {0x0CBC, 0x0CBC},
-      {0x0CBF, 0x0CBF},
-      {0x0CC6, 0x0CC6},
-      {0x0CCC, 0x0CCD},
-      {0x0CE2, 0x0CE3},
-      {0x0D41, 0x0D43},
-      {0x0D4D, 0x0D4D},
-      {0x0DCA, 0x0DCA},
-      {0x0DD2, 0x0DD4},
-      {0x0DD6, 0x0DD6},
-      {0x0E31, 0x0E31},
-      {0x0E34, 0x0E3A},
-      {0x0E47, 0x0E4E},
-      {0x0EB1, 0x0EB1},
-      {0x0EB4, 0x0EB9},
-      {0x0EBB, 0x0EBC},
-      {0x0EC8, 0x0ECD},
-      {0x0F18, 0x0F19},
-      {0x0F35, 0x0F35},
-      {0x0F37, 0x0F37},
-      {0x0F39, 0x0F39},
-      {0x0F71, 0x0F7E},
-      {0x0F80, 0x0F84},
-      {0x0F86, 0x0F87},
-      {0x0F90, 0x0F97},
-      {0x0F99, 0x0FBC},
-      {0x0FC6, 0x0FC6},
-      {0x102D, 0x1030},
-      {0x1032, 0x1032},
-      {0x1036, 0x1037},
-      {0x1039, 0x1039},
-      {0x1058, 0x1059},
-      {0x1160, 0x11FF},
-      {0x135F, 0x135F},
-      {0x1712, 0x1714},
-      {0x1732, 0x1734},
-      {0x1752, 0x1753},
-      {0x1772, 0x1773},
-      {0x17B4, 0x17B5},
-      {0x17B7, 0x17BD},
-      {0x17C6, 0x17C6},
-      {0x17C9, 0x17D3},
-      {0x17DD, 0x17DD},
-      {0x180B, 0x180D},
-      {0x18A9, 0x18A9},
-      {0x1920, 0x1922},
-      {0x1927, 0x1928},
-      {0x1932, 0x1932},
-      {0x1939, 0x193B},
-      {0x1A17, 0x1A18},
-      {0x1B00, 0x1B03},
-      {0x1B34, 0x1B34},
-      {0x1B36, 0x1B3A},
-      {0x1B3C, 0x1B3C},
-      {0x1B42, 0x1B42},
-      {0x1B6B, 0x1B73},
-      {0x1DC0, 0x1DCA},
-      {0x1DFE, 0x1DFF},
-      {0x200B, 0x200F},
-      {0x202A, 0x202E},
-      {0x2060, 0x2063},
-      {0x206A, 0x206F},
-      {0x20D0, 0x20EF},
-      {0x302A, 0x302F},
-      {0x3099, 0x309A},
-      {0xA806, 0xA806},
-      {0xA80B, 0xA80B},
-      {0xA825, 0xA826},
-      {0xFB1E, 0xFB1E},
-      {0xFE00, 0xFE0F},
-      {0xFE20, 0xFE23},
-      {0xFEFF, 0xFEFF},
-      {0xFFF9, 0xFFFB},
-      {0x10A01, 0x10A03},
-      {0x10A05, 0x10A06},
-      {0x10A0C, 0x10A0F},
-      {0x10A38, 0x10A3A},
-      {0x10A3F, 0x10A3F},
-      {0x1D167, 0x1D169},
-      {0x1D173, 0x1D182},
-      {0x1D185, 0x1D18B},
-      {0x1D1AA, 0x1D1AD},
-      {0x1D242, 0x1D244},
-      {0xE0001, 0xE0001},
-      {0xE0020, 0xE007F},
-      {0xE0100, 0xE01EF},
-      /* Add emoji modifiers */
-      {0x1F3FB, 0x1F3FF}, /* Emoji skin tone modifiers */
-      {0x200D, 0x200D} /* Zero Width Joiner - explicitly listed for clarity */
-  };
-
-  /* test for 8-bit control characters */
-  if (ucs == 0)
-    return 0;
-  if (ucs < 32 || (ucs >= 0x7f && ucs < 0xa0))
-    return -1;
+  /* The width is precomputed per code point from the table of non-spacing
+   * characters and the wide ranges, see tools/gen_properties.pl */
+  return static_cast<int>((property_record(ucs) >> PROPERTY_WIDTH_SHIFT) &
+                          PROPERTY_WIDTH_MASK) -
+         1;
+}
 
-  /* binary search in table of non-spacing characters */
-  if (bisearch(ucs, combining, sizeof(combining) / sizeof(struct interval) - 1))
-    return 0;
+/* Characters starting an emoji sequence, and those continuing one without
+ * taking a column of their own */
+inline bool starts_emoji_sequence(char32_t ucs) {
+  return (ucs >= 0x1F000 && ucs <= 0x1FAFF) || (ucs >= 0x2600 && ucs <= 0x27BF);
+}
 
-  /* if we arrive here, ucs is not a combining or C0/C1 control character */
-
-  return 1 +
-         ((ucs >= 0x1100 && ucs <= 0x115f) || /* Hangul Jamo init. consonants */
-          ucs == 0x2329 || ucs == 0x232a ||
-          (ucs >= 0x2e80 && ucs <= 0xa4cf && ucs != 0x303f) || /* CJK ... Yi */
-          (ucs >= 0xac00 && ucs <= 0xd7a3) || /* Hangul Syllables */
-          (ucs >= 0xf900 && ucs <= 0xfaff) || /* CJK Compatibility Ideographs */
-          (ucs >= 0xfe10 && ucs <= 0xfe19) || /* Vertical forms */
-          (ucs >= 0xfe30 && ucs <= 0xfe6f) || /* CJK Compatibility Forms */
-          (ucs >= 0xff00 && ucs <= 0xff60) || /* Fullwidth Forms */
-          (ucs >= 0xffe0 && ucs <= 0xffe6) ||
-          (ucs >= 0x20000 && ucs <= 0x2fffd) ||
-          (ucs >= 0x30000 && ucs <= 0x3fffd) ||
-          /* Emoji and symbol ranges (updated for latest Unicode) */
-          (ucs >= 0x1F000 && ucs <= 0x1F9FF) || /* Emoji and various symbols */
-          (ucs >= 0x1FA00 && ucs <= 0x1FA6F) || /* Chess symbols and others */
-          (ucs >= 0x1FA70 &&
-           ucs <= 0x1FAFF)); /* Symbols and Pictographs Extended-A */
+inline bool extends_emoji_sequence(char32_t ucs) {
+  return (ucs >= 0x1F3FB && ucs <= 0x1F3FF) || // Skin tone modifiers
+         ucs == 0xFE0F ||                      // Variation Selector-16
+         (ucs >= 0xE0020 && ucs <= 0xE007F);   // Tag sequences
 }
 
 /* This function properly handles complex emoji sequences */
@@ -348,8 +224,7 @@ int mk_wcswidth(const char32_t *pwcs, size_t n) {
       return -1;
 
     // Check if this is the start of an emoji sequence
-    bool is_emoji = (base_char >= 0x1F000 && base_char <= 0x1FAFF) ||
-                    (base_char >= 0x2600 && base_char <= 0x27BF);
+    bool is_emoji = starts_emoji_sequence(base_char);
 
     if (is_emoji) {
       // Add the base emoji width
@@ -359,10 +234,7 @@ int mk_wcswidth(const char32_t *pwcs, size_t n) {
 
       // Skip any subsequent ZWJ sequences, skin tone modifiers, etc.
       while (remaining > 0 && *p &&
-             (((*p >= 0x1F3FB && *p <= 0x1F3FF) ||   // Skin tone modifiers
-               (*p == 0x200D) ||                     // Zero Width Joiner
-               (*p == 0xFE0F) ||                     // Variation Selector-16
-               (*p >= 0xE0020 && *p <= 0xE007F)))) { // Tag sequences
+             (extends_emoji_sequence(*p) || *p == 0x200D)) {
 
         // If we hit a ZWJ followed by another emoji, don't count the
         // joined emoji's width
@@ -373,8 +245,7 @@ int mk_wcswidth(const char32_t *pwcs, size_t n) {
           // Skip the next emoji too (but don't add its width)
           if (remaining > 0 && *p) {
             // Check if it's an emoji
-            if ((*p >= 0x1F000 && *p <= 0x1FAFF) ||
-                (*p >= 0x2600 && *p <= 0x27BF)) {
+            if (starts_emoji_sequence(*p)) {
               p++;
               remaining--;
             }
@@ -414,7 +285,95 @@ int wutils::uswidth(const std::u8string_view u8s) {
   return internal::mk_wcswidth(u32s->data(), u32s->size());
 }
 
-#ifdef _WIN32
+/* Character properties */
+
+namespace internal {
+
+static_assert(sizeof(script_names) / sizeof(script_names[0]) ==
+                  static_cast<size_t>(wutils::Script::ZanabazarSquare) + 1,
+              "Script enum is out of sync with the generated tables");
+
+static wutils::CodePointProperties unpack_properties(std::uint32_t record) {
+  const std::uint32_t emoji =
+      (record >> PROPERTY_EMOJI_SHIFT) & PROPERTY_EMOJI_MASK;
+  wutils::CodePointProperties properties;
+  properties.category = static_cast<wutils::GeneralCategory>(
+      (record >> PROPERTY_CATEGORY_SHIFT) & PROPERTY_CATEGORY_MASK);
+  properties.script = static_cast<wutils::Script>(
+      (record >> PROPERTY_SCRIPT_SHIFT) & PROPERTY_SCRIPT_MASK);
+  properties.east_asian_width = static_cast<wutils::EastAsianWidth>(
+      (record >> PROPERTY_EAST_ASIAN_WIDTH_SHIFT) &
+      PROPERTY_EAST_ASIAN_WIDTH_MASK);
+  properties.grapheme_break = static_cast<wutils::GraphemeBreak>(
+      (record >> PROPERTY_GRAPHEME_BREAK_SHIFT) & PROPERTY_GRAPHEME_BREAK_MASK);
+  properties.emoji = emoji & 0x01;
+  properties.emoji_presentation = emoji & 0x02;
+  properties.emoji_modifier = emoji & 0x04;
+  properties.emoji_modifier_base = emoji & 0x08;
+  properties.emoji_component = emoji & 0x10;
+  properties.extended_pictographic = emoji & 0x20;
+  properties.width = static_cast<std::int8_t>(
+      static_cast<int>((record >> PROPERTY_WIDTH_SHIFT) & PROPERTY_WIDTH_MASK) -
+      1);
+  return properties;
+}
+
+} // namespace internal
+
+wutils::CodePointProperties wutils::properties(char32_t cp) {
+  return internal::unpack_properties(internal::property_record(cp));
+}
+
+wutils::GeneralCategory wutils::general_category(char32_t cp) {
+  return static_cast<wutils::GeneralCategory>(
+      (internal::property_record(cp) >> internal::PROPERTY_CATEGORY_SHIFT) &
+      internal::PROPERTY_CATEGORY_MASK);
+}
+
+wutils::Script wutils::script(char32_t cp) {
+  return static_cast<wutils::Script>(
+      (internal::property_record(cp) >> internal::PROPERTY_SCRIPT_SHIFT) &
+      internal::PROPERTY_SCRIPT_MASK);
+}
+
+wutils::EastAsianWidth wutils::east_asian_width(char32_t cp) {
+  return static_cast<wutils::EastAsianWidth>(
+      (internal::property_record(cp) >>
+       internal::PROPERTY_EAST_ASIAN_WIDTH_SHIFT) &
+      internal::PROPERTY_EAST_ASIAN_WIDTH_MASK);
+}
+
+wutils::GraphemeBreak wutils::grapheme_break(char32_t cp) {
+  return static_cast<wutils::GraphemeBreak>(
+      (internal::property_record(cp) >>
+       internal::PROPERTY_GRAPHEME_BREAK_SHIFT) &
+      internal::PROPERTY_GRAPHEME_BREAK_MASK);
+}
+
+void wutils::classify(std::span<const char32_t> code_points,
+                      std::span<wutils::CodePointProperties> out) {
+  const size_t n = std::min(code_points.size(), out.size());
+  // Records are looked up and unpacked in separate passes so the table loads
+  // of neighbouring code points can overlap
+  std::uint32_t records[64];
+  for (size_t i = 0; i < n; i += 64) {
+    const size_t count = std::min<size_t>(n - i, 64);
+    for (size_t k = 0; k < count; ++k)
+      records[k] = internal::property_record(code_points[i + k]);
+    for (size_t k = 0; k < count; ++k)
+      out[i + k] = internal::unpack_properties(records[k]);
+  }
+}
+
+std::string_view wutils::script_name(wutils::Script script) {
+  const size_t index = static_cast<size_t>(script);
+  if (index > static_cast<size_t>(wutils::Script::ZanabazarSquare))
+    return {};
+  return internal::script_names[index];
+}
+
+// Module builds define these in the wutils.print module
+#if defined(_WIN32) && !defined(WUTILS_MODULE)
 void wutils::wcout(const std::wstring_view ws) {
   WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), ws.data(),
                 static_cast<DWORD>(ws.size()), NULL, NULL);
@@ -427,298 +386,3864 @@ void wutils::wcerr(const std::wstring_view ws) {
 
 /* UTF conversion */
 
+// The kernels are in wutils_kernels.hpp, where callers can inline them too
 namespace internal {
-// A struct to hold the result of a single decoding operation
-struct DecodeResult {
-  char32_t codepoint;    // The decoded Unicode codepoint
-  size_t consumed_units; // Number of input units (e.g., char8_t) consumed
-  bool is_valid;         // Was the sequence valid?
-};
-
-// Decodes one character from a UTF-8 stream, with validation.
-DecodeResult decode_one_utf8(std::u8string_view input) {
-  if (input.empty()) {
-    return {0, 0, false};
-  }
+using namespace wutils::detail::kernels;
+using wutils::ContentClass;
+// Overloaded with the parallel version below
+using wutils::detail::kernels::transcoded_units;
+} // namespace internal
 
-  unsigned char c = input[0];
+/* Parallel conversions */
 
-  if (c < 0x80) { // 0xxxxxxx
-    return {c, 1, true};
-  }
+namespace internal {
 
-  if (c < 0xC2) {
-    return {0, 1, false};
-  } // Invalid sequence
+// Chunks of a job are claimed from a shared counter by the calling thread
+// and by the tasks handed to the executor. The caller claims until none are
+// left, so it never waits for a task that has not started; a task that runs
+// late finds nothing to claim and never touches the caller's data
+struct ParallelJob {
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> done{0};
+  size_t chunks = 0;
+  void *context = nullptr;
+  void (*run)(void *, size_t) = nullptr;
 
-  if (c < 0xE0) { // 110xxxxx 10xxxxxx
-    if (input.size() < 2 || (input[1] & 0xC0) != 0x80) {
-      return {0, 1, false};
+  void work() {
+    for (size_t chunk = next.fetch_add(1, std::memory_order_relaxed);
+         chunk < chunks; chunk = next.fetch_add(1, std::memory_order_relaxed)) {
+      run(context, chunk);
+      if (done.fetch_add(1, std::memory_order_acq_rel) + 1 == chunks) {
+        done.notify_all();
+      }
     }
-    char32_t cp = ((c & 0x1F) << 6) | (input[1] & 0x3F);
-    if (cp < 0x80) {
-      return {0, 1, false};
-    } // Overlong
-    return {cp, 2, true};
   }
+};
 
-  if (c < 0xF0) { // 1110xxxx 10xxxxxx 10xxxxxx
-    if (input.size() < 3 || (input[1] & 0xC0) != 0x80 ||
-        (input[2] & 0xC0) != 0x80) {
-      return {0, 1, false};
+// Calls `run` on every chunk index, returning once all calls are done
+template <typename Run>
+void for_each_chunk(const wutils::detail::TaskSubmitter &executor,
+                    const size_t chunks, Run &run) {
+  auto job = std::make_shared<ParallelJob>();
+  job->chunks = chunks;
+  job->context = &run;
+  job->run = [](void *context, size_t chunk) {
+    (*static_cast<Run *>(context))(chunk);
+  };
+  // The calling thread is one of the workers
+  const size_t helpers = std::min<size_t>(
+      chunks - 1, std::max(std::thread::hardware_concurrency(), 2u) - 1);
+  for (size_t i = 0; i < helpers; ++i) {
+    try {
+      executor.submit([job] { job->work(); });
+    } catch (...) {
+      break; // A saturated executor only costs parallelism
     }
-    char32_t cp =
-        ((c & 0x0F) << 12) | ((input[1] & 0x3F) << 6) | (input[2] & 0x3F);
-    if (cp < 0x800) {
-      return {0, 1, false};
-    } // Overlong
-    if (cp >= 0xD800 && cp <= 0xDFFF) {
-      return {0, 1, false};
-    } // Surrogates not allowed
-    return {cp, 3, true};
   }
-
-  if (c < 0xF5) { // 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
-    if (input.size() < 4 || (input[1] & 0xC0) != 0x80 ||
-        (input[2] & 0xC0) != 0x80 || (input[3] & 0xC0) != 0x80) {
-      return {0, 1, false};
-    }
-    char32_t cp = ((c & 0x07) << 18) | ((input[1] & 0x3F) << 12) |
-                  ((input[2] & 0x3F) << 6) | (input[3] & 0x3F);
-    if (cp < 0x10000) {
-      return {0, 1, false};
-    } // Overlong
-    if (cp > 0x10FFFF) {
-      return {0, 1, false};
-    } // Out of range
-    return {cp, 4, true};
+  job->work();
+  for (size_t done = job->done.load(std::memory_order_acquire); done < chunks;
+       done = job->done.load(std::memory_order_acquire)) {
+    job->done.wait(done, std::memory_order_acquire);
   }
+}
 
-  return {0, 1, false}; // Invalid sequence
+template <typename CharT>
+bool is_parallel_input(std::basic_string_view<CharT> input) {
+  return input.size() * sizeof(CharT) >= 2 * wutils::PARALLEL_CHUNK_BYTES;
 }
 
-// Decodes one character from a UTF-16 stream, with validation.
-DecodeResult decode_one_utf16(std::u16string_view input) {
-  if (input.empty()) {
-    return {0, 0, false};
-  }
-  char16_t c1 = input[0];
-  if (c1 < 0xD800 || c1 > 0xDFFF) {
-    return {c1, 1, true}; // Not a surrogate
-  }
-  if (c1 > 0xDBFF || input.size() < 2) {
-    return {0, 1, false}; // Lone low surrogate or truncated sequence
+// Offsets splitting `input` into chunks that no sequence straddles, so each
+// decodes exactly as it does within the whole input
+template <typename CharT>
+std::vector<size_t> chunk_bounds(std::basic_string_view<CharT> input) {
+  constexpr size_t units = wutils::PARALLEL_CHUNK_BYTES / sizeof(CharT);
+  std::vector<size_t> bounds{0};
+  while (input.size() - bounds.back() > units + units / 2) {
+    bounds.push_back(
+        wutils::detail::complete_prefix(input.substr(0, bounds.back() + units)));
   }
-  char16_t c2 = input[1];
-  if (c2 < 0xDC00 || c2 > 0xDFFF) {
-    return {0, 1, false}; // High surrogate not followed by low surrogate
-  }
-  char32_t codepoint = 0x10000 + (((c1 - 0xD800) << 10) | (c2 - 0xDC00));
-  return {codepoint, 2, true};
+  bounds.push_back(input.size());
+  return bounds;
 }
 
-// Encodes a codepoint and appends it to a UTF-8 string.
-void encode_utf8(char32_t codepoint, std::u8string &output) {
-  if (codepoint <= 0x7F) {
-    output.push_back(static_cast<char8_t>(codepoint));
-  } else if (codepoint <= 0x7FF) {
-    output.push_back(static_cast<char8_t>(0xC0 | (codepoint >> 6)));
-    output.push_back(static_cast<char8_t>(0x80 | (codepoint & 0x3F)));
-  } else if (codepoint <= 0xFFFF) {
-    output.push_back(static_cast<char8_t>(0xE0 | (codepoint >> 12)));
-    output.push_back(static_cast<char8_t>(0x80 | ((codepoint >> 6) & 0x3F)));
-    output.push_back(static_cast<char8_t>(0x80 | (codepoint & 0x3F)));
-  } else {
-    output.push_back(static_cast<char8_t>(0xF0 | (codepoint >> 18)));
-    output.push_back(static_cast<char8_t>(0x80 | ((codepoint >> 12) & 0x3F)));
-    output.push_back(static_cast<char8_t>(0x80 | ((codepoint >> 6) & 0x3F)));
-    output.push_back(static_cast<char8_t>(0x80 | (codepoint & 0x3F)));
+template <typename ToChar, typename FromChar>
+wutils::ConversionResult<std::basic_string<ToChar>>
+convert_parallel(std::basic_string_view<FromChar> input,
+                 const wutils::ErrorPolicy errorPolicy,
+                 const wutils::detail::TaskSubmitter &executor) {
+  std::basic_string<ToChar> out;
+  if (!is_parallel_input(input)) {
+    const bool is_valid =
+        wutils::detail::append_transcoded(out, input, errorPolicy);
+    return {std::move(out), is_valid};
+  }
+  const std::vector<size_t> bounds = chunk_bounds(input);
+  const size_t chunks = bounds.size() - 1;
+  auto chunk_input = [&](size_t chunk) {
+    return input.substr(bounds[chunk], bounds[chunk + 1] - bounds[chunk]);
+  };
+  // The chunks are measured first, so each is written at its exact offset
+  // into an output of exactly the converted length
+  std::vector<size_t> offsets(chunks + 1, 0);
+  auto measure = [&](size_t chunk) {
+    offsets[chunk + 1] = transcoded_units<ToChar>(chunk_input(chunk));
+  };
+  for_each_chunk(executor, chunks, measure);
+  for (size_t chunk = 0; chunk < chunks; ++chunk) {
+    offsets[chunk + 1] += offsets[chunk];
   }
+  std::vector<wutils::detail::TranscodeResult> results(chunks);
+  bool is_valid = true;
+  wutils::detail::append_bounded(
+      out, offsets[chunks], [&](ToChar *data) {
+        auto run = [&](size_t chunk) {
+          results[chunk] = transcode_units(chunk_input(chunk),
+                                           data + offsets[chunk], errorPolicy);
+        };
+        for_each_chunk(executor, chunks, run);
+        // Skipped or stopped chunks fall short of their length, so the
+        // outputs are moved down next to each other
+        size_t written = 0;
+        for (size_t chunk = 0; chunk < chunks; ++chunk) {
+          std::memmove(data + written, data + offsets[chunk],
+                       results[chunk].written * sizeof(ToChar));
+          written += results[chunk].written;
+          if (!results[chunk].is_valid) {
+            is_valid = false;
+            if (errorPolicy == wutils::ErrorPolicy::StopOnFirstError) {
+              break;
+            }
+          }
+        }
+        return written;
+      });
+  return {std::move(out), is_valid};
 }
 
-// Encodes a codepoint and appends it to a UTF-16 string.
-void encode_utf16(char32_t codepoint, std::u16string &output) {
-  if (codepoint <= 0xFFFF) {
-    output.push_back(static_cast<char16_t>(codepoint));
-  } else {
-    char16_t high = static_cast<char16_t>(0xD800) +
-                    static_cast<char16_t>((codepoint - 0x10000) >> 10);
-    char16_t low = static_cast<char16_t>(0xDC00) +
-                   static_cast<char16_t>((codepoint - 0x10000) & 0x3FF);
-    output.push_back(high);
-    output.push_back(low);
+template <typename ToChar, typename FromChar>
+size_t transcoded_units(std::basic_string_view<FromChar> input,
+                        const wutils::detail::TaskSubmitter &executor) {
+  if (!is_parallel_input(input)) {
+    return transcoded_units<ToChar>(input);
+  }
+  const std::vector<size_t> bounds = chunk_bounds(input);
+  std::vector<size_t> lengths(bounds.size() - 1);
+  auto run = [&](size_t chunk) {
+    lengths[chunk] = transcoded_units<ToChar>(
+        input.substr(bounds[chunk], bounds[chunk + 1] - bounds[chunk]));
+  };
+  for_each_chunk(executor, lengths.size(), run);
+  size_t length = 0;
+  for (const size_t chunk_length : lengths) {
+    length += chunk_length;
   }
+  return length;
 }
 } // namespace internal
 
-// UTF-16 to UTF-8 conversion
 wutils::ConversionResult<std::u8string>
 wutils::detail::u8(const std::u16string_view u16s,
-                   const ErrorPolicy errorPolicy) {
-  bool is_valid = true;
-  std::u8string result;
-  result.reserve(u16s.size());
-
-  for (size_t i = 0; i < u16s.size();) {
-    internal::DecodeResult decoded = internal::decode_one_utf16(u16s.substr(i));
-    if (decoded.is_valid) {
-      internal::encode_utf8(decoded.codepoint, result);
-    } else {
-      is_valid = false;
-      switch (errorPolicy) {
-      case ErrorPolicy::SkipInvalidValues:
-        break;
-      case ErrorPolicy::StopOnFirstError:
-        return {result, false};
-      case ErrorPolicy::UseReplacementCharacter:
-        result.append(wutils::detail::REPLACEMENT_CHAR_8);
-        break;
-      }
-    }
-    i += decoded.consumed_units;
-  }
-  return {result, is_valid};
+                   const ErrorPolicy errorPolicy,
+                   const TaskSubmitter executor) {
+  return internal::convert_parallel<char8_t>(u16s, errorPolicy, executor);
 }
 
-// UTF-32 to UTF-8 conversion
 wutils::ConversionResult<std::u8string>
 wutils::detail::u8(const std::u32string_view u32s,
-                   const ErrorPolicy errorPolicy) {
-  bool is_valid = true;
-  std::u8string result;
-  result.reserve(u32s.size());
+                   const ErrorPolicy errorPolicy,
+                   const TaskSubmitter executor) {
+  return internal::convert_parallel<char8_t>(u32s, errorPolicy, executor);
+}
 
-  for (char32_t codepoint : u32s) {
-    if (codepoint <= 0x10FFFF &&
-        !(codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
-      internal::encode_utf8(codepoint, result);
-    } else {
-      is_valid = false;
-      switch (errorPolicy) {
-      case ErrorPolicy::SkipInvalidValues:
+wutils::ConversionResult<std::u16string>
+wutils::detail::u16(const std::u8string_view u8s,
+                    const ErrorPolicy errorPolicy,
+                    const TaskSubmitter executor) {
+  return internal::convert_parallel<char16_t>(u8s, errorPolicy, executor);
+}
+
+wutils::ConversionResult<std::u16string>
+wutils::detail::u16(const std::u32string_view u32s,
+                    const ErrorPolicy errorPolicy,
+                    const TaskSubmitter executor) {
+  return internal::convert_parallel<char16_t>(u32s, errorPolicy, executor);
+}
+
+wutils::ConversionResult<std::u32string>
+wutils::detail::u32(const std::u8string_view u8s,
+                    const ErrorPolicy errorPolicy,
+                    const TaskSubmitter executor) {
+  return internal::convert_parallel<char32_t>(u8s, errorPolicy, executor);
+}
+
+wutils::ConversionResult<std::u32string>
+wutils::detail::u32(const std::u16string_view u16s,
+                    const ErrorPolicy errorPolicy,
+                    const TaskSubmitter executor) {
+  return internal::convert_parallel<char32_t>(u16s, errorPolicy, executor);
+}
+
+size_t wutils::detail::u8_length(const std::u16string_view u16s,
+                                 const TaskSubmitter executor) {
+  return internal::transcoded_units<char8_t>(u16s, executor);
+}
+
+size_t wutils::detail::u8_length(const std::u32string_view u32s,
+                                 const TaskSubmitter executor) {
+  return internal::transcoded_units<char8_t>(u32s, executor);
+}
+
+size_t wutils::detail::u16_length(const std::u8string_view u8s,
+                                  const TaskSubmitter executor) {
+  return internal::transcoded_units<char16_t>(u8s, executor);
+}
+
+size_t wutils::detail::u16_length(const std::u32string_view u32s,
+                                  const TaskSubmitter executor) {
+  return internal::transcoded_units<char16_t>(u32s, executor);
+}
+
+size_t wutils::detail::u32_length(const std::u8string_view u8s,
+                                  const TaskSubmitter executor) {
+  return internal::transcoded_units<char32_t>(u8s, executor);
+}
+
+size_t wutils::detail::u32_length(const std::u16string_view u16s,
+                                  const TaskSubmitter executor) {
+  return internal::transcoded_units<char32_t>(u16s, executor);
+}
+
+/* Line reading */
+
+namespace internal {
+constexpr size_t NOT_FOUND = static_cast<size_t>(-1);
+
+// Finds the next line terminator, storing its length in `length`.
+size_t find_line_end(std::u8string_view text, bool unicode_separators,
+                     size_t &length) {
+  if (!unicode_separators) {
+    const void *lf = std::memchr(text.data(), '\n', text.size());
+    length = 1;
+    return lf ? static_cast<size_t>(static_cast<const char8_t *>(lf) -
+                                    text.data())
+              : NOT_FOUND;
+  }
+
+  // Candidates are LF and the lead bytes of NEL (C2 85), LS and PS
+  // (E2 80 A8/A9); anything else is skipped eight bytes at a time
+  size_t i = 0;
+  while (i < text.size()) {
+    if (i + 8 <= text.size()) {
+      const uint64_t word = load_word(text.data() + i);
+      const uint64_t mask = equal_bytes(word, '\n') | equal_bytes(word, 0xC2) |
+                            equal_bytes(word, 0xE2);
+      if (mask == 0) {
+        i += 8;
         continue;
-      case ErrorPolicy::StopOnFirstError:
-        return {result, false};
-      case ErrorPolicy::UseReplacementCharacter:
-        result.append(wutils::detail::REPLACEMENT_CHAR_8);
-        break;
       }
+      i += first_flagged(mask);
+    }
+    const char8_t c = text[i];
+    if (c == '\n') {
+      length = 1;
+      return i;
+    }
+    if (c == 0xC2 && i + 1 < text.size() && text[i + 1] == 0x85) {
+      length = 2;
+      return i;
+    }
+    if (c == 0xE2 && i + 2 < text.size() && text[i + 1] == 0x80 &&
+        (text[i + 2] == 0xA8 || text[i + 2] == 0xA9)) {
+      length = 3;
+      return i;
     }
+    ++i;
   }
-  return {result, is_valid};
+  return NOT_FOUND;
 }
+} // namespace internal
 
-// UTF-8 to UTF-16 conversion
-wutils::ConversionResult<std::u16string>
-wutils::detail::u16(const std::u8string_view u8s,
-                    const ErrorPolicy errorPolicy) {
-  bool is_valid = true;
-  std::u16string result;
-  result.reserve(u8s.size());
-
-  for (size_t i = 0; i < u8s.size();) {
-    internal::DecodeResult decoded = internal::decode_one_utf8(u8s.substr(i));
-    if (decoded.is_valid) {
-      internal::encode_utf16(decoded.codepoint, result);
-    } else {
-      is_valid = false;
-      switch (errorPolicy) {
-      case ErrorPolicy::SkipInvalidValues:
-        break;
-      case ErrorPolicy::StopOnFirstError:
-        return {result, false};
-      case ErrorPolicy::UseReplacementCharacter:
-        internal::encode_utf16(wutils::detail::REPLACEMENT_CHAR_32, result);
-        break;
+wutils::DetectedEncoding wutils::detect_encoding(const std::string_view bytes) {
+  auto starts_with = [&](std::initializer_list<unsigned char> bom) {
+    if (bytes.size() < bom.size()) {
+      return false;
+    }
+    size_t i = 0;
+    for (unsigned char b : bom) {
+      if (static_cast<unsigned char>(bytes[i++]) != b) {
+        return false;
       }
     }
-    i += decoded.consumed_units;
+    return true;
+  };
+  // UTF-32LE must be tested before UTF-16LE, whose BOM is its prefix
+  if (starts_with({0xEF, 0xBB, 0xBF})) {
+    return {Encoding::Utf8, 3};
+  } else if (starts_with({0xFF, 0xFE, 0x00, 0x00})) {
+    return {Encoding::Utf32LE, 4};
+  } else if (starts_with({0x00, 0x00, 0xFE, 0xFF})) {
+    return {Encoding::Utf32BE, 4};
+  } else if (starts_with({0xFF, 0xFE})) {
+    return {Encoding::Utf16LE, 2};
+  } else if (starts_with({0xFE, 0xFF})) {
+    return {Encoding::Utf16BE, 2};
+  }
+
+  // Without a BOM, mostly-ASCII UTF-16 shows up as zero bytes on one side
+  const size_t sample = bytes.size() < 256 ? bytes.size() & ~size_t{1} : 256;
+  size_t even_zeros = 0;
+  size_t odd_zeros = 0;
+  for (size_t i = 0; i < sample; i += 2) {
+    even_zeros += bytes[i] == 0;
+    odd_zeros += bytes[i + 1] == 0;
+  }
+  if (sample > 0 && odd_zeros * 4 >= sample && even_zeros == 0) {
+    return {Encoding::Utf16LE, 0};
   }
-  return {result, is_valid};
+  if (sample > 0 && even_zeros * 4 >= sample && odd_zeros == 0) {
+    return {Encoding::Utf16BE, 0};
+  }
+  return {Encoding::Utf8, 0};
 }
 
-// UTF-32 to UTF-16 conversion
-wutils::ConversionResult<std::u16string>
-wutils::detail::u16(const std::u32string_view u32s,
-                    const ErrorPolicy errorPolicy) {
-  bool is_valid = true;
-  std::u16string result;
-  result.reserve(u32s.size());
+wutils::LineReader::LineReader(const std::string_view bytes,
+                               const LineReaderOptions &options)
+    : source(bytes), options(options), started(true) {
+  detected = detect_encoding(bytes);
+  source_pos = detected.bom_size;
+  if (detected.encoding == Encoding::Utf8) {
+    // Valid lines are views straight into the caller's buffer. Anything else
+    // is read in blocks like a file, for the error policy to apply
+    const std::u8string_view text =
+        detail::as_unicode(bytes).substr(source_pos);
+    zero_copy = detail::valid_prefix(text) == text.size();
+    at_end = zero_copy;
+  }
+}
 
-  for (char32_t codepoint : u32s) {
-    if (codepoint <= 0x10FFFF &&
-        !(codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
-      internal::encode_utf16(codepoint, result);
-    } else {
-      is_valid = false;
-      switch (errorPolicy) {
-      case ErrorPolicy::SkipInvalidValues:
-        continue;
-      case ErrorPolicy::StopOnFirstError:
-        return {result, false};
-      case ErrorPolicy::UseReplacementCharacter:
-        result.push_back(wutils::detail::REPLACEMENT_CHAR_16);
-        break;
+wutils::LineReader::LineReader(std::FILE *file,
+                               const LineReaderOptions &options)
+    : file(file), options(options) {
+  refill();
+}
+
+std::u8string_view wutils::LineReader::window() const {
+  if (zero_copy) {
+    return detail::as_unicode(source).substr(source_pos + pos);
+  }
+  return std::u8string_view(decoded).substr(pos);
+}
+
+bool wutils::LineReader::refill() {
+  const size_t block = options.block_size ? options.block_size : 1;
+  if (file) {
+    // The first read is large enough to see a BOM or sample for zero bytes
+    const size_t want = started || block >= 256 ? block : 256;
+    const size_t kept = raw.size();
+    raw.resize(kept + want);
+    const size_t got = std::fread(raw.data() + kept, 1, want, file);
+    raw.resize(kept + got);
+    at_end = got == 0;
+    if (!started) {
+      detected = detect_encoding(raw);
+      raw.erase(0, detected.bom_size);
+    }
+  } else {
+    const std::string_view next = source.substr(source_pos, block);
+    raw.append(next);
+    source_pos += next.size();
+    at_end = source_pos == source.size();
+  }
+  started = true;
+
+  // Drop the lines already handed out, keeping the partial one
+  decoded.erase(0, pos);
+  pos = 0;
+  const size_t consumed =
+      detail::read_encoded(raw, detected.encoding, at_end,
+                           options.errorPolicy, buffers, decoded, valid);
+  raw.erase(0, consumed);
+  return !at_end;
+}
+
+bool wutils::LineReader::next(std::u8string_view &line) {
+  // Bytes of the window already searched, which refill() keeps in place
+  size_t scanned = 0;
+  for (;;) {
+    const std::u8string_view text = window();
+    size_t length = 0;
+    size_t end = internal::find_line_end(text.substr(scanned),
+                                         options.unicode_separators, length);
+    if (end != internal::NOT_FOUND) {
+      end += scanned;
+      const bool crlf = length == 1 && end > 0 && text[end - 1] == '\r';
+      line = text.substr(0, crlf ? end - 1 : end);
+      pos += end + length;
+      return true;
+    }
+    if (at_end) {
+      if (text.empty()) {
+        return false;
       }
+      line = text;
+      pos += text.size();
+      return true;
     }
+    scanned = text.size();
+    refill();
   }
-  return {result, is_valid};
 }
 
-// UTF-8 to UTF-32 conversion
-wutils::ConversionResult<std::u32string>
-wutils::detail::u32(const std::u8string_view u8s,
-                    const ErrorPolicy errorPolicy) {
-  bool is_valid = true;
-  std::u32string result;
-  result.reserve(u8s.size());
+/* Console sink */
 
-  for (size_t i = 0; i < u8s.size();) {
-    internal::DecodeResult decoded = internal::decode_one_utf8(u8s.substr(i));
-    if (decoded.is_valid) {
-      result.push_back(decoded.codepoint);
-    } else {
-      is_valid = false;
-      switch (errorPolicy) {
-      case ErrorPolicy::SkipInvalidValues:
-        break;
-      case ErrorPolicy::StopOnFirstError:
-        return {result, false};
-      case ErrorPolicy::UseReplacementCharacter:
-        result.push_back(wutils::detail::REPLACEMENT_CHAR_32);
-        break;
+namespace internal {
+
+// A record is an 8 byte header followed by its text, padded to 8 bytes. The
+// header reads zero until the record is committed, then holds its length
+// and flags; the writer zeroes the records it has written before their
+// space is reused
+constexpr std::uint64_t RECORD_COMMITTED = std::uint64_t{1} << 63;
+constexpr std::uint64_t RECORD_STOP = std::uint64_t{1} << 62;
+constexpr std::uint64_t RECORD_LENGTH = RECORD_STOP - 1;
+constexpr size_t RECORD_BATCH = 256; // Records per writev()
+
+inline std::uint64_t record_size(size_t length) {
+  return (8 + length + 7) & ~std::uint64_t{7};
+}
+
+inline std::atomic_ref<std::uint64_t>
+record_header(std::uint64_t *ring, size_t capacity, std::uint64_t pos) {
+  return std::atomic_ref<std::uint64_t>(ring[pos % capacity / 8]);
+}
+
+// The one or two pieces of the ring holding [pos, pos + length)
+struct RingSpan {
+  char8_t *first;
+  size_t first_size;
+  char8_t *second;
+  size_t second_size;
+};
+
+inline RingSpan ring_span(std::uint64_t *ring, size_t capacity,
+                          std::uint64_t pos, size_t length) {
+  char8_t *base = reinterpret_cast<char8_t *>(ring);
+  const size_t at = pos % capacity;
+  const size_t first = std::min(length, capacity - at);
+  return {base + at, first, base, length - first};
+}
+
+inline void ring_copy(std::uint64_t *ring, size_t capacity, std::uint64_t pos,
+                      std::u8string_view text) {
+  // Empty text, as in a STOP record, may have no data pointer to copy from
+  const RingSpan span = ring_span(ring, capacity, pos, text.size());
+  if (span.first_size > 0) {
+    std::memcpy(span.first, text.data(), span.first_size);
+  }
+  if (span.second_size > 0) {
+    std::memcpy(span.second, text.data() + span.first_size, span.second_size);
+  }
+}
+
+#ifdef _WIN32
+// Consoles get UTF-16 through WriteConsoleW, anything else the UTF-8 bytes
+void write_batch(std::FILE *file, const std::u8string &batch) {
+  const HANDLE handle =
+      reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file)));
+  DWORD mode;
+  if (GetConsoleMode(handle, &mode)) {
+    const std::u16string text = wutils::u16s(batch).value;
+    WriteConsoleW(handle, text.data(), static_cast<DWORD>(text.size()), NULL,
+                  NULL);
+  } else {
+    DWORD written;
+    WriteFile(handle, batch.data(), static_cast<DWORD>(batch.size()),
+              &written, NULL);
+  }
+}
+#else
+// Writes every byte of `iov`, resuming after partial writes. Output that
+// cannot be written is dropped rather than holding up the producers
+void write_batch(int fd, iovec *iov, int count) {
+  while (count > 0) {
+    const ssize_t written = ::writev(fd, iov, count);
+    if (written < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        std::this_thread::yield();
+        continue;
       }
+      return;
     }
-    i += decoded.consumed_units;
+    size_t rest = static_cast<size_t>(written);
+    while (count > 0 && rest >= iov->iov_len) {
+      rest -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + rest;
+      iov->iov_len -= rest;
+    }
+  }
+}
+#endif
+} // namespace internal
+
+wutils::ConsoleSink::ConsoleSink(std::FILE *file,
+                                 const ConsoleSinkOptions &options)
+    : file(file), capacity(std::max<size_t>((options.capacity + 7) & ~7, 64)),
+      ring(new std::uint64_t[capacity / 8]()) {
+  std::fflush(file); // Keep what was printed through stdio first
+  writer = std::thread([this] { drain(); });
+}
+
+wutils::ConsoleSink::~ConsoleSink() {
+  enqueue({}, false, internal::RECORD_STOP, true);
+  writer.join();
+}
+
+bool wutils::ConsoleSink::push(const std::u8string_view text,
+                               const bool newline, const bool wait) {
+  return enqueue(text, newline, 0, wait);
+}
+
+bool wutils::ConsoleSink::push(const std::u16string_view text,
+                               const bool newline, const bool wait) {
+  if (text.size() > capacity) {
+    return false; // Every unit takes at least a byte
   }
-  return {result, is_valid};
+  thread_local std::u8string buffer;
+  buffer.clear();
+  detail::append_transcoded(buffer, text,
+                            ErrorPolicy::UseReplacementCharacter);
+  return enqueue(buffer, newline, 0, wait);
 }
 
-// UTF-16 to UTF-32 conversion
-wutils::ConversionResult<std::u32string>
-wutils::detail::u32(const std::u16string_view u16s,
-                    const ErrorPolicy errorPolicy) {
-  bool is_valid = true;
-  std::u32string result;
-  result.reserve(u16s.size());
+bool wutils::ConsoleSink::push(const std::u32string_view text,
+                               const bool newline, const bool wait) {
+  if (text.size() > capacity) {
+    return false;
+  }
+  thread_local std::u8string buffer;
+  buffer.clear();
+  detail::append_transcoded(buffer, text,
+                            ErrorPolicy::UseReplacementCharacter);
+  return enqueue(buffer, newline, 0, wait);
+}
 
-  for (size_t i = 0; i < u16s.size();) {
-    internal::DecodeResult decoded = internal::decode_one_utf16(u16s.substr(i));
-    if (decoded.is_valid) {
-      result.push_back(decoded.codepoint);
-    } else {
-      is_valid = false;
-      switch (errorPolicy) {
-      case ErrorPolicy::SkipInvalidValues:
-        break;
-      case ErrorPolicy::StopOnFirstError:
-        return {result, false};
-      case ErrorPolicy::UseReplacementCharacter:
-        result.push_back(wutils::detail::REPLACEMENT_CHAR_32);
-        break;
+bool wutils::ConsoleSink::enqueue(const std::u8string_view text,
+                                  const bool newline,
+                                  const std::uint64_t flags, const bool wait) {
+  const size_t length = text.size() + newline;
+  const std::uint64_t size = internal::record_size(length);
+  if (size > capacity) {
+    return false;
+  }
+  // Reserve the space with a compare-and-swap on the head
+  std::uint64_t pos = head.load(std::memory_order_relaxed);
+  for (;;) {
+    const std::uint64_t written = tail.load(std::memory_order_acquire);
+    if (pos + size - written > capacity) {
+      if (!wait) {
+        return false;
       }
+      tail.wait(written, std::memory_order_acquire);
+      pos = head.load(std::memory_order_relaxed);
+    } else if (head.compare_exchange_weak(pos, pos + size,
+                                          std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  internal::ring_copy(ring.get(), capacity, pos + 8, text);
+  if (newline) {
+    internal::ring_copy(ring.get(), capacity, pos + 8 + text.size(), u8"\n");
+  }
+  auto header = internal::record_header(ring.get(), capacity, pos);
+  header.store(internal::RECORD_COMMITTED | flags | length,
+               std::memory_order_release);
+  header.notify_one();
+  head.notify_one();
+  return true;
+}
+
+void wutils::ConsoleSink::flush() {
+  const std::uint64_t target = head.load(std::memory_order_acquire);
+  for (std::uint64_t written = tail.load(std::memory_order_acquire);
+       written < target; written = tail.load(std::memory_order_acquire)) {
+    tail.wait(written, std::memory_order_acquire);
+  }
+}
+
+void wutils::ConsoleSink::drain() {
+  std::uint64_t pos = 0;
+#ifdef _WIN32
+  std::u8string batch;
+#else
+  iovec iov[2 * internal::RECORD_BATCH];
+  const int fd = fileno(file);
+#endif
+  for (bool stop = false; !stop;) {
+    const std::uint64_t end = head.load(std::memory_order_acquire);
+    if (pos == end) {
+      head.wait(end, std::memory_order_acquire);
+      continue;
+    }
+    // Gather the committed records, up to the first one still being written
+    std::uint64_t batch_end = pos;
+    size_t count = 0;
+#ifdef _WIN32
+    batch.clear();
+#endif
+    for (size_t records = 0;
+         batch_end < end && records < internal::RECORD_BATCH; ++records) {
+      const std::uint64_t header =
+          internal::record_header(ring.get(), capacity, batch_end)
+              .load(std::memory_order_acquire);
+      if (!(header & internal::RECORD_COMMITTED)) {
+        break;
+      }
+      const size_t length = header & internal::RECORD_LENGTH;
+      const internal::RingSpan span =
+          internal::ring_span(ring.get(), capacity, batch_end + 8, length);
+#ifdef _WIN32
+      batch.append(span.first, span.first_size);
+      batch.append(span.second, span.second_size);
+#else
+      for (const auto &[data, data_size] :
+           {std::pair{span.first, span.first_size},
+            std::pair{span.second, span.second_size}}) {
+        if (data_size > 0) {
+          iov[count++] = {data, data_size};
+        }
+      }
+#endif
+      batch_end += internal::record_size(length);
+      if (header & internal::RECORD_STOP) {
+        stop = true;
+        break;
+      }
+    }
+    if (batch_end == pos) {
+      internal::record_header(ring.get(), capacity, pos)
+          .wait(0, std::memory_order_acquire);
+      continue;
+    }
+#ifdef _WIN32
+    internal::write_batch(file, batch);
+#else
+    internal::write_batch(fd, iov, static_cast<int>(count));
+#endif
+    const internal::RingSpan span =
+        internal::ring_span(ring.get(), capacity, pos, batch_end - pos);
+    std::memset(span.first, 0, span.first_size);
+    std::memset(span.second, 0, span.second_size);
+    pos = batch_end;
+    tail.store(pos, std::memory_order_release);
+    tail.notify_all();
+  }
+}
+
+wutils::ConsoleSink &wutils::console_out() {
+  static ConsoleSink sink(stdout);
+  return sink;
+}
+
+wutils::ConsoleSink &wutils::console_err() {
+  static ConsoleSink sink(stderr);
+  return sink;
+}
+
+/* JSON strings */
+
+namespace internal {
+// High bit set in exactly the bytes of `word` below `n` (n <= 0x80)
+inline uint64_t less_bytes(uint64_t word, unsigned char n) {
+  return ~(((word & SWAR_LOW7) + SWAR_ONES * (0x80 - n)) | word) & SWAR_HIGH;
+}
+
+// Length of the leading run of ASCII that needs no escaping in JSON.
+size_t json_plain_prefix(std::u8string_view text) {
+  size_t i = 0;
+  for (; i + 8 <= text.size(); i += 8) {
+    const uint64_t word = load_word(text.data() + i);
+    const uint64_t mask = less_bytes(word, 0x20) | equal_bytes(word, '"') |
+                          equal_bytes(word, '\\') | (word & SWAR_HIGH);
+    if (mask != 0) {
+      return i + first_flagged(mask);
+    }
+  }
+  for (; i < text.size(); ++i) {
+    const char8_t c = text[i];
+    if (c < 0x20 || c == '"' || c == '\\' || c >= 0x80) {
+      break;
+    }
+  }
+  return i;
+}
+
+// Length of the leading run of a JSON string body that stands for itself,
+// up to a backslash or to a quote or control character, which are invalid
+// unescaped.
+size_t json_literal_prefix(std::u8string_view text) {
+  size_t i = 0;
+  for (; i + 8 <= text.size(); i += 8) {
+    const uint64_t word = load_word(text.data() + i);
+    const uint64_t mask = less_bytes(word, 0x20) | equal_bytes(word, '"') |
+                          equal_bytes(word, '\\');
+    if (mask != 0) {
+      return i + first_flagged(mask);
+    }
+  }
+  for (; i < text.size(); ++i) {
+    const char8_t c = text[i];
+    if (c < 0x20 || c == '"' || c == '\\') {
+      break;
+    }
+  }
+  return i;
+}
+
+void append_json_u_escape(char32_t unit, std::u8string &output) {
+  static constexpr char8_t hex[] = u8"0123456789ABCDEF";
+  const char8_t escape[] = {u8'\\',
+                            u8'u',
+                            hex[(unit >> 12) & 0xF],
+                            hex[(unit >> 8) & 0xF],
+                            hex[(unit >> 4) & 0xF],
+                            hex[unit & 0xF]};
+  output.append(escape, sizeof(escape));
+}
+
+// Appends `codepoint` to a JSON string body, escaping it if needed.
+void append_json_codepoint(char32_t codepoint, bool ascii_only,
+                           std::u8string &output) {
+  switch (codepoint) {
+  case '"':
+    output.append(u8"\\\"");
+    return;
+  case '\\':
+    output.append(u8"\\\\");
+    return;
+  case '\b':
+    output.append(u8"\\b");
+    return;
+  case '\f':
+    output.append(u8"\\f");
+    return;
+  case '\n':
+    output.append(u8"\\n");
+    return;
+  case '\r':
+    output.append(u8"\\r");
+    return;
+  case '\t':
+    output.append(u8"\\t");
+    return;
+  }
+  if (codepoint < 0x20 || (ascii_only && codepoint >= 0x80)) {
+    if (codepoint >= 0x10000) {
+      char16_t pair[2];
+      encode_utf16(codepoint, pair);
+      append_json_u_escape(pair[0], output);
+      append_json_u_escape(pair[1], output);
+    } else {
+      append_json_u_escape(codepoint, output);
+    }
+    return;
+  }
+  char8_t encoded[4];
+  output.append(encoded, encode_utf8(codepoint, encoded));
+}
+
+template <typename FromChar>
+wutils::ConversionResult<std::u8string>
+json_escape_units(std::basic_string_view<FromChar> input, bool ascii_only,
+                  const wutils::ErrorPolicy errorPolicy) {
+  using wutils::ErrorPolicy;
+  bool is_valid = true;
+  std::u8string result;
+  result.reserve(input.size() + input.size() / 8);
+
+  size_t i = 0;
+  while (i < input.size()) {
+    if constexpr (sizeof(FromChar) == 1) {
+      // Copy plain ASCII runs in bulk
+      const size_t plain = json_plain_prefix(input.substr(i));
+      result.append(input.data() + i, plain);
+      i += plain;
+      if (i == input.size()) {
+        break;
+      }
+    }
+    DecodeResult decoded = decode_one(input.substr(i));
+    if (decoded.is_valid) {
+      append_json_codepoint(decoded.codepoint, ascii_only, result);
+    } else {
+      is_valid = false;
+      switch (errorPolicy) {
+      case ErrorPolicy::SkipInvalidValues:
+        break;
+      case ErrorPolicy::StopOnFirstError:
+        return {std::move(result), false};
+      case ErrorPolicy::UseReplacementCharacter:
+        append_json_codepoint(wutils::detail::REPLACEMENT_CHAR_32, ascii_only,
+                              result);
+        break;
+      }
+    }
+    i += decoded.consumed_units;
+  }
+  return {std::move(result), is_valid};
+}
+
+// Parses four hex digits, or returns false.
+bool parse_hex4(std::u8string_view digits, char32_t &value) {
+  if (digits.size() < 4) {
+    return false;
+  }
+  value = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    const char8_t c = digits[i];
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      value |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      value |= c - 'A' + 10;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Decodes one escape sequence starting at the backslash.
+DecodeResult decode_json_escape(std::u8string_view input) {
+  if (input.size() < 2) {
+    return {0, input.size(), false};
+  }
+  switch (input[1]) {
+  case '"':
+  case '\\':
+  case '/':
+    return {input[1], 2, true};
+  case 'b':
+    return {'\b', 2, true};
+  case 'f':
+    return {'\f', 2, true};
+  case 'n':
+    return {'\n', 2, true};
+  case 'r':
+    return {'\r', 2, true};
+  case 't':
+    return {'\t', 2, true};
+  case 'u':
+    break;
+  default:
+    return {0, 2, false};
+  }
+
+  char32_t unit;
+  if (!parse_hex4(input.substr(2), unit)) {
+    return {0, 2, false};
+  }
+  if (unit < 0xD800 || unit > 0xDFFF) {
+    return {unit, 6, true};
+  }
+  // A high surrogate must be followed by an escaped low surrogate
+  char32_t low;
+  if (unit <= 0xDBFF && input.size() >= 12 && input[6] == '\\' &&
+      input[7] == 'u' && parse_hex4(input.substr(8), low) && low >= 0xDC00 &&
+      low <= 0xDFFF) {
+    return {0x10000 + (((unit - 0xD800) << 10) | (low - 0xDC00)), 12, true};
+  }
+  return {0, 6, false};
+}
+
+template <typename String>
+wutils::ConversionResult<String>
+json_unescape_into(std::u8string_view input,
+                   const wutils::ErrorPolicy errorPolicy) {
+  using wutils::ErrorPolicy;
+  using ToChar = typename String::value_type;
+  bool is_valid = true;
+  String result;
+  result.reserve(input.size());
+
+  size_t i = 0;
+  while (i < input.size()) {
+    // Everything up to the next backslash, quote or control character is
+    // transcoded as one run
+    const size_t run_end = i + json_literal_prefix(input.substr(i));
+    if (run_end > i) {
+      const std::u8string_view run = input.substr(i, run_end - i);
+      if (!wutils::detail::append_transcoded(result, run, errorPolicy)) {
+        is_valid = false;
+        if (errorPolicy == ErrorPolicy::StopOnFirstError) {
+          return {std::move(result), false};
+        }
+      }
+      i = run_end;
+      if (i == input.size()) {
+        break;
+      }
+    }
+
+    // A quote or control character must be escaped in the body
+    DecodeResult decoded = input[i] == '\\'
+                               ? decode_json_escape(input.substr(i))
+                               : DecodeResult{0, 1, false};
+    if (decoded.is_valid) {
+      ToChar encoded[4];
+      result.append(encoded, encode(decoded.codepoint, encoded));
+    } else {
+      is_valid = false;
+      switch (errorPolicy) {
+      case ErrorPolicy::SkipInvalidValues:
+        break;
+      case ErrorPolicy::StopOnFirstError:
+        return {std::move(result), false};
+      case ErrorPolicy::UseReplacementCharacter: {
+        ToChar encoded[4];
+        result.append(encoded,
+                      encode(wutils::detail::REPLACEMENT_CHAR_32, encoded));
+        break;
+      }
+      }
+    }
+    i += decoded.consumed_units;
+  }
+  return {std::move(result), is_valid};
+}
+} // namespace internal
+
+wutils::ConversionResult<std::u8string>
+wutils::detail::json_escape(const std::u8string_view u8s,
+                            const bool ascii_only,
+                            const ErrorPolicy errorPolicy) {
+  return internal::json_escape_units(u8s, ascii_only, errorPolicy);
+}
+
+wutils::ConversionResult<std::u8string>
+wutils::detail::json_escape(const std::u16string_view u16s,
+                            const bool ascii_only,
+                            const ErrorPolicy errorPolicy) {
+  return internal::json_escape_units(u16s, ascii_only, errorPolicy);
+}
+
+wutils::ConversionResult<std::u8string>
+wutils::detail::json_escape(const std::u32string_view u32s,
+                            const bool ascii_only,
+                            const ErrorPolicy errorPolicy) {
+  return internal::json_escape_units(u32s, ascii_only, errorPolicy);
+}
+
+wutils::ConversionResult<std::u8string>
+wutils::detail::json_unescape_u8(const std::u8string_view json,
+                                 const ErrorPolicy errorPolicy) {
+  return internal::json_unescape_into<std::u8string>(json, errorPolicy);
+}
+
+wutils::ConversionResult<std::u16string>
+wutils::detail::json_unescape_u16(const std::u8string_view json,
+                                  const ErrorPolicy errorPolicy) {
+  return internal::json_unescape_into<std::u16string>(json, errorPolicy);
+}
+
+/* WTF-8 */
+
+namespace internal {
+template <typename String, typename FromChar>
+wutils::ConversionResult<String>
+wtf_convert(std::basic_string_view<FromChar> input,
+            const wutils::ErrorPolicy errorPolicy) {
+  using ToChar = typename String::value_type;
+  String result;
+  bool is_valid = true;
+  wutils::detail::append_bounded(
+      // WTF-8 never takes more units than the replacement characters strict
+      // UTF would put in place of its surrogates, so the UTF length bounds it
+      result,
+      std::is_same_v<FromChar, ToChar>
+          ? wutils::detail::max_transcoded_size<FromChar, ToChar>(input.size())
+          : wutils::detail::transcoded_length<ToChar>(input),
+      [&](ToChar *data) {
+        // WTF-8 to WTF-8 only rewrites surrogate pairs and invalid bytes, and
+        // is no conversion for telemetry to count
+        const wutils::detail::TranscodeResult transcoded = [&] {
+          if constexpr (std::is_same_v<FromChar, ToChar>) {
+            return transcode_content<true>(input, data, errorPolicy,
+                                           ContentClass::FourByte);
+          } else {
+            return transcode_units<true>(input, data, errorPolicy);
+          }
+        }();
+        is_valid = transcoded.is_valid;
+        return transcoded.written;
+      });
+  return {std::move(result), is_valid};
+}
+} // namespace internal
+
+wutils::ConversionResult<std::u8string>
+wutils::detail::wtf8(const std::u16string_view u16s,
+                     const ErrorPolicy errorPolicy) {
+  return internal::wtf_convert<std::u8string>(u16s, errorPolicy);
+}
+
+wutils::ConversionResult<std::u8string>
+wutils::detail::wtf8(const std::u32string_view u32s,
+                     const ErrorPolicy errorPolicy) {
+  return internal::wtf_convert<std::u8string>(u32s, errorPolicy);
+}
+
+wutils::ConversionResult<std::u8string>
+wutils::detail::wtf8(const std::u8string_view wtf8s,
+                     const ErrorPolicy errorPolicy) {
+  // UTF-8, the common case, is WTF-8 as it is
+  if (valid_prefix(wtf8s) == wtf8s.size()) {
+    return {std::u8string(wtf8s), true};
+  }
+  return internal::wtf_convert<std::u8string>(wtf8s, errorPolicy);
+}
+
+wutils::ConversionResult<std::u16string>
+wutils::detail::wtf16(const std::u8string_view wtf8s,
+                      const ErrorPolicy errorPolicy) {
+  return internal::wtf_convert<std::u16string>(wtf8s, errorPolicy);
+}
+
+wutils::ConversionResult<std::u32string>
+wutils::detail::wtf32(const std::u8string_view wtf8s,
+                      const ErrorPolicy errorPolicy) {
+  return internal::wtf_convert<std::u32string>(wtf8s, errorPolicy);
+}
+
+/* CESU-8 and Modified UTF-8 */
+
+namespace internal {
+// Decodes one character of CESU-8, where supplementary characters are a
+// pair of 3 byte surrogate sequences; `modified` also accepts C0 80 as NUL.
+DecodeResult decode_one_cesu8(std::u8string_view input, bool modified) {
+  if (input.empty()) {
+    return {0, 0, false};
+  }
+  if (modified && input.size() >= 2 && input[0] == 0xC0 && input[1] == 0x80) {
+    return {0, 2, true};
+  }
+  if (modified && input[0] == 0) {
+    return {0, 1, false}; // Modified UTF-8 never holds a raw NUL
+  }
+  if (input[0] >= 0xF0) {
+    return {0, 1, false}; // 4 byte sequences are not part of CESU-8
+  }
+  // Surrogate pairs are joined by the WTF-8 decoder
+  DecodeResult decoded = decode_one_wtf8(input);
+  if (decoded.is_valid && decoded.codepoint >= 0xD800 &&
+      decoded.codepoint <= 0xDFFF) {
+    return {0, 3, false}; // Unpaired surrogate
+  }
+  return decoded;
+}
+
+// Encodes a codepoint as CESU-8 or Modified UTF-8, returns the units written.
+size_t encode_cesu8(char32_t codepoint, bool modified, char8_t *output) {
+  if (modified && codepoint == 0) {
+    output[0] = 0xC0;
+    output[1] = 0x80;
+    return 2;
+  }
+  if (codepoint >= 0x10000) {
+    char16_t pair[2];
+    encode_utf16(codepoint, pair);
+    const size_t high = encode_utf8(pair[0], output);
+    return high + encode_utf8(pair[1], output + high);
+  }
+  return encode_utf8(codepoint, output);
+}
+
+// Length of the prefix of `input` spelled the same in UTF-8 and CESU-8:
+// valid, without supplementary characters and, when `modified`, without
+// NULs. In UTF-8, surrogate sequences such as ED A0-BF are invalid already,
+// so each cached block is checked for the other two and then validated.
+template <typename CharT>
+size_t cesu8_plain_prefix(std::basic_string_view<CharT> input,
+                          bool modified) {
+  if constexpr (sizeof(CharT) > 1) {
+    // Past surrogates and supplementary characters every unit is valid
+    size_t plain = 0;
+    for (; plain < input.size(); ++plain) {
+      const char32_t c = input[plain];
+      if ((modified && c == 0) || (c >= 0xD800 && c <= 0xDFFF) ||
+          c >= 0x10000) {
+        break;
+      }
+    }
+    return plain;
+  } else {
+    constexpr size_t block_bytes = 16384;
+    size_t plain = 0;
+    while (plain < input.size()) {
+      std::u8string_view block = input.substr(plain, block_bytes);
+      if (plain + block.size() < input.size()) {
+        block = block.substr(0, wutils::detail::complete_prefix(block));
+      }
+      // F0 and above lead the 4 byte sequences
+      size_t stop = 0;
+      for (; stop + 8 <= block.size(); stop += 8) {
+        const uint64_t word = load_word(block.data() + stop);
+        const uint64_t mask = equal_bytes(word & (SWAR_ONES * 0xF0), 0xF0) |
+                              (modified ? zero_bytes(word) : 0);
+        if (mask != 0) {
+          break;
+        }
+      }
+      while (stop < block.size() && block[stop] < 0xF0 &&
+             !(modified && block[stop] == 0)) {
+        ++stop;
+      }
+      const size_t valid = wutils::detail::valid_prefix(block.substr(0, stop));
+      plain += valid;
+      if (valid < block.size() || block.empty()) {
+        break;
+      }
+    }
+    return plain;
+  }
+}
+
+template <typename FromChar>
+wutils::ConversionResult<std::u8string>
+cesu8_encode(std::basic_string_view<FromChar> input, bool modified,
+             const wutils::ErrorPolicy errorPolicy) {
+  using wutils::ErrorPolicy;
+  bool is_valid = true;
+  std::u8string result;
+  // Text spelled the same as UTF-8 is written in one go, and the loop only
+  // starts at the first character that differs
+  size_t i = cesu8_plain_prefix(input, modified);
+  if (i < input.size()) {
+    result.reserve(input.size());
+  }
+  if constexpr (sizeof(FromChar) == 1) {
+    result.append(input.data(), i);
+  } else {
+    wutils::detail::append_transcoded(result, input.substr(0, i),
+                                      errorPolicy);
+  }
+
+  while (i < input.size()) {
+    if constexpr (sizeof(FromChar) == 1) {
+      // Without NULs and supplementary characters the bytes are identical
+      const size_t ascii = ascii_prefix(input.substr(i), modified);
+      result.append(input.data() + i, ascii);
+      i += ascii;
+      if (i == input.size()) {
+        break;
+      }
+    }
+    DecodeResult decoded = decode_one(input.substr(i));
+    if (decoded.is_valid) {
+      char8_t encoded[6];
+      if constexpr (sizeof(FromChar) == 1) {
+        if (decoded.codepoint != 0 && decoded.codepoint < 0x10000) {
+          result.append(input.data() + i, decoded.consumed_units);
+          i += decoded.consumed_units;
+          continue;
+        }
+      }
+      result.append(encoded,
+                    encode_cesu8(decoded.codepoint, modified, encoded));
+    } else {
+      is_valid = false;
+      switch (errorPolicy) {
+      case ErrorPolicy::SkipInvalidValues:
+        break;
+      case ErrorPolicy::StopOnFirstError:
+        return {std::move(result), false};
+      case ErrorPolicy::UseReplacementCharacter:
+        result.append(wutils::detail::REPLACEMENT_CHAR_8);
+        break;
+      }
+    }
+    i += decoded.consumed_units;
+  }
+  return {std::move(result), is_valid};
+}
+
+template <typename String>
+wutils::ConversionResult<String>
+cesu8_decode(std::u8string_view input, bool modified,
+             const wutils::ErrorPolicy errorPolicy) {
+  using wutils::ErrorPolicy;
+  using ToChar = typename String::value_type;
+  bool is_valid = true;
+  String result;
+  // Valid UTF-8 without 4 byte sequences reads the same in CESU-8, so it is
+  // copied or transcoded in one go up to the first byte that differs
+  size_t i = cesu8_plain_prefix(input, modified);
+  if (i < input.size()) {
+    result.reserve(input.size());
+  }
+  if constexpr (sizeof(ToChar) == 1) {
+    result.append(input.data(), i);
+  } else {
+    wutils::detail::append_transcoded(result, input.substr(0, i),
+                                      errorPolicy);
+  }
+
+  while (i < input.size()) {
+    // A raw NUL ends the run in Modified UTF-8, for the decoder to reject
+    const size_t ascii = ascii_prefix(input.substr(i), modified);
+    if (ascii > 0) {
+      wutils::detail::append_transcoded(result, input.substr(i, ascii),
+                                        errorPolicy);
+      i += ascii;
+      if (i == input.size()) {
+        break;
+      }
+    }
+    DecodeResult decoded = decode_one_cesu8(input.substr(i), modified);
+    if (decoded.is_valid) {
+      if constexpr (sizeof(ToChar) == 1) {
+        if (decoded.consumed_units <= 3 && decoded.codepoint != 0) {
+          // BMP characters are spelled the same in UTF-8
+          result.append(input.data() + i, decoded.consumed_units);
+          i += decoded.consumed_units;
+          continue;
+        }
+      }
+      ToChar encoded[4];
+      result.append(encoded, encode(decoded.codepoint, encoded));
+    } else {
+      is_valid = false;
+      switch (errorPolicy) {
+      case ErrorPolicy::SkipInvalidValues:
+        break;
+      case ErrorPolicy::StopOnFirstError:
+        return {std::move(result), false};
+      case ErrorPolicy::UseReplacementCharacter: {
+        ToChar encoded[4];
+        result.append(encoded,
+                      encode(wutils::detail::REPLACEMENT_CHAR_32, encoded));
+        break;
+      }
+      }
+    }
+    i += decoded.consumed_units;
+  }
+  return {std::move(result), is_valid};
+}
+} // namespace internal
+
+wutils::ConversionResult<std::u8string>
+wutils::detail::cesu8(const std::u8string_view u8s, const bool modified,
+                      const ErrorPolicy errorPolicy) {
+  return internal::cesu8_encode(u8s, modified, errorPolicy);
+}
+
+wutils::ConversionResult<std::u8string>
+wutils::detail::cesu8(const std::u16string_view u16s, const bool modified,
+                      const ErrorPolicy errorPolicy) {
+  return internal::cesu8_encode(u16s, modified, errorPolicy);
+}
+
+wutils::ConversionResult<std::u8string>
+wutils::detail::cesu8(const std::u32string_view u32s, const bool modified,
+                      const ErrorPolicy errorPolicy) {
+  return internal::cesu8_encode(u32s, modified, errorPolicy);
+}
+
+wutils::ConversionResult<std::u8string>
+wutils::detail::u8_from_cesu8(const std::u8string_view cesu8s,
+                              const bool modified,
+                              const ErrorPolicy errorPolicy) {
+  return internal::cesu8_decode<std::u8string>(cesu8s, modified, errorPolicy);
+}
+
+wutils::ConversionResult<std::u16string>
+wutils::detail::u16_from_cesu8(const std::u8string_view cesu8s,
+                               const bool modified,
+                               const ErrorPolicy errorPolicy) {
+  return internal::cesu8_decode<std::u16string>(cesu8s, modified,
+                                                errorPolicy);
+}
+
+/* Content profiles */
+
+wutils::ContentProfile
+wutils::detail::sample_profile(const std::u8string_view u8s) {
+  return internal::sample_units(u8s);
+}
+
+wutils::ContentProfile
+wutils::detail::sample_profile(const std::u16string_view u16s) {
+  return internal::sample_units(u16s);
+}
+
+wutils::ContentProfile
+wutils::detail::sample_profile(const std::u32string_view u32s) {
+  return internal::sample_units(u32s);
+}
+
+/* Text segmentation */
+
+namespace internal {
+
+// Class before the start of text, also marking the lack of an open terminator
+constexpr std::uint8_t NO_CLASS = 0xFF;
+
+inline WordBreakClass word_break_class(size_t index) {
+  return static_cast<WordBreakClass>(
+      (segment_records[index] >> PROPERTY_WORD_BREAK_SHIFT) &
+      PROPERTY_WORD_BREAK_MASK);
+}
+
+inline SentenceBreakClass sentence_break_class(size_t index) {
+  return static_cast<SentenceBreakClass>(
+      (segment_records[index] >> PROPERTY_SENTENCE_BREAK_SHIFT) &
+      PROPERTY_SENTENCE_BREAK_MASK);
+}
+
+// Decodes the code point at `pos`, reading invalid sequences as U+FFFD
+template <typename CharT>
+char32_t code_point_at(std::basic_string_view<CharT> text, size_t pos,
+                       size_t &units) {
+  if (text[pos] < 0x80) {
+    units = 1;
+    return text[pos];
+  }
+  const DecodeResult decoded = decode_one(text.substr(pos));
+  units = decoded.consumed_units;
+  return decoded.is_valid ? decoded.codepoint : 0xFFFD;
+}
+
+// Length of the leading run of ASCII in `text` for which `in_run` holds.
+// `stop_mask` flags the bytes of a word that end the run, including every
+// non-ASCII byte; UTF-8 is scanned 32 bytes per step.
+template <typename StopMask, typename InRun>
+size_t ascii_run(std::u8string_view text, StopMask stop_mask, InRun in_run) {
+  size_t i = 0;
+  // Most runs are short words, settled by the first eight bytes
+  if (text.size() >= 8) {
+    const uint64_t mask = stop_mask(load_word(text.data()));
+    if (mask != 0) {
+      return first_flagged(mask);
+    }
+    i = 8;
+  }
+  for (; i + 32 <= text.size(); i += 32) {
+    const uint64_t masks[] = {stop_mask(load_word(text.data() + i)),
+                              stop_mask(load_word(text.data() + i + 8)),
+                              stop_mask(load_word(text.data() + i + 16)),
+                              stop_mask(load_word(text.data() + i + 24))};
+    if ((masks[0] | masks[1] | masks[2] | masks[3]) != 0) {
+      size_t k = 0;
+      while (masks[k] == 0) {
+        ++k;
+      }
+      return i + 8 * k + first_flagged(masks[k]);
+    }
+  }
+  for (; i + 8 <= text.size(); i += 8) {
+    const uint64_t mask = stop_mask(load_word(text.data() + i));
+    if (mask != 0) {
+      return i + first_flagged(mask);
+    }
+  }
+  while (i < text.size() && text[i] < 0x80 && in_run(text[i])) {
+    ++i;
+  }
+  return i;
+}
+
+template <typename CharT, typename StopMask, typename InRun>
+  requires(sizeof(CharT) > 1)
+size_t ascii_run(std::basic_string_view<CharT> text, StopMask, InRun in_run) {
+  size_t i = 0;
+  while (i < text.size() && text[i] < 0x80 && in_run(text[i])) {
+    ++i;
+  }
+  return i;
+}
+
+inline bool is_ascii_word(char32_t c) {
+  return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') ||
+         c == '_';
+}
+
+// High bit set in the bytes of `word` that are not ASCII letters, digits or
+// underscores
+inline uint64_t non_word_bytes(uint64_t word) {
+  const uint64_t folded = word | (SWAR_ONES * 0x20);
+  const uint64_t digits = less_bytes(word, '9' + 1) & ~less_bytes(word, '0');
+  const uint64_t letters =
+      less_bytes(folded, 'z' + 1) & ~less_bytes(folded, 'a');
+  return ~(digits | letters | equal_bytes(word, '_')) & SWAR_HIGH;
+}
+
+inline WordBreakClass ascii_word_class(char32_t c) {
+  return c == '_' ? WB_ExtendNumLet
+                  : (c >= '0' && c <= '9' ? WB_Numeric : WB_ALetter);
+}
+
+inline bool is_ahletter(std::uint8_t c) {
+  return c == WB_ALetter || c == WB_HebrewLetter;
+}
+
+inline bool is_midnumletq(std::uint8_t c) {
+  return c == WB_MidNumLet || c == WB_SingleQuote;
+}
+
+inline bool is_word_ignorable(std::uint8_t c) {
+  return c == WB_Extend || c == WB_Format || c == WB_ZWJ;
+}
+
+inline bool is_letter_or_number(std::uint32_t record) {
+  using wutils::GeneralCategory;
+  const auto category = static_cast<GeneralCategory>(
+      (record >> PROPERTY_CATEGORY_SHIFT) & PROPERTY_CATEGORY_MASK);
+  return (category >= GeneralCategory::UppercaseLetter &&
+          category <= GeneralCategory::OtherLetter) ||
+         (category >= GeneralCategory::DecimalNumber &&
+          category <= GeneralCategory::OtherNumber);
+}
+
+// Word_Break class of the first code point from `pos` on that is not Extend,
+// Format or ZWJ
+template <typename CharT>
+std::uint8_t next_word_class(std::basic_string_view<CharT> text, size_t pos) {
+  while (pos < text.size()) {
+    size_t units;
+    const WordBreakClass c =
+        word_break_class(property_index(code_point_at(text, pos, units)));
+    if (!is_word_ignorable(c)) {
+      return c;
+    }
+    pos += units;
+  }
+  return NO_CLASS;
+}
+
+// Rules WB3 to WB999 for the position before a code point of class `c`,
+// `next` indexing the code point after it
+template <typename CharT>
+bool is_word_break(const wutils::detail::WordBreakState &state,
+                   WordBreakClass c, bool pictographic,
+                   std::basic_string_view<CharT> text, size_t next) {
+  const std::uint8_t raw = state.raw;
+  if (raw == WB_CR && c == WB_LF)
+    return false;
+  if (raw == WB_CR || raw == WB_LF || raw == WB_Newline)
+    return true;
+  if (c == WB_CR || c == WB_LF || c == WB_Newline)
+    return true;
+  if (raw == WB_ZWJ && pictographic)
+    return false;
+  if (raw == WB_WSegSpace && c == WB_WSegSpace)
+    return false;
+  if (is_word_ignorable(c))
+    return false;
+
+  const std::uint8_t p = state.last;
+  const std::uint8_t pp = state.before_last;
+  if (is_ahletter(p) && is_ahletter(c))
+    return false;
+  if (is_ahletter(p) && (c == WB_MidLetter || is_midnumletq(c)) &&
+      is_ahletter(next_word_class(text, next)))
+    return false;
+  if (is_ahletter(pp) && (p == WB_MidLetter || is_midnumletq(p)) &&
+      is_ahletter(c))
+    return false;
+  if (p == WB_HebrewLetter && c == WB_SingleQuote)
+    return false;
+  if (p == WB_HebrewLetter && c == WB_DoubleQuote &&
+      next_word_class(text, next) == WB_HebrewLetter)
+    return false;
+  if (pp == WB_HebrewLetter && p == WB_DoubleQuote && c == WB_HebrewLetter)
+    return false;
+  if ((p == WB_Numeric || is_ahletter(p)) &&
+      (c == WB_Numeric || is_ahletter(c)))
+    return false;
+  if (pp == WB_Numeric && (p == WB_MidNum || is_midnumletq(p)) &&
+      c == WB_Numeric)
+    return false;
+  if (p == WB_Numeric && (c == WB_MidNum || is_midnumletq(c)) &&
+      next_word_class(text, next) == WB_Numeric)
+    return false;
+  if (p == WB_Katakana && c == WB_Katakana)
+    return false;
+  if ((is_ahletter(p) || p == WB_Numeric || p == WB_Katakana ||
+       p == WB_ExtendNumLet) &&
+      c == WB_ExtendNumLet)
+    return false;
+  if (p == WB_ExtendNumLet &&
+      (is_ahletter(c) || c == WB_Numeric || c == WB_Katakana))
+    return false;
+  if (p == WB_RegionalIndicator && c == WB_RegionalIndicator &&
+      state.odd_regional)
+    return false;
+  return true;
+}
+
+inline void advance_word_state(wutils::detail::WordBreakState &state,
+                               WordBreakClass c) {
+  const std::uint8_t raw = state.raw;
+  if (is_word_ignorable(c) && raw != NO_CLASS && raw != WB_CR &&
+      raw != WB_LF && raw != WB_Newline) {
+    state.raw = c;
+    return;
+  }
+  state.odd_regional =
+      c == WB_RegionalIndicator &&
+      !(state.last == WB_RegionalIndicator && state.odd_regional);
+  state.before_last = state.last;
+  state.last = state.raw = c;
+}
+
+template <typename CharT>
+size_t next_word_break(std::basic_string_view<CharT> text, size_t pos,
+                       wutils::detail::WordBreakState &state, bool &word) {
+  const size_t start = pos;
+  word = false;
+  while (pos < text.size()) {
+    // Runs of ASCII letters, digits and underscores never break inside, nor
+    // do runs of spaces
+    const char32_t unit = text[pos];
+    if (unit < 0x80 && is_ascii_word(unit) &&
+        (is_ahletter(state.last) || state.last == WB_Numeric ||
+         state.last == WB_ExtendNumLet)) {
+      const size_t end = pos + ascii_run(
+                                   text.substr(pos),
+                                   [](uint64_t w) { return non_word_bytes(w); },
+                                   [](char32_t c) { return is_ascii_word(c); });
+      for (size_t i = pos; !word && i < end; ++i) {
+        word = text[i] != '_';
+      }
+      state.before_last = end - pos >= 2 ? static_cast<std::uint8_t>(
+                                               ascii_word_class(text[end - 2]))
+                                         : state.last;
+      state.last = state.raw = ascii_word_class(text[end - 1]);
+      state.odd_regional = false;
+      pos = end;
+      continue;
+    }
+    if (unit == ' ' && state.raw == WB_WSegSpace) {
+      const size_t end =
+          pos + ascii_run(
+                    text.substr(pos),
+                    [](uint64_t w) { return ~equal_bytes(w, ' ') & SWAR_HIGH; },
+                    [](char32_t c) { return c == ' '; });
+      state.before_last =
+          end - pos >= 2 ? std::uint8_t{WB_WSegSpace} : state.last;
+      state.last = state.raw = WB_WSegSpace;
+      state.odd_regional = false;
+      pos = end;
+      continue;
+    }
+
+    size_t units;
+    const size_t index = property_index(code_point_at(text, pos, units));
+    const std::uint32_t record = property_records[index];
+    const WordBreakClass c = word_break_class(index);
+    const bool pictographic =
+        (record >> PROPERTY_EMOJI_SHIFT) & 0x20; // Extended_Pictographic
+    if (pos != start && is_word_break(state, c, pictographic, text, pos + units))
+      return pos;
+    advance_word_state(state, c);
+    word = word || is_letter_or_number(record);
+    pos += units;
+  }
+  return pos;
+}
+
+inline bool is_paragraph_separator(std::uint8_t c) {
+  return c == SB_CR || c == SB_LF || c == SB_Sep;
+}
+
+// SB8: whether a Lower follows before any OLetter, Upper, separator or
+// terminator, starting with the code point of class `c`
+template <typename CharT>
+bool lower_follows(SentenceBreakClass c, std::basic_string_view<CharT> text,
+                   size_t next) {
+  for (;;) {
+    if (c == SB_OLetter || c == SB_Upper || c == SB_Lower ||
+        is_paragraph_separator(c) || c == SB_ATerm || c == SB_STerm) {
+      return c == SB_Lower;
+    }
+    if (next >= text.size()) {
+      return false;
+    }
+    size_t units;
+    c = sentence_break_class(property_index(code_point_at(text, next, units)));
+    next += units;
+  }
+}
+
+// Rules SB3 to SB998 for the position before a code point of class `c`
+template <typename CharT>
+bool is_sentence_break(const wutils::detail::SentenceBreakState &state,
+                       SentenceBreakClass c,
+                       std::basic_string_view<CharT> text, size_t next) {
+  if (state.raw == SB_CR && c == SB_LF)
+    return false;
+  if (is_paragraph_separator(state.raw))
+    return true;
+  if (c == SB_Extend || c == SB_Format)
+    return false;
+  if (state.term == NO_CLASS)
+    return false;
+
+  if (state.term == SB_ATerm && state.trailer == 0) {
+    if (c == SB_Numeric)
+      return false;
+    if ((state.before_term == SB_Upper || state.before_term == SB_Lower) &&
+        c == SB_Upper)
+      return false;
+  }
+  if (state.term == SB_ATerm && lower_follows(c, text, next))
+    return false;
+  if (c == SB_SContinue || c == SB_ATerm || c == SB_STerm)
+    return false;
+  if (state.trailer <= 1 &&
+      (c == SB_Close || c == SB_Sp || is_paragraph_separator(c)))
+    return false;
+  if (c == SB_Sp || is_paragraph_separator(c))
+    return false;
+  return true;
+}
+
+inline void advance_sentence_state(wutils::detail::SentenceBreakState &state,
+                                   SentenceBreakClass c) {
+  if ((c == SB_Extend || c == SB_Format) && state.raw != NO_CLASS &&
+      !is_paragraph_separator(state.raw)) {
+    state.raw = c;
+    return;
+  }
+  if (c == SB_ATerm || c == SB_STerm) {
+    state.before_term = state.last;
+    state.term = c;
+    state.trailer = 0;
+  } else if (state.term != NO_CLASS && c == SB_Close &&
+             state.trailer <= 1) {
+    state.trailer = 1;
+  } else if (state.term != NO_CLASS && c == SB_Sp) {
+    state.trailer = 2;
+  } else {
+    state.term = NO_CLASS;
+  }
+  state.last = state.raw = c;
+}
+
+inline bool is_sentence_plain(char32_t c) {
+  return c != '.' && c != '!' && c != '?' && c != '\r' && c != '\n';
+}
+
+// High bit set in the bytes of `word` that may end or continue a sentence
+inline uint64_t sentence_stop_bytes(uint64_t word) {
+  return (word & SWAR_HIGH) | equal_bytes(word, '.') | equal_bytes(word, '!') |
+         equal_bytes(word, '?') | equal_bytes(word, '\r') |
+         equal_bytes(word, '\n');
+}
+
+template <typename CharT>
+size_t next_sentence_break(std::basic_string_view<CharT> text, size_t pos,
+                           wutils::detail::SentenceBreakState &state) {
+  const size_t start = pos;
+  while (pos < text.size()) {
+    // Outside a terminator sequence nothing but a terminator or a separator
+    // changes the state, so ASCII text up to one is skipped in bulk
+    if (state.term == NO_CLASS && !is_paragraph_separator(state.raw) &&
+        text[pos] < 0x80 && is_sentence_plain(text[pos])) {
+      pos += ascii_run(
+          text.substr(pos),
+          [](uint64_t w) { return sentence_stop_bytes(w); },
+          [](char32_t c) { return is_sentence_plain(c); });
+      state.last = state.raw =
+          sentence_break_class(property_index(text[pos - 1]));
+      continue;
+    }
+
+    size_t units;
+    const SentenceBreakClass c =
+        sentence_break_class(property_index(code_point_at(text, pos, units)));
+    if (pos != start && is_sentence_break(state, c, text, pos + units))
+      return pos;
+    advance_sentence_state(state, c);
+    pos += units;
+  }
+  return pos;
+}
+
+// Extended grapheme cluster rules, fed one code point at a time. The start
+// of text breaks like a control character
+struct GraphemeState {
+  wutils::GraphemeBreak previous = wutils::GraphemeBreak::Control;
+  bool pictographic = false; // After Extended_Pictographic Extend*
+  bool joined = false;       // After Extended_Pictographic Extend* ZWJ
+  bool odd_regional = false; // After an odd run of regional indicators
+
+  bool operator==(const GraphemeState &) const = default;
+};
+
+// Whether a cluster starts at the code point with property `record`
+inline bool grapheme_break_before(GraphemeState &state, std::uint32_t record) {
+  using GB = wutils::GraphemeBreak;
+  const GB previous = state.previous;
+  const GB next = static_cast<GB>((record >> PROPERTY_GRAPHEME_BREAK_SHIFT) &
+                                  PROPERTY_GRAPHEME_BREAK_MASK);
+  const bool pictographic = (record >> PROPERTY_EMOJI_SHIFT) & 0x20;
+  auto is_control = [](GB c) {
+    return c == GB::Control || c == GB::CR || c == GB::LF;
+  };
+  bool boundary = true;
+  if (previous == GB::CR && next == GB::LF) {
+    boundary = false; // GB3
+  } else if (is_control(previous) || is_control(next)) {
+    boundary = true; // GB4, GB5
+  } else if (next == GB::Extend || next == GB::ZWJ ||
+             next == GB::SpacingMark || previous == GB::Prepend) {
+    boundary = false; // GB9, GB9a, GB9b
+  } else if (previous == GB::L) {
+    boundary = next != GB::L && next != GB::V && next != GB::LV &&
+               next != GB::LVT; // GB6
+  } else if (previous == GB::LV || previous == GB::V) {
+    boundary = next != GB::V && next != GB::T; // GB7
+  } else if (previous == GB::LVT || previous == GB::T) {
+    boundary = next != GB::T; // GB8
+  } else if (state.joined && pictographic) {
+    boundary = false; // GB11
+  } else if (previous == GB::RegionalIndicator &&
+             next == GB::RegionalIndicator && state.odd_regional) {
+    boundary = false; // GB12, GB13
+  }
+  state.joined = state.pictographic && next == GB::ZWJ;
+  state.pictographic =
+      pictographic || (state.pictographic && next == GB::Extend);
+  state.odd_regional =
+      next == GB::RegionalIndicator &&
+      !(previous == GB::RegionalIndicator && state.odd_regional);
+  state.previous = next;
+  return boundary;
+}
+
+} // namespace internal
+
+size_t wutils::detail::next_word_break(const std::u8string_view text,
+                                       const size_t pos,
+                                       WordBreakState &state, bool &word) {
+  return internal::next_word_break(text, pos, state, word);
+}
+
+size_t wutils::detail::next_word_break(const std::u16string_view text,
+                                       const size_t pos,
+                                       WordBreakState &state, bool &word) {
+  return internal::next_word_break(text, pos, state, word);
+}
+
+size_t wutils::detail::next_sentence_break(const std::u8string_view text,
+                                           const size_t pos,
+                                           SentenceBreakState &state) {
+  return internal::next_sentence_break(text, pos, state);
+}
+
+size_t wutils::detail::next_sentence_break(const std::u16string_view text,
+                                           const size_t pos,
+                                           SentenceBreakState &state) {
+  return internal::next_sentence_break(text, pos, state);
+}
+
+/* Bounded conversions */
+
+namespace internal {
+
+// Offset of the last grapheme cluster boundary at or before `end`
+template <typename CharT>
+size_t grapheme_floor(std::basic_string_view<CharT> text, size_t end) {
+  GraphemeState state;
+  size_t boundary = 0;
+  for (size_t i = 0, units; i < text.size() && i <= end; i += units) {
+    const char32_t cp = code_point_at(text, i, units);
+    if (grapheme_break_before(state, property_record(cp))) {
+      boundary = i;
+    }
+  }
+  return boundary;
+}
+
+template <typename FromChar, typename ToChar>
+wutils::detail::TranscodeResult
+transcode_bounded(std::basic_string_view<FromChar> input, ToChar *output,
+                  const size_t max_units, const wutils::ErrorPolicy errorPolicy,
+                  const wutils::Truncation truncation) {
+  using wutils::detail::max_transcoded_size;
+  wutils::detail::TranscodeResult result{0, 0, true};
+  if constexpr (std::is_same_v<FromChar, ToChar>) {
+    result.read = std::min(input.size(), max_units);
+    if (result.read < input.size()) {
+      result.read =
+          wutils::detail::complete_prefix(input.substr(0, result.read));
+    }
+    std::copy_n(input.data(), result.read, output);
+    result.written = result.read;
+  } else {
+    // Convert in blocks whose worst case fits in what is left of the budget,
+    // each ending on a code point, so ASCII-heavy input goes in one step
+    while (result.read < input.size()) {
+      const std::basic_string_view<FromChar> rest = input.substr(result.read);
+      size_t take = (max_units - result.written) /
+                    max_transcoded_size<FromChar, ToChar>(1);
+      take = take >= rest.size()
+                 ? rest.size()
+                 : wutils::detail::complete_prefix(rest.substr(0, take));
+      if (take == 0) {
+        break;
+      }
+      const wutils::detail::TranscodeResult block = transcode_units(
+          rest.substr(0, take), output + result.written, errorPolicy);
+      result.read += block.read;
+      result.written += block.written;
+      if (!block.is_valid) {
+        result.is_valid = false;
+        if (errorPolicy == wutils::ErrorPolicy::StopOnFirstError) {
+          return result;
+        }
+      }
+    }
+    // Then one code point at a time, until the next one does not fit
+    while (result.read < input.size()) {
+      const size_t units = decode_one(input.substr(result.read)).consumed_units;
+      ToChar encoded[max_transcoded_size<FromChar, ToChar>(4)];
+      const wutils::detail::TranscodeResult step = transcode_units(
+          input.substr(result.read, units), encoded, errorPolicy);
+      if (step.written > max_units - result.written) {
+        break;
+      }
+      std::copy_n(encoded, step.written, output + result.written);
+      result.read += step.read;
+      result.written += step.written;
+      if (!step.is_valid) {
+        result.is_valid = false;
+        if (errorPolicy == wutils::ErrorPolicy::StopOnFirstError) {
+          return result;
+        }
+      }
+    }
+  }
+  if (truncation == wutils::Truncation::Grapheme &&
+      result.read < input.size()) {
+    const size_t boundary = grapheme_floor(input, result.read);
+    if (boundary < result.read) {
+      // The prefix fitted once, so converting it again fits as well
+      if constexpr (std::is_same_v<FromChar, ToChar>) {
+        result = {boundary, boundary, true};
+      } else {
+        result =
+            transcode_units(input.substr(0, boundary), output, errorPolicy);
+      }
+    }
+  }
+  return result;
+}
+} // namespace internal
+
+wutils::detail::TranscodeResult
+wutils::detail::transcode_bounded(const std::u8string_view from,
+                                  char8_t *out, const size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation) {
+  return internal::transcode_bounded(from, out, max_units, errorPolicy,
+                                     truncation);
+}
+
+wutils::detail::TranscodeResult
+wutils::detail::transcode_bounded(const std::u8string_view from,
+                                  char16_t *out, const size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation) {
+  return internal::transcode_bounded(from, out, max_units, errorPolicy,
+                                     truncation);
+}
+
+wutils::detail::TranscodeResult
+wutils::detail::transcode_bounded(const std::u8string_view from,
+                                  char32_t *out, const size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation) {
+  return internal::transcode_bounded(from, out, max_units, errorPolicy,
+                                     truncation);
+}
+
+wutils::detail::TranscodeResult
+wutils::detail::transcode_bounded(const std::u16string_view from,
+                                  char8_t *out, const size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation) {
+  return internal::transcode_bounded(from, out, max_units, errorPolicy,
+                                     truncation);
+}
+
+wutils::detail::TranscodeResult
+wutils::detail::transcode_bounded(const std::u16string_view from,
+                                  char16_t *out, const size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation) {
+  return internal::transcode_bounded(from, out, max_units, errorPolicy,
+                                     truncation);
+}
+
+wutils::detail::TranscodeResult
+wutils::detail::transcode_bounded(const std::u16string_view from,
+                                  char32_t *out, const size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation) {
+  return internal::transcode_bounded(from, out, max_units, errorPolicy,
+                                     truncation);
+}
+
+wutils::detail::TranscodeResult
+wutils::detail::transcode_bounded(const std::u32string_view from,
+                                  char8_t *out, const size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation) {
+  return internal::transcode_bounded(from, out, max_units, errorPolicy,
+                                     truncation);
+}
+
+wutils::detail::TranscodeResult
+wutils::detail::transcode_bounded(const std::u32string_view from,
+                                  char16_t *out, const size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation) {
+  return internal::transcode_bounded(from, out, max_units, errorPolicy,
+                                     truncation);
+}
+
+wutils::detail::TranscodeResult
+wutils::detail::transcode_bounded(const std::u32string_view from,
+                                  char32_t *out, const size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation) {
+  return internal::transcode_bounded(from, out, max_units, errorPolicy,
+                                     truncation);
+}
+
+/* Collation */
+
+namespace internal {
+
+#include "wutils_collation.inc"
+
+inline std::uint32_t collation_entry(char32_t cp) {
+  if (cp > 0x10FFFF)
+    return 0;
+  const size_t mid = collation_stage1[cp >> (COLLATION_LEAF_SHIFT +
+                                             COLLATION_MID_SHIFT)];
+  const size_t leaf =
+      collation_stage2[(mid << COLLATION_MID_SHIFT) +
+                       ((cp >> COLLATION_LEAF_SHIFT) &
+                        ((1u << COLLATION_MID_SHIFT) - 1))];
+  return collation_stage3[(leaf << COLLATION_LEAF_SHIFT) +
+                          (cp & ((1u << COLLATION_LEAF_SHIFT) - 1))];
+}
+
+// Yields the collation elements of a string, each packed as primary << 16 |
+// secondary rank << 8 | tertiary rank
+template <typename CharT> class CollationElements {
+public:
+  explicit CollationElements(std::basic_string_view<CharT> text)
+      : text(text) {}
+
+  bool next(std::uint32_t &element) {
+    while (remaining == 0) {
+      if (pos >= text.size()) {
+        return false;
+      }
+      load();
+    }
+    element = *elements++;
+    --remaining;
+    return true;
+  }
+
+private:
+  void load() {
+    size_t units;
+    const char32_t cp = code_point_at(text, pos, units);
+    pos += units;
+    std::uint32_t entry = collation_entry(cp);
+    if (entry & 1) {
+      entry = contract(cp, entry);
+    }
+    if (cp >= 0xAC00 && cp <= 0xD7A3) {
+      hangul_weights(cp);
+      return;
+    }
+    if (entry == 0) {
+      implicit_weights(cp);
+      return;
+    }
+    elements = collation_elements + (entry >> 6);
+    remaining = (entry >> 1) & 31;
+  }
+
+  // Longest contraction starting with `first` and continuing at `pos`
+  std::uint32_t contract(char32_t first, std::uint32_t entry) {
+    const auto *begin = std::begin(collation_contractions);
+    const auto *end = std::end(collation_contractions);
+    const auto *match = std::lower_bound(
+        begin, end, first, [](const CollationContraction &c, char32_t cp) {
+          return c.code_points[0] < cp;
+        });
+    if (pos >= text.size()) {
+      return entry;
+    }
+    size_t units[2] = {0, 0};
+    char32_t next[2] = {code_point_at(text, pos, units[0]), 0};
+    if (pos + units[0] < text.size()) {
+      next[1] = code_point_at(text, pos + units[0], units[1]);
+    }
+    size_t consumed = 0;
+    for (; match != end && match->code_points[0] == first; ++match) {
+      if (match->code_points[1] != next[0]) {
+        continue;
+      }
+      if (match->code_points[2] == 0 && consumed < units[0]) {
+        entry = match->entry;
+        consumed = units[0];
+      } else if (match->code_points[2] != 0 &&
+                 match->code_points[2] == next[1] && units[1] != 0) {
+        entry = match->entry;
+        consumed = units[0] + units[1];
+      }
+    }
+    pos += consumed;
+    return entry;
+  }
+
+  // Syllables are weighted as their conjoining jamo, one element each
+  void hangul_weights(char32_t cp) {
+    const char32_t index = cp - 0xAC00;
+    const char32_t jamo[3] = {0x1100 + index / (21 * 28),
+                              0x1161 + index % (21 * 28) / 28,
+                              0x11A7 + index % 28};
+    remaining = jamo[2] == 0x11A7 ? 2 : 3;
+    for (size_t i = 0; i < remaining; ++i) {
+      derived[i] = collation_elements[collation_entry(jamo[i]) >> 6];
+    }
+    elements = derived;
+  }
+
+  // Implicit weights of code points missing from the table (UTS #10 10.1)
+  void implicit_weights(char32_t cp) {
+    std::uint32_t base = 0xFBC0 + (cp >> 15);
+    std::uint32_t rest = (cp & 0x7FFF) | 0x8000;
+    for (const CollationImplicitRange &range : collation_implicit_ranges) {
+      if (cp >= range.first && cp <= range.last) {
+        base = range.base;
+        rest = (cp - range.origin) | 0x8000;
+      }
+    }
+    const auto *ideograph = std::upper_bound(
+        std::begin(collation_ideographs), std::end(collation_ideographs), cp,
+        [](char32_t cp, const CollationImplicitRange &range) {
+          return cp < range.first;
+        });
+    if (ideograph != std::begin(collation_ideographs) &&
+        cp <= (--ideograph)->last) {
+      base = ideograph->base + (cp >> 15);
+    }
+    derived[0] = base << 16 | COLLATION_COMMON_SECONDARY << 8 |
+                  COLLATION_COMMON_TERTIARY;
+    derived[1] = rest << 16;
+    elements = derived;
+    remaining = 2;
+  }
+
+  std::basic_string_view<CharT> text;
+  size_t pos = 0;
+  const std::uint32_t *elements = nullptr;
+  size_t remaining = 0;
+  std::uint32_t derived[3];
+};
+
+// Appends the non-zero weights of one level, primaries as two bytes
+template <bool Primary>
+inline void append_weight(std::string &key, std::uint32_t element,
+                          unsigned shift) {
+  if constexpr (Primary) {
+    if (element >> 16) {
+      key.push_back(static_cast<char>(element >> 24));
+      key.push_back(static_cast<char>((element >> 16) & 0xFF));
+    }
+  } else {
+    if (const unsigned weight = (element >> shift) & 0xFF) {
+      key.push_back(static_cast<char>(weight));
+    }
+  }
+}
+
+// Levels are separated by a zero byte, which sorts below every weight: no
+// primary has a zero high byte, and ranks start at 1
+template <typename CharT>
+void append_sort_key(std::string &key, std::basic_string_view<CharT> text,
+                     wutils::CollationStrength strength) {
+  const int levels = static_cast<int>(strength) + 1;
+  // Grown geometrically, as SortKeyArena appends many keys to one string
+  const size_t estimate = key.size() + text.size() * (levels + 1) + levels;
+  if (estimate > key.capacity()) {
+    key.reserve(std::max(estimate, key.capacity() * 2));
+  }
+
+  // ASCII has one element per character and no contraction among itself
+  bool ascii;
+  if constexpr (sizeof(CharT) == 4) {
+    ascii = std::all_of(text.begin(), text.end(),
+                        [](char32_t c) { return c < 0x80; });
+  } else {
+    ascii = ascii_prefix(text) == text.size();
+  }
+  if (ascii) {
+    for (const CharT c : text) {
+      append_weight<true>(key, collation_ascii[c], 16);
+    }
+    for (int level = 1; level < levels; ++level) {
+      key.push_back(0);
+      for (const CharT c : text) {
+        append_weight<false>(key, collation_ascii[c], level == 1 ? 8 : 0);
+      }
+    }
+    return;
+  }
+
+  std::uint32_t element;
+  for (CollationElements<CharT> elements(text); elements.next(element);) {
+    append_weight<true>(key, element, 16);
+  }
+  for (int level = 1; level < levels; ++level) {
+    key.push_back(0);
+    for (CollationElements<CharT> elements(text); elements.next(element);) {
+      append_weight<false>(key, element, level == 1 ? 8 : 0);
+    }
+  }
+}
+
+} // namespace internal
+
+void wutils::detail::append_sort_key(std::string &key,
+                                     const std::u8string_view text,
+                                     const CollationStrength strength) {
+  internal::append_sort_key(key, text, strength);
+}
+
+void wutils::detail::append_sort_key(std::string &key,
+                                     const std::u16string_view text,
+                                     const CollationStrength strength) {
+  internal::append_sort_key(key, text, strength);
+}
+
+void wutils::detail::append_sort_key(std::string &key,
+                                     const std::u32string_view text,
+                                     const CollationStrength strength) {
+  internal::append_sort_key(key, text, strength);
+}
+
+/* Rope */
+
+namespace internal {
+
+// Leaves hold about a kilobyte, split at code point boundaries
+constexpr size_t ROPE_LEAF_MAX = 1024;
+constexpr size_t ROPE_LEAF_MIN = ROPE_LEAF_MAX / 4;
+constexpr size_t ROPE_NODE_MAX = 16;
+constexpr size_t ROPE_NODE_MIN = ROPE_NODE_MAX / 2;
+
+// Where mk_wcswidth() stands in an emoji sequence: outside one, after its
+// base or modifiers, or right after a ZWJ that swallows the next emoji
+enum WidthState : std::uint8_t {
+  WIDTH_PLAIN,
+  WIDTH_EMOJI,
+  WIDTH_JOINED,
+  WIDTH_STATES
+};
+
+// Columns taken by `cp`, of column width `width` on its own, in
+// mk_wcswidth(), control characters taking none
+inline size_t width_step(WidthState &state, char32_t cp, int width) {
+  if (state == WIDTH_JOINED) {
+    state = WIDTH_EMOJI;
+    if (starts_emoji_sequence(cp)) {
+      return 0;
+    }
+  }
+  if (state == WIDTH_EMOJI) {
+    if (extends_emoji_sequence(cp)) {
+      return 0;
+    }
+    if (cp == 0x200D) {
+      state = WIDTH_JOINED;
+      return 0;
+    }
+  }
+  state = starts_emoji_sequence(cp) ? WIDTH_EMOJI : WIDTH_PLAIN;
+  return static_cast<size_t>(std::max(width, 0));
+}
+
+inline size_t width_step(WidthState &state, char32_t cp) {
+  return width_step(state, cp, mk_wcwidth(cp));
+}
+
+// Metrics of a subtree. The width depends on the state the text is entered
+// in, so it is kept for each, along with the state it leaves; joining two
+// summaries composes them
+struct RopeSummary {
+  size_t bytes = 0;
+  size_t utf16_units = 0;
+  size_t code_points = 0;
+  size_t newlines = 0;
+  size_t width[WIDTH_STATES] = {};
+  WidthState exit[WIDTH_STATES] = {WIDTH_PLAIN, WIDTH_EMOJI, WIDTH_JOINED};
+
+  RopeSummary &operator+=(const RopeSummary &next) {
+    bytes += next.bytes;
+    utf16_units += next.utf16_units;
+    code_points += next.code_points;
+    newlines += next.newlines;
+    for (size_t state = 0; state < WIDTH_STATES; ++state) {
+      width[state] += next.width[exit[state]];
+      exit[state] = next.exit[exit[state]];
+    }
+    return *this;
+  }
+};
+
+// Counts the units, code points and line feeds of valid UTF-8 eight bytes
+// at a time: every byte but a continuation byte starts a code point, and
+// four byte sequences take two UTF-16 units
+void count_units(std::u8string_view text, RopeSummary &summary) {
+  size_t continuations = 0, four_byte_leads = 0, newlines = 0, i = 0;
+  for (; i + 8 <= text.size(); i += 8) {
+    const uint64_t word = load_word(text.data() + i);
+    continuations += std::popcount(word & ~(word << 1) & SWAR_HIGH);
+    four_byte_leads += std::popcount(word & (word << 1) & (word << 2) &
+                                     (word << 3) & SWAR_HIGH);
+    newlines += std::popcount(equal_bytes(word, '\n'));
+  }
+  for (; i < text.size(); ++i) {
+    continuations += (text[i] & 0xC0) == 0x80;
+    four_byte_leads += text[i] >= 0xF0;
+    newlines += text[i] == '\n';
+  }
+  summary.bytes = text.size();
+  summary.code_points = text.size() - continuations;
+  summary.utf16_units = summary.code_points + four_byte_leads;
+  summary.newlines = newlines;
+}
+
+// Number of control characters in a run of ASCII
+size_t ascii_controls(std::u8string_view run) {
+  size_t controls = 0, i = 0;
+  for (; i + 8 <= run.size(); i += 8) {
+    const uint64_t word = load_word(run.data() + i);
+    controls += std::popcount(less_bytes(word, 0x20) | equal_bytes(word, 0x7F));
+  }
+  for (; i < run.size(); ++i) {
+    controls += run[i] < 0x20 || run[i] == 0x7F;
+  }
+  return controls;
+}
+
+// Columns of valid UTF-8 entered in `state`, which is left as the text ends.
+// Any ASCII character ends an emoji sequence, so runs of it are counted
+// without decoding
+size_t measure_width(std::u8string_view text, WidthState &state) {
+  size_t width = 0;
+  for (size_t i = 0; i < text.size();) {
+    if (text[i] < 0x80) {
+      const size_t run = ascii_prefix(text.substr(i));
+      width += run - ascii_controls(text.substr(i, run));
+      state = WIDTH_PLAIN;
+      i += run;
+    } else {
+      size_t units;
+      width += width_step(state, code_point_at(text, i, units));
+      i += units;
+    }
+  }
+  return width;
+}
+
+RopeSummary summarize(std::u8string_view text) {
+  RopeSummary summary;
+  count_units(text, summary);
+  WidthState plain = WIDTH_PLAIN;
+  summary.width[WIDTH_PLAIN] = measure_width(text, plain);
+  summary.exit[WIDTH_PLAIN] = plain;
+  // Entered inside a sequence, the text only differs until it falls in step
+  // with the plain run, at the latest on its first ASCII character
+  for (const WidthState entry : {WIDTH_EMOJI, WIDTH_JOINED}) {
+    WidthState state = entry, reference = WIDTH_PLAIN;
+    size_t width = 0, reference_width = 0;
+    for (size_t i = 0, units; i < text.size() && state != reference;
+         i += units) {
+      const char32_t cp = code_point_at(text, i, units);
+      width += width_step(state, cp);
+      reference_width += width_step(reference, cp);
+    }
+    summary.width[entry] = summary.width[WIDTH_PLAIN] - reference_width + width;
+    summary.exit[entry] = state == reference ? plain : state;
+  }
+  return summary;
+}
+
+// `text` with its invalid sequences replaced by U+FFFD
+std::u8string repair_utf8(std::u8string_view text) {
+  std::u8string repaired;
+  repaired.reserve(text.size() + 8);
+  for (size_t i = 0; i < text.size();) {
+    const DecodeResult decoded = decode_one(text.substr(i));
+    if (decoded.is_valid) {
+      repaired.append(text.substr(i, decoded.consumed_units));
+    } else {
+      repaired.append(wutils::detail::REPLACEMENT_CHAR_8);
+    }
+    i += decoded.consumed_units;
+  }
+  return repaired;
+}
+
+bool is_valid_utf8(std::u8string_view text) {
+  return wutils::detail::valid_prefix(text) == text.size();
+}
+
+// Moves `offset` back to the start of the code point it falls in
+inline size_t code_point_start(std::u8string_view text, size_t offset) {
+  while (offset > 0 && offset < text.size() && (text[offset] & 0xC0) == 0x80) {
+    --offset;
+  }
+  return offset;
+}
+
+} // namespace internal
+
+struct wutils::detail::RopeNode {
+  internal::RopeSummary summary;
+  bool leaf = true;
+  std::u8string text;
+  std::vector<std::unique_ptr<RopeNode>> children;
+};
+
+namespace internal {
+
+using wutils::detail::RopeNode;
+using RopeNodes = std::vector<std::unique_ptr<RopeNode>>;
+
+void update(RopeNode &node) {
+  if (node.leaf) {
+    node.summary = summarize(node.text);
+    return;
+  }
+  node.summary = RopeSummary();
+  for (const auto &child : node.children) {
+    node.summary += child->summary;
+  }
+}
+
+std::unique_ptr<RopeNode> make_leaf(std::u8string_view text) {
+  auto leaf = std::make_unique<RopeNode>();
+  leaf->text = text;
+  update(*leaf);
+  return leaf;
+}
+
+std::unique_ptr<RopeNode> clone(const RopeNode &node) {
+  auto copy = std::make_unique<RopeNode>();
+  copy->summary = node.summary;
+  copy->leaf = node.leaf;
+  copy->text = node.text;
+  for (const auto &child : node.children) {
+    copy->children.push_back(clone(*child));
+  }
+  return copy;
+}
+
+// Cuts an oversized node into evenly sized pieces, keeping the first in
+// place and returning the others, which go right after it in the parent
+RopeNodes split(RopeNode &node) {
+  RopeNodes rest;
+  if (node.leaf && node.text.size() > ROPE_LEAF_MAX) {
+    const std::u8string_view text = node.text;
+    const size_t pieces = (text.size() + ROPE_LEAF_MAX - 1) / ROPE_LEAF_MAX;
+    size_t end = text.size();
+    for (size_t piece = pieces - 1; piece > 0; --piece) {
+      const size_t start = code_point_start(text, text.size() * piece / pieces);
+      rest.push_back(make_leaf(text.substr(start, end - start)));
+      end = start;
+    }
+    std::reverse(rest.begin(), rest.end());
+    node.text.resize(end);
+  } else if (!node.leaf && node.children.size() > ROPE_NODE_MAX) {
+    const size_t count = node.children.size();
+    const size_t pieces = (count + ROPE_NODE_MAX - 1) / ROPE_NODE_MAX;
+    for (size_t piece = 1; piece < pieces; ++piece) {
+      auto sibling = std::make_unique<RopeNode>();
+      sibling->leaf = false;
+      sibling->children.assign(
+          std::make_move_iterator(node.children.begin() +
+                                  count * piece / pieces),
+          std::make_move_iterator(node.children.begin() +
+                                  count * (piece + 1) / pieces));
+      update(*sibling);
+      rest.push_back(std::move(sibling));
+    }
+    node.children.resize(count / pieces);
+  }
+  update(node);
+  return rest;
+}
+
+// Inserts valid UTF-8 at a code point boundary of the subtree, returning the
+// nodes split off as it overflowed
+RopeNodes insert(RopeNode &node, size_t offset, std::u8string_view text) {
+  if (node.leaf) {
+    node.text.insert(offset, text);
+    return split(node);
+  }
+  size_t i = 0;
+  for (; i + 1 < node.children.size() &&
+         offset > node.children[i]->summary.bytes;
+       ++i) {
+    offset -= node.children[i]->summary.bytes;
+  }
+  RopeNodes overflow = insert(*node.children[i], offset, text);
+  node.children.insert(node.children.begin() + i + 1,
+                       std::make_move_iterator(overflow.begin()),
+                       std::make_move_iterator(overflow.end()));
+  return split(node);
+}
+
+bool is_underfull(const RopeNode &node) {
+  return node.leaf ? node.text.size() < ROPE_LEAF_MIN
+                   : node.children.size() < ROPE_NODE_MIN;
+}
+
+// Merges `right` into `left` when they fit in one node, returning true, or
+// else evens out their sizes
+bool join(RopeNode &left, RopeNode &right) {
+  if (left.leaf) {
+    if (left.text.size() + right.text.size() <= ROPE_LEAF_MAX) {
+      left.text += right.text;
+      update(left);
+      return true;
+    }
+    std::u8string text = left.text + right.text;
+    const size_t middle = code_point_start(text, text.size() / 2);
+    right.text = text.substr(middle);
+    text.resize(middle);
+    left.text = std::move(text);
+  } else {
+    left.children.insert(left.children.end(),
+                         std::make_move_iterator(right.children.begin()),
+                         std::make_move_iterator(right.children.end()));
+    right.children.clear();
+    if (left.children.size() <= ROPE_NODE_MAX) {
+      update(left);
+      return true;
+    }
+    const size_t middle = left.children.size() / 2;
+    right.children.assign(std::make_move_iterator(left.children.begin() + middle),
+                          std::make_move_iterator(left.children.end()));
+    left.children.resize(middle);
+  }
+  update(left);
+  update(right);
+  return false;
+}
+
+// Removes bytes [start, end) of the subtree, both on code point boundaries,
+// then repairs the children left undersized. Only the two paths to the ends
+// of the range are visited; subtrees in between are dropped whole
+void erase(RopeNode &node, size_t start, size_t end) {
+  if (node.leaf) {
+    node.text.erase(start, end - start);
+    update(node);
+    return;
+  }
+  auto &children = node.children;
+  size_t child_start = 0;
+  for (size_t i = 0; i < children.size() && child_start < end;) {
+    const size_t child_end = child_start + children[i]->summary.bytes;
+    if (start <= child_start && child_end <= end) {
+      children.erase(children.begin() + i);
+    } else {
+      if (start < child_end) {
+        erase(*children[i], std::max(start, child_start) - child_start,
+              std::min(end, child_end) - child_start);
+      }
+      ++i;
+    }
+    child_start = child_end;
+  }
+  for (size_t i = 0; i < children.size();) {
+    if (!children[i]->leaf && children[i]->children.empty()) {
+      children.erase(children.begin() + i);
+    } else if (children.size() > 1 && is_underfull(*children[i])) {
+      const size_t left = i + 1 < children.size() ? i : i - 1;
+      if (join(*children[left], *children[left + 1])) {
+        children.erase(children.begin() + left + 1);
+      }
+      i = left;
+      if (!is_underfull(*children[i])) {
+        ++i;
+      }
+    } else {
+      ++i;
+    }
+  }
+  update(node);
+}
+
+// Walks down to the leaf holding `offset`, adding the summaries of the
+// subtrees passed over to `before`
+const RopeNode &find_leaf(const RopeNode &root, size_t &offset,
+                          RopeSummary &before) {
+  const RopeNode *node = &root;
+  while (!node->leaf) {
+    size_t i = 0;
+    for (; i + 1 < node->children.size() &&
+           offset >= node->children[i]->summary.bytes;
+         ++i) {
+      offset -= node->children[i]->summary.bytes;
+      before += node->children[i]->summary;
+    }
+    node = node->children[i].get();
+  }
+  return *node;
+}
+
+size_t clamp_offset(const RopeNode *root, size_t offset) {
+  if (root == nullptr) {
+    return 0;
+  }
+  if (offset >= root->summary.bytes) {
+    return root->summary.bytes;
+  }
+  RopeSummary before;
+  const RopeNode &leaf = find_leaf(*root, offset, before);
+  return before.bytes + code_point_start(leaf.text, offset);
+}
+
+// Amount of `metric` in a subtree entered in width `state`
+size_t measure(const RopeSummary &summary, wutils::TextMetric metric,
+               WidthState state) {
+  switch (metric) {
+  case wutils::TextMetric::Bytes:
+    return summary.bytes;
+  case wutils::TextMetric::Utf16Units:
+    return summary.utf16_units;
+  case wutils::TextMetric::CodePoints:
+    return summary.code_points;
+  case wutils::TextMetric::Newlines:
+    return summary.newlines;
+  case wutils::TextMetric::Width:
+    return summary.width[state];
+  }
+  return 0;
+}
+
+void append_range(const RopeNode &node, size_t start, size_t end,
+                  std::u8string &out) {
+  if (node.leaf) {
+    out.append(std::u8string_view(node.text).substr(start, end - start));
+    return;
+  }
+  size_t child_start = 0;
+  for (const auto &child : node.children) {
+    const size_t child_end = child_start + child->summary.bytes;
+    if (child_start >= end) {
+      break;
+    }
+    if (start < child_end) {
+      append_range(*child, std::max(start, child_start) - child_start,
+                   std::min(end, child_end) - child_start, out);
+    }
+    child_start = child_end;
+  }
+}
+
+} // namespace internal
+
+wutils::Rope::Rope() noexcept = default;
+
+wutils::Rope::Rope(const std::u8string_view text) { insert(0, text); }
+
+wutils::Rope::Rope(const Rope &other)
+    : root(other.root ? internal::clone(*other.root) : nullptr) {}
+
+wutils::Rope::Rope(Rope &&other) noexcept = default;
+
+wutils::Rope &wutils::Rope::operator=(const Rope &other) {
+  if (this != &other) {
+    root = other.root ? internal::clone(*other.root) : nullptr;
+  }
+  return *this;
+}
+
+wutils::Rope &wutils::Rope::operator=(Rope &&other) noexcept = default;
+
+wutils::Rope::~Rope() = default;
+
+void wutils::Rope::insert(const std::size_t offset,
+                          const std::u8string_view text) {
+  if (text.empty()) {
+    return;
+  }
+  if (!internal::is_valid_utf8(text)) {
+    insert(offset, internal::repair_utf8(text));
+    return;
+  }
+  const size_t at = internal::clamp_offset(root.get(), offset);
+  if (!root) {
+    root = internal::make_leaf({});
+  }
+  internal::RopeNodes overflow = internal::insert(*root, at, text);
+  while (!overflow.empty()) {
+    auto parent = std::make_unique<detail::RopeNode>();
+    parent->leaf = false;
+    parent->children.push_back(std::move(root));
+    parent->children.insert(parent->children.end(),
+                            std::make_move_iterator(overflow.begin()),
+                            std::make_move_iterator(overflow.end()));
+    root = std::move(parent);
+    overflow = internal::split(*root);
+  }
+}
+
+void wutils::Rope::erase(const std::size_t offset, const std::size_t count) {
+  const size_t start = internal::clamp_offset(root.get(), offset);
+  const size_t end = internal::clamp_offset(
+      root.get(), offset + std::min(count, size() - std::min(offset, size())));
+  if (start >= end) {
+    return;
+  }
+  internal::erase(*root, start, end);
+  while (!root->leaf && root->children.size() == 1) {
+    root = std::move(root->children.front());
+  }
+  if (!root->leaf && root->children.empty()) {
+    root.reset();
+  }
+}
+
+void wutils::Rope::clear() noexcept { root.reset(); }
+
+std::size_t wutils::Rope::size() const noexcept {
+  return root ? root->summary.bytes : 0;
+}
+
+wutils::TextMetrics wutils::Rope::metrics() const noexcept {
+  if (!root) {
+    return {};
+  }
+  const internal::RopeSummary &summary = root->summary;
+  return {summary.bytes, summary.utf16_units, summary.code_points,
+          summary.newlines, summary.width[internal::WIDTH_PLAIN]};
+}
+
+wutils::TextMetrics wutils::Rope::prefix(const std::size_t offset) const {
+  if (!root) {
+    return {};
+  }
+  size_t local = std::min(offset, size());
+  internal::RopeSummary before;
+  const detail::RopeNode &leaf = internal::find_leaf(*root, local, before);
+  const std::u8string_view head = std::u8string_view(leaf.text).substr(
+      0, internal::code_point_start(leaf.text, local));
+  internal::RopeSummary partial;
+  internal::count_units(head, partial);
+  internal::WidthState state = before.exit[internal::WIDTH_PLAIN];
+  return {before.bytes + partial.bytes,
+          before.utf16_units + partial.utf16_units,
+          before.code_points + partial.code_points,
+          before.newlines + partial.newlines,
+          before.width[internal::WIDTH_PLAIN] +
+              internal::measure_width(head, state)};
+}
+
+std::size_t wutils::Rope::offset_of(const TextMetric metric,
+                                    const std::size_t value) const {
+  if (!root) {
+    return 0;
+  }
+  if (metric == TextMetric::Bytes) {
+    return internal::clamp_offset(root.get(), value);
+  }
+  if (metric == TextMetric::Newlines && value == 0) {
+    return 0;
+  }
+  // Lines start past their preceding line feed, other positions are the
+  // last ones not exceeding the value
+  const bool lines = metric == TextMetric::Newlines;
+  auto reaches = [&](size_t amount) {
+    return lines ? amount >= value : amount > value;
+  };
+  size_t before = 0, offset = 0;
+  internal::WidthState state = internal::WIDTH_PLAIN;
+  const detail::RopeNode *node = root.get();
+  if (!reaches(internal::measure(node->summary, metric, state))) {
+    return size();
+  }
+  while (!node->leaf) {
+    for (const auto &child : node->children) {
+      const size_t amount = internal::measure(child->summary, metric, state);
+      if (reaches(before + amount)) {
+        node = child.get();
+        break;
+      }
+      before += amount;
+      offset += child->summary.bytes;
+      state = child->summary.exit[state];
+    }
+  }
+  const std::u8string_view text = node->text;
+  size_t i = 0;
+  if (lines) {
+    for (; before < value; ++i) {
+      before += text[i] == '\n';
+    }
+    return offset + i;
+  }
+  for (size_t units; i < text.size(); i += units) {
+    const char32_t cp = internal::code_point_at(text, i, units);
+    size_t amount = 1;
+    if (metric == TextMetric::Utf16Units) {
+      amount = cp > 0xFFFF ? 2 : 1;
+    } else if (metric == TextMetric::Width) {
+      amount = internal::width_step(state, cp);
+    }
+    if (before + amount > value) {
+      break;
+    }
+    before += amount;
+  }
+  return offset + i;
+}
+
+std::u8string wutils::Rope::substr(const std::size_t offset,
+                                   const std::size_t count) const {
+  std::u8string out;
+  const size_t start = internal::clamp_offset(root.get(), offset);
+  const size_t end = internal::clamp_offset(
+      root.get(), start + std::min(count, size() - start));
+  if (root && start < end) {
+    out.reserve(end - start);
+    internal::append_range(*root, start, end, out);
+  }
+  return out;
+}
+
+/* Text measurement */
+
+namespace internal {
+
+// Where a measurement stands between two code points
+struct MeasureState {
+  WidthState width = WIDTH_PLAIN;
+  GraphemeState grapheme;
+
+  bool operator==(const MeasureState &) const = default;
+};
+
+// Totals of a run of text. As in mk_wcswidth(), the width stops at the
+// first NUL and is void if a control character comes before it
+struct MeasureTally {
+  size_t width = 0;
+  size_t code_points = 0;
+  size_t graphemes = 0;
+  bool control = false;
+  bool ended = false; // A NUL was seen
+
+  // Appends the tally of the text that follows
+  MeasureTally &operator+=(const MeasureTally &next) {
+    if (!ended) {
+      width += next.width;
+      control |= next.control;
+      ended = next.ended;
+    }
+    code_points += next.code_points;
+    graphemes += next.graphemes;
+    return *this;
+  }
+};
+
+inline void measure_code_point(MeasureState &state, MeasureTally &tally,
+                               char32_t cp) {
+  const std::uint32_t record = property_record(cp);
+  const int width =
+      static_cast<int>((record >> PROPERTY_WIDTH_SHIFT) & PROPERTY_WIDTH_MASK) -
+      1;
+  const size_t columns = width_step(state.width, cp, width);
+  tally.ended |= cp == 0;
+  if (!tally.ended) {
+    tally.width += columns;
+    tally.control |= width < 0;
+  }
+  ++tally.code_points;
+  tally.graphemes += grapheme_break_before(state.grapheme, record);
+}
+
+// Code points of `text` as uswidth() reads them: UTF-8 and UTF-16 without
+// their invalid sequences, UTF-32 unit by unit. `visit` returns false to
+// stop, and the offset reached is returned
+template <typename CharT, typename Visit>
+size_t visit_code_points(std::basic_string_view<CharT> text, Visit visit) {
+  size_t i = 0;
+  while (i < text.size()) {
+    if constexpr (sizeof(CharT) == 4) {
+      if (!visit(text[i++])) {
+        break;
+      }
+    } else {
+      const DecodeResult decoded = decode_one(text.substr(i));
+      i += decoded.consumed_units;
+      if (decoded.is_valid && !visit(decoded.codepoint)) {
+        break;
+      }
+    }
+  }
+  return i;
+}
+
+inline uint64_t non_printable_bytes(uint64_t word) {
+  return less_bytes(word, 0x20) | equal_bytes(word, 0x7F) | (word & SWAR_HIGH);
+}
+
+template <typename CharT>
+void measure_text(std::basic_string_view<CharT> text, MeasureState &state,
+                  MeasureTally &tally) {
+  for (size_t i = 0; i < text.size();) {
+    if constexpr (sizeof(CharT) < 4) {
+      // Past the first character of a run of printable ASCII, every
+      // character is a cluster of one column, leaving the state as it is
+      if (text[i] >= 0x20 && text[i] < 0x7F) {
+        const size_t run =
+            ascii_run(text.substr(i), non_printable_bytes,
+                      [](char32_t c) { return c >= 0x20 && c != 0x7F; });
+        measure_code_point(state, tally, text[i]);
+        tally.code_points += run - 1;
+        tally.graphemes += run - 1;
+        tally.width += tally.ended ? 0 : run - 1;
+        i += run;
+        continue;
+      }
+    }
+    const size_t units = visit_code_points(text.substr(i), [&](char32_t cp) {
+      measure_code_point(state, tally, cp);
+      return false;
+    });
+    i += units;
+  }
+}
+
+// Measurement of a chunk entered at the start of text, with what it needs
+// to be re-entered in another state
+template <typename CharT> struct ChunkMeasure {
+  std::basic_string_view<CharT> text;
+  MeasureTally tally;
+  MeasureState exit;
+};
+
+// Adds `chunk`, entered in `state`, to `total`. The chunk only measures
+// differently until both readings reach the same state, usually within a
+// code point or two, so only that head is measured again
+template <typename CharT>
+void merge_chunk(MeasureTally &total, MeasureState &state,
+                 const ChunkMeasure<CharT> &chunk) {
+  MeasureState from_start;
+  MeasureTally actual, assumed;
+  bool converged = state == from_start;
+  visit_code_points(chunk.text, [&](char32_t cp) {
+    if (converged) {
+      return false;
+    }
+    measure_code_point(state, actual, cp);
+    measure_code_point(from_start, assumed, cp);
+    converged = state == from_start;
+    return true;
+  });
+  MeasureTally tally = chunk.tally;
+  tally.width += actual.width - assumed.width;
+  tally.graphemes += actual.graphemes - assumed.graphemes;
+  total += tally;
+  if (converged) {
+    state = chunk.exit;
+  }
+}
+
+template <typename CharT>
+wutils::TextCounts
+text_counts(std::basic_string_view<CharT> text,
+            const wutils::detail::TaskSubmitter *executor = nullptr) {
+  MeasureTally total;
+  if (executor == nullptr || !is_parallel_input(text)) {
+    MeasureState state;
+    measure_text(text, state, total);
+  } else {
+    const std::vector<size_t> bounds = chunk_bounds(text);
+    std::vector<ChunkMeasure<CharT>> chunks(bounds.size() - 1);
+    auto run = [&](size_t chunk) {
+      ChunkMeasure<CharT> &measure = chunks[chunk];
+      measure.text =
+          text.substr(bounds[chunk], bounds[chunk + 1] - bounds[chunk]);
+      measure_text(measure.text, measure.exit, measure.tally);
+    };
+    for_each_chunk(*executor, chunks.size(), run);
+    MeasureState state;
+    for (const ChunkMeasure<CharT> &chunk : chunks) {
+      merge_chunk(total, state, chunk);
+    }
+  }
+  return {total.control ? -1 : static_cast<int>(total.width),
+          total.code_points, total.graphemes};
+}
+} // namespace internal
+
+wutils::TextCounts wutils::text_counts(const std::u8string_view u8s) {
+  return internal::text_counts(u8s);
+}
+
+wutils::TextCounts wutils::text_counts(const std::u16string_view u16s) {
+  return internal::text_counts(u16s);
+}
+
+wutils::TextCounts wutils::text_counts(const std::u32string_view u32s) {
+  return internal::text_counts(u32s);
+}
+
+wutils::TextCounts wutils::detail::text_counts(const std::u8string_view u8s,
+                                               const TaskSubmitter executor) {
+  return internal::text_counts(u8s, &executor);
+}
+
+wutils::TextCounts wutils::detail::text_counts(const std::u16string_view u16s,
+                                               const TaskSubmitter executor) {
+  return internal::text_counts(u16s, &executor);
+}
+
+wutils::TextCounts wutils::detail::text_counts(const std::u32string_view u32s,
+                                               const TaskSubmitter executor) {
+  return internal::text_counts(u32s, &executor);
+}
+
+/* Cursor movement */
+
+namespace internal {
+
+// Start of the code point that ends at `pos`, as code_point_at() reads the
+// text forward: a sequence that does not decode to exactly the units before
+// `pos` is one unit
+template <typename CharT>
+size_t previous_code_point(std::basic_string_view<CharT> text, size_t pos) {
+  if constexpr (sizeof(CharT) == 1) {
+    size_t start = pos - 1;
+    while (start > 0 && pos - start < 4 && (text[start] & 0xC0) == 0x80) {
+      --start;
+    }
+    return decode_one(text.substr(start, pos - start)).consumed_units ==
+                   pos - start
+               ? start
+               : pos - 1;
+  } else if constexpr (sizeof(CharT) == 2) {
+    return pos >= 2 && (text[pos - 1] & 0xFC00) == 0xDC00 &&
+                   (text[pos - 2] & 0xFC00) == 0xD800
+               ? pos - 2
+               : pos - 1;
+  } else {
+    return pos - 1;
+  }
+}
+
+inline int record_width(std::uint32_t record) {
+  return static_cast<int>((record >> PROPERTY_WIDTH_SHIFT) &
+                          PROPERTY_WIDTH_MASK) -
+         1;
+}
+
+// Whether a cluster boundary lies between code points of properties `a` and
+// `b` whatever comes before them. Only GB11 and GB12 to GB13 look further
+// back, and then only between a ZWJ and a pictograph or two regional
+// indicators
+inline bool settled_grapheme_break(std::uint32_t a, std::uint32_t b) {
+  using GB = wutils::GraphemeBreak;
+  auto break_class = [](std::uint32_t record) {
+    return static_cast<GB>((record >> PROPERTY_GRAPHEME_BREAK_SHIFT) &
+                           PROPERTY_GRAPHEME_BREAK_MASK);
+  };
+  GraphemeState state;
+  state.previous = break_class(a);
+  if (!grapheme_break_before(state, b)) {
+    return false;
+  }
+  const bool pictographic = (b >> PROPERTY_EMOJI_SHIFT) & 0x20;
+  return !(break_class(a) == GB::ZWJ && pictographic) &&
+         !(break_class(a) == GB::RegionalIndicator &&
+           break_class(b) == GB::RegionalIndicator);
+}
+
+template <typename CharT>
+wutils::CursorStep next_grapheme_boundary(std::basic_string_view<CharT> text,
+                                          size_t offset) {
+  offset = std::min(offset, text.size());
+  GraphemeState state;
+  WidthState width = WIDTH_PLAIN;
+  size_t columns = 0, pos = offset;
+  while (pos < text.size()) {
+    size_t units;
+    const char32_t cp = code_point_at(text, pos, units);
+    const std::uint32_t record = property_record(cp);
+    if (grapheme_break_before(state, record) && pos != offset) {
+      break;
+    }
+    columns += width_step(width, cp, record_width(record));
+    pos += units;
+  }
+  return {pos, columns};
+}
+
+template <typename CharT>
+wutils::CursorStep prev_grapheme_boundary(std::basic_string_view<CharT> text,
+                                          size_t offset) {
+  offset = std::min(offset, text.size());
+  if (offset == 0) {
+    return {0, 0};
+  }
+  // Back to a boundary the code points on either side settle on their own
+  size_t start = previous_code_point(text, offset);
+  size_t units;
+  std::uint32_t after = property_record(code_point_at(text, start, units));
+  while (start > 0) {
+    const size_t before = previous_code_point(text, start);
+    const std::uint32_t record =
+        property_record(code_point_at(text, before, units));
+    if (settled_grapheme_break(record, after)) {
+      break;
+    }
+    start = before;
+    after = record;
+  }
+  // Then forward to the last boundary before `offset`, measuring from it
+  GraphemeState state;
+  WidthState width = WIDTH_PLAIN;
+  size_t boundary = start, columns = 0;
+  for (size_t pos = start; pos < offset; pos += units) {
+    const char32_t cp = code_point_at(text, pos, units);
+    const std::uint32_t record = property_record(cp);
+    if (grapheme_break_before(state, record)) {
+      boundary = pos;
+      columns = 0;
+      width = WIDTH_PLAIN;
+    }
+    columns += width_step(width, cp, record_width(record));
+  }
+  return {boundary, columns};
+}
+
+// Start of the code points that the word rules may look back at from
+// `offset`: the last two that are not Extend, Format or ZWJ, or the whole
+// run of regional indicators if the last is one
+template <typename CharT>
+size_t word_context_start(std::basic_string_view<CharT> text, size_t offset) {
+  size_t pos = offset, seen = 0;
+  bool regional = false;
+  while (pos > 0) {
+    pos = previous_code_point(text, pos);
+    size_t units;
+    const WordBreakClass c =
+        word_break_class(property_index(code_point_at(text, pos, units)));
+    if (is_word_ignorable(c)) {
+      continue;
+    }
+    if (++seen == 1) {
+      regional = c == WB_RegionalIndicator;
+    } else if (!regional || c != WB_RegionalIndicator) {
+      break;
+    }
+  }
+  return pos;
+}
+
+template <typename CharT>
+wutils::CursorStep next_word_boundary(std::basic_string_view<CharT> text,
+                                      size_t offset) {
+  offset = std::min(offset, text.size());
+  wutils::detail::WordBreakState state;
+  size_t units;
+  for (size_t pos = word_context_start(text, offset); pos < offset;
+       pos += units) {
+    advance_word_state(
+        state,
+        word_break_class(property_index(code_point_at(text, pos, units))));
+  }
+  wutils::CursorStep step{};
+  step.offset = next_word_break(text, offset, state, step.word);
+  WidthState width = WIDTH_PLAIN;
+  for (size_t pos = offset; pos < step.offset; pos += units) {
+    const char32_t cp = code_point_at(text, pos, units);
+    step.columns += width_step(width, cp, record_width(property_record(cp)));
+  }
+  return step;
+}
+
+} // namespace internal
+
+wutils::CursorStep
+wutils::detail::next_grapheme_boundary(const std::u8string_view text,
+                                       const size_t offset) {
+  return internal::next_grapheme_boundary(text, offset);
+}
+
+wutils::CursorStep
+wutils::detail::next_grapheme_boundary(const std::u16string_view text,
+                                       const size_t offset) {
+  return internal::next_grapheme_boundary(text, offset);
+}
+
+wutils::CursorStep
+wutils::detail::next_grapheme_boundary(const std::u32string_view text,
+                                       const size_t offset) {
+  return internal::next_grapheme_boundary(text, offset);
+}
+
+wutils::CursorStep
+wutils::detail::prev_grapheme_boundary(const std::u8string_view text,
+                                       const size_t offset) {
+  return internal::prev_grapheme_boundary(text, offset);
+}
+
+wutils::CursorStep
+wutils::detail::prev_grapheme_boundary(const std::u16string_view text,
+                                       const size_t offset) {
+  return internal::prev_grapheme_boundary(text, offset);
+}
+
+wutils::CursorStep
+wutils::detail::prev_grapheme_boundary(const std::u32string_view text,
+                                       const size_t offset) {
+  return internal::prev_grapheme_boundary(text, offset);
+}
+
+wutils::CursorStep
+wutils::detail::next_word_boundary(const std::u8string_view text,
+                                   const size_t offset) {
+  return internal::next_word_boundary(text, offset);
+}
+
+wutils::CursorStep
+wutils::detail::next_word_boundary(const std::u16string_view text,
+                                   const size_t offset) {
+  return internal::next_word_boundary(text, offset);
+}
+
+wutils::CursorStep
+wutils::detail::next_word_boundary(const std::u32string_view text,
+                                   const size_t offset) {
+  return internal::next_word_boundary(text, offset);
+}
+
+/* Bidirectional text */
+
+namespace internal {
+
+using wutils::BidiClass;
+
+inline BidiClass bidi_class_at(size_t index) {
+  return static_cast<BidiClass>(
+      (segment_records[index] >> PROPERTY_BIDI_CLASS_SHIFT) &
+      PROPERTY_BIDI_CLASS_MASK);
+}
+
+inline bool is_rtl_class(BidiClass c) {
+  return c == BidiClass::R || c == BidiClass::AL || c == BidiClass::AN ||
+         c == BidiClass::RLE || c == BidiClass::RLO || c == BidiClass::RLI;
+}
+
+// Lead bytes of the code points that may be right-to-left: U+0590 to
+// U+08FF, U+2000 to U+2FFF for the explicit controls, U+F000 to U+FFFF for
+// the presentation forms and U+10000 to U+3FFFF
+inline bool is_rtl_lead(char8_t byte) {
+  return (byte >= 0xD6 && byte <= 0xE0) || byte == 0xE2 || byte == 0xEF ||
+         byte == 0xF0;
+}
+
+// High bit set in the bytes of `word` for which is_rtl_lead() holds
+inline uint64_t rtl_lead_bytes(uint64_t word) {
+  const uint64_t low = word & SWAR_LOW7;
+  const uint64_t range =
+      word & SWAR_HIGH & ~less_bytes(low, 0x56) & less_bytes(low, 0x61);
+  return range | equal_bytes(word, 0xE2) | equal_bytes(word, 0xEF) |
+         equal_bytes(word, 0xF0);
+}
+
+// Offset of the first code unit from `pos` on that may start a
+// right-to-left code point
+template <typename CharT>
+size_t next_rtl_candidate(std::basic_string_view<CharT> text, size_t pos) {
+  if constexpr (sizeof(CharT) == 1) {
+    for (; pos + 8 <= text.size(); pos += 8) {
+      const uint64_t mask = rtl_lead_bytes(load_word(text.data() + pos));
+      if (mask != 0) {
+        return pos + first_flagged(mask);
+      }
+    }
+    while (pos < text.size() && !is_rtl_lead(text[pos])) {
+      ++pos;
+    }
+  } else {
+    while (pos < text.size() && text[pos] < 0x0590) {
+      ++pos;
+    }
+  }
+  return pos;
+}
+
+template <typename CharT> bool has_rtl(std::basic_string_view<CharT> text) {
+  size_t pos = 0;
+  while ((pos = next_rtl_candidate(text, pos)) < text.size()) {
+    size_t units;
+    if (is_rtl_class(
+            bidi_class_at(property_index(code_point_at(text, pos, units))))) {
+      return true;
+    }
+    pos += units;
+  }
+  return false;
+}
+
+constexpr std::uint8_t BIDI_MAX_DEPTH = 125;
+constexpr size_t NO_MATCHING_PDI = SIZE_MAX;
+
+inline bool is_isolate_initiator(BidiClass c) {
+  return c == BidiClass::LRI || c == BidiClass::RLI || c == BidiClass::FSI;
+}
+
+// Characters rule X9 removes, kept in place here and skipped by the rules
+// that follow it
+inline bool is_removed_by_x9(BidiClass c) {
+  return c == BidiClass::RLE || c == BidiClass::LRE || c == BidiClass::RLO ||
+         c == BidiClass::LRO || c == BidiClass::PDF || c == BidiClass::BN;
+}
+
+inline bool is_neutral_or_isolate(BidiClass c) {
+  return c == BidiClass::B || c == BidiClass::S || c == BidiClass::WS ||
+         c == BidiClass::ON || is_isolate_initiator(c) || c == BidiClass::PDI;
+}
+
+// Direction a resolved type counts as for rules N0 and N1, ON if none
+inline BidiClass strong_direction(BidiClass c) {
+  if (c == BidiClass::L) {
+    return BidiClass::L;
+  }
+  return c == BidiClass::R || c == BidiClass::EN || c == BidiClass::AN
+             ? BidiClass::R
+             : BidiClass::ON;
+}
+
+inline BidiClass level_direction(std::uint8_t level) {
+  return level & 1 ? BidiClass::R : BidiClass::L;
+}
+
+inline const BidiBracket *find_bracket(char32_t cp) {
+  const BidiBracket *end = std::end(bidi_brackets);
+  const BidiBracket *found = std::lower_bound(
+      std::begin(bidi_brackets), end, cp,
+      [](const BidiBracket &b, char32_t c) { return b.code_point < c; });
+  return found != end && found->code_point == cp ? found : nullptr;
+}
+
+// U+2329 and U+232A are canonically equivalent to U+3008 and U+3009, and
+// pair with them (BD16)
+inline char32_t canonical_bracket(char32_t cp) {
+  return cp == 0x2329 ? 0x3008 : (cp == 0x232A ? 0x3009 : cp);
+}
+
+// One paragraph, code point by code point. The buffers are reused from one
+// paragraph to the next
+struct BidiParagraph {
+  std::vector<size_t> offsets; // Of each code point, then of the end
+  std::vector<char32_t> code_points;
+  std::vector<BidiClass> initial;
+  std::vector<BidiClass> types;
+  std::vector<std::uint8_t> levels;
+  std::vector<size_t> matching_pdi; // Of isolate initiators (BD9)
+  std::vector<size_t> kept;         // Code points not removed by X9
+  std::uint8_t level = 0;
+
+  size_t size() const { return code_points.size(); }
+};
+
+// P2, P3: level of the first strong character in [begin, end), skipping
+// isolates, or `fallback` if there is none
+inline std::uint8_t first_strong_level(const BidiParagraph &p, size_t begin,
+                                       size_t end, std::uint8_t fallback) {
+  for (size_t i = begin; i < end; ++i) {
+    const BidiClass c = p.initial[i];
+    if (c == BidiClass::L) {
+      return 0;
+    }
+    if (c == BidiClass::R || c == BidiClass::AL) {
+      return 1;
+    }
+    if (is_isolate_initiator(c)) {
+      if (p.matching_pdi[i] == NO_MATCHING_PDI) {
+        break;
+      }
+      i = p.matching_pdi[i];
+    }
+  }
+  return fallback;
+}
+
+// X1 to X8: explicit levels and directions
+inline void resolve_explicit(BidiParagraph &p) {
+  struct Status {
+    std::uint8_t level;
+    BidiClass override; // ON for none
+    bool isolate;
+  };
+  std::vector<Status> stack{{p.level, BidiClass::ON, false}};
+  stack.reserve(BIDI_MAX_DEPTH + 2);
+  size_t overflow_isolates = 0, overflow_embeddings = 0, valid_isolates = 0;
+  auto next_level = [&](bool rtl) {
+    const std::uint8_t level = stack.back().level;
+    return static_cast<std::uint8_t>(rtl ? (level + 1) | 1
+                                         : (level + 2) & ~1);
+  };
+  for (size_t i = 0; i < p.size(); ++i) {
+    const BidiClass c = p.initial[i];
+    const Status top = stack.back();
+    p.levels[i] = top.level;
+    switch (c) {
+    case BidiClass::RLE:
+    case BidiClass::LRE:
+    case BidiClass::RLO:
+    case BidiClass::LRO: {
+      const std::uint8_t level =
+          next_level(c == BidiClass::RLE || c == BidiClass::RLO);
+      if (level <= BIDI_MAX_DEPTH && overflow_isolates == 0 &&
+          overflow_embeddings == 0) {
+        stack.push_back({level,
+                         c == BidiClass::RLO   ? BidiClass::R
+                         : c == BidiClass::LRO ? BidiClass::L
+                                               : BidiClass::ON,
+                         false});
+      } else if (overflow_isolates == 0) {
+        ++overflow_embeddings;
+      }
+      break;
+    }
+    case BidiClass::RLI:
+    case BidiClass::LRI:
+    case BidiClass::FSI: {
+      if (top.override != BidiClass::ON) {
+        p.types[i] = top.override;
+      }
+      bool rtl = c == BidiClass::RLI;
+      if (c == BidiClass::FSI) {
+        const size_t end = p.matching_pdi[i] == NO_MATCHING_PDI
+                               ? p.size()
+                               : p.matching_pdi[i];
+        rtl = first_strong_level(p, i + 1, end, 0) == 1;
+      }
+      const std::uint8_t level = next_level(rtl);
+      if (level <= BIDI_MAX_DEPTH && overflow_isolates == 0 &&
+          overflow_embeddings == 0) {
+        ++valid_isolates;
+        stack.push_back({level, BidiClass::ON, true});
+      } else {
+        ++overflow_isolates;
+      }
+      break;
+    }
+    case BidiClass::PDI:
+      if (overflow_isolates > 0) {
+        --overflow_isolates;
+      } else if (valid_isolates > 0) {
+        overflow_embeddings = 0;
+        while (!stack.back().isolate) {
+          stack.pop_back();
+        }
+        stack.pop_back();
+        --valid_isolates;
+      }
+      p.levels[i] = stack.back().level;
+      if (stack.back().override != BidiClass::ON) {
+        p.types[i] = stack.back().override;
+      }
+      break;
+    case BidiClass::PDF:
+      if (overflow_isolates > 0) {
+      } else if (overflow_embeddings > 0) {
+        --overflow_embeddings;
+      } else if (!top.isolate && stack.size() >= 2) {
+        stack.pop_back();
+      }
+      break;
+    case BidiClass::B:
+      p.levels[i] = p.level;
+      break;
+    case BidiClass::BN:
+      break;
+    default:
+      if (top.override != BidiClass::ON) {
+        p.types[i] = top.override;
+      }
+      break;
+    }
+  }
+}
+
+// W1 to W7, N0 to N2 and I1 to I2 over one isolating run sequence, the
+// code points `seq` of the paragraph
+inline void resolve_sequence(BidiParagraph &p, const std::vector<size_t> &seq,
+                             BidiClass sos, BidiClass eos) {
+  using BC = BidiClass;
+  const size_t n = seq.size();
+  const std::uint8_t level = p.levels[seq[0]];
+  const BidiClass embedding = level_direction(level);
+  auto type = [&](size_t k) -> BidiClass & { return p.types[seq[k]]; };
+
+  // W1 to W3
+  BidiClass strong = sos;
+  for (size_t k = 0; k < n; ++k) {
+    if (type(k) == BC::NSM) {
+      type(k) = k == 0 ? sos
+                : is_isolate_initiator(p.initial[seq[k - 1]]) ||
+                        p.initial[seq[k - 1]] == BC::PDI
+                    ? BC::ON
+                    : type(k - 1);
+    }
+    const BidiClass c = type(k);
+    if (c == BC::L || c == BC::R || c == BC::AL) {
+      strong = c;
+    } else if (c == BC::EN && strong == BC::AL) {
+      type(k) = BC::AN;
+    }
+  }
+  for (size_t k = 0; k < n; ++k) {
+    if (type(k) == BC::AL) {
+      type(k) = BC::R;
+    }
+  }
+  // W4
+  for (size_t k = 1; k + 1 < n; ++k) {
+    const BidiClass before = type(k - 1), after = type(k + 1);
+    if (type(k) == BC::ES && before == BC::EN && after == BC::EN) {
+      type(k) = BC::EN;
+    } else if (type(k) == BC::CS && before == after &&
+               (before == BC::EN || before == BC::AN)) {
+      type(k) = before;
+    }
+  }
+  // W5, W6
+  for (size_t k = 0; k < n;) {
+    if (type(k) != BC::ET) {
+      ++k;
+      continue;
+    }
+    size_t end = k;
+    while (end < n && type(end) == BC::ET) {
+      ++end;
+    }
+    const bool number =
+        (k > 0 && type(k - 1) == BC::EN) || (end < n && type(end) == BC::EN);
+    for (; k < end; ++k) {
+      type(k) = number ? BC::EN : BC::ON;
+    }
+  }
+  for (size_t k = 0; k < n; ++k) {
+    if (type(k) == BC::ES || type(k) == BC::CS) {
+      type(k) = BC::ON;
+    }
+  }
+  // W7
+  strong = sos;
+  for (size_t k = 0; k < n; ++k) {
+    if (type(k) == BC::L || type(k) == BC::R) {
+      strong = type(k);
+    } else if (type(k) == BC::EN && strong == BC::L) {
+      type(k) = BC::L;
+    }
+  }
+
+  // N0: bracket pairs, found as in BD16 with a stack of 63 openings
+  struct Opening {
+    char32_t pair;
+    size_t k;
+  };
+  std::vector<Opening> openings;
+  std::vector<std::pair<size_t, size_t>> pairs;
+  for (size_t k = 0; k < n; ++k) {
+    const BidiBracket *bracket =
+        type(k) == BC::ON ? find_bracket(p.code_points[seq[k]]) : nullptr;
+    if (bracket == nullptr) {
+      continue;
+    }
+    if (bracket->opening) {
+      if (openings.size() == 63) {
+        break;
+      }
+      openings.push_back({canonical_bracket(bracket->pair), k});
+      continue;
+    }
+    const char32_t closing = canonical_bracket(bracket->code_point);
+    for (size_t j = openings.size(); j-- > 0;) {
+      if (openings[j].pair == closing) {
+        pairs.emplace_back(openings[j].k, k);
+        openings.resize(j);
+        break;
+      }
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+  for (const auto &[open, close] : pairs) {
+    BidiClass inside = BC::ON;
+    for (size_t k = open + 1; k < close && inside != embedding; ++k) {
+      const BidiClass d = strong_direction(type(k));
+      if (d != BC::ON) {
+        inside = d;
+      }
+    }
+    if (inside == BC::ON) {
+      continue;
+    }
+    BidiClass resolved = embedding;
+    if (inside != embedding) {
+      BidiClass before = sos;
+      for (size_t k = open; k-- > 0;) {
+        if (strong_direction(type(k)) != BC::ON) {
+          before = strong_direction(type(k));
+          break;
+        }
+      }
+      resolved = before == inside ? inside : embedding;
+    }
+    for (const size_t bracket : {open, close}) {
+      type(bracket) = resolved;
+      for (size_t k = bracket + 1; k < n && p.initial[seq[k]] == BC::NSM;
+           ++k) {
+        type(k) = resolved;
+      }
+    }
+  }
+
+  // N1, N2
+  for (size_t k = 0; k < n;) {
+    if (!is_neutral_or_isolate(type(k))) {
+      ++k;
+      continue;
+    }
+    size_t end = k;
+    while (end < n && is_neutral_or_isolate(type(end))) {
+      ++end;
+    }
+    const BidiClass before = k == 0 ? sos : strong_direction(type(k - 1));
+    const BidiClass after = end == n ? eos : strong_direction(type(end));
+    const BidiClass resolved = before == after ? before : embedding;
+    for (; k < end; ++k) {
+      type(k) = resolved;
+    }
+  }
+
+  // I1, I2
+  for (size_t k = 0; k < n; ++k) {
+    std::uint8_t &l = p.levels[seq[k]];
+    const BidiClass c = type(k);
+    if (l % 2 == 0) {
+      l += c == BC::R ? 1 : (c == BC::AN || c == BC::EN ? 2 : 0);
+    } else if (c == BC::L || c == BC::EN || c == BC::AN) {
+      ++l;
+    }
+  }
+}
+
+// X9 to I2, and L1, over the code points of `p` once classified
+inline void resolve_paragraph(BidiParagraph &p,
+                              wutils::BidiDirection direction) {
+  using BC = BidiClass;
+  const size_t n = p.size();
+  p.matching_pdi.assign(n, NO_MATCHING_PDI);
+  std::vector<size_t> open_isolates;
+  for (size_t i = 0; i < n; ++i) {
+    if (is_isolate_initiator(p.initial[i])) {
+      open_isolates.push_back(i);
+    } else if (p.initial[i] == BC::PDI && !open_isolates.empty()) {
+      p.matching_pdi[open_isolates.back()] = i;
+      open_isolates.pop_back();
+    }
+  }
+  p.level = direction == wutils::BidiDirection::RightToLeft ? 1
+            : direction == wutils::BidiDirection::LeftToRight
+                ? 0
+                : first_strong_level(p, 0, n, 0);
+  p.types = p.initial;
+  p.levels.assign(n, p.level);
+  resolve_explicit(p);
+
+  // X10: level runs of the code points X9 keeps, chained into isolating run
+  // sequences across isolates
+  p.kept.clear();
+  p.kept.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    if (!is_removed_by_x9(p.initial[i])) {
+      p.kept.push_back(i);
+    }
+  }
+  std::vector<size_t> run_starts; // Positions in kept
+  std::vector<size_t> run_of(n), kept_at(n);
+  for (size_t k = 0; k < p.kept.size(); ++k) {
+    if (k == 0 || p.levels[p.kept[k]] != p.levels[p.kept[k - 1]]) {
+      run_starts.push_back(k);
+    }
+    run_of[p.kept[k]] = run_starts.size() - 1;
+    kept_at[p.kept[k]] = k;
+  }
+  run_starts.push_back(p.kept.size());
+  // sos and eos compare with the levels before I1 and I2
+  const std::vector<std::uint8_t> explicit_levels = p.levels;
+  auto level_at = [&](size_t k) {
+    return k < p.kept.size() ? explicit_levels[p.kept[k]] : p.level;
+  };
+  std::vector<bool> chained(run_starts.size());
+  std::vector<size_t> seq;
+  seq.reserve(p.kept.size());
+  for (size_t run = 0; run + 1 < run_starts.size(); ++run) {
+    if (chained[run]) {
+      continue;
+    }
+    seq.clear();
+    size_t last = 0;
+    for (size_t r = run;;) {
+      for (size_t k = run_starts[r]; k < run_starts[r + 1]; ++k) {
+        seq.push_back(p.kept[k]);
+      }
+      last = run_starts[r + 1] - 1;
+      // A run ending with an isolate initiator goes on with the one
+      // starting with its matching PDI
+      const size_t pdi = p.matching_pdi[p.kept[last]];
+      if (pdi == NO_MATCHING_PDI || run_starts[run_of[pdi]] != kept_at[pdi]) {
+        break;
+      }
+      r = run_of[pdi];
+      chained[r] = true;
+    }
+    const std::uint8_t level = p.levels[seq[0]];
+    const size_t first = run_starts[run];
+    const std::uint8_t before = first == 0 ? p.level : level_at(first - 1);
+    const std::uint8_t after = is_isolate_initiator(p.initial[seq.back()])
+                                   ? p.level
+                                   : level_at(last + 1);
+    resolve_sequence(p, seq, level_direction(std::max(level, before)),
+                     level_direction(std::max(level, after)));
+  }
+
+  // Removed characters take the level of the one before them, which keeps
+  // them inside the run they were typed in
+  for (size_t i = 0; i < n; ++i) {
+    if (is_removed_by_x9(p.initial[i])) {
+      p.levels[i] = i == 0 ? p.level : p.levels[i - 1];
+    }
+  }
+  // L1: separators, and whitespace before them or at the end of the line
+  bool trailing = true;
+  for (size_t i = n; i-- > 0;) {
+    const BC c = p.initial[i];
+    if (c == BC::B || c == BC::S) {
+      p.levels[i] = p.level;
+      trailing = true;
+    } else if (c == BC::WS || is_isolate_initiator(c) || c == BC::PDI ||
+               is_removed_by_x9(c)) {
+      if (trailing) {
+        p.levels[i] = p.level;
+      }
+    } else {
+      trailing = false;
+    }
+  }
+}
+
+// L2: runs of equal level, reversed from the highest level down to the
+// lowest odd one
+inline void append_visual_runs(std::vector<wutils::BidiRun> &runs,
+                               const BidiParagraph &p) {
+  const size_t first = runs.size();
+  for (size_t i = 0; i < p.size();) {
+    size_t end = i + 1;
+    while (end < p.size() && p.levels[end] == p.levels[i]) {
+      ++end;
+    }
+    runs.push_back({p.offsets[i], p.offsets[end] - p.offsets[i], p.levels[i]});
+    i = end;
+  }
+  std::uint8_t highest = 0, lowest_odd = BIDI_MAX_DEPTH + 2;
+  for (size_t r = first; r < runs.size(); ++r) {
+    highest = std::max(highest, runs[r].level);
+    if (runs[r].level & 1) {
+      lowest_odd = std::min(lowest_odd, runs[r].level);
+    }
+  }
+  for (std::uint8_t level = highest; level >= lowest_odd; --level) {
+    for (size_t r = first; r < runs.size();) {
+      if (runs[r].level < level) {
+        ++r;
+        continue;
+      }
+      size_t end = r;
+      while (end < runs.size() && runs[end].level >= level) {
+        ++end;
+      }
+      std::reverse(runs.begin() + r, runs.begin() + end);
+      r = end;
+    }
+  }
+}
+
+template <typename CharT>
+void append_bidi_runs(std::vector<wutils::BidiRun> &runs,
+                      std::basic_string_view<CharT> line,
+                      wutils::BidiDirection direction) {
+  if (line.empty()) {
+    return;
+  }
+  if (direction != wutils::BidiDirection::RightToLeft && !has_rtl(line)) {
+    runs.push_back({0, line.size(), 0});
+    return;
+  }
+  BidiParagraph p;
+  p.offsets.reserve(line.size() + 1);
+  p.code_points.reserve(line.size());
+  p.initial.reserve(line.size());
+  for (size_t pos = 0; pos < line.size();) {
+    p.offsets.clear();
+    p.code_points.clear();
+    p.initial.clear();
+    BidiClass c = BidiClass::L;
+    while (pos < line.size() && c != BidiClass::B) {
+      size_t units;
+      const char32_t cp = code_point_at(line, pos, units);
+      c = bidi_class_at(property_index(cp));
+      p.offsets.push_back(pos);
+      p.code_points.push_back(cp);
+      p.initial.push_back(c);
+      pos += units;
+    }
+    p.offsets.push_back(pos);
+    resolve_paragraph(p, direction);
+    append_visual_runs(runs, p);
+  }
+}
+
+} // namespace internal
+
+wutils::BidiClass wutils::bidi_class(const char32_t cp) {
+  return internal::bidi_class_at(internal::property_index(cp));
+}
+
+char32_t wutils::bidi_mirror(const char32_t cp) {
+  using internal::BidiMirror;
+  const BidiMirror *end = std::end(internal::bidi_mirrors);
+  const BidiMirror *found = std::lower_bound(
+      std::begin(internal::bidi_mirrors), end, cp,
+      [](const BidiMirror &m, char32_t c) { return m.code_point < c; });
+  return found != end && found->code_point == cp ? found->mirror : cp;
+}
+
+bool wutils::detail::has_rtl(const std::u8string_view text) {
+  return internal::has_rtl(text);
+}
+
+bool wutils::detail::has_rtl(const std::u16string_view text) {
+  return internal::has_rtl(text);
+}
+
+bool wutils::detail::has_rtl(const std::u32string_view text) {
+  return internal::has_rtl(text);
+}
+
+void wutils::detail::append_bidi_runs(std::vector<BidiRun> &runs,
+                                      const std::u8string_view line,
+                                      const BidiDirection direction) {
+  internal::append_bidi_runs(runs, line, direction);
+}
+
+void wutils::detail::append_bidi_runs(std::vector<BidiRun> &runs,
+                                      const std::u16string_view line,
+                                      const BidiDirection direction) {
+  internal::append_bidi_runs(runs, line, direction);
+}
+
+void wutils::detail::append_bidi_runs(std::vector<BidiRun> &runs,
+                                      const std::u32string_view line,
+                                      const BidiDirection direction) {
+  internal::append_bidi_runs(runs, line, direction);
+}
+
+/* Telemetry */
+
+bool wutils::telemetry_enabled() {
+#ifdef WUTILS_TELEMETRY
+  return true;
+#else
+  return false;
+#endif
+}
+
+wutils::TelemetrySnapshot wutils::telemetry_snapshot() {
+  TelemetrySnapshot snapshot;
+#ifdef WUTILS_TELEMETRY
+  auto add = [](std::uint64_t &total, const std::atomic<uint64_t> &counter) {
+    total += counter.load(std::memory_order_relaxed);
+  };
+  for (const internal::ThreadTelemetry *block =
+           internal::telemetry_threads.load(std::memory_order_acquire);
+       block != nullptr; block = block->next) {
+    for (size_t pair = 0; pair < internal::TELEMETRY_PAIRS; ++pair) {
+      const internal::PairCounters &counters = block->pairs[pair];
+      ConversionTelemetry &total = snapshot.pairs[pair];
+      add(total.calls, counters.calls);
+      add(total.input_units, counters.input_units);
+      add(total.output_units, counters.output_units);
+      add(total.invalid_sequences, counters.invalid_sequences);
+      for (size_t loop = 0; loop < 5; ++loop) {
+        add(total.loop_calls[loop], counters.loop_calls[loop]);
+      }
+      for (size_t bucket = 0; bucket < TELEMETRY_BUCKETS; ++bucket) {
+        add(total.size_histogram[bucket], counters.size_histogram[bucket]);
+        add(total.latency_histogram[bucket],
+            counters.latency_histogram[bucket]);
+      }
+    }
+  }
+#endif
+  return snapshot;
+}
+
+wutils::TelemetrySnapshot
+wutils::TelemetrySnapshot::since(const TelemetrySnapshot &earlier) const {
+  TelemetrySnapshot delta = *this;
+  for (size_t pair = 0; pair < 6; ++pair) {
+    ConversionTelemetry &now = delta.pairs[pair];
+    const ConversionTelemetry &then = earlier.pairs[pair];
+    now.calls -= then.calls;
+    now.input_units -= then.input_units;
+    now.output_units -= then.output_units;
+    now.invalid_sequences -= then.invalid_sequences;
+    for (size_t loop = 0; loop < 5; ++loop) {
+      now.loop_calls[loop] -= then.loop_calls[loop];
+    }
+    for (size_t bucket = 0; bucket < TELEMETRY_BUCKETS; ++bucket) {
+      now.size_histogram[bucket] -= then.size_histogram[bucket];
+      now.latency_histogram[bucket] -= then.latency_histogram[bucket];
     }
-    i += decoded.consumed_units;
   }
-  return {result, is_valid};
+  return delta;
 }
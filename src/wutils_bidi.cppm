@@ -0,0 +1,127 @@
+module;
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+export module wutils:bidi;
+
+export import :core;
+
+export namespace wutils {
+
+enum class BidiClass : std::uint8_t {
+  L,
+  R,
+  AL,
+  EN,
+  ES,
+  ET,
+  AN,
+  CS,
+  NSM,
+  BN,
+  B,
+  S,
+  WS,
+  ON,
+  LRE,
+  LRO,
+  RLE,
+  RLO,
+  PDF,
+  LRI,
+  RLI,
+  FSI,
+  PDI
+};
+
+BidiClass bidi_class(char32_t cp);
+
+char32_t bidi_mirror(char32_t cp);
+
+enum class BidiDirection : std::uint8_t { Auto, LeftToRight, RightToLeft };
+
+struct BidiRun {
+  std::size_t offset;
+  std::size_t length;
+  std::uint8_t level;
+
+  bool right_to_left() const { return level & 1; }
+
+  bool operator==(const BidiRun &) const = default;
+};
+
+namespace detail {
+
+bool has_rtl(std::u8string_view text);
+bool has_rtl(std::u16string_view text);
+bool has_rtl(std::u32string_view text);
+
+void append_bidi_runs(std::vector<BidiRun> &runs, std::u8string_view line,
+                      BidiDirection direction);
+void append_bidi_runs(std::vector<BidiRun> &runs, std::u16string_view line,
+                      BidiDirection direction);
+void append_bidi_runs(std::vector<BidiRun> &runs, std::u32string_view line,
+                      BidiDirection direction);
+
+}
+
+template <BasicStringView From> inline bool has_rtl(const From &text) {
+  return detail::has_rtl(detail::as_unicode(text));
+}
+
+template <BasicStringView From>
+inline std::vector<BidiRun>
+bidi_runs(const From &line, BidiDirection direction = BidiDirection::Auto) {
+  std::vector<BidiRun> runs;
+  detail::append_bidi_runs(runs, detail::as_unicode(line), direction);
+  return runs;
+}
+
+class BidiCache {
+public:
+  template <BasicStringView From>
+  std::span<const BidiRun>
+  runs(std::size_t line, const From &text,
+       BidiDirection direction = BidiDirection::Auto) {
+    const auto units = detail::as_unicode(text);
+    using Unit = typename decltype(units)::value_type;
+    const std::string_view bytes(reinterpret_cast<const char *>(units.data()),
+                                 units.size() * sizeof(Unit));
+    Entry &entry = lines[line];
+    if (entry.unit_size != sizeof(Unit) || entry.units != bytes ||
+        entry.direction != direction) {
+      entry.runs.clear();
+      detail::append_bidi_runs(entry.runs, units, direction);
+      entry.units.assign(bytes);
+      entry.unit_size = sizeof(Unit);
+      entry.direction = direction;
+      ++misses;
+    }
+    return entry.runs;
+  }
+
+  void erase(std::size_t line) { lines.erase(line); }
+
+  void clear() { lines.clear(); }
+
+  std::size_t resolved() const { return misses; }
+
+private:
+  struct Entry {
+    std::vector<BidiRun> runs;
+    std::string units;
+    std::size_t unit_size = 0;
+    BidiDirection direction = BidiDirection::Auto;
+  };
+
+  std::unordered_map<std::size_t, Entry> lines;
+  std::size_t misses = 0;
+};
+
+} // namespace wutils
@@ -0,0 +1,71 @@
+module;
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+export module wutils:collation;
+
+export import :core;
+
+export namespace wutils {
+
+enum class CollationStrength { Primary, Secondary, Tertiary };
+
+namespace detail {
+
+void append_sort_key(std::string &key, std::u8string_view text,
+                     CollationStrength strength);
+void append_sort_key(std::string &key, std::u16string_view text,
+                     CollationStrength strength);
+void append_sort_key(std::string &key, std::u32string_view text,
+                     CollationStrength strength);
+
+}
+
+template <BasicStringView From>
+inline std::string
+sort_key(const From &from,
+         CollationStrength strength = CollationStrength::Tertiary) {
+  std::string key;
+  detail::append_sort_key(key, detail::as_unicode(from), strength);
+  return key;
+}
+
+class SortKeyArena {
+public:
+  explicit SortKeyArena(
+      CollationStrength strength = CollationStrength::Tertiary)
+      : strength(strength) {}
+
+  template <BasicStringView From> std::size_t add(const From &from) {
+    detail::append_sort_key(bytes, detail::as_unicode(from), strength);
+    ends.push_back(bytes.size());
+    return ends.size() - 1;
+  }
+
+  std::string_view operator[](std::size_t index) const {
+    const std::size_t start = index == 0 ? 0 : ends[index - 1];
+    return std::string_view(bytes).substr(start, ends[index] - start);
+  }
+
+  std::size_t size() const { return ends.size(); }
+
+  void reserve(std::size_t keys, std::size_t key_bytes) {
+    ends.reserve(keys);
+    bytes.reserve(key_bytes);
+  }
+
+  void clear() {
+    bytes.clear();
+    ends.clear();
+  }
+
+private:
+  std::string bytes;
+  std::vector<std::size_t> ends;
+  CollationStrength strength;
+};
+
+} // namespace wutils
@@ -0,0 +1,1104 @@
+module;
+
+#include <uchar.h>
+#include <wchar.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#ifdef WUTILS_INLINE_KERNELS
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#ifdef WUTILS_TELEMETRY
+#include <atomic>
+#include <chrono>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#endif
+#endif
+
+#if __cpp_lib_ranges_to_container >= 202202L || __cpp_lib_containers_ranges > 202202L
+import <ranges>;
+#endif
+
+export module wutils:core;
+
+#ifdef WUTILS_INLINE_KERNELS
+import :telemetry;
+#endif
+
+export namespace wutils {
+
+inline constexpr bool wchar_is_char8 =
+    sizeof(wchar_t) ==
+    sizeof(char8_t);
+inline constexpr bool wchar_is_char16 =
+    sizeof(wchar_t) == sizeof(char16_t);
+inline constexpr bool wchar_is_char32 =
+    sizeof(wchar_t) ==
+    sizeof(char32_t);
+
+static_assert(wchar_is_char8 || wchar_is_char16 || wchar_is_char32,
+              "Unsupported wchar_t width, expecting 8, 16 or 32 bits");
+
+static_assert((wchar_is_char8 + wchar_is_char16 + wchar_is_char32) == 1,
+              "Exactly one wchar_t type must match");
+
+using uchar_t =
+    std::conditional_t<wchar_is_char8, char8_t,
+                       std::conditional_t<wchar_is_char16, char16_t, char32_t>>;
+using ustring = std::basic_string<uchar_t>;
+using ustring_view = std::basic_string_view<uchar_t>;
+
+static_assert(sizeof(wchar_t) == sizeof(ustring::value_type) &&
+                  sizeof(wchar_t) == sizeof(ustring_view::value_type),
+              "Invalid wchar_t deduction");
+
+enum class ErrorPolicy {
+  UseReplacementCharacter,
+  SkipInvalidValues,
+  StopOnFirstError
+};
+
+template <typename T> struct ConversionResult {
+  T value;
+  bool is_valid;
+
+  T &operator*() { return value; }
+  T *operator->() { return &value; }
+  const T *operator->() const { return &value; }
+  explicit operator bool() const { return is_valid; }
+};
+
+enum class ContentClass {
+  Unknown,
+  Ascii,
+  TwoByte,
+  ThreeByte,
+  FourByte
+};
+
+struct ContentProfile {
+  ContentClass dominant;
+  std::size_t counts[4];
+};
+
+enum class StoreMode {
+  Auto,
+  Cached,
+  Streaming
+};
+
+inline constexpr std::size_t STREAMING_STORE_BYTES = std::size_t{32} << 20;
+
+namespace detail {
+
+inline constexpr const char8_t *REPLACEMENT_CHAR_8 = u8"�";
+inline constexpr const char16_t REPLACEMENT_CHAR_16 = u'�';
+inline constexpr const char32_t REPLACEMENT_CHAR_32 = U'�';
+
+template <typename T, template <typename...> class C>
+struct instantiation_of_impl : std::false_type {};
+
+template <template <typename...> class C, typename... Args>
+struct instantiation_of_impl<C<Args...>, C> : std::true_type {};
+
+template <typename T, template <typename...> class C>
+concept instantiation_of = instantiation_of_impl<T, C>::value;
+
+template <typename T, template <typename...> class... Cs>
+concept instantiation_of_one_of = (... or instantiation_of<T, Cs>);
+
+template <typename T>
+concept BasicString = instantiation_of<T, std::basic_string>;
+
+template <typename T>
+concept BasicStringView =
+    instantiation_of_one_of<T, std::basic_string, std::basic_string_view>;
+
+template <typename T>
+concept is_unicode_char =
+    std::is_same_v<T, char8_t> || std::is_same_v<T, char16_t> ||
+    std::is_same_v<T, char32_t>;
+
+// ===== Implicit Conversions =====
+template <typename FromChar, typename ToChar>
+struct implicit_conversion : std::false_type {};
+template <> struct implicit_conversion<char, char8_t> : std::true_type {};
+
+template <> struct implicit_conversion<char8_t, char> : std::true_type {};
+
+template <> struct implicit_conversion<wchar_t, uchar_t> : std::true_type {};
+
+template <> struct implicit_conversion<uchar_t, wchar_t> : std::true_type {};
+
+template <typename CharT>
+struct implicit_conversion<CharT, CharT> : std::true_type {};
+
+// ===== Specialized Conversions =====
+inline ConversionResult<std::u8string>
+u8(const std::u8string_view u8s,
+   [[maybe_unused]] const ErrorPolicy errorPolicy =
+       ErrorPolicy::UseReplacementCharacter) {
+  return {std::u8string(u8s), true};
+}
+ConversionResult<std::u8string>
+u8(const std::u16string_view u16s,
+   const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+ConversionResult<std::u8string>
+u8(const std::u32string_view u32s,
+   const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+
+ConversionResult<std::u16string>
+u16(const std::u8string_view u8s,
+    const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+inline ConversionResult<std::u16string>
+u16(const std::u16string_view u16s,
+    [[maybe_unused]] const ErrorPolicy errorPolicy =
+        ErrorPolicy::UseReplacementCharacter) {
+  return {std::u16string(u16s), true};
+}
+ConversionResult<std::u16string>
+u16(const std::u32string_view u32s,
+    const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+
+ConversionResult<std::u32string>
+u32(const std::u8string_view u8s,
+    const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+ConversionResult<std::u32string>
+u32(const std::u16string_view u16s,
+    const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+inline ConversionResult<std::u32string>
+u32(const std::u32string_view u32s,
+    [[maybe_unused]] const ErrorPolicy errorPolicy =
+        ErrorPolicy::UseReplacementCharacter) {
+  return {std::u32string(u32s), true};
+}
+
+struct TranscodeResult {
+  std::size_t read;
+  std::size_t written;
+  bool is_valid;
+};
+
+template <typename FromChar, typename ToChar>
+constexpr std::size_t max_transcoded_size(const std::size_t n) {
+  if constexpr (sizeof(ToChar) == 1 && sizeof(FromChar) <= 2) {
+    return n * 3;
+  } else if constexpr (sizeof(ToChar) == 1 && sizeof(FromChar) == 4) {
+    return n * 4;
+  } else if constexpr (sizeof(ToChar) == 2 && sizeof(FromChar) == 4) {
+    return n * 2;
+  } else {
+    return n;
+  }
+}
+
+TranscodeResult transcode(const std::u16string_view from, char8_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+TranscodeResult transcode(const std::u32string_view from, char8_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+TranscodeResult transcode(const std::u8string_view from, char16_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+TranscodeResult transcode(const std::u32string_view from, char16_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+TranscodeResult transcode(const std::u8string_view from, char32_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+TranscodeResult transcode(const std::u16string_view from, char32_t *out,
+                          const ErrorPolicy errorPolicy,
+                          const ContentClass content = ContentClass::Unknown,
+                          const StoreMode store = StoreMode::Auto);
+
+TranscodeResult transcode(const std::u8string_view from, char8_t *out,
+                          const ErrorPolicy errorPolicy);
+TranscodeResult transcode(const std::u16string_view from, char16_t *out,
+                          const ErrorPolicy errorPolicy);
+TranscodeResult transcode(const std::u32string_view from, char32_t *out,
+                          const ErrorPolicy errorPolicy);
+
+template <typename CharT> struct UnitSink {
+  void (*emit)(void *context, const CharT *units, std::size_t count);
+  void *context;
+};
+
+TranscodeResult transcode_blocks(const std::u16string_view from,
+                                 const UnitSink<char8_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+TranscodeResult transcode_blocks(const std::u32string_view from,
+                                 const UnitSink<char8_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+TranscodeResult transcode_blocks(const std::u8string_view from,
+                                 const UnitSink<char16_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+TranscodeResult transcode_blocks(const std::u32string_view from,
+                                 const UnitSink<char16_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+TranscodeResult transcode_blocks(const std::u8string_view from,
+                                 const UnitSink<char32_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+TranscodeResult transcode_blocks(const std::u16string_view from,
+                                 const UnitSink<char32_t> sink,
+                                 const ErrorPolicy errorPolicy,
+                                 const ContentClass content);
+
+std::size_t valid_prefix(const std::u8string_view u8s);
+std::size_t valid_prefix(const std::u16string_view u16s);
+std::size_t valid_prefix(const std::u32string_view u32s);
+
+std::size_t u8_length(const std::u16string_view u16s);
+std::size_t u8_length(const std::u32string_view u32s);
+std::size_t u16_length(const std::u8string_view u8s);
+std::size_t u16_length(const std::u32string_view u32s);
+std::size_t u32_length(const std::u8string_view u8s);
+std::size_t u32_length(const std::u16string_view u16s);
+
+std::size_t u8_estimate(const std::u16string_view u16s);
+std::size_t u8_estimate(const std::u32string_view u32s);
+std::size_t u16_estimate(const std::u8string_view u8s);
+std::size_t u16_estimate(const std::u32string_view u32s);
+std::size_t u32_estimate(const std::u8string_view u8s);
+std::size_t u32_estimate(const std::u16string_view u16s);
+
+ContentProfile sample_profile(const std::u8string_view u8s);
+ContentProfile sample_profile(const std::u16string_view u16s);
+ContentProfile sample_profile(const std::u32string_view u32s);
+
+std::size_t complete_prefix(const std::u8string_view u8s);
+std::size_t complete_prefix(const std::u16string_view u16s);
+inline std::size_t complete_prefix(const std::u32string_view u32s) {
+  return u32s.size();
+}
+
+ConversionResult<std::u8string> json_escape(const std::u8string_view u8s,
+                                            const bool ascii_only,
+                                            const ErrorPolicy errorPolicy);
+ConversionResult<std::u8string> json_escape(const std::u16string_view u16s,
+                                            const bool ascii_only,
+                                            const ErrorPolicy errorPolicy);
+ConversionResult<std::u8string> json_escape(const std::u32string_view u32s,
+                                            const bool ascii_only,
+                                            const ErrorPolicy errorPolicy);
+
+ConversionResult<std::u8string>
+json_unescape_u8(const std::u8string_view json, const ErrorPolicy errorPolicy);
+ConversionResult<std::u16string>
+json_unescape_u16(const std::u8string_view json, const ErrorPolicy errorPolicy);
+
+ConversionResult<std::u8string>
+wtf8(const std::u16string_view u16s,
+     const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+ConversionResult<std::u8string>
+wtf8(const std::u32string_view u32s,
+     const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+ConversionResult<std::u8string>
+wtf8(const std::u8string_view wtf8s,
+     const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+ConversionResult<std::u16string>
+wtf16(const std::u8string_view wtf8s,
+      const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+ConversionResult<std::u32string>
+wtf32(const std::u8string_view wtf8s,
+      const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter);
+
+ConversionResult<std::u8string> cesu8(const std::u8string_view u8s,
+                                      const bool modified,
+                                      const ErrorPolicy errorPolicy);
+ConversionResult<std::u8string> cesu8(const std::u16string_view u16s,
+                                      const bool modified,
+                                      const ErrorPolicy errorPolicy);
+ConversionResult<std::u8string> cesu8(const std::u32string_view u32s,
+                                      const bool modified,
+                                      const ErrorPolicy errorPolicy);
+ConversionResult<std::u8string> u8_from_cesu8(const std::u8string_view cesu8s,
+                                              const bool modified,
+                                              const ErrorPolicy errorPolicy);
+ConversionResult<std::u16string>
+u16_from_cesu8(const std::u8string_view cesu8s, const bool modified,
+               const ErrorPolicy errorPolicy);
+
+template <typename ToChar, typename FromChar>
+std::size_t transcoded_length(const std::basic_string_view<FromChar> from) {
+  if constexpr (std::is_same_v<FromChar, ToChar>) {
+    return from.size();
+  } else if constexpr (std::is_same_v<ToChar, char8_t>) {
+    return u8_length(from);
+  } else if constexpr (std::is_same_v<ToChar, char16_t>) {
+    return u16_length(from);
+  } else {
+    return u32_length(from);
+  }
+}
+
+template <typename ToChar, typename FromChar>
+std::size_t estimated_length(const std::basic_string_view<FromChar> from) {
+  if constexpr (std::is_same_v<ToChar, char8_t>) {
+    return u8_estimate(from);
+  } else if constexpr (std::is_same_v<ToChar, char16_t>) {
+    return u16_estimate(from);
+  } else {
+    return u32_estimate(from);
+  }
+}
+
+inline std::u8string_view as_unicode(const std::string_view s) {
+  return {reinterpret_cast<const char8_t *>(s.data()), s.size()};
+}
+inline ustring_view as_unicode(const std::wstring_view ws) {
+  return {reinterpret_cast<const uchar_t *>(ws.data()), ws.size()};
+}
+inline std::u8string_view as_unicode(const std::u8string_view u8s) {
+  return u8s;
+}
+inline std::u16string_view as_unicode(const std::u16string_view u16s) {
+  return u16s;
+}
+inline std::u32string_view as_unicode(const std::u32string_view u32s) {
+  return u32s;
+}
+
+template <typename CharT>
+using unit_of = typename decltype(as_unicode(
+    std::basic_string_view<CharT>()))::value_type;
+
+template <BasicString String, typename Write>
+void append_bounded(String &out, const std::size_t bound, Write write) {
+  const std::size_t old_size = out.size();
+  if (out.capacity() < old_size + bound) {
+    const std::size_t doubled = out.capacity() * 2;
+    out.reserve(doubled > old_size + bound ? doubled : old_size + bound);
+  }
+#if __cpp_lib_string_resize_and_overwrite >= 202110L
+  out.resize_and_overwrite(old_size + bound, [&](auto *data, std::size_t) {
+    return old_size + write(data + old_size);
+  });
+#else
+  out.resize(old_size + bound);
+  out.resize(old_size + write(out.data() + old_size));
+#endif
+}
+
+template <BasicString String, typename FromChar>
+  requires is_unicode_char<FromChar>
+bool append_transcoded(String &out, const std::basic_string_view<FromChar> from,
+                       const ErrorPolicy errorPolicy,
+                       const ContentClass content = ContentClass::Unknown,
+                       const StoreMode store = StoreMode::Auto) {
+  using Char = typename String::value_type;
+  using ToChar = unit_of<Char>;
+  bool is_valid = true;
+  auto write_in_place = [&](const std::basic_string_view<FromChar> units,
+                            const std::size_t bound) {
+    append_bounded(out, bound, [&](Char *data) {
+      ToChar *const units_out = reinterpret_cast<ToChar *>(data);
+      TranscodeResult result;
+      if constexpr (std::is_same_v<FromChar, ToChar>) {
+        result = transcode(units, units_out, errorPolicy);
+      } else {
+        result = transcode(units, units_out, errorPolicy, content, store);
+      }
+      is_valid = result.is_valid;
+      return result.written;
+    });
+  };
+  const std::size_t worst = max_transcoded_size<FromChar, ToChar>(from.size());
+  if constexpr (std::is_same_v<FromChar, ToChar>) {
+    const std::size_t valid = valid_prefix(from);
+    out.append(reinterpret_cast<const Char *>(from.data()), valid);
+    if (valid < from.size()) {
+      const std::basic_string_view<FromChar> rest = from.substr(valid);
+      write_in_place(rest,
+                     max_transcoded_size<FromChar, ToChar>(rest.size()));
+    }
+  } else if (worst <= out.capacity() - out.size()) {
+    write_in_place(from, worst);
+  } else if (store == StoreMode::Streaming ||
+             (store == StoreMode::Auto &&
+              worst * sizeof(ToChar) >= STREAMING_STORE_BYTES)) {
+    write_in_place(from, transcoded_length<ToChar>(from));
+  } else if (const std::size_t estimate = estimated_length<ToChar>(from);
+             worst - estimate <= worst / 8) {
+    write_in_place(from, worst);
+  } else {
+    const std::size_t needed = out.size() + estimate;
+    if (out.capacity() < needed) {
+      const std::size_t doubled = out.capacity() * 2;
+      out.reserve(doubled > needed ? doubled : needed);
+    }
+    const UnitSink<ToChar> sink{
+        [](void *context, const ToChar *units, const std::size_t count) {
+          static_cast<String *>(context)->append(
+              reinterpret_cast<const Char *>(units), count);
+        },
+        &out};
+    is_valid = transcode_blocks(from, sink, errorPolicy, content).is_valid;
+  }
+  return is_valid;
+}
+
+template <BasicString To, typename From>
+ConversionResult<To> convert_tuned(const From &from,
+                                   const ContentClass content,
+                                   const ErrorPolicy errorPolicy,
+                                   const StoreMode store = StoreMode::Auto) {
+  const auto units = as_unicode(from);
+  using FromChar = typename decltype(units)::value_type;
+  using ToChar = typename To::value_type;
+  if constexpr (std::is_same_v<FromChar, ToChar>) {
+    return {To(units), true};
+  } else {
+    To out;
+    const bool is_valid =
+        append_transcoded(out, units, errorPolicy, content, store);
+    return {std::move(out), is_valid};
+  }
+}
+
+template <typename From, typename To>
+inline constexpr bool is_implicitly_convertible =
+    implicit_conversion<From, To>::value;
+
+template <BasicStringView From, BasicString To>
+  requires is_implicitly_convertible<typename From::value_type,
+                                     typename To::value_type>
+To convert_implicitly(From from) {
+  if constexpr (std::is_same_v<typename From::value_type,
+                               typename To::value_type>) {
+    return To(from);
+  } else {
+#if defined(_MSC_VER) && (__cpp_lib_containers_ranges > 202202L)
+    return To(std::from_range, from);
+#elif __cpp_lib_ranges_to_container >= 202202L
+    return from |
+           std::ranges::views::transform([](typename From::value_type wc) {
+             return static_cast<typename To::value_type>(wc);
+           }) |
+           std::ranges::to<To>();
+#else
+    // C++20 fallback without ranges
+    To out;
+    out.reserve(from.size());
+    for (auto it = from.cbegin(); it != from.cend(); ++it) {
+      out.push_back(static_cast<typename To::value_type>(*it));
+    }
+    return out;
+#endif
+  }
+};
+} // namespace detail
+
+using detail::BasicString, detail::BasicStringView;
+
+// "Dispatch" our functions based on conversion type //
+
+// OVERLOAD 1: Implicit conversion (fast path).
+template <BasicStringView From, BasicString To>
+  requires(detail::is_implicitly_convertible<typename From::value_type,
+                                             typename To::value_type>)
+inline ConversionResult<To> convert(From from,
+                                    [[maybe_unused]] ErrorPolicy errorPolicy =
+                                        ErrorPolicy::UseReplacementCharacter) {
+  return {detail::convert_implicitly<From, To>(from), true};
+}
+
+// OVERLOAD 2: The "Unicode Kernel." Both types are different Unicode formats.
+template <BasicStringView From, BasicString To>
+  requires(!detail::is_implicitly_convertible<typename From::value_type,
+                                              typename To::value_type> &&
+           detail::is_unicode_char<typename From::value_type> &&
+           detail::is_unicode_char<typename To::value_type>)
+inline ConversionResult<To>
+convert(From from,
+        ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  using ToChar = typename To::value_type;
+  if constexpr (std::is_same_v<ToChar, char8_t>) {
+    return detail::u8(from, errorPolicy);
+  } else if constexpr (std::is_same_v<ToChar, char16_t>) {
+    return detail::u16(from, errorPolicy);
+  } else if constexpr (std::is_same_v<ToChar, char32_t>) {
+    return detail::u32(from, errorPolicy);
+  }
+}
+
+// OVERLOAD 3: Entry point. Convert non-Unicode source to a Unicode pivot and
+// recurse.
+template <BasicStringView From, BasicString To>
+  requires(!detail::is_unicode_char<typename From::value_type> &&
+           !detail::is_implicitly_convertible<typename From::value_type,
+                                              typename To::value_type>)
+inline ConversionResult<To>
+convert(From from,
+        ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  // char and wchar_t text is read in place as the Unicode units they share
+  // their representation with
+  using Units =
+      std::basic_string_view<detail::unit_of<typename From::value_type>>;
+  return convert<Units, To>(detail::as_unicode(from), errorPolicy);
+}
+
+// OVERLOAD 4: Exit point. Source is Unicode, destination is not.
+template <BasicStringView From, BasicString To>
+  requires(!detail::is_implicitly_convertible<typename From::value_type,
+                                              typename To::value_type> &&
+           detail::is_unicode_char<typename From::value_type> &&
+           !detail::is_unicode_char<typename To::value_type>)
+inline ConversionResult<To>
+convert(From from,
+        ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  // char and wchar_t strings are written through the Unicode units they
+  // share their representation with, without an intermediate string
+  To out;
+  const bool is_valid = detail::append_transcoded(
+      out, detail::as_unicode(std::basic_string_view(from)), errorPolicy);
+  return {std::move(out), is_valid};
+}
+
+// Simple conversions to avoid ConversionResult
+inline ustring ws_to_us(std::wstring_view from) {
+  return detail::convert_implicitly<std::wstring_view, ustring>(from);
+}
+
+inline std::wstring us_to_ws(ustring_view from) {
+  return detail::convert_implicitly<ustring_view, std::wstring>(from);
+}
+
+inline std::u8string s_to_u8s(std::string_view from) {
+  return detail::convert_implicitly<std::string_view, std::u8string>(from);
+}
+
+inline std::string u8s_to_s(std::u8string_view from) {
+  return detail::convert_implicitly<std::u8string_view, std::string>(from);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+u8s(From from, ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return convert<From, std::u8string>(from, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u16string>
+u16s(From from,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return convert<From, std::u16string>(from, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u32string>
+u32s(From from,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return convert<From, std::u32string>(from, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<ustring>
+us(From from, ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return convert<From, ustring>(from, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::wstring>
+ws(From from, ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return convert<From, std::wstring>(from, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::string>
+s(From from, ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return convert<From, std::string>(from, errorPolicy);
+}
+
+template <BasicStringView From> inline std::size_t u8length(const From &from) {
+  return detail::transcoded_length<char8_t>(detail::as_unicode(from));
+}
+
+template <BasicStringView From>
+inline std::size_t u16length(const From &from) {
+  return detail::transcoded_length<char16_t>(detail::as_unicode(from));
+}
+
+template <BasicStringView From>
+inline std::size_t u32length(const From &from) {
+  return detail::transcoded_length<char32_t>(detail::as_unicode(from));
+}
+
+template <typename CharT, typename Allocator = std::allocator<CharT>>
+  requires detail::is_unicode_char<CharT>
+class BasicUtfBuilder {
+public:
+  using value_type = CharT;
+  using string_type =
+      std::basic_string<CharT, std::char_traits<CharT>, Allocator>;
+  using view_type = std::basic_string_view<CharT>;
+
+  BasicUtfBuilder() = default;
+  explicit BasicUtfBuilder(const Allocator &alloc) : buffer(alloc) {}
+  explicit BasicUtfBuilder(const ErrorPolicy errorPolicy,
+                           const Allocator &alloc = Allocator())
+      : buffer(alloc), errorPolicy(errorPolicy) {}
+
+  BasicUtfBuilder &append(const std::string_view s) {
+    return append_view(detail::as_unicode(s));
+  }
+  BasicUtfBuilder &append(const std::wstring_view ws) {
+    return append_view(detail::as_unicode(ws));
+  }
+  BasicUtfBuilder &append(const std::u8string_view u8s) {
+    return append_view(u8s);
+  }
+  BasicUtfBuilder &append(const std::u16string_view u16s) {
+    return append_view(u16s);
+  }
+  BasicUtfBuilder &append(const std::u32string_view u32s) {
+    return append_view(u32s);
+  }
+
+  template <typename T>
+    requires requires(BasicUtfBuilder &b, const T &from) { b.append(from); }
+  BasicUtfBuilder &operator+=(const T &from) {
+    return append(from);
+  }
+
+  template <typename... Froms> void reserve_for(const Froms &...froms) {
+    buffer.reserve(buffer.size() +
+                   (std::size_t{0} + ... +
+                    detail::transcoded_length<CharT>(
+                        detail::as_unicode(froms))));
+  }
+  void reserve(const std::size_t n) { buffer.reserve(n); }
+
+  string_type release() {
+    string_type out = std::move(buffer);
+    buffer.clear();
+    valid = true;
+    return out;
+  }
+
+  void clear() {
+    buffer.clear();
+    valid = true;
+  }
+
+  view_type view() const { return buffer; }
+  std::size_t size() const { return buffer.size(); }
+  bool empty() const { return buffer.empty(); }
+  bool is_valid() const { return valid; }
+
+private:
+  template <typename FromChar>
+  BasicUtfBuilder &append_view(const std::basic_string_view<FromChar> from) {
+    valid &= detail::append_transcoded(buffer, from, errorPolicy);
+    return *this;
+  }
+
+  string_type buffer;
+  ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter;
+  bool valid = true;
+};
+
+using Utf8Builder = BasicUtfBuilder<char8_t>;
+using Utf16Builder = BasicUtfBuilder<char16_t>;
+using Utf32Builder = BasicUtfBuilder<char32_t>;
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+json_escape(const From &from, const bool ascii_only = false,
+            ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::json_escape(detail::as_unicode(from), ascii_only,
+                             errorPolicy);
+}
+
+inline ConversionResult<std::u8string>
+json_unescape(const std::u8string_view json,
+              ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::json_unescape_u8(json, errorPolicy);
+}
+
+inline ConversionResult<std::u8string>
+json_unescape(const std::string_view json,
+              ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::json_unescape_u8(detail::as_unicode(json), errorPolicy);
+}
+
+inline ConversionResult<std::u16string> json_unescape_u16(
+    const std::u8string_view json,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::json_unescape_u16(json, errorPolicy);
+}
+
+inline ConversionResult<std::u16string> json_unescape_u16(
+    const std::string_view json,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::json_unescape_u16(detail::as_unicode(json), errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+wtf8s(const From &from,
+      ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::wtf8(detail::as_unicode(from), errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u16string>
+wtf16s(const From &wtf8,
+       ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::wtf16(detail::as_unicode(wtf8), errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u32string>
+wtf32s(const From &wtf8,
+       ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::wtf32(detail::as_unicode(wtf8), errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::wstring>
+wtfws(const From &wtf8,
+      ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  ConversionResult<ustring> intermediate;
+  if constexpr (std::is_same_v<uchar_t, char16_t>) {
+    intermediate = detail::wtf16(detail::as_unicode(wtf8), errorPolicy);
+  } else {
+    intermediate = detail::wtf32(detail::as_unicode(wtf8), errorPolicy);
+  }
+  return {us_to_ws(intermediate.value), intermediate.is_valid};
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+cesu8s(const From &from,
+       ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::cesu8(detail::as_unicode(from), false, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+mutf8s(const From &from,
+       ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::cesu8(detail::as_unicode(from), true, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+u8s_from_cesu8(const From &cesu8,
+               ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::u8_from_cesu8(detail::as_unicode(cesu8), false, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u16string> u16s_from_cesu8(
+    const From &cesu8,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::u16_from_cesu8(detail::as_unicode(cesu8), false,
+                                errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+u8s_from_mutf8(const From &mutf8,
+               ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::u8_from_cesu8(detail::as_unicode(mutf8), true, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u16string> u16s_from_mutf8(
+    const From &mutf8,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::u16_from_cesu8(detail::as_unicode(mutf8), true, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ContentProfile content_profile(const From &from) {
+  return detail::sample_profile(detail::as_unicode(from));
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+u8s(const From &from, const ContentClass content,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u8string>(from, content, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u16string>
+u16s(const From &from, const ContentClass content,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u16string>(from, content, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u32string>
+u32s(const From &from, const ContentClass content,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u32string>(from, content, errorPolicy);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u8string>
+u8s(const From &from, const StoreMode store,
+    ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u8string>(from, ContentClass::Unknown,
+                                              errorPolicy, store);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u16string>
+u16s(const From &from, const StoreMode store,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u16string>(from, ContentClass::Unknown,
+                                               errorPolicy, store);
+}
+
+template <BasicStringView From>
+inline ConversionResult<std::u32string>
+u32s(const From &from, const StoreMode store,
+     ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_tuned<std::u32string>(from, ContentClass::Unknown,
+                                               errorPolicy, store);
+}
+
+enum class Truncation {
+  CodePoint,
+  Grapheme
+};
+
+template <typename T> struct BoundedResult {
+  T value;
+  std::size_t consumed;
+  bool is_valid;
+
+  T &operator*() { return value; }
+  T *operator->() { return &value; }
+  const T *operator->() const { return &value; }
+  explicit operator bool() const { return is_valid; }
+};
+
+namespace detail {
+
+TranscodeResult transcode_bounded(const std::u8string_view from, char8_t *out,
+                                  const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u16string_view from, char8_t *out,
+                                  const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u32string_view from, char8_t *out,
+                                  const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u8string_view from, char16_t *out,
+                                  const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u16string_view from,
+                                  char16_t *out, const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u32string_view from,
+                                  char16_t *out, const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u8string_view from, char32_t *out,
+                                  const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u16string_view from,
+                                  char32_t *out, const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+TranscodeResult transcode_bounded(const std::u32string_view from,
+                                  char32_t *out, const std::size_t max_units,
+                                  const ErrorPolicy errorPolicy,
+                                  const Truncation truncation);
+
+template <BasicString To, typename From>
+BoundedResult<To> convert_bounded(const From &from, const std::size_t max_units,
+                                  const Truncation truncation,
+                                  const ErrorPolicy errorPolicy) {
+  const auto units = as_unicode(from);
+  using FromChar = typename decltype(units)::value_type;
+  using ToChar = typename To::value_type;
+  To out;
+  std::size_t bound = max_transcoded_size<FromChar, ToChar>(units.size());
+  if constexpr (std::is_same_v<FromChar, ToChar>) {
+    if (valid_prefix(units) == units.size()) {
+      bound = units.size();
+    }
+  } else if (bound <= max_units) {
+    bound = transcoded_length<ToChar>(units);
+  }
+  TranscodeResult result{0, 0, true};
+  append_bounded(out, bound < max_units ? bound : max_units,
+                 [&](ToChar *data) {
+                   result = transcode_bounded(units, data, max_units,
+                                              errorPolicy, truncation);
+                   return result.written;
+                 });
+  return {std::move(out), result.read, result.is_valid};
+}
+
+}
+
+template <BasicStringView From>
+inline BoundedResult<std::u8string>
+u8s_bounded(const From &from, const std::size_t max_units,
+            const Truncation truncation = Truncation::CodePoint,
+            ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_bounded<std::u8string>(from, max_units, truncation,
+                                                errorPolicy);
+}
+
+template <BasicStringView From>
+inline BoundedResult<std::u16string>
+u16s_bounded(const From &from, const std::size_t max_units,
+             const Truncation truncation = Truncation::CodePoint,
+             ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_bounded<std::u16string>(from, max_units, truncation,
+                                                 errorPolicy);
+}
+
+template <BasicStringView From>
+inline BoundedResult<std::u32string>
+u32s_bounded(const From &from, const std::size_t max_units,
+             const Truncation truncation = Truncation::CodePoint,
+             ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_bounded<std::u32string>(from, max_units, truncation,
+                                                 errorPolicy);
+}
+
+template <typename CharT, std::size_t N>
+  requires detail::is_unicode_char<CharT> && (N > 0)
+class InlineString {
+public:
+  using value_type = CharT;
+  using view_type = std::basic_string_view<CharT>;
+
+  InlineString() = default;
+  InlineString(const InlineString &other) : length(other.length) {
+    std::char_traits<CharT>::copy(units, other.units, length);
+  }
+  InlineString &operator=(const InlineString &other) {
+    length = other.length;
+    std::char_traits<CharT>::copy(units, other.units, length);
+    return *this;
+  }
+
+  template <typename Write>
+  void resize_and_overwrite(const std::size_t n, Write write) {
+    length = write(units, n < N ? n : N);
+  }
+
+  static constexpr std::size_t capacity() { return N; }
+  std::size_t size() const { return length; }
+  bool empty() const { return length == 0; }
+  const CharT *data() const { return units; }
+  const CharT *begin() const { return units; }
+  const CharT *end() const { return units + length; }
+  const CharT &operator[](const std::size_t i) const { return units[i]; }
+
+  view_type view() const { return {units, length}; }
+  operator view_type() const { return view(); }
+
+  friend bool operator==(const InlineString &a, const view_type b) {
+    return a.view() == b;
+  }
+
+private:
+  std::size_t length = 0;
+  CharT units[N];
+};
+
+namespace detail {
+
+template <typename ToChar, std::size_t N, typename From>
+BoundedResult<InlineString<ToChar, N>>
+convert_inline(const From &from, const ErrorPolicy errorPolicy) {
+  const auto units = as_unicode(from);
+  using FromChar = typename decltype(units)::value_type;
+  InlineString<ToChar, N> out;
+  TranscodeResult result{0, 0, true};
+  out.resize_and_overwrite(N, [&](ToChar *data, const std::size_t) {
+    if constexpr (!std::is_same_v<FromChar, ToChar>) {
+      if (max_transcoded_size<FromChar, ToChar>(units.size()) <= N) {
+        result = transcode(units, data, errorPolicy);
+        return result.written;
+      }
+    }
+    result = transcode_bounded(units, data, N, errorPolicy,
+                               Truncation::CodePoint);
+    return result.written;
+  });
+  return {out, result.read, result.is_valid};
+}
+
+}
+
+template <std::size_t N, BasicStringView From>
+inline BoundedResult<InlineString<char8_t, N>>
+u8s_inline(const From &from,
+           ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_inline<char8_t, N>(from, errorPolicy);
+}
+
+template <std::size_t N, BasicStringView From>
+inline BoundedResult<InlineString<char16_t, N>>
+u16s_inline(const From &from,
+            ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_inline<char16_t, N>(from, errorPolicy);
+}
+
+template <std::size_t N, BasicStringView From>
+inline BoundedResult<InlineString<char32_t, N>>
+u32s_inline(const From &from,
+            ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter) {
+  return detail::convert_inline<char32_t, N>(from, errorPolicy);
+}
+
+int uswidth(const std::u8string_view u8s);
+int uswidth(const std::u16string_view u16s);
+int uswidth(const std::u32string_view u32s);
+
+struct TextCounts {
+  int width;
+  std::size_t code_points;
+  std::size_t graphemes;
+};
+
+TextCounts text_counts(const std::u8string_view u8s);
+TextCounts text_counts(const std::u16string_view u16s);
+TextCounts text_counts(const std::u32string_view u32s);
+
+inline int wswidth(const std::wstring_view ws) {
+  ustring u = ws_to_us(ws);
+  return uswidth(u);
+}
+
+} // namespace wutils
+
+#ifdef WUTILS_INLINE_KERNELS
+#include "wutils_kernels.hpp"
+#endif
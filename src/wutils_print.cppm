@@ -0,0 +1,37 @@
+module;
+
+#include <string_view>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <iostream>
+#endif
+
+export module wutils.print;
+
+export import wutils;
+
+export namespace wutils {
+
+#ifdef _WIN32
+void wcout(const std::wstring_view ws) {
+  WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), ws.data(),
+                static_cast<DWORD>(ws.size()), NULL, NULL);
+}
+void wcerr(const std::wstring_view ws) {
+  WriteConsoleW(GetStdHandle(STD_ERROR_HANDLE), ws.data(),
+                static_cast<DWORD>(ws.size()), NULL, NULL);
+}
+#else
+inline void wcout(const std::wstring_view ws) { std::wcout << ws; }
+inline void wcerr(const std::wstring_view ws) { std::wcerr << ws << std::endl; }
+#endif
+
+inline void wprint(const std::wstring_view ws) { wcout(ws); }
+inline void wprintln(const std::wstring_view ws) {
+  wcout(ws);
+  wcout(L"\n");
+}
+
+} // namespace wutils
@@ -0,0 +1,121 @@
+module;
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+export module wutils:properties;
+
+export namespace wutils {
+
+enum class GeneralCategory : std::uint8_t {
+  Unassigned,
+  UppercaseLetter,
+  LowercaseLetter,
+  TitlecaseLetter,
+  ModifierLetter,
+  OtherLetter,
+  NonspacingMark,
+  SpacingMark,
+  EnclosingMark,
+  DecimalNumber,
+  LetterNumber,
+  OtherNumber,
+  ConnectorPunctuation,
+  DashPunctuation,
+  OpenPunctuation,
+  ClosePunctuation,
+  InitialPunctuation,
+  FinalPunctuation,
+  OtherPunctuation,
+  MathSymbol,
+  CurrencySymbol,
+  ModifierSymbol,
+  OtherSymbol,
+  SpaceSeparator,
+  LineSeparator,
+  ParagraphSeparator,
+  Control,
+  Format,
+  Surrogate,
+  PrivateUse
+};
+
+enum class Script : std::uint8_t {
+  Unknown, Common, Inherited, Adlam, Ahom, AnatolianHieroglyphs, Arabic,
+  Armenian, Avestan, Balinese, Bamum, BassaVah, Batak, Bengali, Bhaiksuki,
+  Bopomofo, Brahmi, Braille, Buginese, Buhid, CanadianAboriginal, Carian,
+  CaucasianAlbanian, Chakma, Cham, Cherokee, Chorasmian, Coptic, Cuneiform,
+  Cypriot, CyproMinoan, Cyrillic, Deseret, Devanagari, DivesAkuru, Dogra,
+  Duployan, EgyptianHieroglyphs, Elbasan, Elymaic, Ethiopic, Georgian,
+  Glagolitic, Gothic, Grantha, Greek, Gujarati, GunjalaGondi, Gurmukhi, Han,
+  Hangul, HanifiRohingya, Hanunoo, Hatran, Hebrew, Hiragana, ImperialAramaic,
+  InscriptionalPahlavi, InscriptionalParthian, Javanese, Kaithi, Kannada,
+  Katakana, KayahLi, Kharoshthi, KhitanSmallScript, Khmer, Khojki, Khudawadi,
+  Lao, Latin, Lepcha, Limbu, LinearA, LinearB, Lisu, Lycian, Lydian, Mahajani,
+  Makasar, Malayalam, Mandaic, Manichaean, Marchen, MasaramGondi, Medefaidrin,
+  MeeteiMayek, MendeKikakui, MeroiticCursive, MeroiticHieroglyphs, Miao, Modi,
+  Mongolian, Mro, Multani, Myanmar, Nabataean, Nandinagari, NewTaiLue, Newa,
+  Nko, Nushu, NyiakengPuachueHmong, Ogham, OlChiki, OldHungarian, OldItalic,
+  OldNorthArabian, OldPermic, OldPersian, OldSogdian, OldSouthArabian,
+  OldTurkic, OldUyghur, Oriya, Osage, Osmanya, PahawhHmong, Palmyrene,
+  PauCinHau, PhagsPa, Phoenician, PsalterPahlavi, Rejang, Runic, Samaritan,
+  Saurashtra, Sharada, Shavian, Siddham, SignWriting, Sinhala, Sogdian,
+  SoraSompeng, Soyombo, Sundanese, SylotiNagri, Syriac, Tagalog, Tagbanwa,
+  TaiLe, TaiTham, TaiViet, Takri, Tamil, Tangsa, Tangut, Telugu, Thaana, Thai,
+  Tibetan, Tifinagh, Tirhuta, Toto, Ugaritic, Vai, Vithkuqi, Wancho,
+  WarangCiti, Yezidi, Yi, ZanabazarSquare
+};
+
+enum class EastAsianWidth : std::uint8_t {
+  Neutral,
+  Ambiguous,
+  Halfwidth,
+  Wide,
+  Fullwidth,
+  Narrow
+};
+
+enum class GraphemeBreak : std::uint8_t {
+  Other,
+  CR,
+  LF,
+  Control,
+  Extend,
+  ZWJ,
+  RegionalIndicator,
+  Prepend,
+  SpacingMark,
+  L,
+  V,
+  T,
+  LV,
+  LVT
+};
+
+struct CodePointProperties {
+  GeneralCategory category;
+  Script script;
+  EastAsianWidth east_asian_width;
+  GraphemeBreak grapheme_break;
+  bool emoji : 1;
+  bool emoji_presentation : 1;
+  bool emoji_modifier : 1;
+  bool emoji_modifier_base : 1;
+  bool emoji_component : 1;
+  bool extended_pictographic : 1;
+  std::int8_t width;
+};
+
+CodePointProperties properties(char32_t cp);
+GeneralCategory general_category(char32_t cp);
+Script script(char32_t cp);
+EastAsianWidth east_asian_width(char32_t cp);
+GraphemeBreak grapheme_break(char32_t cp);
+
+void classify(std::span<const char32_t> code_points,
+              std::span<CodePointProperties> out);
+
+std::string_view script_name(Script script);
+
+} // namespace wutils
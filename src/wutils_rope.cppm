@@ -0,0 +1,65 @@
+module;
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+export module wutils:rope;
+
+export import :core;
+
+export namespace wutils {
+
+struct TextMetrics {
+  std::size_t bytes = 0;
+  std::size_t utf16_units = 0;
+  std::size_t code_points = 0;
+  std::size_t newlines = 0;
+  std::size_t width = 0;
+};
+
+enum class TextMetric { Bytes, Utf16Units, CodePoints, Newlines, Width };
+
+namespace detail {
+struct RopeNode;
+}
+
+class Rope {
+public:
+  Rope() noexcept;
+  explicit Rope(std::u8string_view text);
+  explicit Rope(const std::string_view text)
+      : Rope(detail::as_unicode(text)) {}
+  Rope(const Rope &other);
+  Rope(Rope &&other) noexcept;
+  Rope &operator=(const Rope &other);
+  Rope &operator=(Rope &&other) noexcept;
+  ~Rope();
+
+  void insert(std::size_t offset, std::u8string_view text);
+  void insert(const std::size_t offset, const std::string_view text) {
+    insert(offset, detail::as_unicode(text));
+  }
+  void append(const std::u8string_view text) { insert(size(), text); }
+  void append(const std::string_view text) { insert(size(), text); }
+  void erase(std::size_t offset, std::size_t count);
+  void clear() noexcept;
+
+  std::size_t size() const noexcept;
+  bool empty() const noexcept { return size() == 0; }
+
+  TextMetrics metrics() const noexcept;
+  TextMetrics prefix(std::size_t offset) const;
+
+  std::size_t offset_of(TextMetric metric, std::size_t value) const;
+
+  std::u8string substr(std::size_t offset,
+                       std::size_t count = std::u8string::npos) const;
+  std::u8string str() const { return substr(0); }
+
+private:
+  std::unique_ptr<detail::RopeNode> root;
+};
+
+} // namespace wutils
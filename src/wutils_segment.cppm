@@ -0,0 +1,131 @@
+module;
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+export module wutils:segment;
+
+export import :core;
+
+export namespace wutils {
+
+namespace detail {
+
+struct WordBreakState {
+  std::uint8_t raw = 0xFF;
+  std::uint8_t last = 0xFF;
+  std::uint8_t before_last = 0xFF;
+  bool odd_regional = false;
+};
+
+struct SentenceBreakState {
+  std::uint8_t raw = 0xFF;
+  std::uint8_t last = 0xFF;
+  std::uint8_t term = 0xFF;
+  std::uint8_t before_term = 0xFF;
+  std::uint8_t trailer = 0;
+};
+
+std::size_t next_word_break(std::u8string_view text, std::size_t pos,
+                            WordBreakState &state, bool &word);
+std::size_t next_word_break(std::u16string_view text, std::size_t pos,
+                            WordBreakState &state, bool &word);
+std::size_t next_sentence_break(std::u8string_view text, std::size_t pos,
+                                SentenceBreakState &state);
+std::size_t next_sentence_break(std::u16string_view text, std::size_t pos,
+                                SentenceBreakState &state);
+
+}
+
+template <typename CharT> class BasicWordBoundaries {
+public:
+  explicit BasicWordBoundaries(std::basic_string_view<CharT> text)
+      : text(text) {}
+
+  bool next(std::size_t &boundary) {
+    if (pos >= text.size()) {
+      return false;
+    }
+    pos = detail::next_word_break(text, pos, state, word);
+    boundary = pos;
+    return true;
+  }
+
+  bool is_word() const { return word; }
+
+private:
+  std::basic_string_view<CharT> text;
+  std::size_t pos = 0;
+  detail::WordBreakState state;
+  bool word = false;
+};
+
+using Utf8WordBoundaries = BasicWordBoundaries<char8_t>;
+using Utf16WordBoundaries = BasicWordBoundaries<char16_t>;
+
+template <typename CharT> class BasicSentenceBoundaries {
+public:
+  explicit BasicSentenceBoundaries(std::basic_string_view<CharT> text)
+      : text(text) {}
+
+  bool next(std::size_t &boundary) {
+    if (pos >= text.size()) {
+      return false;
+    }
+    pos = detail::next_sentence_break(text, pos, state);
+    boundary = pos;
+    return true;
+  }
+
+private:
+  std::basic_string_view<CharT> text;
+  std::size_t pos = 0;
+  detail::SentenceBreakState state;
+};
+
+using Utf8SentenceBoundaries = BasicSentenceBoundaries<char8_t>;
+using Utf16SentenceBoundaries = BasicSentenceBoundaries<char16_t>;
+
+struct CursorStep {
+  std::size_t offset;
+  std::size_t columns;
+  bool word = false;
+};
+
+namespace detail {
+
+CursorStep next_grapheme_boundary(std::u8string_view text, std::size_t offset);
+CursorStep next_grapheme_boundary(std::u16string_view text,
+                                  std::size_t offset);
+CursorStep next_grapheme_boundary(std::u32string_view text,
+                                  std::size_t offset);
+CursorStep prev_grapheme_boundary(std::u8string_view text, std::size_t offset);
+CursorStep prev_grapheme_boundary(std::u16string_view text,
+                                  std::size_t offset);
+CursorStep prev_grapheme_boundary(std::u32string_view text,
+                                  std::size_t offset);
+CursorStep next_word_boundary(std::u8string_view text, std::size_t offset);
+CursorStep next_word_boundary(std::u16string_view text, std::size_t offset);
+CursorStep next_word_boundary(std::u32string_view text, std::size_t offset);
+
+}
+
+template <BasicStringView From>
+inline CursorStep next_grapheme_boundary(const From &text,
+                                         std::size_t offset) {
+  return detail::next_grapheme_boundary(detail::as_unicode(text), offset);
+}
+
+template <BasicStringView From>
+inline CursorStep prev_grapheme_boundary(const From &text,
+                                         std::size_t offset) {
+  return detail::prev_grapheme_boundary(detail::as_unicode(text), offset);
+}
+
+template <BasicStringView From>
+inline CursorStep next_word_boundary(const From &text, std::size_t offset) {
+  return detail::next_word_boundary(detail::as_unicode(text), offset);
+}
+
+} // namespace wutils
@@ -0,0 +1,414 @@
+module;
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+
+export module wutils:stream;
+
+export import :core;
+
+export namespace wutils {
+
+enum class Encoding { Utf8, Utf16LE, Utf16BE, Utf32LE, Utf32BE };
+
+namespace detail {
+
+template <typename Unit> constexpr Unit byteswap_unit(Unit unit) {
+  if constexpr (sizeof(Unit) == 2) {
+    return static_cast<Unit>((unit >> 8) | (unit << 8));
+  } else {
+    return static_cast<Unit>(((unit >> 24) & 0xFF) | ((unit >> 8) & 0xFF00) |
+                             ((unit & 0xFF00) << 8) | ((unit & 0xFF) << 24));
+  }
+}
+
+constexpr bool is_native_order(const Encoding encoding) {
+  if (encoding == Encoding::Utf8) {
+    return true;
+  }
+  const bool little =
+      encoding == Encoding::Utf16LE || encoding == Encoding::Utf32LE;
+  return little == (std::endian::native == std::endian::little);
+}
+
+constexpr std::size_t unit_size(const Encoding encoding) {
+  switch (encoding) {
+  case Encoding::Utf8:
+    return 1;
+  case Encoding::Utf16LE:
+  case Encoding::Utf16BE:
+    return 2;
+  default:
+    return 4;
+  }
+}
+
+struct EncodeBuffers {
+  std::u8string u8;
+  std::u16string u16;
+  std::u32string u32;
+};
+
+template <typename FromChar>
+bool write_encoded(std::streambuf &sink,
+                   const std::basic_string_view<FromChar> units,
+                   const Encoding encoding, const ErrorPolicy errorPolicy,
+                   EncodeBuffers &buffers, bool &is_valid) {
+  auto emit = [&](auto &staging) -> bool {
+    staging.clear();
+    is_valid &= append_transcoded(staging, units, errorPolicy);
+    if (!is_native_order(encoding)) {
+      for (auto &unit : staging) {
+        unit = byteswap_unit(unit);
+      }
+    }
+    const auto bytes =
+        static_cast<std::streamsize>(staging.size() * unit_size(encoding));
+    return sink.sputn(reinterpret_cast<const char *>(staging.data()), bytes) ==
+           bytes;
+  };
+  switch (encoding) {
+  case Encoding::Utf8:
+    return emit(buffers.u8);
+  case Encoding::Utf16LE:
+  case Encoding::Utf16BE:
+    return emit(buffers.u16);
+  default:
+    return emit(buffers.u32);
+  }
+}
+
+template <BasicString String>
+std::size_t read_encoded(const std::string_view bytes, const Encoding encoding,
+                         const bool at_end, const ErrorPolicy errorPolicy,
+                         EncodeBuffers &buffers, String &out, bool &is_valid) {
+  auto decode = [&](auto &staging) -> std::size_t {
+    using Unit = typename std::remove_reference_t<decltype(staging)>::value_type;
+    const std::size_t count = bytes.size() / sizeof(Unit);
+    staging.resize(count);
+    std::memcpy(staging.data(), bytes.data(), count * sizeof(Unit));
+    if (!is_native_order(encoding)) {
+      for (auto &unit : staging) {
+        unit = byteswap_unit(unit);
+      }
+    }
+    std::basic_string_view<Unit> units(staging);
+    if (!at_end) {
+      units = units.substr(0, complete_prefix(units));
+    }
+    if (at_end && bytes.size() % sizeof(Unit) != 0) {
+      is_valid = false;
+    }
+    is_valid &= append_transcoded(out, units, errorPolicy);
+    return at_end ? bytes.size() : units.size() * sizeof(Unit);
+  };
+  switch (encoding) {
+  case Encoding::Utf8: {
+    std::u8string_view units = as_unicode(bytes);
+    if (!at_end) {
+      units = units.substr(0, complete_prefix(units));
+    }
+    is_valid &= append_transcoded(out, units, errorPolicy);
+    return units.size();
+  }
+  case Encoding::Utf16LE:
+  case Encoding::Utf16BE:
+    return decode(buffers.u16);
+  default:
+    return decode(buffers.u32);
+  }
+}
+
+}
+
+struct DetectedEncoding {
+  Encoding encoding;
+  std::size_t bom_size;
+};
+
+DetectedEncoding detect_encoding(const std::string_view bytes);
+
+struct LineReaderOptions {
+  bool unicode_separators = false;
+  ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter;
+  std::size_t block_size = 64 * 1024;
+};
+
+class LineReader {
+public:
+  explicit LineReader(const std::string_view bytes,
+                      const LineReaderOptions &options = {});
+  explicit LineReader(std::FILE *file, const LineReaderOptions &options = {});
+
+  bool next(std::u8string_view &line);
+
+  Encoding encoding() const { return detected.encoding; }
+  bool is_valid() const { return valid; }
+
+private:
+  bool refill();
+  std::u8string_view window() const;
+
+  std::string_view source;
+  std::size_t source_pos = 0;
+  std::FILE *file = nullptr;
+  LineReaderOptions options;
+  DetectedEncoding detected{Encoding::Utf8, 0};
+  std::string raw;
+  std::u8string decoded;
+  std::size_t pos = 0;
+  detail::EncodeBuffers buffers;
+  bool started = false;
+  bool zero_copy = false;
+  bool at_end = false;
+  bool valid = true;
+};
+
+template <typename CharT>
+class BasicTranscodingOutBuf : public std::basic_streambuf<CharT> {
+  using base = std::basic_streambuf<CharT>;
+  using unit_type = detail::unit_of<CharT>;
+
+public:
+  using typename base::int_type;
+  using typename base::traits_type;
+
+  explicit BasicTranscodingOutBuf(
+      std::streambuf &sink, const Encoding encoding = Encoding::Utf8,
+      const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter,
+      const std::size_t buffer_size = 4096)
+      : sink(&sink), encoding(encoding), errorPolicy(errorPolicy),
+        buffer(buffer_size < 4 ? 4 : buffer_size, CharT()) {
+    this->setp(buffer.data(), buffer.data() + buffer.size());
+  }
+
+  BasicTranscodingOutBuf(const BasicTranscodingOutBuf &) = delete;
+  BasicTranscodingOutBuf &operator=(const BasicTranscodingOutBuf &) = delete;
+
+  ~BasicTranscodingOutBuf() override { flush_pending(true); }
+
+  bool is_valid() const { return valid; }
+
+protected:
+  int_type overflow(int_type ch) override {
+    if (!flush_pending(false)) {
+      return traits_type::eof();
+    }
+    if (traits_type::eq_int_type(ch, traits_type::eof())) {
+      return traits_type::not_eof(ch);
+    }
+    *this->pptr() = traits_type::to_char_type(ch);
+    this->pbump(1);
+    return ch;
+  }
+
+  int sync() override {
+    if (!flush_pending(false)) {
+      return -1;
+    }
+    return sink->pubsync();
+  }
+
+private:
+  bool flush_pending(const bool final) {
+    if (failed) {
+      return false;
+    }
+    const std::basic_string_view<unit_type> pending(
+        reinterpret_cast<const unit_type *>(this->pbase()),
+        static_cast<std::size_t>(this->pptr() - this->pbase()));
+    const std::size_t complete =
+        final ? pending.size() : detail::complete_prefix(pending);
+    if (!detail::write_encoded(*sink, pending.substr(0, complete), encoding,
+                               errorPolicy, buffers, valid) ||
+        (!valid && errorPolicy == ErrorPolicy::StopOnFirstError)) {
+      failed = true;
+      return false;
+    }
+
+    const std::size_t tail = pending.size() - complete;
+    traits_type::move(buffer.data(), this->pbase() + complete, tail);
+    this->setp(buffer.data(), buffer.data() + buffer.size());
+    this->pbump(static_cast<int>(tail));
+    return true;
+  }
+
+  std::streambuf *sink;
+  Encoding encoding;
+  ErrorPolicy errorPolicy;
+  std::basic_string<CharT> buffer;
+  detail::EncodeBuffers buffers;
+  bool valid = true;
+  bool failed = false;
+};
+
+template <typename CharT>
+class BasicTranscodingInBuf : public std::basic_streambuf<CharT> {
+  using base = std::basic_streambuf<CharT>;
+  using unit_type = detail::unit_of<CharT>;
+
+public:
+  using typename base::int_type;
+  using typename base::traits_type;
+
+  explicit BasicTranscodingInBuf(
+      std::streambuf &source, const Encoding encoding = Encoding::Utf8,
+      const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter,
+      const std::size_t buffer_size = 4096)
+      : source(&source), encoding(encoding), errorPolicy(errorPolicy),
+        block_size(buffer_size < 4 ? 4 : buffer_size) {}
+
+  BasicTranscodingInBuf(const BasicTranscodingInBuf &) = delete;
+  BasicTranscodingInBuf &operator=(const BasicTranscodingInBuf &) = delete;
+
+  bool is_valid() const { return valid; }
+
+protected:
+  int_type underflow() override {
+    if (this->gptr() < this->egptr()) {
+      return traits_type::to_int_type(*this->gptr());
+    }
+    decoded.clear();
+    while (decoded.empty() && !exhausted) {
+      const std::size_t kept = raw.size();
+      raw.resize(kept + block_size);
+      const std::streamsize got =
+          source->sgetn(raw.data() + kept, static_cast<std::streamsize>(
+                                               block_size));
+      raw.resize(kept + static_cast<std::size_t>(got > 0 ? got : 0));
+      const bool at_end = got <= 0;
+
+      const std::size_t consumed =
+          detail::read_encoded(raw, encoding, at_end, errorPolicy, buffers,
+                               decoded, valid);
+      raw.erase(0, consumed);
+      if (at_end || (!valid && errorPolicy == ErrorPolicy::StopOnFirstError)) {
+        exhausted = true;
+      }
+    }
+    if (decoded.empty()) {
+      return traits_type::eof();
+    }
+    CharT *begin = reinterpret_cast<CharT *>(decoded.data());
+    this->setg(begin, begin, begin + decoded.size());
+    return traits_type::to_int_type(*begin);
+  }
+
+private:
+  std::streambuf *source;
+  Encoding encoding;
+  ErrorPolicy errorPolicy;
+  std::size_t block_size;
+  std::string raw;
+  std::basic_string<unit_type> decoded;
+  detail::EncodeBuffers buffers;
+  bool valid = true;
+  bool exhausted = false;
+};
+
+template <typename CharT>
+class BasicTranscodingOStream : public std::basic_ostream<CharT> {
+public:
+  explicit BasicTranscodingOStream(
+      std::streambuf &sink, const Encoding encoding = Encoding::Utf8,
+      const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter)
+      : std::basic_ostream<CharT>(nullptr), buf(sink, encoding, errorPolicy) {
+    this->init(&buf);
+  }
+
+  BasicTranscodingOutBuf<CharT> *rdbuf() { return &buf; }
+
+private:
+  BasicTranscodingOutBuf<CharT> buf;
+};
+
+template <typename CharT>
+class BasicTranscodingIStream : public std::basic_istream<CharT> {
+public:
+  explicit BasicTranscodingIStream(
+      std::streambuf &source, const Encoding encoding = Encoding::Utf8,
+      const ErrorPolicy errorPolicy = ErrorPolicy::UseReplacementCharacter)
+      : std::basic_istream<CharT>(nullptr),
+        buf(source, encoding, errorPolicy) {
+    this->init(&buf);
+  }
+
+  BasicTranscodingInBuf<CharT> *rdbuf() { return &buf; }
+
+private:
+  BasicTranscodingInBuf<CharT> buf;
+};
+
+using WTranscodingOutBuf = BasicTranscodingOutBuf<wchar_t>;
+using WTranscodingInBuf = BasicTranscodingInBuf<wchar_t>;
+using WTranscodingOStream = BasicTranscodingOStream<wchar_t>;
+using WTranscodingIStream = BasicTranscodingIStream<wchar_t>;
+
+struct ConsoleSinkOptions {
+  std::size_t capacity = 1 << 20;
+};
+
+class ConsoleSink {
+public:
+  explicit ConsoleSink(std::FILE *file, const ConsoleSinkOptions &options = {});
+  ~ConsoleSink();
+  ConsoleSink(const ConsoleSink &) = delete;
+  ConsoleSink &operator=(const ConsoleSink &) = delete;
+
+  template <typename Text>
+    requires requires(const Text &text) { detail::as_unicode(text); }
+  bool write(const Text &text) {
+    return push(detail::as_unicode(text), false, true);
+  }
+
+  template <typename Text>
+    requires requires(const Text &text) { detail::as_unicode(text); }
+  bool writeln(const Text &text) {
+    return push(detail::as_unicode(text), true, true);
+  }
+
+  template <typename Text>
+    requires requires(const Text &text) { detail::as_unicode(text); }
+  bool try_write(const Text &text) {
+    return push(detail::as_unicode(text), false, false);
+  }
+
+  template <typename Text>
+    requires requires(const Text &text) { detail::as_unicode(text); }
+  bool try_writeln(const Text &text) {
+    return push(detail::as_unicode(text), true, false);
+  }
+
+  void flush();
+
+private:
+  bool push(std::u8string_view text, bool newline, bool wait);
+  bool push(std::u16string_view text, bool newline, bool wait);
+  bool push(std::u32string_view text, bool newline, bool wait);
+  bool enqueue(std::u8string_view text, bool newline, std::uint64_t flags,
+               bool wait);
+  void drain();
+
+  std::FILE *file;
+  std::size_t capacity;
+  std::unique_ptr<std::uint64_t[]> ring;
+  std::atomic<std::uint64_t> head{0};
+  std::atomic<std::uint64_t> tail{0};
+  std::thread writer;
+};
+
+ConsoleSink &console_out();
+ConsoleSink &console_err();
+
+} // namespace wutils
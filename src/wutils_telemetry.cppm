@@ -0,0 +1,45 @@
+module;
+
+#include <cstddef>
+#include <cstdint>
+
+export module wutils:telemetry;
+
+export namespace wutils {
+
+enum class ConversionPair {
+  Utf8ToUtf16,
+  Utf8ToUtf32,
+  Utf16ToUtf8,
+  Utf16ToUtf32,
+  Utf32ToUtf8,
+  Utf32ToUtf16
+};
+
+inline constexpr std::size_t TELEMETRY_BUCKETS = 40;
+
+struct ConversionTelemetry {
+  std::uint64_t calls = 0;
+  std::uint64_t input_units = 0;
+  std::uint64_t output_units = 0;
+  std::uint64_t invalid_sequences = 0;
+  std::uint64_t loop_calls[5] = {};
+  std::uint64_t size_histogram[TELEMETRY_BUCKETS] = {};
+  std::uint64_t latency_histogram[TELEMETRY_BUCKETS] = {};
+};
+
+struct TelemetrySnapshot {
+  ConversionTelemetry pairs[6];
+
+  const ConversionTelemetry &operator[](const ConversionPair pair) const {
+    return pairs[static_cast<int>(pair)];
+  }
+
+  TelemetrySnapshot since(const TelemetrySnapshot &earlier) const;
+};
+
+bool telemetry_enabled();
+
+TelemetrySnapshot telemetry_snapshot();
+
+} // namespace wutils
@@ -3,6 +3,7 @@ import std;
 import wutils;
 
 using namespace std::string_literals;
+using namespace std::string_view_literals;
 
 struct InputData {
   int width;
@@ -117,6 +118,39 @@ TEST(ErrorHandling, InvalidUTF8StopOnFirstError) {
   EXPECT_EQ(res.value, U"start_");
 }
 
+TEST(ErrorHandling, InvalidUTF8ReplacesEachByte) {
+  // Every byte of an ill-formed or truncated sequence becomes one U+FFFD,
+  // in every loop, at the end of the input and in front of more text
+  constexpr char32_t R = wutils::detail::REPLACEMENT_CHAR_32;
+  const std::pair<std::u8string_view, std::u32string> cases[] = {
+      {u8"\xC1\xBF", std::u32string(2, R)},         // Overlong
+      {u8"\xE0\x9F\xBF", std::u32string(3, R)},     // Overlong
+      {u8"\xED\xA0\x80", std::u32string(3, R)},     // Surrogate
+      {u8"\xF0\x8F\xBF\xBF", std::u32string(4, R)}, // Overlong
+      {u8"\xF4\x90\x80\x80", std::u32string(4, R)}, // Above U+10FFFF
+      {u8"\xF5\x80", std::u32string(2, R)},         // No such lead
+      {u8"\xE2\x82", std::u32string(2, R)},         // Truncated
+      {u8"\xF0\x9F\x98", std::u32string(3, R)},     // Truncated
+      {u8"\xE2\x82\xAC\xF0\x9F\x98\x82", U"€😂"},   // Valid
+  };
+  using wutils::ContentClass;
+  for (const auto &[bytes, expected] : cases) {
+    for (const std::u8string_view tail : {u8""sv, u8"abcdef"sv}) {
+      const std::u8string input = std::u8string(bytes) + std::u8string(tail);
+      std::u32string output(input.size(), U'\0');
+      for (const ContentClass content :
+           {ContentClass::Ascii, ContentClass::TwoByte, ContentClass::ThreeByte,
+            ContentClass::FourByte}) {
+        const auto res = wutils::detail::transcode(
+            std::u8string_view(input), output.data(),
+            wutils::ErrorPolicy::UseReplacementCharacter, content);
+        EXPECT_EQ(std::u32string_view(output.data(), res.written),
+                  expected + U"abcdef"s.substr(0, tail.size()));
+      }
+    }
+  }
+}
+
 TEST(ErrorHandling, InvalidUTF16UseReplacementCharacter) {
   const char16_t invalid_u16_data[] = {u's',   u't', u'a', u'r', u't', u'_',
                                        0xD800, // Unpaired high surrogate
@@ -167,6 +201,1345 @@ TEST(ErrorHandling, InvalidUTF16StopOnFirstError) {
   EXPECT_EQ(res.value, u8"start_");
 }
 
+TEST(Builder, AppendsMixedEncodings) {
+  wutils::Utf8Builder builder;
+  builder.reserve_for(u8"Hello, "s, L"Wörld"s, u" 😂"s, U"!"s, "?"s);
+  EXPECT_TRUE(builder.empty());
+
+  builder.append(u8"Hello, ").append(L"Wörld").append(u" 😂");
+  builder += U"!";
+  builder += "?"s;
+  EXPECT_TRUE(builder.is_valid());
+  EXPECT_EQ(builder.view(), u8"Hello, Wörld 😂!?");
+
+  std::u8string released = builder.release();
+  EXPECT_EQ(released, u8"Hello, Wörld 😂!?");
+  EXPECT_TRUE(builder.empty());
+}
+
+TEST(Builder, ReserveForLeavesNoReallocation) {
+  const std::u32string cjk(1000, U'日');
+  const std::u16string ascii(1000, u'x');
+  wutils::Utf8Builder builder;
+  builder.reserve_for(cjk, ascii);
+  const char8_t *const data = builder.view().data();
+
+  builder.append(cjk).append(ascii);
+  EXPECT_EQ(builder.view().size(), 4000u);
+  EXPECT_EQ(builder.view().data(), data);
+}
+
+TEST(Builder, ErrorPolicyAppliesPerPiece) {
+  const char8_t invalid_byte[] = {u8'a', 0xFF, u8'b'};
+  wutils::Utf16Builder builder(wutils::ErrorPolicy::SkipInvalidValues);
+  builder.append(std::u8string_view(invalid_byte, 3)).append(U"c");
+  EXPECT_FALSE(builder.is_valid());
+  EXPECT_EQ(builder.release(), u"abc");
+
+  builder.clear();
+  EXPECT_TRUE(builder.is_valid());
+}
+
+TEST(Length, MatchesConversion) {
+  for (const auto &[width, u8s] : test_data) {
+    SCOPED_TRACE("Testing lengths for: " + std::string(u8s.begin(), u8s.end()));
+    auto u16s = wutils::u16s(u8s);
+    auto u32s = wutils::u32s(u8s);
+    EXPECT_EQ(wutils::u16length(u8s), u16s->size());
+    EXPECT_EQ(wutils::u32length(u8s), u32s->size());
+    EXPECT_EQ(wutils::u8length(*u16s), u8s.size());
+    EXPECT_EQ(wutils::u8length(*u32s), u8s.size());
+    EXPECT_EQ(wutils::u16length(*u32s), u16s->size());
+    EXPECT_EQ(wutils::u32length(*u16s), u32s->size());
+  }
+}
+
+TEST(Length, ResultsKeepNoWorstCaseCapacity) {
+  const std::u32string text(100000, U'a');
+  const std::u16string text16(100000, u'a');
+  EXPECT_LT(wutils::u8s(text)->capacity(), 2 * text.size());
+  EXPECT_LT(wutils::u8s(text16)->capacity(), 2 * text.size());
+  EXPECT_LT(wutils::u16s(text)->capacity(), 2 * text.size());
+}
+
+TEST(Streams, WideOutputToUtf8Sink) {
+  std::stringbuf sink;
+  {
+    // A tiny buffer forces sequences to straddle blocks
+    wutils::WTranscodingOutBuf buf(sink, wutils::Encoding::Utf8,
+                                   wutils::ErrorPolicy::UseReplacementCharacter,
+                                   5);
+    std::wostream out(&buf);
+    out << L"Résumé " << 42 << L" 😂𠮷\n";
+    out.flush();
+    EXPECT_TRUE(buf.is_valid());
+  }
+  EXPECT_EQ(sink.str(), reinterpret_cast<const char *>(u8"Résumé 42 😂𠮷\n"));
+}
+
+TEST(Streams, WideInputFromUtf16Source) {
+  const std::u16string text = u"Résumé 😂\n𠮷 line two";
+  std::string bytes;
+  for (char16_t unit : text) {
+    bytes.push_back(static_cast<char>(unit >> 8));
+    bytes.push_back(static_cast<char>(unit & 0xFF));
+  }
+  std::stringbuf source(bytes);
+  wutils::WTranscodingInBuf buf(source, wutils::Encoding::Utf16BE,
+                                wutils::ErrorPolicy::UseReplacementCharacter,
+                                5);
+  std::wistream in(&buf);
+  std::wstring first, second;
+  std::getline(in, first);
+  std::getline(in, second);
+  EXPECT_EQ(first, L"Résumé 😂");
+  EXPECT_EQ(second, L"𠮷 line two");
+  EXPECT_TRUE(buf.is_valid());
+}
+
+TEST(Streams, Utf8RoundTrip) {
+  std::stringbuf sink;
+  {
+    wutils::BasicTranscodingOStream<char16_t> out(sink,
+                                                  wutils::Encoding::Utf8);
+    for (const auto &[width, text] : test_data) {
+      out << *wutils::u16s(text) << u'\n';
+    }
+  }
+  std::stringbuf source(sink.str());
+  wutils::WTranscodingIStream in(source);
+  std::wstring line;
+  for (const auto &[width, text] : test_data) {
+    ASSERT_TRUE(std::getline(in, line));
+    EXPECT_EQ(line, *wutils::ws(text));
+  }
+}
+
+TEST(Streams, Utf8ToUtf8IsValidated) {
+  std::stringbuf sink;
+  {
+    wutils::BasicTranscodingOutBuf<char> buf(sink, wutils::Encoding::Utf8);
+    std::ostream out(&buf);
+    out << "o\xFFk";
+    out.flush();
+    EXPECT_FALSE(buf.is_valid());
+  }
+  EXPECT_EQ(sink.str(), "o\xEF\xBF\xBDk");
+
+  std::stringbuf source("o\xFFk\n");
+  wutils::BasicTranscodingInBuf<char> buf(
+      source, wutils::Encoding::Utf8, wutils::ErrorPolicy::SkipInvalidValues);
+  std::istream in(&buf);
+  std::string line;
+  ASSERT_TRUE(std::getline(in, line));
+  EXPECT_EQ(line, "ok");
+  EXPECT_FALSE(buf.is_valid());
+}
+
+TEST(LineReader, SplitsUtf8InPlace) {
+  const std::u8string text = u8"first\r\nsecond third\u0085fourth\n\nlast";
+  const std::string_view bytes(reinterpret_cast<const char *>(text.data()),
+                               text.size());
+  std::vector<std::u8string> lines;
+  std::u8string_view line;
+
+  wutils::LineReader plain(bytes);
+  while (plain.next(line)) {
+    lines.emplace_back(line);
+  }
+  EXPECT_EQ(lines, (std::vector<std::u8string>{
+                       u8"first", u8"second third\u0085fourth", u8"",
+                       u8"last"}));
+
+  lines.clear();
+  wutils::LineReader unicode(bytes, {.unicode_separators = true});
+  while (unicode.next(line)) {
+    EXPECT_GE(line.data(), text.data()); // Views into the input
+    lines.emplace_back(line);
+  }
+  EXPECT_EQ(lines, (std::vector<std::u8string>{u8"first", u8"second",
+                                               u8"third", u8"fourth", u8"",
+                                               u8"last"}));
+}
+
+TEST(LineReader, DecodesUtf16AcrossBlocks) {
+  std::u16string text = u"﻿";
+  std::vector<std::u8string> expected;
+  for (const auto &[width, u8s] : test_data) {
+    text += *wutils::u16s(u8s) + u"\r\n";
+    expected.push_back(u8s);
+  }
+  const std::string_view bytes(reinterpret_cast<const char *>(text.data()),
+                               text.size() * sizeof(char16_t));
+
+  // Odd block sizes split surrogate pairs, units and CRLF between blocks
+  for (std::size_t block_size : {1, 3, 7, 64}) {
+    SCOPED_TRACE("Block size " + std::to_string(block_size));
+    wutils::LineReader reader(bytes, {.block_size = block_size});
+    EXPECT_EQ(reader.encoding(), std::endian::native == std::endian::little
+                                     ? wutils::Encoding::Utf16LE
+                                     : wutils::Encoding::Utf16BE);
+    std::vector<std::u8string> lines;
+    std::u8string_view line;
+    while (reader.next(line)) {
+      lines.emplace_back(line);
+    }
+    EXPECT_EQ(lines, expected);
+    EXPECT_TRUE(reader.is_valid());
+  }
+}
+
+TEST(LineReader, ReadsFile) {
+  std::FILE *file = std::tmpfile();
+  ASSERT_NE(file, nullptr);
+  // Longer than the first read, so the rest comes in blocks of two bytes
+  const std::string long_line(300, 'x');
+  const std::string bytes = "\xEF\xBB\xBFone\n" + long_line +
+                            "\ntwo \xF0\x9F\x98\x82\r\nthree";
+  std::fwrite(bytes.data(), 1, bytes.size(), file);
+  std::rewind(file);
+
+  wutils::LineReader reader(file, {.block_size = 2});
+  std::vector<std::u8string> lines;
+  std::u8string_view line;
+  while (reader.next(line)) {
+    lines.emplace_back(line);
+  }
+  std::fclose(file);
+  EXPECT_EQ(lines, (std::vector<std::u8string>{
+                       u8"one", std::u8string(300, u8'x'), u8"two 😂",
+                       u8"three"}));
+}
+
+TEST(LineReader, ValidatesUtf8) {
+  const std::string_view bytes = "ok\n\xFF\xFE bad\n";
+  std::vector<std::u8string> lines;
+  std::u8string_view line;
+
+  wutils::LineReader replaced(bytes);
+  while (replaced.next(line)) {
+    lines.emplace_back(line);
+  }
+  EXPECT_FALSE(replaced.is_valid());
+  EXPECT_EQ(lines, (std::vector<std::u8string>{u8"ok", u8"�� bad"}));
+
+  lines.clear();
+  wutils::LineReader skipped(
+      bytes, {.errorPolicy = wutils::ErrorPolicy::SkipInvalidValues});
+  while (skipped.next(line)) {
+    lines.emplace_back(line);
+  }
+  EXPECT_FALSE(skipped.is_valid());
+  EXPECT_EQ(lines, (std::vector<std::u8string>{u8"ok", u8" bad"}));
+}
+
+static std::string read_all(std::FILE *file) {
+  std::rewind(file);
+  std::string text;
+  char block[4096];
+  for (size_t n; (n = std::fread(block, 1, sizeof(block), file)) > 0;) {
+    text.append(block, n);
+  }
+  return text;
+}
+
+TEST(ConsoleSink, KeepsLinesWhole) {
+  std::FILE *file = std::tmpfile();
+  ASSERT_NE(file, nullptr);
+  constexpr int threads = 8, lines = 2000;
+  std::vector<std::u16string> expected;
+  for (int t = 0; t < threads; ++t) {
+    expected.push_back(u"thread " + std::u16string(t + 1, u'é') + u" 😂");
+  }
+  {
+    // A small ring makes the producers wait for the writer
+    wutils::ConsoleSink sink(file, {.capacity = 256});
+    std::vector<std::jthread> workers;
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back([&sink, &expected, t] {
+        for (int i = 0; i < lines; ++i) {
+          EXPECT_TRUE(sink.writeln(expected[t]));
+        }
+      });
+    }
+  }
+  std::istringstream text(read_all(file));
+  std::fclose(file);
+  std::vector<int> counts(threads);
+  for (std::string line; std::getline(text, line);) {
+    const auto it =
+        std::find(expected.begin(), expected.end(), wutils::u16s(line).value);
+    ASSERT_NE(it, expected.end()) << line;
+    ++counts[it - expected.begin()];
+  }
+  EXPECT_EQ(counts, std::vector<int>(threads, lines));
+}
+
+TEST(ConsoleSink, FlushAndCapacity) {
+  std::FILE *file = std::tmpfile();
+  ASSERT_NE(file, nullptr);
+  const std::string head = "Grüße, 世界\n👋🏽";
+  {
+    wutils::ConsoleSink sink(file, {.capacity = 64});
+    EXPECT_TRUE(sink.write(u8"Grüße, "sv));
+    EXPECT_TRUE(sink.writeln(U"世界"sv));
+    EXPECT_TRUE(sink.try_write(L"👋🏽"sv));
+    sink.flush();
+    EXPECT_EQ(read_all(file), head);
+
+    // Records are never split, so one larger than the ring is refused
+    const std::u8string large(64, u8'x');
+    EXPECT_FALSE(sink.write(large));
+    EXPECT_FALSE(sink.try_writeln(large));
+    EXPECT_TRUE(sink.write(large.substr(0, 56)));
+  }
+  EXPECT_EQ(read_all(file), head + std::string(56, 'x'));
+  std::fclose(file);
+}
+
+TEST(Json, Escape) {
+  const std::u8string text = u8"say \"hi\"\\\n\t\x01 Résumé 😂";
+  EXPECT_EQ(*wutils::json_escape(text),
+            u8"say \\\"hi\\\"\\\\\\n\\t\\u0001 Résumé 😂");
+  EXPECT_EQ(*wutils::json_escape(text, true),
+            u8"say \\\"hi\\\"\\\\\\n\\t\\u0001 R\\u00E9sum\\u00E9 "
+            u8"\\uD83D\\uDE02");
+  EXPECT_EQ(*wutils::json_escape(*wutils::ws(text), true),
+            *wutils::json_escape(text, true));
+  EXPECT_EQ(*wutils::json_escape(*wutils::u16s(text)),
+            *wutils::json_escape(text));
+
+  const char16_t lone_surrogate[] = {u'a', 0xD800, u'b'};
+  auto res = wutils::json_escape(std::u16string_view(lone_surrogate, 3), true);
+  EXPECT_FALSE(res.is_valid);
+  EXPECT_EQ(res.value, u8"a\\uFFFDb");
+}
+
+TEST(Json, Unescape) {
+  const std::string json = "say \\\"hi\\\"\\/\\n R\\u00e9sum\\u00E9 "
+                           "\\uD83D\\uDE02 😂";
+  auto u8 = wutils::json_unescape(json);
+  EXPECT_TRUE(u8.is_valid);
+  EXPECT_EQ(u8.value, u8"say \"hi\"/\n Résumé 😂 😂");
+
+  auto u16 = wutils::json_unescape_u16(json);
+  EXPECT_TRUE(u16.is_valid);
+  EXPECT_EQ(u16.value, u"say \"hi\"/\n Résumé 😂 😂");
+
+  for (const auto &[width, text] : test_data) {
+    EXPECT_EQ(*wutils::json_unescape(*wutils::json_escape(text, true)), text);
+  }
+}
+
+TEST(Json, UnescapeInvalid) {
+  const std::u8string json = u8"a\\uD83Db\\qc\\u12";
+  auto replaced = wutils::json_unescape_u16(json);
+  EXPECT_FALSE(replaced.is_valid);
+  EXPECT_EQ(replaced.value, u"a�b�c�12");
+
+  auto skipped =
+      wutils::json_unescape(json, wutils::ErrorPolicy::SkipInvalidValues);
+  EXPECT_EQ(skipped.value, u8"abc12");
+
+  auto stopped =
+      wutils::json_unescape(json, wutils::ErrorPolicy::StopOnFirstError);
+  EXPECT_FALSE(stopped.is_valid);
+  EXPECT_EQ(stopped.value, u8"a");
+}
+
+TEST(Json, UnescapeInvalidRawBytes) {
+  const std::string json = "a\xFF" "b\\n\xC3";
+  auto replaced = wutils::json_unescape(json);
+  EXPECT_FALSE(replaced.is_valid);
+  EXPECT_EQ(replaced.value, u8"a�b\n�");
+
+  auto skipped =
+      wutils::json_unescape(json, wutils::ErrorPolicy::SkipInvalidValues);
+  EXPECT_FALSE(skipped.is_valid);
+  EXPECT_EQ(skipped.value, u8"ab\n");
+
+  auto stopped =
+      wutils::json_unescape(json, wutils::ErrorPolicy::StopOnFirstError);
+  EXPECT_FALSE(stopped.is_valid);
+  EXPECT_EQ(stopped.value, u8"a");
+}
+
+TEST(Json, UnescapeRejectsRawQuotesAndControls) {
+  auto newline = wutils::json_unescape(u8"a\nb");
+  EXPECT_FALSE(newline.is_valid);
+  EXPECT_EQ(newline.value, u8"a�b");
+
+  auto quote = wutils::json_unescape(u8"a\"b");
+  EXPECT_FALSE(quote.is_valid);
+  EXPECT_EQ(quote.value, u8"a�b");
+
+  // Past the first eight byte word, next to an escaped quote
+  const std::u8string json = u8"a long plain run\\\"\t\"end";
+  auto skipped =
+      wutils::json_unescape_u16(json, wutils::ErrorPolicy::SkipInvalidValues);
+  EXPECT_FALSE(skipped.is_valid);
+  EXPECT_EQ(skipped.value, u"a long plain run\"end");
+
+  auto stopped =
+      wutils::json_unescape(json, wutils::ErrorPolicy::StopOnFirstError);
+  EXPECT_FALSE(stopped.is_valid);
+  EXPECT_EQ(stopped.value, u8"a long plain run\"");
+}
+
+TEST(Wtf8, LoneSurrogatesRoundTrip) {
+  const char16_t units[] = {u'a', 0xD800, u'b', 0xDFFF, 0xD83D, 0xDE02, 0xDBFF};
+  const std::u16string ill_formed(units, sizeof(units) / sizeof(char16_t));
+
+  auto wtf8 = wutils::wtf8s(ill_formed);
+  EXPECT_TRUE(wtf8.is_valid);
+  EXPECT_EQ(wtf8.value, u8"a\xED\xA0\x80"
+                        u8"b\xED\xBF\xBF"
+                        u8"😂\xED\xAF\xBF");
+  auto back = wutils::wtf16s(*wtf8);
+  EXPECT_TRUE(back.is_valid);
+  EXPECT_EQ(back.value, ill_formed);
+
+  // Strict UTF-8 decoding still rejects the encoded surrogates
+  EXPECT_FALSE(wutils::u16s(*wtf8));
+}
+
+TEST(Wtf8, WellFormedMatchesUtf8) {
+  for (const auto &[width, u8s] : test_data) {
+    EXPECT_EQ(*wutils::wtf8s(*wutils::u16s(u8s)), u8s);
+    EXPECT_EQ(*wutils::wtf8s(*wutils::ws(u8s)), u8s);
+    EXPECT_EQ(*wutils::wtf16s(u8s), *wutils::u16s(u8s));
+    EXPECT_EQ(*wutils::wtfws(u8s), *wutils::ws(u8s));
+  }
+}
+
+TEST(Wtf8, JoinsSurrogatePairs) {
+  // A pair is one 4 byte sequence in either direction
+  const char32_t pair[] = {0xD83D, 0xDE00, 0xD800};
+  auto wtf8 = wutils::wtf8s(std::u32string_view(pair, 3));
+  EXPECT_TRUE(wtf8.is_valid);
+  EXPECT_EQ(wtf8.value, u8"😀\xED\xA0\x80");
+
+  const std::u8string encoded_pair = u8"\xED\xA0\xBD\xED\xB8\x80";
+  EXPECT_EQ(*wutils::wtf32s(encoded_pair), U"😀");
+  EXPECT_EQ(*wutils::wtf16s(encoded_pair), u"😀");
+  EXPECT_EQ(*wutils::wtf8s(encoded_pair), u8"😀");
+
+  auto checked = wutils::wtf8s(std::u8string(u8"a\xFF"));
+  EXPECT_FALSE(checked.is_valid);
+  EXPECT_EQ(checked.value, u8"a�");
+}
+
+TEST(Cesu8, EncodesSupplementaryAsSurrogatePairs) {
+  const std::u8string text = u8"a\0b😂é"s;
+  auto cesu8 = wutils::cesu8s(text);
+  EXPECT_TRUE(cesu8.is_valid);
+  EXPECT_EQ(cesu8.value, u8"a\0b\xED\xA0\xBD\xED\xB8\x82é"s);
+
+  auto mutf8 = wutils::mutf8s(*wutils::u16s(text));
+  EXPECT_TRUE(mutf8.is_valid);
+  EXPECT_EQ(mutf8.value, u8"a\xC0\x80"
+                         u8"b\xED\xA0\xBD\xED\xB8\x82é");
+
+  EXPECT_EQ(*wutils::u8s_from_cesu8(*cesu8), text);
+  EXPECT_EQ(*wutils::u8s_from_mutf8(*mutf8), text);
+  EXPECT_EQ(*wutils::u16s_from_mutf8(*mutf8), *wutils::u16s(text));
+}
+
+TEST(Cesu8, RoundTrip) {
+  for (const auto &[width, u8s] : test_data) {
+    EXPECT_EQ(*wutils::u8s_from_cesu8(*wutils::cesu8s(u8s)), u8s);
+    EXPECT_EQ(*wutils::u16s_from_mutf8(*wutils::mutf8s(*wutils::ws(u8s))),
+              *wutils::u16s(u8s));
+  }
+}
+
+TEST(Cesu8, RejectsUnpairedAndFourByteSequences) {
+  const std::u8string invalid = u8"a\xED\xA0\xBDz\xF0\x9F\x98\x82";
+  auto res = wutils::u16s_from_cesu8(invalid);
+  EXPECT_FALSE(res.is_valid);
+  EXPECT_EQ(res.value, u"a�z����");
+}
+
+TEST(Cesu8, CopiesPlainTextUpToTheFirstDifference) {
+  // Long enough for the surrogate pair to fall past the first scanned block
+  std::u8string plain;
+  for (int i = 0; i < 10000; ++i) {
+    plain += u8"é日";
+  }
+  const std::u8string text = plain + u8"😂\0x"s;
+
+  auto cesu8 = wutils::mutf8s(text);
+  EXPECT_TRUE(cesu8.is_valid);
+  EXPECT_EQ(cesu8.value, plain + u8"\xED\xA0\xBD\xED\xB8\x82\xC0\x80x");
+  EXPECT_EQ(*wutils::mutf8s(*wutils::u16s(text)), cesu8.value);
+  EXPECT_EQ(*wutils::u8s_from_mutf8(*cesu8), text);
+  EXPECT_EQ(*wutils::u16s_from_mutf8(*cesu8), *wutils::u16s(text));
+
+  auto stopped = wutils::u8s_from_cesu8(
+      plain + u8"\xED\xA0\xBD", wutils::ErrorPolicy::StopOnFirstError);
+  EXPECT_FALSE(stopped.is_valid);
+  EXPECT_EQ(stopped.value, plain);
+}
+
+TEST(Cesu8, ModifiedRejectsRawNul) {
+  // Long enough for the NUL to fall inside an eight byte ASCII block
+  const std::u8string text = u8"a\0b long ascii run\0"s;
+  EXPECT_TRUE(wutils::u8s_from_cesu8(text).is_valid);
+
+  auto replaced = wutils::u8s_from_mutf8(text);
+  EXPECT_FALSE(replaced.is_valid);
+  EXPECT_EQ(replaced.value, u8"a�b long ascii run�");
+
+  auto skipped = wutils::u16s_from_mutf8(
+      text, wutils::ErrorPolicy::SkipInvalidValues);
+  EXPECT_FALSE(skipped.is_valid);
+  EXPECT_EQ(skipped.value, u"ab long ascii run");
+}
+
+TEST(ContentProfile, ClassifiesDominantLength) {
+  EXPECT_EQ(wutils::content_profile(u8"plain ascii text"s).dominant,
+            wutils::ContentClass::Ascii);
+  EXPECT_EQ(wutils::content_profile(u8"Ελληνικά κείμενα"s).dominant,
+            wutils::ContentClass::TwoByte);
+  EXPECT_EQ(wutils::content_profile(*wutils::u16s(u8"日本語のテキスト"s)).dominant,
+            wutils::ContentClass::ThreeByte);
+  EXPECT_EQ(wutils::content_profile(U"😂😂😂 🌍🌎🌏"s).dominant,
+            wutils::ContentClass::FourByte);
+}
+
+TEST(ContentProfile, EveryLoopMatches) {
+  std::u8string mixed;
+  for (int i = 0; i < 8; ++i) {
+    for (const auto &[width, text] : test_data) {
+      mixed += text;
+    }
+  }
+  const std::u8string invalid = mixed + u8"\xC0\xAF\xE6\x97\xFF"s + mixed +
+                                u8"\xE6\x97"s;
+  const std::u16string mixed16 = *wutils::u16s(mixed);
+  const std::u32string mixed32 = *wutils::u32s(mixed);
+
+  for (auto content :
+       {wutils::ContentClass::Unknown, wutils::ContentClass::Ascii,
+        wutils::ContentClass::TwoByte, wutils::ContentClass::ThreeByte,
+        wutils::ContentClass::FourByte}) {
+    SCOPED_TRACE("Content class " + std::to_string(static_cast<int>(content)));
+    EXPECT_EQ(*wutils::u16s(mixed, content), mixed16);
+    EXPECT_EQ(*wutils::u32s(mixed, content), mixed32);
+    EXPECT_EQ(*wutils::u8s(mixed16, content), mixed);
+    EXPECT_EQ(*wutils::u32s(mixed16, content), mixed32);
+    EXPECT_EQ(*wutils::u8s(mixed32, content), mixed);
+    for (auto policy : {wutils::ErrorPolicy::UseReplacementCharacter,
+                        wutils::ErrorPolicy::SkipInvalidValues,
+                        wutils::ErrorPolicy::StopOnFirstError}) {
+      auto tuned = wutils::u16s(invalid, content, policy);
+      auto generic = wutils::u16s(invalid, policy);
+      EXPECT_FALSE(tuned.is_valid);
+      EXPECT_EQ(tuned.value, generic.value);
+    }
+  }
+}
+
+TEST(Properties, Lookup) {
+  auto latin = wutils::properties(U'A');
+  EXPECT_EQ(latin.category, wutils::GeneralCategory::UppercaseLetter);
+  EXPECT_EQ(latin.script, wutils::Script::Latin);
+  EXPECT_EQ(latin.east_asian_width, wutils::EastAsianWidth::Narrow);
+  EXPECT_EQ(latin.grapheme_break, wutils::GraphemeBreak::Other);
+  EXPECT_FALSE(latin.emoji);
+  EXPECT_EQ(latin.width, 1);
+
+  auto han = wutils::properties(U'一');
+  EXPECT_EQ(han.category, wutils::GeneralCategory::OtherLetter);
+  EXPECT_EQ(han.script, wutils::Script::Han);
+  EXPECT_EQ(han.east_asian_width, wutils::EastAsianWidth::Wide);
+  EXPECT_EQ(han.width, 2);
+
+  auto accent = wutils::properties(U'́');
+  EXPECT_EQ(accent.category, wutils::GeneralCategory::NonspacingMark);
+  EXPECT_EQ(accent.script, wutils::Script::Inherited);
+  EXPECT_EQ(accent.grapheme_break, wutils::GraphemeBreak::Extend);
+  EXPECT_EQ(accent.width, 0);
+
+  auto face = wutils::properties(U'😀');
+  EXPECT_TRUE(face.emoji);
+  EXPECT_TRUE(face.emoji_presentation);
+  EXPECT_TRUE(face.extended_pictographic);
+  EXPECT_FALSE(face.emoji_modifier);
+  EXPECT_EQ(face.script, wutils::Script::Common);
+  EXPECT_EQ(face.width, 2);
+
+  auto skin = wutils::properties(U'\U0001F3FB');
+  EXPECT_TRUE(skin.emoji_modifier);
+  EXPECT_TRUE(skin.emoji_component);
+  EXPECT_EQ(skin.grapheme_break, wutils::GraphemeBreak::Extend);
+  EXPECT_TRUE(wutils::properties(U'👍').emoji_modifier_base);
+
+  EXPECT_EQ(wutils::grapheme_break(U'\r'), wutils::GraphemeBreak::CR);
+  EXPECT_EQ(wutils::grapheme_break(U'‍'), wutils::GraphemeBreak::ZWJ);
+  EXPECT_EQ(wutils::grapheme_break(U'🇦'),
+            wutils::GraphemeBreak::RegionalIndicator);
+  EXPECT_EQ(wutils::grapheme_break(U'가'), wutils::GraphemeBreak::LV);
+  EXPECT_EQ(wutils::general_category(U'\n'),
+            wutils::GeneralCategory::Control);
+  EXPECT_EQ(wutils::properties(U'\n').width, -1);
+  EXPECT_EQ(wutils::script(U'Ж'), wutils::Script::Cyrillic);
+  EXPECT_EQ(wutils::east_asian_width(U'é'), wutils::EastAsianWidth::Ambiguous);
+  EXPECT_EQ(wutils::east_asian_width(U'ｱ'), wutils::EastAsianWidth::Halfwidth);
+  EXPECT_EQ(wutils::general_category(U'\U000F0000'),
+            wutils::GeneralCategory::PrivateUse);
+
+  auto beyond = wutils::properties(0x110000);
+  EXPECT_EQ(beyond.category, wutils::GeneralCategory::Unassigned);
+  EXPECT_EQ(beyond.script, wutils::Script::Unknown);
+  EXPECT_EQ(beyond.width, 1);
+
+  EXPECT_EQ(wutils::script_name(wutils::Script::OldItalic), "Old_Italic");
+  EXPECT_EQ(wutils::script_name(wutils::Script::ZanabazarSquare),
+            "Zanabazar_Square");
+}
+
+TEST(Properties, ClassifyMatchesLookup) {
+  std::vector<char32_t> code_points;
+  for (char32_t cp = 0; cp < 0x30000; cp += 7) {
+    code_points.push_back(cp);
+  }
+  for (const auto &[width, text] : test_data) {
+    const std::u32string u32 = *wutils::u32s(text);
+    code_points.insert(code_points.end(), u32.begin(), u32.end());
+  }
+  code_points.push_back(0x10FFFF);
+  code_points.push_back(0x110000);
+
+  std::vector<wutils::CodePointProperties> classified(code_points.size());
+  wutils::classify(code_points, classified);
+  for (std::size_t i = 0; i < code_points.size(); ++i) {
+    auto expected = wutils::properties(code_points[i]);
+    SCOPED_TRACE("U+" + std::to_string(code_points[i]));
+    EXPECT_EQ(classified[i].category, expected.category);
+    EXPECT_EQ(classified[i].script, expected.script);
+    EXPECT_EQ(classified[i].east_asian_width, expected.east_asian_width);
+    EXPECT_EQ(classified[i].grapheme_break, expected.grapheme_break);
+    EXPECT_EQ(classified[i].emoji, expected.emoji);
+    EXPECT_EQ(classified[i].extended_pictographic,
+              expected.extended_pictographic);
+    EXPECT_EQ(classified[i].width, expected.width);
+  }
+}
+
+TEST(Properties, WidthFromTables) {
+  // Non-spacing characters anywhere in the table take no column
+  EXPECT_EQ(wutils::uswidth(u8"a⃝"), 1);
+  EXPECT_EQ(wutils::uswidth(u8"a⁠b"), 2);
+  EXPECT_EQ(wutils::uswidth(u8"が"), 2);
+  EXPECT_EQ(wutils::uswidth(u8"a\U000E0101"), 1);
+}
+
+template <typename Boundaries, typename CharT>
+std::vector<std::basic_string<CharT>>
+segments(std::basic_string_view<CharT> text) {
+  std::vector<std::basic_string<CharT>> result;
+  Boundaries boundaries(text);
+  std::size_t start = 0, end;
+  while (boundaries.next(end)) {
+    result.emplace_back(text.substr(start, end - start));
+    start = end;
+  }
+  return result;
+}
+
+TEST(Segmentation, Words) {
+  const std::u8string text =
+      u8"The quick (\"brown\") fox can't jump 32.3 feet, right?";
+  const std::vector<std::u8string> expected = {
+      u8"The", u8" ",   u8"quick", u8" ",    u8"(",   u8"\"",   u8"brown",
+      u8"\"",  u8")",   u8" ",     u8"fox",  u8" ",   u8"can't", u8" ",
+      u8"jump", u8" ",  u8"32.3",  u8" ",    u8"feet", u8",",   u8" ",
+      u8"right", u8"?"};
+  EXPECT_EQ((segments<wutils::Utf8WordBoundaries>(std::u8string_view(text))),
+            expected);
+
+  wutils::Utf8WordBoundaries words(text);
+  std::size_t end;
+  std::vector<bool> is_word;
+  while (words.next(end)) {
+    is_word.push_back(words.is_word());
+  }
+  ASSERT_EQ(is_word.size(), expected.size());
+  EXPECT_TRUE(is_word[0]);
+  EXPECT_FALSE(is_word[1]);
+  EXPECT_FALSE(is_word[4]);
+  EXPECT_TRUE(is_word[12]);
+  EXPECT_TRUE(is_word[16]);
+
+  EXPECT_EQ((segments<wutils::Utf8WordBoundaries>(
+                std::u8string_view(u8"日本語テキスト_2 \r\n\r\n"))),
+            (std::vector<std::u8string>{u8"日", u8"本", u8"語",
+                                        u8"テキスト_2", u8" ", u8"\r\n",
+                                        u8"\r\n"}));
+  EXPECT_EQ((segments<wutils::Utf8WordBoundaries>(
+                std::u8string_view(u8"👨‍👩‍👧🇺🇸🇬🇧🇫 résumé  x"))),
+            (std::vector<std::u8string>{u8"👨‍👩‍👧", u8"🇺🇸", u8"🇬🇧", u8"🇫",
+                                        u8" ", u8"résumé", u8"  ",
+                                        u8"x"}));
+}
+
+TEST(Segmentation, Sentences) {
+  const std::u8string text =
+      u8"Wait... what? It cost 3.50 e.g. twice.\r\n“Fine.” Done";
+  EXPECT_EQ(
+      (segments<wutils::Utf8SentenceBoundaries>(std::u8string_view(text))),
+      (std::vector<std::u8string>{u8"Wait... what? ",
+                                  u8"It cost 3.50 e.g. twice.\r\n",
+                                  u8"“Fine.” ", u8"Done"}));
+}
+
+TEST(Segmentation, Utf16MatchesUtf8) {
+  std::u8string text;
+  for (const auto &[width, sample] : test_data) {
+    text += sample;
+    text += u8". Next one, 12.5 of them! ";
+  }
+  text += std::u8string(100, u8'a') + u8"\xE6\x97" + std::u8string(40, u8' ');
+  const std::u16string text16 = *wutils::u16s(text);
+
+  auto as_u8 = [](const std::vector<std::u16string> &parts) {
+    std::vector<std::u8string> result;
+    for (const auto &part : parts) {
+      result.push_back(*wutils::u8s(part));
+    }
+    return result;
+  };
+  auto words = segments<wutils::Utf8WordBoundaries>(std::u8string_view(text));
+  auto sentences =
+      segments<wutils::Utf8SentenceBoundaries>(std::u8string_view(text));
+  std::u8string joined;
+  for (const auto &word : words) {
+    joined += word;
+  }
+  EXPECT_EQ(joined, text);
+  EXPECT_GT(sentences.size(), test_data.size());
+
+  // The invalid sequence reads as U+FFFD either way
+  const std::u8string valid = *wutils::u8s(text16);
+  EXPECT_EQ(as_u8(segments<wutils::Utf16WordBoundaries>(
+                std::u16string_view(text16))),
+            segments<wutils::Utf8WordBoundaries>(std::u8string_view(valid)));
+  EXPECT_EQ(as_u8(segments<wutils::Utf16SentenceBoundaries>(
+                std::u16string_view(text16))),
+            segments<wutils::Utf8SentenceBoundaries>(std::u8string_view(valid)));
+}
+
+TEST(Cursor, GraphemeSteps) {
+  const std::u8string text = u8"é👨‍👩‍👧🇺🇸🇬🇧🇫\r\n世x";
+  std::vector<wutils::CursorStep> forward;
+  for (std::size_t offset = 0; offset < text.size();) {
+    forward.push_back(wutils::next_grapheme_boundary(text, offset));
+    offset = forward.back().offset;
+  }
+  const std::vector<std::size_t> ends = {3, 21, 29, 37, 41, 43, 46, 47};
+  const std::vector<std::size_t> columns = {1, 2, 4, 4, 2, 0, 2, 1};
+  ASSERT_EQ(forward.size(), ends.size());
+  for (std::size_t i = 0; i < ends.size(); ++i) {
+    EXPECT_EQ(forward[i].offset, ends[i]);
+    EXPECT_EQ(forward[i].columns, columns[i]);
+  }
+  EXPECT_EQ(wutils::next_grapheme_boundary(text, text.size()).offset,
+            text.size());
+
+  // Backward lands on the same boundaries, pairing the flags from the start
+  // of their run
+  std::size_t offset = text.size();
+  for (std::size_t i = ends.size(); i-- > 0;) {
+    const wutils::CursorStep step =
+        wutils::prev_grapheme_boundary(text, offset);
+    EXPECT_EQ(step.offset, i == 0 ? 0 : ends[i - 1]);
+    EXPECT_EQ(step.columns, columns[i]);
+    offset = step.offset;
+  }
+  EXPECT_EQ(wutils::prev_grapheme_boundary(text, 0).offset, 0u);
+
+  const std::u16string text16 = *wutils::u16s(text);
+  const std::wstring wide = *wutils::ws(text);
+  std::size_t at16 = 0, at_wide = 0;
+  for (std::size_t i = 0; i < ends.size(); ++i) {
+    const wutils::CursorStep step16 =
+        wutils::next_grapheme_boundary(text16, at16);
+    const wutils::CursorStep step_wide =
+        wutils::next_grapheme_boundary(wide, at_wide);
+    EXPECT_EQ(step16.columns, columns[i]);
+    EXPECT_EQ(step_wide.columns, columns[i]);
+    EXPECT_EQ(wutils::prev_grapheme_boundary(text16, step16.offset).offset,
+              at16);
+    at16 = step16.offset;
+    at_wide = step_wide.offset;
+  }
+  EXPECT_EQ(at16, text16.size());
+  EXPECT_EQ(at_wide, wide.size());
+}
+
+TEST(Cursor, WordSteps) {
+  const std::u8string_view text = u8"can't  jump 32.3 feet, 日本";
+  auto next = [&](std::size_t offset) {
+    const wutils::CursorStep step = wutils::next_word_boundary(text, offset);
+    return std::tuple(step.offset, step.columns, step.word);
+  };
+  EXPECT_EQ(next(0), std::tuple(5u, 5u, true));
+  EXPECT_EQ(next(5), std::tuple(7u, 2u, false));
+  EXPECT_EQ(next(2), std::tuple(5u, 3u, true));
+  // Inside "32.3", the digits before the cursor keep the number whole
+  EXPECT_EQ(next(14), std::tuple(16u, 2u, true));
+  EXPECT_EQ(next(21), std::tuple(22u, 1u, false));
+  EXPECT_EQ(next(23), std::tuple(26u, 2u, true));
+  EXPECT_EQ(next(text.size()), std::tuple(text.size(), 0u, false));
+
+  // A flag after the first of a pair of regional indicators
+  const std::u8string flags = u8"🇺🇸🇬🇧";
+  EXPECT_EQ(wutils::next_word_boundary(flags, 8).offset, 16u);
+  EXPECT_EQ(wutils::next_word_boundary(flags, 4).offset, 8u);
+
+  const std::wstring wide = L"can't stop";
+  EXPECT_EQ(wutils::next_word_boundary(wide, 2).offset, 5u);
+  const std::u16string text16 = u"32.3 feet";
+  EXPECT_EQ(wutils::next_word_boundary(text16, 1).offset, 4u);
+}
+
+// Runs in visual order as "text:level"
+template <typename CharT>
+std::vector<std::u8string>
+visual_runs(std::basic_string_view<CharT> line,
+            wutils::BidiDirection direction = wutils::BidiDirection::Auto) {
+  std::vector<std::u8string> result;
+  for (const wutils::BidiRun &run : wutils::bidi_runs(line, direction)) {
+    result.push_back(*wutils::u8s(line.substr(run.offset, run.length)) +
+                     u8":" + static_cast<char8_t>(u8'0' + run.level));
+  }
+  return result;
+}
+
+TEST(Bidi, ResolvesRuns) {
+  using Runs = std::vector<std::u8string>;
+  const auto rtl = wutils::BidiDirection::RightToLeft;
+  EXPECT_EQ(visual_runs(std::u8string_view(u8"car is אבג.")),
+            (Runs{u8"car is :0", u8"אבג:1", u8".:0"}));
+  // A number after Latin text in a right-to-left paragraph goes with it
+  EXPECT_EQ(visual_runs(std::u8string_view(u8"אבג abc 123.")),
+            (Runs{u8".:1", u8"abc 123:2", u8"אבג :1"}));
+  // Digits after Arabic letters are Arabic numbers
+  EXPECT_EQ(visual_runs(std::u8string_view(u8"عدد 123")),
+            (Runs{u8"123:2", u8"عدد :1"}));
+  EXPECT_EQ(visual_runs(std::u8string_view(u8"1 + 2 = שלוש")),
+            (Runs{u8" = שלוש:1", u8"2:2", u8" + :1", u8"1:2"}));
+  // Bracket pairs resolve together (the N0 example of UAX #9)
+  EXPECT_EQ(visual_runs(std::u8string_view(u8"אב(גד[&ef]!)gh"), rtl),
+            (Runs{u8"gh:2", u8"]!):1", u8"ef:2", u8"אב(גד[&:1"}));
+  // Isolates, the first strong character of an FSI deciding its direction,
+  // and overrides
+  EXPECT_EQ(visual_runs(std::u8string_view(u8"abc \u2067אבג\u2069 def")),
+            (Runs{u8"abc \u2067:0", u8"אבג:1", u8"\u2069 def:0"}));
+  EXPECT_EQ(visual_runs(std::u8string_view(u8"\u2068אבג\u2069 abc")),
+            (Runs{u8"\u2068:0", u8"אבג:1", u8"\u2069 abc:0"}));
+  EXPECT_EQ(visual_runs(std::u8string_view(u8"\u202Eabc\u202C")),
+            (Runs{u8"\u202E:0", u8"abc:1", u8"\u202C:0"}));
+  // Each paragraph takes its own direction
+  EXPECT_EQ(visual_runs(std::u8string_view(u8"אבג\nabc")),
+            (Runs{u8"אבג\n:1", u8"abc:0"}));
+
+  const std::u16string text16 = u"(אבג) abc";
+  EXPECT_EQ(visual_runs(std::u16string_view(text16)),
+            (Runs{u8"abc:2", u8"(אבג) :1"}));
+  const std::wstring wide = L"(אבג) abc";
+  EXPECT_EQ(wutils::bidi_runs(wide),
+            (std::vector<wutils::BidiRun>{{6, 3, 2}, {0, 6, 1}}));
+}
+
+TEST(Bidi, SkipsLeftToRightText) {
+  for (const auto &[width, text] : test_data) {
+    SCOPED_TRACE(std::string(text.begin(), text.end()));
+    const bool arabic = text.starts_with(u8"ا");
+    EXPECT_EQ(wutils::has_rtl(text), arabic);
+    EXPECT_EQ(wutils::has_rtl(*wutils::u16s(text)), arabic);
+    if (!arabic && !text.empty()) {
+      EXPECT_EQ(wutils::bidi_runs(text),
+                (std::vector<wutils::BidiRun>{{0, text.size(), 0}}));
+    }
+  }
+  std::u8string long_line(100, u8'x');
+  long_line += u8"“Ωμέγα”, 日本語 ";
+  EXPECT_FALSE(wutils::has_rtl(long_line));
+  EXPECT_TRUE(wutils::has_rtl(long_line + u8"\u200F"));
+  EXPECT_TRUE(wutils::has_rtl(long_line + u8"١"));
+  EXPECT_TRUE(wutils::has_rtl(long_line + u8"\U00010800"));
+  EXPECT_EQ(wutils::bidi_class(U'א'), wutils::BidiClass::R);
+  EXPECT_EQ(wutils::bidi_class(U'١'), wutils::BidiClass::AN);
+  EXPECT_EQ(wutils::bidi_mirror(U'('), U')');
+  EXPECT_EQ(wutils::bidi_mirror(U'«'), U'»');
+  EXPECT_EQ(wutils::bidi_mirror(U'a'), U'a');
+}
+
+TEST(Bidi, CacheResolvesChangedLines) {
+  wutils::BidiCache cache;
+  std::u8string line = u8"car is אבג.";
+  const std::vector<wutils::BidiRun> runs = wutils::bidi_runs(line);
+  EXPECT_TRUE(std::ranges::equal(cache.runs(0, line), runs));
+  EXPECT_TRUE(std::ranges::equal(cache.runs(0, line), runs));
+  EXPECT_EQ(cache.resolved(), 1u);
+  cache.runs(5, line);
+  EXPECT_EQ(cache.resolved(), 2u);
+  line += u8" abc";
+  EXPECT_EQ(cache.runs(0, line).size(), 3u);
+  cache.runs(0, line, wutils::BidiDirection::RightToLeft);
+  EXPECT_EQ(cache.resolved(), 4u);
+  cache.erase(5);
+  cache.runs(5, std::u8string_view(u8"car is אבג."));
+  EXPECT_EQ(cache.resolved(), 5u);
+
+  // Lines of the same length are told apart by their contents, and any row
+  // may be used
+  const std::u8string other = u8"bus is אבג.";
+  const std::size_t far_row = std::size_t{1} << 40;
+  EXPECT_TRUE(std::ranges::equal(cache.runs(far_row, other),
+                                 wutils::bidi_runs(other)));
+  EXPECT_TRUE(std::ranges::equal(cache.runs(far_row, line.substr(0, 14)),
+                                 runs));
+  cache.runs(far_row, line.substr(0, 14));
+  EXPECT_EQ(cache.resolved(), 7u);
+}
+
+TEST(Collation, Order) {
+  auto key = [](std::u8string_view text) { return wutils::sort_key(text); };
+  EXPECT_LT(key(u8"role"), key(u8"Role"));
+  EXPECT_LT(key(u8"Role"), key(u8"rôle"));
+  EXPECT_LT(key(u8"rôle"), key(u8"roles"));
+  EXPECT_LT(key(u8"a b"), key(u8"ab"));
+  EXPECT_LT(key(u8"abc"), key(u8"abd"));
+  EXPECT_LT(key(u8""), key(u8"a"));
+  EXPECT_LT(key(u8"9"), key(u8"a"));
+
+  using wutils::CollationStrength;
+  EXPECT_EQ(wutils::sort_key(u8"role"s, CollationStrength::Primary),
+            wutils::sort_key(u8"Rôle"s, CollationStrength::Primary));
+  EXPECT_EQ(wutils::sort_key(u8"role"s, CollationStrength::Secondary),
+            wutils::sort_key(u8"Role"s, CollationStrength::Secondary));
+  EXPECT_LT(wutils::sort_key(u8"Role"s, CollationStrength::Secondary),
+            wutils::sort_key(u8"rôle"s, CollationStrength::Secondary));
+
+  // Contractions, Hangul syllables and implicit weights
+  EXPECT_LT(key(u8"l·a"), key(u8"l·b"));
+  EXPECT_NE(key(u8"l·"), key(u8"l") + key(u8"·").substr(2));
+  EXPECT_EQ(key(u8"한"), key(u8"한"));
+  EXPECT_LT(key(u8"一"), key(u8"丁"));
+  EXPECT_LT(key(u8"丁"), key(u8"㐀"));
+  EXPECT_LT(key(u8"㐀"), key(u8"\U00020000"));
+  EXPECT_LT(key(u8"\U00020000"), key(u8"\U000E0000"));
+}
+
+TEST(Collation, EncodingsAgree) {
+  for (const auto &[width, sample] : test_data) {
+    const std::string key = wutils::sort_key(sample);
+    EXPECT_EQ(wutils::sort_key(*wutils::u16s(sample)), key);
+    EXPECT_EQ(wutils::sort_key(*wutils::u32s(sample)), key);
+    EXPECT_EQ(wutils::sort_key(*wutils::ws(sample)), key);
+  }
+  // The ASCII shortcut weighs characters as the general path does
+  EXPECT_EQ(wutils::sort_key(u8"Hello, World!é"s).substr(0, 2 * 13),
+            wutils::sort_key(u8"Hello, World!"s).substr(0, 2 * 13));
+  // Invalid input is weighted as U+FFFD
+  EXPECT_EQ(wutils::sort_key(u8"a\xFF"s), wutils::sort_key(u8"a�"s));
+}
+
+TEST(Collation, Arena) {
+  const std::vector<std::u8string> words = {u8"peach", u8"Péché", u8"péché",
+                                            u8"pêche", u8"peach", u8"PEACH"};
+  wutils::SortKeyArena arena;
+  arena.reserve(words.size(), 64);
+  for (std::size_t i = 0; i < words.size(); ++i) {
+    EXPECT_EQ(arena.add(words[i]), i);
+  }
+  ASSERT_EQ(arena.size(), words.size());
+  for (std::size_t i = 0; i < words.size(); ++i) {
+    EXPECT_EQ(arena[i], wutils::sort_key(words[i]));
+  }
+  EXPECT_EQ(arena[0], arena[4]);
+
+  std::vector<std::size_t> order = {0, 1, 2, 3, 4, 5};
+  std::stable_sort(order.begin(), order.end(),
+                   [&](std::size_t a, std::size_t b) {
+                     return arena[a] < arena[b];
+                   });
+  EXPECT_EQ(order, (std::vector<std::size_t>{0, 4, 5, 2, 1, 3}));
+
+  arena.clear();
+  EXPECT_EQ(arena.size(), 0u);
+  EXPECT_EQ(arena.add(u8"x"s), 0u);
+}
+
+TEST(Rope, Edits) {
+  wutils::Rope rope(u8"Hello, World!"s);
+  rope.insert(7, u8"wide 世界 and "s);
+  rope.erase(0, 7);
+  rope.append("\n!"s);
+  EXPECT_EQ(rope.str(), u8"wide 世界 and World!\n!");
+  EXPECT_EQ(rope.substr(5, 6), u8"世界");
+  // Offsets inside a code point move back to its start
+  EXPECT_EQ(rope.substr(6, 4), u8"世");
+  rope.insert(7, u8"|"s);
+  EXPECT_EQ(rope.str(), u8"wide |世界 and World!\n!");
+  rope.erase(5, 1000);
+  EXPECT_EQ(rope.str(), u8"wide ");
+  rope.insert(100, u8"\xFF"s);
+  EXPECT_EQ(rope.str(), u8"wide �");
+  rope.clear();
+  EXPECT_TRUE(rope.empty());
+  EXPECT_EQ(rope.metrics().bytes, 0u);
+
+  // Large documents are spread over many chunks
+  std::u8string text;
+  for (int i = 0; i < 2000; ++i) {
+    text += test_data[i % test_data.size()].text + u8"\n";
+  }
+  wutils::Rope large(text);
+  for (std::size_t i = 0; i < 200; ++i) {
+    const std::size_t offset = large.offset_of(wutils::TextMetric::Newlines,
+                                               i * 7 % 2000);
+    large.insert(offset, u8"é"s);
+    text.insert(offset, u8"é");
+    const std::size_t start = large.prefix(offset * 3 % text.size()).bytes;
+    const std::size_t end = large.prefix(start + 5).bytes;
+    large.erase(start, 5);
+    text.erase(start, end - start);
+  }
+  EXPECT_EQ(large.str(), text);
+  wutils::Rope copy = large;
+  large.erase(0, text.size() / 2);
+  EXPECT_EQ(copy.str(), text);
+  EXPECT_EQ(large.str(), text.substr(copy.prefix(text.size() / 2).bytes));
+}
+
+TEST(Rope, Metrics) {
+  std::u8string text;
+  std::size_t width = 0;
+  for (const auto &[sample_width, sample] : test_data) {
+    text += sample + u8"\n";
+    width += sample_width;
+  }
+  text = text + text + text;
+  wutils::Rope rope(text);
+  rope.insert(rope.size() / 2, u8"\U00010348"s);
+  text.insert(rope.prefix(rope.size() / 2).bytes, u8"\U00010348");
+
+  const wutils::TextMetrics metrics = rope.metrics();
+  EXPECT_EQ(metrics.bytes, text.size());
+  EXPECT_EQ(metrics.utf16_units, wutils::u16length(text));
+  EXPECT_EQ(metrics.code_points, wutils::u32length(text));
+  EXPECT_EQ(metrics.newlines, 3 * test_data.size());
+  EXPECT_EQ(metrics.width, 3 * width + 1);
+
+  // Emoji sequences are measured as a whole when split between edits
+  wutils::Rope emoji(u8"👨‍👩"s);
+  emoji.insert(emoji.size(), u8"‍👧👍"s);
+  emoji.insert(emoji.size(), u8"🏽"s);
+  EXPECT_EQ(emoji.metrics().width,
+            static_cast<std::size_t>(wutils::uswidth(u8"👨‍👩‍👧👍🏽")));
+  EXPECT_EQ(emoji.metrics().width, 4u);
+}
+
+TEST(Rope, PositionConversions) {
+  using wutils::TextMetric;
+  wutils::Rope rope(u8"ab\n😀日\n\nz"s);
+  EXPECT_EQ(rope.offset_of(TextMetric::Newlines, 0), 0u);
+  EXPECT_EQ(rope.offset_of(TextMetric::Newlines, 1), 3u);
+  EXPECT_EQ(rope.offset_of(TextMetric::Newlines, 2), 11u);
+  EXPECT_EQ(rope.offset_of(TextMetric::Newlines, 3), 12u);
+  EXPECT_EQ(rope.offset_of(TextMetric::Newlines, 4), rope.size());
+  EXPECT_EQ(rope.offset_of(TextMetric::CodePoints, 4), 7u);
+  // Halfway into a surrogate pair or a wide character stays before it
+  EXPECT_EQ(rope.offset_of(TextMetric::Utf16Units, 4), 3u);
+  EXPECT_EQ(rope.offset_of(TextMetric::Utf16Units, 5), 7u);
+  EXPECT_EQ(rope.offset_of(TextMetric::Width, 3), 3u);
+  EXPECT_EQ(rope.offset_of(TextMetric::Width, 4), 7u);
+  EXPECT_EQ(rope.offset_of(TextMetric::Width, 100), rope.size());
+  EXPECT_EQ(rope.offset_of(TextMetric::Bytes, 5), 3u);
+
+  const wutils::TextMetrics prefix = rope.prefix(10);
+  EXPECT_EQ(prefix.bytes, 10u);
+  EXPECT_EQ(prefix.utf16_units, 6u);
+  EXPECT_EQ(prefix.code_points, 5u);
+  EXPECT_EQ(prefix.newlines, 1u);
+  EXPECT_EQ(prefix.width, 6u);
+  EXPECT_EQ(rope.prefix(9).bytes, 7u);
+}
+
+TEST(Telemetry, Counters) {
+  using wutils::ConversionPair;
+  const wutils::TelemetrySnapshot before = wutils::telemetry_snapshot();
+  EXPECT_EQ(wutils::u16s(u8"héllo\xFF"s).value.size(), 6u);
+  std::thread([] { wutils::u8s(U"abc"s); }).join();
+  const wutils::TelemetrySnapshot delta =
+      wutils::telemetry_snapshot().since(before);
+
+  const wutils::ConversionTelemetry &utf8 = delta[ConversionPair::Utf8ToUtf16];
+  const wutils::ConversionTelemetry &utf32 = delta[ConversionPair::Utf32ToUtf8];
+  const std::uint64_t calls = wutils::telemetry_enabled() ? 1 : 0;
+  EXPECT_EQ(utf8.calls, calls);
+  EXPECT_EQ(utf8.input_units, 7 * calls);
+  EXPECT_EQ(utf8.output_units, 6 * calls);
+  EXPECT_EQ(utf8.invalid_sequences, calls);
+  EXPECT_EQ(utf8.size_histogram[3], calls);
+  std::uint64_t loops = 0, latencies = 0;
+  for (const std::uint64_t count : utf8.loop_calls) {
+    loops += count;
+  }
+  for (const std::uint64_t count : utf8.latency_histogram) {
+    latencies += count;
+  }
+  EXPECT_EQ(loops, calls);
+  EXPECT_EQ(latencies, calls);
+  // Threads that have exited still count
+  EXPECT_EQ(utf32.calls, calls);
+  EXPECT_EQ(utf32.input_units, 3 * calls);
+  EXPECT_EQ(delta[ConversionPair::Utf16ToUtf32].calls, 0u);
+}
+
+// Runs every task on a thread of its own
+struct ThreadExecutor {
+  std::vector<std::jthread> threads;
+  void submit(std::function<void()> task) {
+    threads.emplace_back(std::move(task));
+  }
+};
+
+// Holds tasks back until after the call that submitted them has returned
+struct DeferredExecutor {
+  std::vector<std::function<void()>> tasks;
+  void submit(std::function<void()> task) { tasks.push_back(std::move(task)); }
+};
+
+TEST(Parallel, MatchesSequential) {
+  // An odd-sized pattern puts chunk boundaries inside every kind of sequence
+  std::u8string u8;
+  while (u8.size() < 3 * wutils::PARALLEL_CHUNK_BYTES) {
+    u8 += u8"ab é日😀\xF0\x9F\x98 \xED\xA0\x80z\xC3\n";
+  }
+  const std::u16string u16 = wutils::u16s(u8).value;
+  std::u16string broken_u16 = u16;
+  broken_u16[broken_u16.size() / 2] = 0xD800;
+
+  for (const wutils::ErrorPolicy policy :
+       {wutils::ErrorPolicy::UseReplacementCharacter,
+        wutils::ErrorPolicy::SkipInvalidValues,
+        wutils::ErrorPolicy::StopOnFirstError}) {
+    ThreadExecutor threads;
+    DeferredExecutor deferred;
+    const auto expected = wutils::u32s(u8, policy);
+    const auto parallel = wutils::u32s(u8, threads, policy);
+    EXPECT_EQ(parallel.value, expected.value);
+    EXPECT_EQ(parallel.is_valid, expected.is_valid);
+    const auto late = wutils::u16s(u8, deferred, policy);
+    EXPECT_EQ(late.value, wutils::u16s(u8, policy).value);
+    for (const auto &task : deferred.tasks) {
+      task();
+    }
+    const auto u8_from_u16 = wutils::u8s(broken_u16, threads, policy);
+    EXPECT_EQ(u8_from_u16.value, wutils::u8s(broken_u16, policy).value);
+    EXPECT_FALSE(u8_from_u16.is_valid);
+  }
+
+  ThreadExecutor threads;
+  EXPECT_EQ(wutils::u16length(u8, threads), wutils::u16length(u8));
+  EXPECT_EQ(wutils::u32length(u8, threads), wutils::u32length(u8));
+  EXPECT_EQ(wutils::u8length(broken_u16, threads),
+            wutils::u8length(broken_u16));
+}
+
+TEST(Parallel, SmallInputStaysOnCaller) {
+  DeferredExecutor deferred;
+  EXPECT_EQ(wutils::u16s(u8"héllo"s, deferred).value, u"héllo");
+  EXPECT_EQ(wutils::u8length(u"héllo"s, deferred), 6u);
+  EXPECT_TRUE(deferred.tasks.empty());
+}
+
+TEST(TextCounts, Clusters) {
+  const wutils::TextCounts combining = wutils::text_counts(u8"e\u0301x"sv);
+  EXPECT_EQ(combining.width, 2);
+  EXPECT_EQ(combining.code_points, 3u);
+  EXPECT_EQ(combining.graphemes, 2u);
+  const wutils::TextCounts family =
+      wutils::text_counts(u"\U0001F468\u200D\U0001F469\u200D\U0001F467"sv);
+  EXPECT_EQ(family.width, 2);
+  EXPECT_EQ(family.code_points, 5u);
+  EXPECT_EQ(family.graphemes, 1u);
+  // Regional indicators pair up, and CR LF is one cluster
+  EXPECT_EQ(wutils::text_counts(U"\U0001F1E6\U0001F1E7\U0001F1E6"sv).graphemes,
+            2u);
+  EXPECT_EQ(wutils::text_counts(u8"\r\n\n"sv).graphemes, 2u);
+  EXPECT_EQ(wutils::text_counts(u8"\r\n\n"sv).width, -1);
+  EXPECT_EQ(wutils::text_counts(U"각ᄀ"sv).graphemes, 2u);
+  // Invalid sequences are skipped and NUL ends the width, as in uswidth()
+  const wutils::TextCounts nul = wutils::text_counts(u8"ab\xFF\0\x01z"sv);
+  EXPECT_EQ(nul.width, 2);
+  EXPECT_EQ(nul.code_points, 5u);
+  for (const InputData &data : test_data) {
+    EXPECT_EQ(wutils::text_counts(data.text).width, data.width);
+  }
+}
+
+TEST(Parallel, TextCountsMatchSequential) {
+  const std::size_t chunk = wutils::PARALLEL_CHUNK_BYTES;
+  std::vector<std::u32string> texts;
+  std::u32string mixed;
+  while (mixed.size() < chunk) {
+    mixed += U"x\U0001F468\u200D\U0001F469\u200D\U0001F467e\u0301\u0301"
+             U"\U0001F1E6\U0001F1E7\U0001F1E6\r\n가日";
+  }
+  texts.push_back(mixed);
+  // Runs longer than a chunk only settle in the chunk they end in
+  texts.push_back(U"\U0001F600" + std::u32string(chunk, U'\u0301') + U"a");
+  texts.push_back(U"a" + std::u32string(chunk / 2 + 1, U'\U0001F1E6') + U"b");
+  texts.push_back(mixed + U'\0' + mixed);
+  texts.push_back(mixed + U'\x01' + mixed);
+
+  ThreadExecutor threads;
+  auto expect_same = [&](const auto &text) {
+    const wutils::TextCounts expected = wutils::text_counts(text);
+    const wutils::TextCounts parallel = wutils::text_counts(text, threads);
+    EXPECT_EQ(parallel.width, expected.width);
+    EXPECT_EQ(parallel.code_points, expected.code_points);
+    EXPECT_EQ(parallel.graphemes, expected.graphemes);
+    EXPECT_EQ(wutils::uswidth(text, threads), wutils::uswidth(text));
+  };
+  for (const std::u32string &text : texts) {
+    expect_same(text);
+    expect_same(wutils::u8s(text).value);
+    // One more unit in front moves every boundary
+    expect_same(u"a" + wutils::u16s(text).value);
+  }
+}
+
+TEST(Bounded, StopsOnCodePoint) {
+  // A surrogate pair is never split
+  const auto cut = wutils::u16s_bounded(u8"a😀b"s, 2);
+  EXPECT_EQ(cut.value, u"a");
+  EXPECT_EQ(cut.consumed, 1u);
+  EXPECT_TRUE(cut.is_valid);
+  EXPECT_EQ(wutils::u16s_bounded(u8"a😀b"s, 3).value, u"a😀");
+  EXPECT_EQ(wutils::u16s_bounded(u8"a😀b"s, 3).consumed, 5u);
+  EXPECT_EQ(wutils::u8s_bounded(u"héllo"s, 2).value, u8"h");
+  EXPECT_EQ(wutils::u8s_bounded(u"héllo"s, 100).value, u8"héllo");
+  EXPECT_EQ(wutils::u16s_bounded(u"a😀"s, 2).value, u"a");
+  EXPECT_EQ(wutils::u32s_bounded(u8"日本"s, 0).consumed, 0u);
+
+  const auto stopped = wutils::u16s_bounded(
+      u8"ab\xFF" "cd"s, 10, wutils::Truncation::CodePoint,
+      wutils::ErrorPolicy::StopOnFirstError);
+  EXPECT_EQ(stopped.value, u"ab");
+  EXPECT_EQ(stopped.consumed, 2u);
+  EXPECT_FALSE(stopped.is_valid);
+}
+
+TEST(Bounded, StopsOnGrapheme) {
+  using wutils::Truncation;
+  const std::u32string text = U"ae\u0301\U0001F468\u200D\U0001F469b";
+  EXPECT_EQ(wutils::u8s_bounded(text, 2).value, u8"ae");
+  EXPECT_EQ(wutils::u8s_bounded(text, 2, Truncation::Grapheme).value, u8"a");
+  EXPECT_EQ(wutils::u8s_bounded(text, 2, Truncation::Grapheme).consumed, 1u);
+  const auto family = wutils::u16s_bounded(text, 6, Truncation::Grapheme);
+  EXPECT_EQ(family.value, u"ae\u0301");
+  EXPECT_EQ(family.consumed, 3u);
+  EXPECT_EQ(wutils::u16s_bounded(text, 8, Truncation::Grapheme).consumed, 6u);
+}
+
+TEST(Bounded, Resumes) {
+  std::u8string text;
+  while (text.size() < 5000) {
+    text += u8"Grüße, 世界! 👋🏽 \xF0\x9F ";
+  }
+  std::u16string joined;
+  for (std::u8string_view rest = text; !rest.empty();) {
+    const auto piece = wutils::u16s_bounded(rest, 255);
+    ASSERT_LE(piece.value.size(), 255u);
+    ASSERT_GT(piece.consumed, 0u);
+    joined += piece.value;
+    rest.remove_prefix(piece.consumed);
+  }
+  EXPECT_EQ(joined, wutils::u16s(text).value);
+}
+
+TEST(Inline, ConvertsInPlace) {
+  const auto hello = wutils::u16s_inline<16>(u8"Grüße, 世界"s);
+  EXPECT_EQ(hello.value, u"Grüße, 世界");
+  EXPECT_EQ(hello.consumed, 15u);
+  EXPECT_TRUE(hello.is_valid);
+  EXPECT_EQ(hello->capacity(), 16u);
+  EXPECT_EQ(wutils::u8s_inline<8>(U"日本"s).value, u8"日本");
+  EXPECT_EQ(wutils::u32s_inline<4>("abc"s).value, U"abc");
+  EXPECT_EQ(wutils::u8s_inline<4>(u8"abc"s).value, u8"abc");
+
+  const auto invalid = wutils::u16s_inline<16>(u8"a\xFF" "b"s);
+  EXPECT_EQ(invalid.value, u"a�b");
+  EXPECT_FALSE(invalid.is_valid);
+
+  // Copies keep their contents
+  auto copy = hello.value;
+  EXPECT_EQ(copy, u"Grüße, 世界");
+  copy = invalid.value;
+  EXPECT_EQ(std::u16string(copy.view()), u"a�b");
+}
+
+TEST(Inline, StopsWhenFull) {
+  const std::u8string text = u8"ab😀cd";
+  const auto cut = wutils::u16s_inline<3>(text);
+  EXPECT_EQ(cut.value, u"ab");
+  EXPECT_EQ(cut.consumed, 2u);
+  EXPECT_LT(cut.consumed, text.size());
+  EXPECT_EQ(wutils::u16s_inline<4>(text).value, u"ab😀");
+  EXPECT_EQ(wutils::u8s_inline<3>(u8"aé€"s).value, u8"aé");
+  EXPECT_EQ(wutils::u8s_inline<3>(u8"aé€"s).consumed, 3u);
+
+  // Resuming from `consumed` converts the rest
+  std::u16string joined;
+  for (std::u8string_view rest = text; !rest.empty();) {
+    const auto piece = wutils::u16s_inline<2>(rest);
+    ASSERT_GT(piece.consumed, 0u);
+    joined += piece.value.view();
+    rest.remove_prefix(piece.consumed);
+  }
+  EXPECT_EQ(joined, u"ab😀cd");
+}
+
+TEST(Streaming, MatchesCached) {
+  std::u8string text;
+  while (text.size() < 100000) {
+    text += u8"Grüße, 世界! 👋🏽 \xF0\x9F \xC0\xAF ascii text ";
+  }
+  const std::u16string u16 = wutils::u16s(text).value;
+  for (const auto policy : {wutils::ErrorPolicy::UseReplacementCharacter,
+                            wutils::ErrorPolicy::SkipInvalidValues,
+                            wutils::ErrorPolicy::StopOnFirstError}) {
+    const auto streamed = wutils::u16s(text, wutils::StoreMode::Streaming,
+                                       policy);
+    const auto cached = wutils::u16s(text, wutils::StoreMode::Cached, policy);
+    EXPECT_EQ(streamed.value, cached.value);
+    EXPECT_EQ(streamed.is_valid, cached.is_valid);
+    EXPECT_EQ(wutils::u32s(text, wutils::StoreMode::Streaming, policy).value,
+              wutils::u32s(text, wutils::StoreMode::Cached, policy).value);
+    EXPECT_EQ(wutils::u8s(u16, wutils::StoreMode::Streaming, policy).value,
+              wutils::u8s(u16, wutils::StoreMode::Cached, policy).value);
+  }
+  // Output that does not start on a 16 byte boundary
+  const std::u32string expected = wutils::u32s(text).value;
+  std::vector<char32_t> buffer(expected.size() + 3);
+  for (size_t offset = 0; offset < 3; ++offset) {
+    const auto res = wutils::detail::transcode(
+        std::u8string_view(text), buffer.data() + offset,
+        wutils::ErrorPolicy::UseReplacementCharacter,
+        wutils::ContentClass::Unknown, wutils::StoreMode::Streaming);
+    EXPECT_EQ(res.read, text.size());
+    EXPECT_EQ(std::u32string_view(buffer.data() + offset, res.written),
+              expected);
+  }
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,87 @@
+# Helpers shared by the table generators in this directory.
+package WutilsTables;
+
+use strict;
+use warnings;
+use Exporter 'import';
+use List::Util qw(max);
+
+our @EXPORT_OK = qw(build_trie c_type emit_array);
+
+# Smallest unsigned C++ type holding values up to $max.
+sub c_type {
+  my ($max) = @_;
+  return $max < 256 ? 'std::uint8_t'
+       : $max < 65536 ? 'std::uint16_t'
+       : 'std::uint32_t';
+}
+
+sub c_size {
+  my ($max) = @_;
+  return $max < 256 ? 1 : $max < 65536 ? 2 : 4;
+}
+
+# Splits $values into blocks of 2^$shift entries and interns the blocks.
+sub blocks {
+  my ($values, $shift) = @_;
+  my $size = 1 << $shift;
+  my (@data, @index, %block_index);
+  for (my $i = 0; $i < @$values; $i += $size) {
+    my $key = join ',', @$values[$i .. $i + $size - 1];
+    unless (defined $block_index{$key}) {
+      $block_index{$key} = @data / $size;
+      push @data, @$values[$i .. $i + $size - 1];
+    }
+    push @index, $block_index{$key};
+  }
+  return (\@data, \@index);
+}
+
+# Builds the smallest three-stage trie over @$values, one value per code
+# point. A value is found at
+#   stage3[(stage2[(stage1[cp >> (leaf + mid)] << mid) +
+#                  ((cp >> leaf) & ((1 << mid) - 1))] << leaf) +
+#          (cp & ((1 << leaf) - 1))]
+sub build_trie {
+  my ($values) = @_;
+  my $max_value = max(@$values);
+  my $best;
+  for my $leaf_shift (4 .. 8) {
+    my ($stage3, $leaf_index) = blocks($values, $leaf_shift);
+    for my $mid_shift (2 .. 6) {
+      my ($stage2, $stage1) = blocks($leaf_index, $mid_shift);
+      my %trie = (
+        leaf_shift => $leaf_shift,
+        mid_shift => $mid_shift,
+        stage1 => $stage1,
+        stage2 => $stage2,
+        stage3 => $stage3,
+        stage1_type => c_type(max(@$stage1)),
+        stage2_type => c_type(max(@$stage2)),
+        stage3_type => c_type($max_value),
+      );
+      $trie{size} = @$stage1 * c_size(max(@$stage1)) +
+                    @$stage2 * c_size(max(@$stage2)) +
+                    @$stage3 * c_size($max_value);
+      $best = \%trie if !defined $best || $trie{size} < $best->{size};
+    }
+  }
+  return $best;
+}
+
+sub emit_array {
+  my ($type, $name, $values, $format) = @_;
+  print "static const $type ${name}[] = {\n";
+  my $line = '   ';
+  for (@$values) {
+    my $item = sprintf " $format,", $_;
+    if (length($line) + length($item) > 80) {
+      print "$line\n";
+      $line = '   ';
+    }
+    $line .= $item;
+  }
+  print "$line\n};\n\n";
+}
+
+1;
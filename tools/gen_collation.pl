@@ -0,0 +1,163 @@
+#!/usr/bin/env perl
+# Generates src/wutils_collation.inc, the Default Unicode Collation Element
+# Table used by wutils::sort_key().
+#
+# Usage: perl tools/gen_collation.pl [allkeys.txt] > src/wutils_collation.inc
+#
+# allkeys.txt defaults to the copy shipped with Perl's Unicode::Collate.
+# Unified_Ideograph, which selects the implicit weights of Han characters,
+# comes from Perl's Unicode database.
+
+use strict;
+use warnings;
+use FindBin;
+use lib $FindBin::Bin;
+use Unicode::UCD qw(prop_invlist);
+use WutilsTables qw(build_trie emit_array);
+
+my $MAX = 0x110000;
+
+my $allkeys = shift // (grep { -f } map { "$_/Unicode/Collate/allkeys.txt" }
+                        @INC)[0] // die "allkeys.txt not found\n";
+open my $in, '<', $allkeys or die "$allkeys: $!\n";
+
+my ($version, @implicit, @entries);
+while (<$in>) {
+  s/\s*#.*//;
+  next unless /\S/;
+  if (/^\@version\s+(\S+)/) {
+    $version = $1;
+  } elsif (/^\@implicitweights\s+([0-9A-F]+)\.\.([0-9A-F]+);\s*([0-9A-F]+)/) {
+    push @implicit, [hex $1, hex $2, hex $3];
+  } elsif (/^([0-9A-F ]+?)\s*;\s*((?:\[[.*][0-9A-F.]+\])+)/) {
+    my @code_points = map { hex } split ' ', $1;
+    my @elements;
+    push @elements, [map { hex } split /\./]
+      for $2 =~ /\[[.*]([0-9A-F.]+)\]/g;
+    push @entries, [\@code_points, \@elements];
+  } else {
+    die "$allkeys: cannot parse line $.: $_";
+  }
+}
+close $in;
+
+# Secondary and tertiary weights are replaced by their rank among the
+# weights in use, so each fits in a byte of the sort key. Zero stays zero.
+my (%secondary, %tertiary);
+for (@entries) {
+  for (@{$_->[1]}) {
+    $secondary{$_->[1]} = 1;
+    $tertiary{$_->[2]} = 1;
+  }
+}
+$secondary{0x20} = $tertiary{0x02} = 1; # Implicit weights
+my $rank = 0;
+$secondary{$_} = $_ ? ++$rank : 0 for sort { $a <=> $b } keys %secondary;
+$rank = 0;
+$tertiary{$_} = $_ ? ++$rank : 0 for sort { $a <=> $b } keys %tertiary;
+die "secondary weights do not fit in a byte\n" if keys %secondary > 256;
+
+# Collation elements of every entry, back to back. An entry is referenced as
+# offset << 6 | count << 1, the low bit marking code points that start a
+# contraction.
+my (@elements, @mapping, @contractions);
+$mapping[$MAX - 1] = 0;
+for (@entries) {
+  my ($code_points, $entry_elements) = @$_;
+  my $count = @$entry_elements;
+  die "too many collation elements\n" if $count >= 32;
+  my $entry = @elements << 6 | $count << 1;
+  push @elements,
+    map { $_->[0] << 16 | $secondary{$_->[1]} << 8 | $tertiary{$_->[2]} }
+    @$entry_elements;
+  if (@$code_points == 1) {
+    $mapping[$code_points->[0]] |= $entry;
+  } else {
+    die "contraction longer than three code points\n" if @$code_points > 3;
+    push @contractions, [@$code_points, (0) x (3 - @$code_points), $entry];
+    $mapping[$code_points->[0]] |= 1;
+  }
+}
+die "collation element table too large\n" if @elements >= 1 << 16;
+$_ //= 0 for @mapping;
+for (@contractions) {
+  die sprintf("contraction start %04X has no mapping\n", $_->[0])
+    unless $mapping[$_->[0]] >> 1;
+}
+@contractions = sort {
+  $a->[0] <=> $b->[0] || $a->[1] <=> $b->[1] || $a->[2] <=> $b->[2]
+} @contractions;
+
+my @ascii;
+for my $cp (0 .. 0x7F) {
+  my $entry = $mapping[$cp];
+  die sprintf("U+%04X needs one collation element\n", $cp)
+    unless ($entry >> 1 & 31) == 1;
+  push @ascii, $elements[$entry >> 6];
+}
+
+# Implicit weights: ranges listed in allkeys.txt count from the start of the
+# first range sharing their base, Unified_Ideograph ones from U+0000.
+my %origin;
+for (sort { $a->[0] <=> $b->[0] } @implicit) {
+  $origin{$_->[2]} //= $_->[0];
+}
+my @implicit_ranges =
+  map { [@$_, $origin{$_->[2]}] } sort { $a->[0] <=> $b->[0] } @implicit;
+my @ideographs;
+my @list = prop_invlist('Unified_Ideograph');
+for (my $i = 0; $i < @list; $i += 2) {
+  my ($first, $last) = ($list[$i], ($list[$i + 1] // $MAX) - 1);
+  for my $cp ($first .. $last) {
+    my $core = ($cp >= 0x4E00 && $cp <= 0x9FFF) ||
+               ($cp >= 0xF900 && $cp <= 0xFAFF);
+    my $base = $core ? 0xFB40 : 0xFB80;
+    if (@ideographs && $ideographs[-1][1] == $cp - 1 &&
+        $ideographs[-1][2] == $base) {
+      $ideographs[-1][1] = $cp;
+    } else {
+      push @ideographs, [$cp, $cp, $base];
+    }
+  }
+}
+
+my $trie = build_trie(\@mapping);
+my $total = $trie->{size} + 4 * (@elements + @ascii) + 16 * @contractions;
+print <<"EOF";
+/* Generated by tools/gen_collation.pl from DUCET $version. Do not edit. */
+/* Total size: $total bytes. */
+
+constexpr unsigned COLLATION_LEAF_SHIFT = $trie->{leaf_shift};
+constexpr unsigned COLLATION_MID_SHIFT = $trie->{mid_shift};
+
+/* Ranks of the secondary and tertiary weights of implicit elements */
+constexpr std::uint32_t COLLATION_COMMON_SECONDARY = $secondary{0x20};
+constexpr std::uint32_t COLLATION_COMMON_TERTIARY = $tertiary{0x02};
+
+struct CollationContraction {
+  char32_t code_points[3];
+  std::uint32_t entry;
+};
+
+struct CollationImplicitRange {
+  char32_t first;
+  char32_t last;
+  std::uint32_t base;
+  char32_t origin;
+};
+
+EOF
+for my $stage (1 .. 3) {
+  emit_array($trie->{"stage${stage}_type"}, "collation_stage$stage",
+             $trie->{"stage$stage"}, $stage == 3 ? '0x%X' : '%d');
+}
+emit_array('std::uint32_t', 'collation_elements', \@elements, '0x%X');
+emit_array('std::uint32_t', 'collation_ascii', \@ascii, '0x%X');
+emit_array('CollationContraction', 'collation_contractions',
+           [map { sprintf '{{0x%04X, 0x%04X, 0x%04X}, 0x%X}', @$_ }
+            @contractions], '%s');
+emit_array('CollationImplicitRange', 'collation_implicit_ranges',
+           [map { sprintf '{0x%X, 0x%X, 0x%X, 0x%X}', @$_ } @implicit_ranges],
+           '%s');
+emit_array('CollationImplicitRange', 'collation_ideographs',
+           [map { sprintf '{0x%X, 0x%X, 0x%X, 0}', @$_ } @ideographs], '%s');
@@ -0,0 +1,277 @@
+#!/usr/bin/env perl
+# Generates src/wutils_properties.inc, the code point property trie used by
+# wutils::properties(), wutils::classify() and the column width functions.
+#
+# Usage: perl tools/gen_properties.pl > src/wutils_properties.inc
+#
+# Property data comes from the Unicode database shipped with Perl
+# (Unicode::UCD), so the tables follow the Unicode version of the Perl used
+# to run this script. The enumerator order emitted here must match the enums
+# declared in include/wutils_properties.hpp.
+
+use strict;
+use warnings;
+use FindBin;
+use lib $FindBin::Bin;
+use Unicode::UCD qw(prop_invmap);
+use WutilsTables qw(build_trie emit_array);
+
+my $MAX = 0x110000;
+
+my @categories = qw(Cn Lu Ll Lt Lm Lo Mn Mc Me Nd Nl No Pc Pd Ps Pe Pi Pf Po
+                    Sm Sc Sk So Zs Zl Zp Cc Cf Cs Co);
+my @widths = qw(Neutral A H W F Na);
+my @breaks = qw(Other CR LF Control Extend ZWJ Regional_Indicator Prepend
+                SpacingMark L V T LV LVT);
+my @emoji = qw(Emoji EPres EMod EBase EComp ExtPict);
+my @word_breaks = qw(Other CR LF Newline Extend ZWJ Regional_Indicator Format
+                     Katakana Hebrew_Letter ALetter Single_Quote Double_Quote
+                     MidNumLet MidLetter MidNum Numeric ExtendNumLet
+                     WSegSpace);
+my @sentence_breaks = qw(Other CR LF Extend Sep Format Sp Lower Upper OLetter
+                         Numeric ATerm SContinue STerm Close);
+my @bidi_classes = qw(L R AL EN ES ET AN CS NSM BN B S WS ON LRE LRO RLE RLO
+                      PDF LRI RLI FSI PDI);
+
+# Record layout, low bit first.
+my @fields = (
+  [category => 5], [script => 8], [east_asian_width => 3],
+  [grapheme_break => 4], [emoji => 6], [width => 2],
+);
+# Segmentation and bidi properties, kept in a parallel table of 16-bit
+# records.
+my @segment_fields =
+  ([word_break => 5], [sentence_break => 4], [bidi_class => 5]);
+
+sub expand {
+  my ($prop, $index) = @_;
+  my ($list, $map) = prop_invmap($prop);
+  my @values = (0) x $MAX;
+  for my $i (0 .. $#$list) {
+    my $end = $i < $#$list ? $list->[$i + 1] : $MAX;
+    my $value = $map->[$i];
+    die "$prop: unexpected value $value\n" unless defined $index->($value);
+    @values[$list->[$i] .. $end - 1] = ($index->($value)) x ($end - $list->[$i]);
+  }
+  return \@values;
+}
+
+sub index_of {
+  my %index;
+  @index{@_} = 0 .. $#_;
+  return sub { $index{$_[0]} };
+}
+
+# Scripts: Unknown, Common and Inherited first, the rest alphabetically.
+my (undef, $script_map) = prop_invmap('Script');
+my %seen;
+my @scripts = grep { !$seen{$_}++ }
+  qw(Unknown Common Inherited), sort @$script_map;
+
+my %props;
+$props{category} = expand('gc', index_of(@categories));
+$props{script} = expand('Script', index_of(@scripts));
+$props{east_asian_width} = expand('ea', index_of(@widths));
+# Perl folds Extended_Pictographic into its GCB map; it is kept as a
+# separate emoji flag here.
+$props{grapheme_break} =
+  expand('GCB', index_of(@breaks, 'ExtPict_XX'));
+$_ = $_ == @breaks ? 0 : $_ for @{$props{grapheme_break}};
+# Perl tailors spaces in its WB map; WSegSpace is the untailored set.
+my %wseg_space = map { $_ => 1 }
+  0x20, 0x1680, 0x2000 .. 0x2006, 0x2008 .. 0x200A, 0x205F, 0x3000;
+# Extended_Pictographic is folded in as for GCB.
+my $word_break = index_of(@word_breaks);
+my %tailored = (
+  ExtPict_XX => 'Other', ExtPict_LE => 'ALetter',
+  Perl_Tailored_HSpace => 'Other',
+);
+$props{word_break} = expand('WB', sub {
+  $word_break->($tailored{$_[0]} // $_[0]);
+});
+$props{word_break}[$_] = $word_break->('WSegSpace') for keys %wseg_space;
+$props{sentence_break} = expand('SB', index_of(@sentence_breaks));
+$props{bidi_class} = expand('Bidi_Class', index_of(@bidi_classes));
+$props{emoji} = [(0) x $MAX];
+for my $bit (0 .. $#emoji) {
+  my $flag = expand($emoji[$bit], index_of('N', 'Y'));
+  $props{emoji}[$_] |= $flag->[$_] << $bit for 0 .. $MAX - 1;
+}
+
+# Column widths as computed by mk_wcwidth(): -1 for control characters, 0
+# for the null character and non-spacing characters, 2 for wide and
+# fullwidth characters and emoji, otherwise 1. Stored biased by one.
+#
+# Non-spacing characters, generated by
+# "uniset +cat=Me +cat=Mn +cat=Cf -00AD +1160-11FF +200B c". Emoji
+# modifiers keep their own width; mk_wcswidth() folds them into the emoji
+# they follow.
+my @combining = (
+  [0x0300, 0x036F], [0x0483, 0x0486], [0x0488, 0x0489], [0x0591, 0x05BD],
+  [0x05BF, 0x05BF], [0x05C1, 0x05C2], [0x05C4, 0x05C5], [0x05C7, 0x05C7],
+  [0x0600, 0x0603], [0x0610, 0x0615], [0x064B, 0x065E], [0x0670, 0x0670],
+  [0x06D6, 0x06E4], [0x06E7, 0x06E8], [0x06EA, 0x06ED], [0x070F, 0x070F],
+  [0x0711, 0x0711], [0x0730, 0x074A], [0x07A6, 0x07B0], [0x07EB, 0x07F3],
+  [0x0901, 0x0902], [0x093C, 0x093C], [0x0941, 0x0948], [0x094D, 0x094D],
+  [0x0951, 0x0954], [0x0962, 0x0963], [0x0981, 0x0981], [0x09BC, 0x09BC],
+  [0x09C1, 0x09C4], [0x09CD, 0x09CD], [0x09E2, 0x09E3], [0x0A01, 0x0A02],
+  [0x0A3C, 0x0A3C], [0x0A41, 0x0A42], [0x0A47, 0x0A48], [0x0A4B, 0x0A4D],
+  [0x0A70, 0x0A71], [0x0A81, 0x0A82], [0x0ABC, 0x0ABC], [0x0AC1, 0x0AC5],
+  [0x0AC7, 0x0AC8], [0x0ACD, 0x0ACD], [0x0AE2, 0x0AE3], [0x0B01, 0x0B01],
+  [0x0B3C, 0x0B3C], [0x0B3F, 0x0B3F], [0x0B41, 0x0B43], [0x0B4D, 0x0B4D],
+  [0x0B56, 0x0B56], [0x0B82, 0x0B82], [0x0BC0, 0x0BC0], [0x0BCD, 0x0BCD],
+  [0x0C3E, 0x0C40], [0x0C46, 0x0C48], [0x0C4A, 0x0C4D], [0x0C55, 0x0C56],
+  [0x0CBC, 0x0CBC], [0x0CBF, 0x0CBF], [0x0CC6, 0x0CC6], [0x0CCC, 0x0CCD],
+  [0x0CE2, 0x0CE3], [0x0D41, 0x0D43], [0x0D4D, 0x0D4D], [0x0DCA, 0x0DCA],
+  [0x0DD2, 0x0DD4], [0x0DD6, 0x0DD6], [0x0E31, 0x0E31], [0x0E34, 0x0E3A],
+  [0x0E47, 0x0E4E], [0x0EB1, 0x0EB1], [0x0EB4, 0x0EB9], [0x0EBB, 0x0EBC],
+  [0x0EC8, 0x0ECD], [0x0F18, 0x0F19], [0x0F35, 0x0F35], [0x0F37, 0x0F37],
+  [0x0F39, 0x0F39], [0x0F71, 0x0F7E], [0x0F80, 0x0F84], [0x0F86, 0x0F87],
+  [0x0F90, 0x0F97], [0x0F99, 0x0FBC], [0x0FC6, 0x0FC6], [0x102D, 0x1030],
+  [0x1032, 0x1032], [0x1036, 0x1037], [0x1039, 0x1039], [0x1058, 0x1059],
+  [0x1160, 0x11FF], [0x135F, 0x135F], [0x1712, 0x1714], [0x1732, 0x1734],
+  [0x1752, 0x1753], [0x1772, 0x1773], [0x17B4, 0x17B5], [0x17B7, 0x17BD],
+  [0x17C6, 0x17C6], [0x17C9, 0x17D3], [0x17DD, 0x17DD], [0x180B, 0x180D],
+  [0x18A9, 0x18A9], [0x1920, 0x1922], [0x1927, 0x1928], [0x1932, 0x1932],
+  [0x1939, 0x193B], [0x1A17, 0x1A18], [0x1B00, 0x1B03], [0x1B34, 0x1B34],
+  [0x1B36, 0x1B3A], [0x1B3C, 0x1B3C], [0x1B42, 0x1B42], [0x1B6B, 0x1B73],
+  [0x1DC0, 0x1DCA], [0x1DFE, 0x1DFF], [0x200B, 0x200F], [0x202A, 0x202E],
+  [0x2060, 0x2063], [0x206A, 0x206F], [0x20D0, 0x20EF], [0x302A, 0x302F],
+  [0x3099, 0x309A], [0xA806, 0xA806], [0xA80B, 0xA80B], [0xA825, 0xA826],
+  [0xFB1E, 0xFB1E], [0xFE00, 0xFE0F], [0xFE20, 0xFE23], [0xFEFF, 0xFEFF],
+  [0xFFF9, 0xFFFB], [0x10A01, 0x10A03], [0x10A05, 0x10A06],
+  [0x10A0C, 0x10A0F], [0x10A38, 0x10A3A], [0x10A3F, 0x10A3F],
+  [0x1D167, 0x1D169], [0x1D173, 0x1D182], [0x1D185, 0x1D18B],
+  [0x1D1AA, 0x1D1AD], [0x1D242, 0x1D244], [0xE0001, 0xE0001],
+  [0xE0020, 0xE007F], [0xE0100, 0xE01EF],
+);
+my @wide = (
+  [0x1100, 0x115F], [0x2329, 0x232A], [0x2E80, 0x303E], [0x3040, 0xA4CF],
+  [0xAC00, 0xD7A3], [0xF900, 0xFAFF], [0xFE10, 0xFE19], [0xFE30, 0xFE6F],
+  [0xFF00, 0xFF60], [0xFFE0, 0xFFE6], [0x20000, 0x2FFFD], [0x30000, 0x3FFFD],
+  [0x1F000, 0x1F9FF], [0x1FA00, 0x1FAFF],
+);
+my @width = (2) x $MAX;
+for (@wide) { @width[$_->[0] .. $_->[1]] = (3) x ($_->[1] - $_->[0] + 1) }
+for (@combining) { @width[$_->[0] .. $_->[1]] = (1) x ($_->[1] - $_->[0] + 1) }
+@width[0x01 .. 0x1F] = (0) x 0x1F;
+@width[0x7F .. 0x9F] = (0) x 0x21;
+$width[0] = 1;
+$props{width} = \@width;
+
+sub pack_fields {
+  my ($cp, $fields) = @_;
+  my ($record, $shift) = (0, 0);
+  for (@$fields) {
+    my ($name, $bits) = @$_;
+    my $value = $props{$name}[$cp];
+    die "$name does not fit in $bits bits\n" if $value >= 1 << $bits;
+    $record |= $value << $shift;
+    $shift += $bits;
+  }
+  return $record;
+}
+
+# Pack the records of every code point and intern the distinct pairs.
+my (@records, @segment_records, %record_index, @leaf);
+for my $cp (0 .. $MAX - 1) {
+  my $record = pack_fields($cp, \@fields);
+  my $segment = pack_fields($cp, \@segment_fields);
+  my $key = "$record,$segment";
+  unless (defined $record_index{$key}) {
+    $record_index{$key} = @records;
+    push @records, $record;
+    push @segment_records, $segment;
+  }
+  push @leaf, $record_index{$key};
+}
+
+my $trie = build_trie(\@leaf);
+my ($leaf_shift, $mid_shift) = @$trie{qw(leaf_shift mid_shift)};
+
+# An unassigned code point of width 1 (biased to 2) with no other properties
+my $width_shift = 0; # width is the last field
+$width_shift += $_->[1] for @fields[0 .. $#fields - 1];
+my $beyond = $record_index{(2 << $width_shift) . ',0'}
+  // die "no unassigned record\n";
+# Bracket pairs for rule N0 and mirrored glyphs for rule L4 of UAX #9, both
+# sorted by code point.
+my (@brackets, @mirrors);
+{
+  my ($list, $pairs) = prop_invmap('bpb');
+  my (undef, $types) = prop_invmap('bpt');
+  for my $i (0 .. $#$list) {
+    next if $pairs->[$i] eq '';
+    die "bracket ranges differ\n" unless $types->[$i] =~ /^[oc]$/;
+    push @brackets, [$list->[$i], $pairs->[$i], $types->[$i] eq 'o'];
+  }
+  ($list, my $glyphs) = prop_invmap('bmg');
+  for my $i (0 .. $#$list) {
+    push @mirrors, [$list->[$i], $glyphs->[$i]] if $glyphs->[$i] ne '';
+  }
+}
+
+my $version = Unicode::UCD::UnicodeVersion();
+my $total = $trie->{size} + 6 * @records + 12 * @brackets + 8 * @mirrors;
+print <<"EOF";
+/* Generated by tools/gen_properties.pl from Unicode $version. Do not edit. */
+/* Total size: $total bytes. */
+
+constexpr unsigned PROPERTY_LEAF_SHIFT = $leaf_shift;
+constexpr unsigned PROPERTY_MID_SHIFT = $mid_shift;
+
+/* Record of code points above U+10FFFF: unassigned, width 1 */
+constexpr std::uint16_t PROPERTY_BEYOND_UNICODE = $beyond;
+
+struct BidiBracket {
+  char32_t code_point;
+  char32_t pair;
+  bool opening;
+};
+
+struct BidiMirror {
+  char32_t code_point;
+  char32_t mirror;
+};
+
+EOF
+for my $layout (\@fields, \@segment_fields) {
+  my $shift = 0;
+  for (@$layout) {
+    my ($name, $bits) = @$_;
+    printf "constexpr unsigned PROPERTY_%s_SHIFT = %d;\n", uc $name, $shift;
+    printf "constexpr std::uint32_t PROPERTY_%s_MASK = 0x%X;\n", uc $name,
+      (1 << $bits) - 1;
+    $shift += $bits;
+  }
+}
+print "\n";
+
+sub emit_enum {
+  my ($name, $prefix, @values) = @_;
+  print "enum $name : std::uint8_t {\n";
+  my $line = ' ';
+  for (@values) {
+    my $item = " ${prefix}_" . join('', split /_/) . ',';
+    if (length($line) + length($item) > 80) {
+      print "$line\n";
+      $line = ' ';
+    }
+    $line .= $item;
+  }
+  print "$line\n};\n\n";
+}
+emit_enum('WordBreakClass', 'WB', @word_breaks);
+emit_enum('SentenceBreakClass', 'SB', @sentence_breaks);
+for my $stage (1 .. 3) {
+  emit_array($trie->{"stage${stage}_type"}, "property_stage$stage",
+             $trie->{"stage$stage"}, '%d');
+}
+emit_array('std::uint32_t', 'property_records', \@records, '0x%07X');
+emit_array('std::uint16_t', 'segment_records', \@segment_records, '0x%03X');
+emit_array('BidiBracket', 'bidi_brackets',
+           [map { sprintf '{0x%04X, 0x%04X, %s}', $_->[0], $_->[1],
+                  $_->[2] ? 'true' : 'false' } @brackets], '%s');
+emit_array('BidiMirror', 'bidi_mirrors',
+           [map { sprintf '{0x%04X, 0x%04X}', @$_ } @mirrors], '%s');
+emit_array('char *const', 'script_names', [map { "\"$_\"" } @scripts], '%s');